@@ -1,150 +1,321 @@
-#pragma once
-
-
-/*
-	The knapsack algorithms in this library use rulesets called "economies".
-
-	An economy describes a burden and a value.
-		The value is a simple number that we want to maximize.
-		The burden represents one or more limited resources.
-
-	Economy_f, the most common, uses a float burden and float value.
-*/
-
-namespace perf_goblin
-{
-	template<typename T_Burden, typename T_Value = float> struct Economy_;
-	template<typename T_BaseEconomy>                      struct Economy_Normal_;
-
-	using Economy_f        = Economy_<float, float>;
-	using Economy_Normal_f = Economy_Normal_<Economy_f>;
-
-	/*
-		Utility: concepts of zero and infinity
-	*/
-	namespace detail
-	{
-		struct Zero_t     {template<typename T> operator T() const {return 0;}};
-		struct Infinity_t {template<typename T> operator T() const {return std::numeric_limits<T>::infinity();}};
-	}
-
-	/*
-		Class for basic economies with a scalar burden.
-	*/
-	template<
-		typename T_Burden,
-		typename T_Value /* defaults to float */>
-	struct Economy_
-	{
-		static const bool burden_is_scalar = true;
-		using burden_t   = T_Burden;
-		using value_t    = T_Value;
-
-		// capacity_t is the same as burden_t in simple economies.
-		using capacity_t = burden_t;
-
-		// scalar_t is 
-		using scalar_t   = T_Burden;
-
-		// Concepts of zero and infinity.
-		static detail::Zero_t     zero()        {return {};}
-		static detail::Infinity_t infinite()    {return {};}
-
-		// Is a burden possible to bear?
-		static constexpr bool is_possible(const burden_t burden)    {return acceptable(burden, infinite());}
-
-		// Return whether one burden is strictly less than another.
-		//   Probabilistic economies 
-		static bool lesser(const burden_t &lhs, const burden_t &rhs)    {return (lhs < rhs);}
-
-		// Return whether the burden is possible within the capacity
-		static bool acceptable(const burden_t &lhs, const capacity_t &rhs)    {return (lhs < rhs);}
-	};
-
-
-	/*
-		An economy for normally-distributed burdens.
-			This allows us to consolidate independent variations in cost.
-	*/
-	template<typename T_BaseEconomy>
-	struct Economy_Normal_
-	{
-	public:
-		using base_t        = T_BaseEconomy;
-		using base_burden_t = typename base_t::burden_t;
-		using base_capac_t  = typename base_t::capacity_t;
-		using value_t       = typename base_t::value_t;
-		using scalar_t      = typename base_t::scalar_t;
-
-		struct burden_t
-		{
-			base_burden_t mean;
-			base_burden_t var;
-			
-			// TEMPORARY
-			operator base_burden_t() const    {return mean;}
-
-			burden_t  operator* (const scalar_t  s) const    {return {mean*s, var*(s*s)};}
-			burden_t &operator*=(const scalar_t  s)          {mean *= s; var *= s*s; return *this;}
-			burden_t  operator/ (const scalar_t  s) const    {return {mean/s, var/(s*s)};}
-			burden_t &operator/=(const scalar_t  s)          {mean /= s; var /= s*s; return *this;}
-			burden_t  operator+ (const burden_t &o) const    {return {mean+o.mean, var+o.var};}
-			burden_t &operator+=(const burden_t &o)          {mean += o.mean; var += o.var; return *this;}
-			burden_t  operator- (const burden_t &o) const    {return {mean-o.mean, var+o.var};}
-			burden_t &operator-=(const burden_t &o)          {mean -= o.mean; var += o.var; return *this;}
-
-			base_burden_t sigma_offset(const scalar_t sigmas) const
-			{
-				return mean + sigmas * std::sqrt(var);
-			}
-		};
-
-		/*
-			A maximum capacity that applies to mean net burden,
-				plus some number of sigmas (standard deviations).
-				3-5 sigmas makes exceeding capacity very unlikely.
-		*/
-		struct capacity_t
-		{
-			base_capac_t limit;
-			scalar_t     sigmas = 3;
-		};
-
-	public:
-		static const bool burden_is_scalar = base_t::burden_is_scalar;
-
-		struct Zero_t     : public detail::Zero_t        {operator burden_t() const {return {base_t::zero(),     base_t::zero()};}};
-		struct Infinity_t : public detail::Infinity_t    {operator burden_t() const {return {base_t::infinite(), base_t::zero()};}};
-
-		static Zero_t     zero()        {return {};}
-		static Infinity_t infinite()    {return {};}
-		
-		static constexpr bool is_possible(const burden_t burden)    {return base_t::is_possible(burden.mean) & base_t::is_possible(burden.var);}
-
-		/*
-			There isn't an objective total order for normal burdens.
-				For knapsack purposes, we order by mean...
-		*/
-		static bool lesser(const burden_t &lhs, const burden_t &rhs)
-		{
-			// Strictly comparing means...
-			return base_t::lesser(lhs.mean, rhs.mean);
-			/*base_burden_t diff = (lhs.mean - rhs.mean);
-			diff = (diff*diff) / (sigmas*sigmas);
-			return base_t::lesser(diff, rhs.var + lhs.var - scalar_t(2)*std::sqrt(lhs.var*rhs.var));*/
-		}
-
-		static bool acceptable(const burden_t &burden, const capacity_t &capac)
-		{
-#if 0
-			assert(burden.var == 0);
-			return base_t::acceptable(burden.mean, capac.limit);
-#else
-			// (mean + E*sqrt(var)) < limit  ==>  E^2*var < (limit-mean)^2
-			if (!base_t::acceptable(burden.mean, capac.limit)) return false;
-			base_burden_t margin = capac.limit - burden.mean;
-			return base_t::lesser(capac.sigmas*capac.sigmas * burden.var, margin*margin);
-#endif
-		}
-	};
+#pragma once
+
+#include <cmath>       // std::sqrt
+#include <cstdint>
+#include <limits>      // std::numeric_limits
+#include <type_traits>
+
+/*
+	The knapsack algorithms in this library use rulesets called "economies".
+
+	An economy describes a burden and a value.
+		The value is a simple number that we want to maximize.
+		The burden represents one or more limited resources.
+
+	Economy_f, the most common, uses a float burden and float value.
+
+	An economy also chooses the precision of accumulated statistics (accum_t).
+		Float statistics stop changing after about 2^24 samples, so processes which
+		run for days should use Economy_fd (double) or Economy_fk (Kahan-compensated float).
+
+	Economy_Ticks measures burdens in integer ticks (such as nanoseconds) with saturating
+		arithmetic.  Sums of ticks are exact in any order, so knapsack decisions are
+		bit-identical across compilers and CPUs, as lockstep simulations require.
+*/
+
+namespace perf_goblin
+{
+	template<typename T_Burden, typename T_Value = float, typename T_Accum = T_Burden> struct Economy_;
+	template<typename T_BaseEconomy>                      struct Economy_Normal_;
+	template<typename T>                                  struct Compensated_;
+	template<typename T_Int>                              struct Ticks_;
+
+	using Economy_f        = Economy_<float, float>;
+	using Economy_fd       = Economy_<float, float, double>;
+	using Economy_fk       = Economy_<float, float, Compensated_<float>>;
+	using Economy_Ticks    = Economy_<Ticks_<uint32_t>, float, double>;
+	using Economy_Normal_f = Economy_Normal_<Economy_f>;
+
+	/*
+		Utility: concepts of zero and infinity
+	*/
+	namespace detail
+	{
+		struct Zero_t     {template<typename T> operator T() const {return 0;}};
+		struct Infinity_t {template<typename T> operator T() const {return std::numeric_limits<T>::infinity();}};
+
+		// The plain type in which an accumulator's terms are calculated.
+		template<typename T> struct AccumValue                    {using type = T;};
+		template<typename T> struct AccumValue<Compensated_<T>>   {using type = T;};
+	}
+
+	/*
+		A Kahan-compensated sum.  Keeps the low-order bits lost by each addition,
+			so sums of many small terms stay accurate without a wider type.
+			(Compensation is lost if compiled with unsafe floating-point optimizations.)
+	*/
+	template<typename T>
+	struct Compensated_
+	{
+		T sum = 0, error = 0;
+
+		Compensated_()    {}
+		Compensated_(const T value) : sum(value) {}
+
+		operator T() const    {return sum;}
+
+		Compensated_ &operator+=(const T term)
+		{
+			T y = term - error, t = sum + y;
+			error = (t - sum) - y;
+			sum = t;
+			return *this;
+		}
+		Compensated_ &operator-=(const T term)    {return *this += -term;}
+		Compensated_ &operator*=(const T factor)  {sum *= factor; error *= factor; return *this;}
+	};
+
+	/*
+		An unsigned count of ticks with saturating arithmetic.
+			The maximum value is an impossible burden, and stays so when scaled.
+			Scaling by a real number rounds to the nearest tick.
+	*/
+	template<typename T_Int>
+	struct Ticks_
+	{
+		using int_t = T_Int;
+		static_assert(std::is_unsigned<int_t>::value, "ticks must be unsigned");
+		static constexpr int_t MAX = std::numeric_limits<int_t>::max();
+
+		int_t ticks = 0;
+
+		Ticks_()    {}
+		template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+		explicit Ticks_(const T value) : ticks(_round(double(value))) {}
+
+		static Ticks_ from_ticks(const int_t t)    {Ticks_ r; r.ticks = t; return r;}
+		static Ticks_ max()                        {return from_ticks(MAX);}
+
+		explicit operator double() const    {return double(ticks);}
+		explicit operator float () const    {return float(ticks);}
+
+		Ticks_  operator+ (const Ticks_ o) const    {int_t t = ticks + o.ticks; return from_ticks(t < ticks ? MAX : t);}
+		Ticks_  operator- (const Ticks_ o) const    {return from_ticks(ticks == MAX ? MAX : (ticks > o.ticks ? ticks - o.ticks : 0));}
+		Ticks_ &operator+=(const Ticks_ o)          {return *this = *this + o;}
+		Ticks_ &operator-=(const Ticks_ o)          {return *this = *this - o;}
+
+		Ticks_  operator* (const double s) const    {return from_ticks((ticks == MAX && s > 0) ? MAX : _round(double(ticks) * s));}
+		Ticks_  operator/ (const double s) const    {return from_ticks((ticks == MAX && s > 0) ? MAX : _round(double(ticks) / s));}
+		Ticks_ &operator*=(const double s)          {return *this = *this * s;}
+		Ticks_ &operator/=(const double s)          {return *this = *this / s;}
+
+		// The ratio of two tick counts.
+		double  operator/ (const Ticks_ o) const    {return double(ticks) / double(o.ticks);}
+
+		bool operator==(const Ticks_ o) const    {return ticks == o.ticks;}
+		bool operator!=(const Ticks_ o) const    {return ticks != o.ticks;}
+		bool operator< (const Ticks_ o) const    {return ticks <  o.ticks;}
+		bool operator> (const Ticks_ o) const    {return ticks >  o.ticks;}
+		bool operator<=(const Ticks_ o) const    {return ticks <= o.ticks;}
+		bool operator>=(const Ticks_ o) const    {return ticks >= o.ticks;}
+
+	private:
+		static int_t _round(const double v)
+		{
+			if (!(v > 0)) return 0;
+			if (!(v < double(MAX))) return MAX;
+			return int_t(v + .5);
+		}
+	};
+
+	template<typename T_Int> constexpr T_Int Ticks_<T_Int>::MAX;
+
+	/*
+		Class for basic economies with a scalar burden.
+	*/
+	template<
+		typename T_Burden,
+		typename T_Value /* defaults to float */,
+		typename T_Accum /* defaults to T_Burden */>
+	struct Economy_
+	{
+		static const bool burden_is_scalar = true;
+
+		// Burdens are totally ordered, consistently with acceptable.  (See Economy_Normal_.)
+		static const bool burden_is_ordered = true;
+		using burden_t   = T_Burden;
+		using value_t    = T_Value;
+
+		// accum_t holds sums of many measurements (see BurdenStat_).
+		using accum_t    = T_Accum;
+
+		// capacity_t is the same as burden_t in simple economies.
+		using capacity_t = burden_t;
+
+		// scalar_t is 
+		using scalar_t   = T_Burden;
+
+		// variance_t holds squared burdens (see Economy_Normal_).
+		using variance_t = burden_t;
+
+		// Concepts of zero and infinity.
+		static detail::Zero_t     zero()        {return {};}
+		static detail::Infinity_t infinite()    {return {};}
+
+		// Is a burden possible to bear?
+		static constexpr bool is_possible(const burden_t burden)    {return acceptable(burden, infinite());}
+
+		// Return whether one burden is strictly less than another.
+		//   Probabilistic economies 
+		static bool lesser(const burden_t &lhs, const burden_t &rhs)    {return (lhs < rhs);}
+
+		// Return whether the burden is possible within the capacity
+		static bool acceptable(const burden_t &lhs, const capacity_t &rhs)    {return (lhs < rhs);}
+
+		// Burdens and capacities as plain numbers, such that acceptable burdens sum to less than the capacity.
+		//   Knapsack_ uses these to bound the value of solutions by linear relaxation.
+		static double relax(const burden_t &burden)    {return double(burden);}
+
+		// Squares and square roots, between burdens and variances.
+		static variance_t square   (const burden_t b)      {return b*b;}
+		static burden_t   deviation(const variance_t v)    {return std::sqrt(v);}
+	};
+
+	/*
+		Economy for burdens in integer ticks (see Ticks_), up to 32 bits.
+			Variances are held in 64 bits.  Statistics accumulate in double unless
+			another accumulator is given, and scalars (such as ratios) are float.
+	*/
+	template<typename T_Int, typename T_Value, typename T_Accum>
+	struct Economy_<Ticks_<T_Int>, T_Value, T_Accum>
+	{
+		static_assert(sizeof(T_Int) <= 4, "squared ticks must fit in 64 bits");
+
+		static const bool burden_is_scalar  = true;
+		static const bool burden_is_ordered = true;
+		using burden_t   = Ticks_<T_Int>;
+		using value_t    = T_Value;
+		using accum_t    = typename std::conditional<std::is_same<T_Accum, burden_t>::value, double, T_Accum>::type;
+		using capacity_t = burden_t;
+		using scalar_t   = float;
+		using variance_t = Ticks_<uint64_t>;
+
+		struct Zero_t     : public detail::Zero_t        {operator burden_t() const {return burden_t();}   operator variance_t() const {return variance_t();}};
+		struct Infinity_t : public detail::Infinity_t    {operator burden_t() const {return burden_t::max();} operator variance_t() const {return variance_t::max();}};
+
+		static Zero_t     zero()        {return {};}
+		static Infinity_t infinite()    {return {};}
+
+		static bool is_possible(const burden_t   burden)    {return burden.ticks != burden_t::MAX;}
+		static bool is_possible(const variance_t var)       {return var.ticks    != variance_t::MAX;}
+
+		static bool lesser    (const burden_t &lhs, const burden_t &rhs)      {return (lhs < rhs);}
+		static bool acceptable(const burden_t &lhs, const capacity_t &rhs)    {return (lhs < rhs);}
+
+		static double relax(const burden_t &burden)    {return double(burden);}
+
+		static variance_t square(const burden_t b)    {return variance_t::from_ticks(uint64_t(b.ticks) * b.ticks);}
+		static burden_t deviation(const variance_t v)
+		{
+			// Integer square root, corrected from the floating-point estimate.
+			uint64_t r = uint64_t(std::sqrt(double(v.ticks)));
+			while (r > 0 && (r > UINT32_MAX || r*r > v.ticks)) --r;
+			while (r < UINT32_MAX && (r+1)*(r+1) <= v.ticks) ++r;
+			return burden_t::from_ticks(r > uint64_t(burden_t::MAX) ? burden_t::MAX : typename burden_t::int_t(r));
+		}
+	};
+
+
+	/*
+		An economy for normally-distributed burdens.
+			This allows us to consolidate independent variations in cost.
+	*/
+	template<typename T_BaseEconomy>
+	struct Economy_Normal_
+	{
+	public:
+		using base_t        = T_BaseEconomy;
+		using base_burden_t = typename base_t::burden_t;
+		using base_capac_t  = typename base_t::capacity_t;
+		using value_t       = typename base_t::value_t;
+		using scalar_t      = typename base_t::scalar_t;
+		using accum_t       = typename base_t::accum_t;
+		using base_var_t    = typename base_t::variance_t;
+
+		struct burden_t
+		{
+			base_burden_t mean;
+			base_var_t    var;
+			
+			// TEMPORARY
+			operator base_burden_t() const    {return mean;}
+
+			burden_t  operator* (const scalar_t  s) const    {return {mean*s, var*(s*s)};}
+			burden_t &operator*=(const scalar_t  s)          {mean *= s; var *= s*s; return *this;}
+			burden_t  operator/ (const scalar_t  s) const    {return {mean/s, var/(s*s)};}
+			burden_t &operator/=(const scalar_t  s)          {mean /= s; var /= s*s; return *this;}
+			burden_t  operator+ (const burden_t &o) const    {return {mean+o.mean, var+o.var};}
+			burden_t &operator+=(const burden_t &o)          {mean += o.mean; var += o.var; return *this;}
+			burden_t  operator- (const burden_t &o) const    {return {mean-o.mean, var+o.var};}
+			burden_t &operator-=(const burden_t &o)          {mean -= o.mean; var += o.var; return *this;}
+
+			base_burden_t sigma_offset(const scalar_t sigmas) const
+			{
+				return mean + base_t::deviation(var) * sigmas;
+			}
+		};
+
+		/*
+			A maximum capacity that applies to mean net burden,
+				plus some number of sigmas (standard deviations).
+				3-5 sigmas makes exceeding capacity very unlikely.
+		*/
+		struct capacity_t
+		{
+			base_capac_t limit;
+			scalar_t     sigmas = 3;
+		};
+
+	public:
+		static const bool burden_is_scalar  = base_t::burden_is_scalar;
+		static const bool burden_is_ordered = false;
+
+		struct Zero_t     : public detail::Zero_t        {operator burden_t() const {return {base_t::zero(),     base_t::zero()};}};
+		struct Infinity_t : public detail::Infinity_t    {operator burden_t() const {return {base_t::infinite(), base_t::zero()};}};
+
+		static Zero_t     zero()        {return {};}
+		static Infinity_t infinite()    {return {};}
+		
+		static constexpr bool is_possible(const burden_t burden)    {return base_t::is_possible(burden.mean) & base_t::is_possible(burden.var);}
+
+		/*
+			There isn't an objective total order for normal burdens.
+				For knapsack purposes, we order by mean...
+		*/
+		static bool lesser(const burden_t &lhs, const burden_t &rhs)
+		{
+			// Strictly comparing means...
+			return base_t::lesser(lhs.mean, rhs.mean);
+			/*base_burden_t diff = (lhs.mean - rhs.mean);
+			diff = (diff*diff) / (sigmas*sigmas);
+			return base_t::lesser(diff, rhs.var + lhs.var - scalar_t(2)*std::sqrt(lhs.var*rhs.var));*/
+		}
+
+		static bool acceptable(const burden_t &burden, const capacity_t &capac)
+		{
+#if 0
+			assert(burden.var == 0);
+			return base_t::acceptable(burden.mean, capac.limit);
+#else
+			// (mean + E*sqrt(var)) < limit  ==>  E^2*var < (limit-mean)^2
+			if (!base_t::acceptable(burden.mean, capac.limit)) return false;
+			base_burden_t margin = capac.limit - burden.mean;
+			return burden.var * (capac.sigmas*capac.sigmas) < base_t::square(margin);
+#endif
+		}
+
+		// Acceptable burdens have means within the capacity's limit.
+		static double relax(const burden_t   &burden)    {return base_t::relax(burden.mean);}
+		static double relax(const capacity_t &capac)     {return base_t::relax(capac.limit);}
+	};
 }
\ No newline at end of file
@@ -0,0 +1,359 @@
+#pragma once
+
+/*
+	An open-addressing hash map used for profile tasks and goblin settings.
+		Entries are stored inline in one array, with a parallel array of control bytes.
+		Each control byte holds 7 bits of the entry's hash, or marks an empty or erased slot.
+
+	Lookups probe groups of 16 slots at a time, comparing all control bytes in a group
+		at once (with SSE2 where available).  Most lookups touch one cache line of control
+		bytes and one entry.  The table grows at 7/8 occupancy.
+
+	Unlike std::unordered_map, insertion may move entries, invalidating iterators and
+		references.  Keys must not be modified through iterators.
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>     // std::memset
+#include <new>
+#include <memory>      // std::allocator
+#include <utility>     // std::pair
+#include <tuple>       // std::forward_as_tuple
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+#include <functional>  // std::hash, std::equal_to
+
+#if defined(_MSC_VER)
+	#include <intrin.h> // _BitScanForward
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define PERF_GOBLIN_FLAT_MAP_SSE2 1
+#else
+	#define PERF_GOBLIN_FLAT_MAP_SSE2 0
+#endif
+
+
+namespace perf_goblin
+{
+	namespace detail
+	{
+		template<
+			typename T_Key,
+			typename T_Value,
+			typename T_Hash  = std::hash<T_Key>,
+			typename T_Equal = std::equal_to<T_Key>>
+		class FlatMap
+		{
+		public:
+			using key_type    = T_Key;
+			using mapped_type = T_Value;
+			using value_type  = std::pair<T_Key, T_Value>;
+			using size_type   = size_t;
+
+			static const size_t GROUP = 16;
+
+		private:
+			using ctrl_t = int8_t;
+			static const ctrl_t EMPTY   = -128; // 0b10000000
+			static const ctrl_t DELETED = -2;   // 0b11111110
+
+			// A bitmask of matching slots within a group.
+			struct Group
+			{
+				const ctrl_t *ctrl;
+
+#if PERF_GOBLIN_FLAT_MAP_SSE2
+				uint32_t match(ctrl_t h2) const
+				{
+					__m128i c = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+					return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(h2))));
+				}
+				uint32_t match_empty() const    {return match(EMPTY);}
+				uint32_t match_free() const
+				{
+					// Empty and deleted slots have the high bit set.
+					__m128i c = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+					return uint32_t(_mm_movemask_epi8(c));
+				}
+#else
+				uint32_t match(ctrl_t h2) const
+				{
+					uint32_t m = 0;
+					for (size_t i = 0; i < GROUP; ++i) m |= uint32_t(ctrl[i] == h2) << i;
+					return m;
+				}
+				uint32_t match_empty() const    {return match(EMPTY);}
+				uint32_t match_free() const
+				{
+					uint32_t m = 0;
+					for (size_t i = 0; i < GROUP; ++i) m |= uint32_t(ctrl[i] < 0) << i;
+					return m;
+				}
+#endif
+			};
+
+			// Index of the lowest set bit (m must be nonzero).
+			static unsigned lowest_bit(uint32_t m)
+			{
+#if defined(_MSC_VER)
+				unsigned long i;
+				_BitScanForward(&i, m);
+				return unsigned(i);
+#elif defined(__GNUC__)
+				return unsigned(__builtin_ctz(m));
+#else
+				unsigned i = 0;
+				while (!(m & 1u)) {m >>= 1; ++i;}
+				return i;
+#endif
+			}
+
+		public:
+			template<bool T_Const>
+			class Iterator_
+			{
+			public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type        = typename FlatMap::value_type;
+				using difference_type   = ptrdiff_t;
+				using reference         = typename std::conditional<T_Const, const value_type&, value_type&>::type;
+				using pointer           = typename std::conditional<T_Const, const value_type*, value_type*>::type;
+				using map_t             = typename std::conditional<T_Const, const FlatMap, FlatMap>::type;
+
+				Iterator_()                                          {}
+				Iterator_(map_t *map, size_t index) : _map(map), _index(index)    {_skip();}
+				Iterator_(const Iterator_<false> &o) : _map(o._map), _index(o._index) {}
+
+				reference operator* () const    {return _map->_slots[_index];}
+				pointer   operator->() const    {return &_map->_slots[_index];}
+
+				Iterator_ &operator++()         {++_index; _skip(); return *this;}
+				Iterator_  operator++(int)      {Iterator_ i = *this; ++*this; return i;}
+
+				bool operator==(const Iterator_ &o) const    {return _index == o._index;}
+				bool operator!=(const Iterator_ &o) const    {return _index != o._index;}
+
+			private:
+				friend class FlatMap;
+				friend class Iterator_<true>;
+
+				void _skip()    {while (_index < _map->_capacity && _map->_ctrl[_index] < 0) ++_index;}
+
+				map_t *_map   = nullptr;
+				size_t _index = 0;
+			};
+
+			using iterator       = Iterator_<false>;
+			using const_iterator = Iterator_<true>;
+
+		public:
+			FlatMap()                              {}
+			FlatMap(const FlatMap &o)              {*this = o;}
+			FlatMap(FlatMap &&o)                   {swap(o);}
+			~FlatMap()                             {_release();}
+
+			FlatMap &operator=(const FlatMap &o)
+			{
+				if (&o == this) return *this;
+				clear();
+				reserve(o._size);
+				for (auto &entry : o) _insert_new(entry.first, _hash(entry.first), entry.second);
+				return *this;
+			}
+			FlatMap &operator=(FlatMap &&o)    {swap(o); return *this;}
+
+			void swap(FlatMap &o)
+			{
+				std::swap(_ctrl,     o._ctrl);
+				std::swap(_slots,    o._slots);
+				std::swap(_capacity, o._capacity);
+				std::swap(_size,     o._size);
+				std::swap(_deleted,  o._deleted);
+			}
+
+			size_t size()     const    {return _size;}
+			bool   empty()    const    {return _size == 0;}
+			size_t capacity() const    {return _capacity;}
+
+			// Memory allocated for the table (excluding any owned by keys and values).
+			size_t bytes()    const    {return _capacity * (sizeof(ctrl_t) + sizeof(value_type));}
+
+			iterator       begin()          {return iterator(this, 0);}
+			iterator       end  ()          {return iterator(this, _capacity);}
+			const_iterator begin() const    {return const_iterator(this, 0);}
+			const_iterator end  () const    {return const_iterator(this, _capacity);}
+
+			iterator       find(const key_type &key)          {return iterator(this, _find(key, _hash(key)));}
+			const_iterator find(const key_type &key) const    {return const_iterator(this, _find(key, _hash(key)));}
+			size_t         count(const key_type &key) const   {return _find(key, _hash(key)) != _capacity;}
+
+			/*
+				Insert a value if the key is not present.  Returns the entry and whether it was inserted.
+			*/
+			template<typename... T_Args>
+			std::pair<iterator, bool> try_emplace(const key_type &key, T_Args&&... args)
+			{
+				size_t hash = _hash(key), index = _find(key, hash);
+				if (index != _capacity) return {iterator(this, index), false};
+				return {iterator(this, _insert_new(key, hash, std::forward<T_Args>(args)...)), true};
+			}
+			template<typename T_Arg>
+			std::pair<iterator, bool> emplace(const key_type &key, T_Arg &&value)
+			{
+				return try_emplace(key, std::forward<T_Arg>(value));
+			}
+
+			mapped_type &operator[](const key_type &key)    {return try_emplace(key).first->second;}
+
+			size_t erase(const key_type &key)
+			{
+				size_t index = _find(key, _hash(key));
+				if (index == _capacity) return 0;
+				_erase_at(index);
+				return 1;
+			}
+			iterator erase(const_iterator i)
+			{
+				_erase_at(i._index);
+				return iterator(this, i._index);
+			}
+
+			void clear()
+			{
+				if (!_size && !_deleted) return;
+				for (size_t i = 0; i < _capacity; ++i) if (_ctrl[i] >= 0) _slots[i].~value_type();
+				std::memset(_ctrl, EMPTY, _capacity);
+				_size = _deleted = 0;
+			}
+
+			// Ensure `count` entries fit without growing.
+			void reserve(size_t count)
+			{
+				size_t capacity = GROUP;
+				while (capacity - capacity/8 <= count) capacity *= 2;
+				if (capacity > _capacity) _rehash(capacity);
+			}
+
+		private:
+			// Spread hash bits; std::hash is the identity for pointers and integers on some platforms.
+			static size_t _hash(const key_type &key)
+			{
+				uint64_t h = uint64_t(T_Hash()(key)) * 0x9E3779B97F4A7C15ull;
+				return size_t(h ^ (h >> 32));
+			}
+			static ctrl_t _h2(size_t hash)    {return ctrl_t(hash & 0x7F);}
+
+			size_t _group_mask() const        {return _capacity/GROUP - 1;}
+
+			// Index of the key, or _capacity if absent.
+			size_t _find(const key_type &key, size_t hash) const
+			{
+				if (!_capacity) return 0;
+				const ctrl_t h2 = _h2(hash);
+				size_t g = (hash >> 7) & _group_mask();
+				for (size_t step = 1; ; ++step)
+				{
+					Group group = {_ctrl + g*GROUP};
+					for (uint32_t m = group.match(h2); m; m &= m-1)
+					{
+						size_t index = g*GROUP + lowest_bit(m);
+						if (T_Equal()(_slots[index].first, key)) return index;
+					}
+					if (group.match_empty()) return _capacity;
+					g = (g + step) & _group_mask(); // Triangular probing visits every group.
+				}
+			}
+
+			// Insert a key known to be absent.
+			template<typename... T_Args>
+			size_t _insert_new(const key_type &key, size_t hash, T_Args&&... args)
+			{
+				if (_size + _deleted + 1 > _capacity - _capacity/8)
+				{
+					// Reclaim tombstones if they make up much of the table, otherwise grow.
+					_rehash((_size + 1 > _capacity/2) ? std::max<size_t>(2*_capacity, size_t(GROUP)) : _capacity);
+				}
+
+				size_t g = (hash >> 7) & _group_mask();
+				for (size_t step = 1; ; ++step)
+				{
+					uint32_t m = Group{_ctrl + g*GROUP}.match_free();
+					if (m)
+					{
+						size_t index = g*GROUP + lowest_bit(m);
+						if (_ctrl[index] == DELETED) --_deleted;
+						new (_slots + index) value_type(std::piecewise_construct,
+							std::forward_as_tuple(key), std::forward_as_tuple(std::forward<T_Args>(args)...));
+						_ctrl[index] = _h2(hash);
+						++_size;
+						return index;
+					}
+					g = (g + step) & _group_mask();
+				}
+			}
+
+			void _erase_at(size_t index)
+			{
+				_slots[index].~value_type();
+				--_size;
+
+				// Probes stop at groups with an empty slot, so this one may become empty too.
+				if (Group{_ctrl + (index & ~(GROUP-1))}.match_empty()) _ctrl[index] = EMPTY;
+				else {_ctrl[index] = DELETED; ++_deleted;}
+			}
+
+			void _rehash(size_t capacity)
+			{
+				ctrl_t     *old_ctrl  = _ctrl;
+				value_type *old_slots = _slots;
+				size_t      old_cap   = _capacity;
+
+				_ctrl     = _alloc_ctrl(capacity);
+				_slots    = std::allocator<value_type>().allocate(capacity);
+				_capacity = capacity;
+				_size     = _deleted = 0;
+
+				for (size_t i = 0; i < old_cap; ++i) if (old_ctrl[i] >= 0)
+				{
+					value_type &entry = old_slots[i];
+					_insert_new(entry.first, _hash(entry.first), std::move(entry.second));
+					entry.~value_type();
+				}
+				if (old_cap)
+				{
+					std::allocator<value_type>().deallocate(old_slots, old_cap);
+					_free_ctrl(old_ctrl);
+				}
+			}
+
+			// Control bytes are aligned for group loads.
+			static ctrl_t *_alloc_ctrl(size_t capacity)
+			{
+				ctrl_t *ctrl = reinterpret_cast<ctrl_t*>(new Block[capacity/GROUP]);
+				std::memset(ctrl, EMPTY, capacity);
+				return ctrl;
+			}
+			static void _free_ctrl(ctrl_t *ctrl)    {delete[] reinterpret_cast<Block*>(ctrl);}
+
+			struct alignas(GROUP) Block {ctrl_t bytes[GROUP];};
+
+			void _release()
+			{
+				if (!_capacity) return;
+				clear();
+				std::allocator<value_type>().deallocate(_slots, _capacity);
+				_free_ctrl(_ctrl);
+				_ctrl = nullptr; _slots = nullptr; _capacity = 0;
+			}
+
+		private:
+			ctrl_t     *_ctrl     = nullptr;
+			value_type *_slots    = nullptr;
+			size_t      _capacity = 0, _size = 0, _deleted = 0;
+		};
+	}
+}
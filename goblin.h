@@ -1,519 +1,838 @@
-#pragma once
-
-/*
-	A little goblin which gleefully adjusts settings to maintain FPS.
-		It is based on the knapsack algorithm in knapsack.h.
-	
-	The goblin controls a list of settings, each of which has some options.
-		Each option is assigned a subjective numerical "experience value".
-		Settings may provide measurements of their performance cost.
-
-	The goblin selects one option for each setting each frame.
-		It tries to maximize experience value without exceeding a cost limit.
-		It tracks recent and overall costs to estimate cost accurately.
-*/
-
-#include <unordered_map> // Goblin's settings map
-
-#include "knapsack.h"
-#include "economy.h"
-#include "profile.h"
-
-
-namespace perf_goblin
-{
-	
-	template<typename T_Economy>     class Goblin_;
-	template<typename T_Economy>     class Setting_;
-
-	using Goblin  = Goblin_ <Economy_f>;
-	using Setting = Setting_<Economy_f>;
-
-	
-
-	/*
-		The goblin!
-			It takes control of a number of settings and their profile data.
-	*/
-	template<typename T_Economy>
-	class Goblin_
-	{
-	public:
-		using economy_t      = T_Economy;
-		using burden_t       = typename economy_t::burden_t;
-		using scalar_t       = typename economy_t::scalar_t;
-		using value_t        = typename economy_t::value_t;
-
-		using Profile_t      = Profile_<economy_t>;
-		using economy_norm_t = typename Profile_t::economy_norm_t;;
-		using burden_norm_t  = typename economy_norm_t::burden_t;
-		using burden_stat_t  = typename Profile_t::burden_stat_t;
-		using capacity_t     = typename economy_norm_t::capacity_t;
-
-		using Knapsack_t     = Knapsack_<economy_norm_t>;
-		using choice_index_t = typename Knapsack_t::choice_index_t;
-		using Decision_t     = typename Knapsack_t::Decision;
-		using Option_t       = typename Knapsack_t::Option;
-
-		using Setting_t        = Setting_<economy_t>;
-		using strategy_index_t = choice_index_t;
-
-		static const choice_index_t NO_CHOICE = Knapsack_t::NO_CHOICE;
-
-		
-		using Settings  = std::unordered_map<Setting_t*, Decision_t>;
-
-		struct Config
-		{
-			scalar_t recent_alpha  = 1.f - 1.f/30.f;
-			scalar_t anomaly_alpha = 1.f - 1.f/30.f;
-			scalar_t measure_quota = 30;
-			value_t  explore_value = 0;
-		};
-
-		struct Anomaly
-		{
-			scalar_t latest = 1;
-			scalar_t recent = 1;
-		};
-
-	public:
-		Config config;
-
-	private:
-		Profile_t             _profile, _past;
-		Settings              settings;
-		Knapsack_t            _knapsack;
-		std::vector<Option_t> option_store;
-		Anomaly               _anomaly;
-
-	public:
-		Goblin_();
-		~Goblin_();
-
-		/*
-			Overwrite performance profiles.
-		*/
-		void set_profile     (const Profile_t &profile)    {_profile = profile;}
-		void set_past_profile(const Profile_t &profile)    {_past    = profile;}
-
-		/*
-			Add & remove settings.
-		*/
-		bool add   (Setting_t *setting);
-		void remove(Setting_t *setting);
-
-		/*
-			Iterate over settings & decisions.
-		*/
-		typename Settings::const_iterator begin() const    {return settings.begin();}
-		typename Settings::const_iterator end  () const    {return settings.end();}
-
-		/*
-			Update all settings, accounting for any new measurements.
-				Alternatively, you can call subroutines separately:
-				- harvest() : collect new measurements and update anomaly
-				- decide(...) : resolve all settings
-		*/
-		void update(capacity_t capacity, size_t precision);
-		void update_decide(capacity_t capacity, size_t precision);
-		void update_harvest();
-
-		/*
-			Access the profile(s) and knapsack solver (for stats)
-		*/
-		const Knapsack_t &knapsack()     const    {return _knapsack;}
-		const Anomaly    &anomaly()      const    {return _anomaly;}
-		const Profile_t  &profile()      const    {return _profile;}
-		const Profile_t  &past_profile() const    {return _past;}
-
-		/*
-			Get a consolidated profile of past and current-run knowledge.
-		*/
-		Profile_t         full_profile() const
-		{
-			scalar_t ratio = past_present_ratio();
-			if (ratio <  0) return _profile;
-			if (ratio == 0) return _past;
-			Profile_t profile = _profile;
-			for (auto &t : _past.tasks())
-				profile.assimilate(t.first, *t.second, ratio);
-			return profile;
-		}
-
-		/*
-			Calculate burden ratio between past and present profile.
-		*/
-		scalar_t past_present_ratio() const
-		{
-			scalar_t total_ratio = 0;
-			scalar_t total_weight = 0;
-			for (auto &t : _profile.tasks())
-			{
-				auto *curr = t.second;
-				if (auto *prev = _past.find(t.first))
-				{
-					for (choice_index_t i = 0; i < curr->count; ++i)
-					{
-						auto &cest = curr->estimates[i].full, &pest = prev->estimates[i].full;
-						scalar_t w = cest.count() * pest.count();
-						if (w > 0)
-						{
-							w = std::sqrt(w * cest.mean() * pest.mean());
-							total_ratio += w * (cest.mean() / pest.mean());
-							total_weight += w;
-						}
-					}
-				}
-			}
-			if (total_weight > 0) return total_ratio / total_weight;
-			else                  return scalar_t(-1);
-		}
-
-		/*
-			Access decision for a setting
-		*/
-		const Decision_t *get_decision(Setting_t *setting) const
-		{
-			auto i = settings.find(setting);
-			return (i==settings.end()) ? nullptr : &i->second;
-		}
-
-	private:
-		// No copying
-		Goblin_(const Goblin_ &o) = delete;
-		void operator=(const Goblin_ &o) = delete;
-	};
-	
-	/*
-		A setting which can be controlled by the goblin.
-	*/
-	template<typename T_Economy>
-	class Setting_
-	{
-	public:
-		using economy_t      = T_Economy;
-		using burden_t       = typename economy_t::burden_t;
-		using value_t        = typename economy_t::value_t;
-
-		using Profile_t      = Profile_<economy_t>;
-		using Measurement    = typename Profile_t::Measurement;
-
-		using Goblin_t         = Goblin_<economy_t>;
-		
-		using strategy_index_t = typename Goblin_t::strategy_index_t;
-		using choice_index_t   = typename Goblin_t::choice_index_t;
-
-		static const choice_index_t NO_CHOICE = Goblin_t::NO_CHOICE;
-
-		struct Option
-		{
-			value_t value;
-		};
-		struct Options
-		{
-			const Option  *options;
-			choice_index_t option_count;
-
-			// Iterable.
-			const Option *begin() const    {return options;}
-			const Option *end  () const    {return options+option_count;}
-		};
-
-	public:
-		Setting_() {}
-
-		virtual ~Setting_()
-		{
-			if (_goblin) _goblin->remove(this);
-		}
-
-		/*
-			Get the set of options (defines values).
-		*/
-		virtual const Options &options() const = 0;
-
-		/*
-			Return a reasonable default choice.
-		*/
-		virtual choice_index_t choice_default() const    {return 0;}
-		
-
-		/*
-			Semi-unique ID for performance profile.
-				IDs may be re-used for settings with the same burdens per option.
-				Avoid double quotes and line breaks in this value.
-		*/
-		virtual const std::string &id() const = 0;
-
-		/*
-			Get the goblin controlling this setting, if any.
-		*/
-		Goblin_t *goblin() const    {return _goblin;}
-
-	protected:
-		/*
-			These methods are used by the Goblin.
-		*/
-		friend class Goblin_<economy_t>;
-
-		// Called when a goblin takes or releases control over this setting.
-		virtual void        goblin_set() {}
-
-		// Get the next measurement in queue (default-construct if N/A)
-		virtual Measurement measurement() = 0;
-
-		// Receive new choices made by the Goblin.
-		//   Strategies are unsupported at the moment and always set to zero.
-		virtual void        choice_set(
-			choice_index_t   choice_index,
-			strategy_index_t strategy_index) = 0;
-
-	private:
-		
-		Goblin_t *_goblin = nullptr;
-	};
-
-
-	/*
-		Goblin implementation...
-	*/
-	template<typename Econ>
-	Goblin_<Econ>::Goblin_()
-	{
-	}
-
-	template<typename Econ>
-	Goblin_<Econ>::~Goblin_()
-	{
-		while (settings.size()) remove(settings.begin()->first);
-	}
-
-	template<typename Econ>
-	bool Goblin_<Econ>::add   (Setting_t *setting)
-	{
-		if (setting->_goblin) return setting->_goblin == this;
-		setting->_goblin = this;
-		setting->goblin_set();
-		if (settings.find(setting) != settings.end()) return true;
-		settings.emplace(setting, Decision_t());
-		return true;
-	}
-	template<typename Econ>
-	void Goblin_<Econ>::remove(Setting_t *setting)
-	{
-		settings.erase(setting);
-		if (setting->_goblin == this)
-		{
-			setting->_goblin = nullptr;
-			setting->goblin_set();
-		}
-	}
-
-	template<typename Econ>
-	void Goblin_<Econ>::update_harvest()
-	{
-		// Decay old measurements
-		_profile.decay_recent(config.recent_alpha);
-
-		// Sums for calculating anomaly
-		burden_t
-			sum_typical = economy_t::zero(),
-			sum_current = economy_t::zero();
-
-		// Harvest any new measurements
-		for (auto &pair : settings)
-		{
-			auto *setting = pair.first;
-
-			while (true)
-			{
-				// Measure...
-				auto measure = setting->measurement();
-				if (!measure.valid()) break;
-
-				// Burdens must be >= 0.
-				if (economy_t::lesser(measure.burden, economy_t::zero()))
-					measure.burden = economy_t::zero();
-
-				// Compare with existing metrics to calculate anomaly.
-				auto entry = _profile.find(setting->id());
-				if (entry)
-				{
-					sum_typical += entry->estimates[measure.choice].full.mean();
-					sum_current += measure.burden;
-				}
-
-				// Collect into profile.
-				_profile.collect(
-					setting->id(),
-					setting->options().option_count,
-					measure);
-			}
-		}
-
-		// Estimate anomaly
-		if (economy_t::lesser(economy_t::zero(), sum_typical))
-		{
-			_anomaly.latest = sum_current / sum_typical;
-			_anomaly.recent += (1 - config.anomaly_alpha) * (_anomaly.latest - _anomaly.recent);
-		}
-	}
-
-	template<typename Econ>
-	void Goblin_<Econ>::update_decide(capacity_t capacity, size_t precision)
-	{
-		_knapsack.clear();
-		option_store.clear();
-
-		// Calculate proportion between past-run costs and this-run costs.
-		scalar_t ratio = past_present_ratio();
-
-		static const burden_stat_t UNKNOWN_BURDEN = {};
-
-		// Calculate estimated burden for all options and generate a knapsack problem
-		for (auto &pair : settings)
-		{
-			auto *setting = pair.first;
-			auto &decision = pair.second;
-			const typename Setting::Options &options = setting->options();
-			decision.option_count = options.option_count;
-
-			// Get profile data for this task
-			auto *pres = _profile.find(setting->id());
-			auto *past = _past   .find(setting->id());
-
-			// Estimate burdens for each choice.
-			if (pres || (past && ratio > scalar_t(0)))
-			{
-				// Calculate a blind guess for unprofiled options?
-				burden_norm_t blind_guess = economy_norm_t::zero();
-				scalar_t      unexplored_burden_mod = scalar_t(1);
-				scalar_t      data_total = 0, data_missing = 0;
-				if (!pres || !pres->meets_quota(config.measure_quota))
-				{
-					burden_norm_t lightest = economy_norm_t::infinite();
-
-					for (choice_index_t i = 0; i < decision.option_count; ++i)
-					{
-						const burden_stat_t &
-							curr = (pres ? pres->estimates[i].full : UNKNOWN_BURDEN),
-							prev = (past ? past->estimates[i].full : UNKNOWN_BURDEN);
-
-						data_total   += curr.count() + prev.count();
-						data_missing += std::max<scalar_t>(0,
-							config.measure_quota - curr.count() - prev.count());
-
-						burden_norm_t test;
-						float count = 0;
-						if      (curr) {count = curr.count(); test = curr.burden_norm() * _anomaly.recent;}
-						else if (prev) {count = prev.count(); test = prev.burden_norm() * ratio;}
-						if (count && economy_norm_t::lesser(test, lightest)) lightest = test;
-					}
-
-					blind_guess = lightest;
-					unexplored_burden_mod = data_missing /
-						std::max<scalar_t>(data_missing, data_total);
-				}
-
-				// Estimate burdens for each option, if possible.
-				for (choice_index_t i = 0; i < decision.option_count; ++i)
-				{
-					burden_norm_t option_burden;
-					value_t value_bonus = economy_t::zero();
-
-					const burden_stat_t &
-						recent = (pres ? pres->estimates[i].recent : UNKNOWN_BURDEN),
-						curr   = (pres ? pres->estimates[i].full   : UNKNOWN_BURDEN),
-						prev   = (past ? past->estimates[i].full   : UNKNOWN_BURDEN);
-
-					// Prior burden is based on past runs, or failing that a blind guess.
-					burden_norm_t prior_burden = (prev ?
-						(prev.burden_norm() * ratio) :
-						blind_guess);
-
-					if (curr)
-					{
-						if (curr.count() < config.measure_quota)
-						{
-							// Interpolate between data from this run and prior estimate.
-							float mix = curr.count() / config.measure_quota;
-							option_burden = curr.burden_norm() * _anomaly.recent;
-							option_burden =
-								option_burden * mix +
-								prior_burden  * (1.f-mix);
-						}
-						else
-						{
-							// TODO mix with full when recent measures are few
-
-							// Estimate based on recent measurements
-							option_burden = recent.burden_norm();
-						}
-					}
-					else
-					{
-						// No profiling data from this run.  Use past data or blind guess.
-						option_burden = prior_burden;
-					}
-
-					// Incentive to explore options further...
-					if (prev.count() + curr.count() < config.measure_quota)
-					{
-						value_bonus    = config.explore_value;
-						option_burden *= unexplored_burden_mod;
-					}
-
-					// Formulate option for knapsack decision...
-					option_store.push_back(Option_t{
-						option_burden,
-						options.options[i].value + value_bonus});
-				}
-			}
-			else
-			{
-				// Lacking any profiler data from this run, we force to the default choice.
-				decision.choice = setting->choice_default();
-				if (decision.choice >= decision.option_count) decision.choice = 0;
-				for (choice_index_t i = 0; i < options.option_count; ++i)
-				{
-					option_store.push_back(Option_t{
-						{(i == decision.choice) ? burden_t(economy_t::zero()) : burden_t(economy_t::infinite())},
-						options.options[i].value});
-				}
-			}
-
-			// Add this decision to the knapsack.
-			_knapsack.add_decision(&decision);
-		}
-
-		// Associate all decisions with options
-		{
-			size_t i = 0;
-			for (auto &pair : settings)
-			{
-				pair.second.options = &option_store[i];
-				i += pair.second.option_count;
-			}
-		}
-
-		// Finally, run the knapsack solver.
-		_knapsack.decide(capacity, precision);
-
-		// Then apply all choices
-		for (auto &pair : settings)
-		{
-			pair.first->choice_set(pair.second.choice, 0);
-		}
-	}
-
-	template<typename Econ>
-	void Goblin_<Econ>::update(capacity_t capacity, size_t precision)
-	{
-		// Harvest new measurements
-		update_harvest();
-
-		// Decide
-		update_decide(capacity, precision);
-	}
-}
+#pragma once
+
+/*
+	A little goblin which gleefully adjusts settings to maintain FPS.
+		It is based on the knapsack algorithm in knapsack.h.
+	
+	The goblin controls a list of settings, each of which has some options.
+		Each option is assigned a subjective numerical "experience value".
+		Settings may provide measurements of their performance cost.
+
+	The goblin selects one option for each setting each frame.
+		It tries to maximize experience value without exceeding a cost limit.
+		It tracks recent and overall costs to estimate cost accurately.
+*/
+
+#include <cmath>
+#include <deque>
+
+#include "knapsack.h"
+#include "economy.h"
+#include "profile.h"
+#include "profile_view.h"
+
+
+namespace perf_goblin
+{
+	
+	template<typename T_Economy>     class Goblin_;
+	template<typename T_Economy>     class Setting_;
+	template<typename T_Economy>     class GoblinState_;
+
+	using Goblin  = Goblin_ <Economy_f>;
+	using Setting = Setting_<Economy_f>;
+
+	
+
+	/*
+		The goblin!
+			It takes control of a number of settings and their profile data.
+	*/
+	template<typename T_Economy>
+	class Goblin_
+	{
+	public:
+		using economy_t      = T_Economy;
+		using burden_t       = typename economy_t::burden_t;
+		using scalar_t       = typename economy_t::scalar_t;
+		using value_t        = typename economy_t::value_t;
+
+		using Profile_t      = Profile_<economy_t>;
+		using ProfileShard_t = ProfileShard_<economy_t>;
+		using ProfileView_t  = ProfileView_<economy_t>;
+		using ProfileImage_t = ProfileImage_<economy_t>;
+		using economy_norm_t = typename Profile_t::economy_norm_t;;
+		using burden_norm_t  = typename economy_norm_t::burden_t;
+		using burden_stat_t  = typename Profile_t::burden_stat_t;
+		using BurdenRatio_t  = BurdenRatio_<economy_t>;
+		using resource_t     = typename Profile_t::resource_t;
+		static const resource_t RESOURCE_CLASSES = Profile_t::RESOURCE_CLASSES;
+		using capacity_t     = typename economy_norm_t::capacity_t;
+
+		using Knapsack_t     = Knapsack_<economy_norm_t>;
+		using choice_index_t = typename Knapsack_t::choice_index_t;
+		using Decision_t     = typename Knapsack_t::Decision;
+		using Option_t       = typename Knapsack_t::Option;
+
+		using Setting_t        = Setting_<economy_t>;
+		using strategy_index_t = choice_index_t;
+
+		static const choice_index_t NO_CHOICE = Knapsack_t::NO_CHOICE;
+
+		
+		// Maps each setting to the index of its decision (see decision_at).
+		using Settings  = detail::FlatMap<Setting_t*, size_t>;
+
+		struct Config
+		{
+			scalar_t recent_alpha  = 1.f - 1.f/30.f;
+			scalar_t anomaly_alpha = 1.f - 1.f/30.f;
+			scalar_t measure_quota = 30;
+			value_t  explore_value = 0;
+
+			// Fraction of settings asked to measure each frame (see Setting_::wants_measurement).
+			//   Settings are prioritized by estimate uncertainty and staleness.
+			scalar_t sample_fraction = 1;
+
+			// Samples a resource class needs before its past/present ratio outweighs the overall one.
+			scalar_t ratio_shrinkage = 30;
+		};
+
+		struct Anomaly
+		{
+			scalar_t latest = 1;
+			scalar_t recent = 1;
+		};
+
+		/*
+			Settings whose combined burden is measured together (see Profile_::Group).
+		*/
+		class Group
+		{
+		public:
+			void add(Setting_t *setting)
+			{
+				_settings.push_back(setting);
+				_model.add(setting->id(), setting->options().option_count, setting->resource_class());
+			}
+			void clear()    {_settings.clear(); _model.clear();}
+
+			const std::vector<Setting_t*>   &settings() const    {return _settings;}
+			typename Profile_t::Group       &model()             {return _model;}
+			const typename Profile_t::Group &model()    const    {return _model;}
+
+		private:
+			friend class Goblin_;
+			std::vector<Setting_t*>     _settings;
+			typename Profile_t::Group   _model;
+			std::vector<choice_index_t> _choices;
+		};
+
+		/*
+			Observes a goblin's inputs and decisions (eg, a GoblinTraceRecorder_).
+				harvested is called for each measurement taken from a setting, after clamping;
+				decided is called after each update_decide has applied its choices.
+		*/
+		class Observer
+		{
+		public:
+			virtual ~Observer() {}
+			virtual void harvested(const Setting_t &setting, const typename Profile_t::Measurement &measure) = 0;
+			virtual void decided(capacity_t capacity, size_t precision) = 0;
+		};
+
+	public:
+		Config config;
+
+	private:
+		Profile_t             _profile;
+		ProfileView_t         _past;
+		ProfileImage_t        _past_image;
+		Settings              settings;
+		std::vector<Setting_t*> _order; // Settings in the order added, for deterministic decisions.
+
+		// Decisions live in a deque, so pointers to them survive adding settings.
+		//   _order_decisions parallels _order; removed settings' slots are reused.
+		std::deque<Decision_t>   _decisions;
+		std::vector<Decision_t*> _order_decisions;
+		std::vector<size_t>      _free_decisions;
+		Knapsack_t            _knapsack;
+		std::vector<Option_t> option_store;
+		Anomaly               _anomaly;
+		burden_t              _group_typical = economy_t::zero(), _group_current = economy_t::zero();
+		BurdenRatio_t         _ratio, _ratios[RESOURCE_CLASSES];
+		size_t                _frame = 0;
+		Observer             *_observer = nullptr;
+
+		// Scratch for choosing which settings to sample.
+		struct SampleCandidate
+		{
+			scalar_t   priority;
+			Setting_t *setting;
+
+			bool operator<(const SampleCandidate &o) const    {return priority > o.priority;}
+		};
+		std::vector<SampleCandidate> sample_store;
+
+		void update_sampling();
+
+		friend class GoblinState_<economy_t>;
+
+	public:
+		Goblin_();
+		~Goblin_();
+
+		/*
+			Overwrite performance profiles.
+		*/
+		void set_profile     (const Profile_t &profile)    {_profile = profile; ratio_recount();}
+		void set_past_profile(const Profile_t &profile)    {_past_image.assign(profile); _past = _past_image.view(); ratio_recount();}
+
+		/*
+			Use binary profile data (such as a mapped file) as the past profile, without copying.
+				The data must outlive its use by the goblin.
+		*/
+		void set_past_profile(const ProfileView_t &view)
+		{
+			if (view.data() != _past_image.data()) _past_image.clear();
+			_past = view;
+			ratio_recount();
+		}
+
+		/*
+			Observe measurements collected into the current-run profile (eg, by a ProfileJournal_).
+		*/
+		void set_profile_observer(typename Profile_t::Observer *observer)    {_profile.set_observer(observer);}
+
+		/*
+			Limit the current-run profile's memory use (see Profile_::trim).
+				Stale tasks are evicted during update_harvest.
+		*/
+		void set_profile_memory_limit(size_t bytes)    {_profile.set_memory_limit(bytes);}
+
+		/*
+			Set an observer of measurements and decisions, or null.
+		*/
+		void      set_observer(Observer *observer)    {_observer = observer;}
+		Observer *observer() const                    {return _observer;}
+
+		/*
+			Add & remove settings.
+		*/
+		bool add   (Setting_t *setting);
+		void remove(Setting_t *setting);
+
+		/*
+			Iterate over settings, with the index of each one's decision (see decision_at).
+		*/
+		typename Settings::const_iterator begin() const    {return settings.begin();}
+		typename Settings::const_iterator end  () const    {return settings.end();}
+
+		/*
+			Settings in the order they were added, which is the order they're decided in.
+		*/
+		const std::vector<Setting_t*> &settings_in_order() const    {return _order;}
+
+		/*
+			Update all settings, accounting for any new measurements.
+				Alternatively, you can call subroutines separately:
+				- harvest() : collect new measurements and update anomaly
+				- decide(...) : resolve all settings
+		*/
+		void update(capacity_t capacity, size_t precision);
+		void update_decide(capacity_t capacity, size_t precision);
+		void update_harvest();
+
+		/*
+			Add a measurement of a group's combined burden under the current choices.
+				Call this between updates, after the measured work is done.
+				The burden counts toward the anomaly at the next update.
+				Returns false if some setting in the group isn't controlled by this goblin.
+		*/
+		bool collect_group(Group &group, burden_t burden);
+
+		/*
+			Merge measurements collected by another thread, then reset the shard.
+				Call this between updates, while no thread is collecting into the shard.
+				Merged measurements don't contribute to the anomaly.
+		*/
+		void merge(ProfileShard_t &shard);
+
+		/*
+			Access the profile(s) and knapsack solver (for stats)
+				The solver's decisions are those of the last update, less any settings removed since.
+		*/
+		const Knapsack_t &knapsack()     const    {return _knapsack;}
+		const Anomaly    &anomaly()      const    {return _anomaly;}
+		const Profile_t  &profile()      const    {return _profile;}
+		const ProfileView_t &past_profile() const    {return _past;}
+
+		/*
+			Get a consolidated profile of past and current-run knowledge.
+		*/
+		Profile_t         full_profile() const
+		{
+			scalar_t ratio = past_present_ratio();
+			if (ratio <  0) return _profile;
+			Profile_t profile;
+			if (ratio != 0) profile = _profile;
+			for (auto t : _past)
+			{
+				const std::string id = t.first;
+				auto *curr = _profile.find(id);
+				profile.assimilate(id, *t.second,
+					(ratio == 0) ? scalar_t(1) : past_present_ratio(curr ? curr->resource : t.second->resource));
+			}
+			return profile;
+		}
+
+		/*
+			Burden ratio between past and present profile (-1 if unknown).
+				This is maintained incrementally as measurements are collected.
+		*/
+		scalar_t past_present_ratio() const    {return _ratio.ratio();}
+
+		/*
+			Burden ratio for tasks of one resource class.
+				Shrinks toward the overall ratio when the class has little data.
+				Classes out of range are treated as class 0, as when collecting.
+		*/
+		scalar_t past_present_ratio(resource_t resource) const
+		{
+			scalar_t overall = _ratio.ratio();
+			if (overall < 0) return overall;
+			const BurdenRatio_t &r = _ratios[ratio_class(resource)];
+			scalar_t specific = r.ratio();
+			if (specific < 0) return overall;
+			scalar_t mix = scalar_t(r.sum_count / (r.sum_count + config.ratio_shrinkage));
+			return specific * mix + overall * (1 - mix);
+		}
+
+		/*
+			Access decision for a setting
+		*/
+		const Decision_t *get_decision(Setting_t *setting) const
+		{
+			auto i = settings.find(setting);
+			return (i==settings.end()) ? nullptr : &_decisions[i->second];
+		}
+		const Decision_t &decision_at(size_t index) const    {return _decisions[index];}
+
+	private:
+		// Recalculate the past/present ratios from scratch.
+		void ratio_recount()
+		{
+			_ratio.reset();
+			for (auto &r : _ratios) r.reset();
+			for (auto &t : _profile.tasks())
+				if (auto *prev = _past.find(t.first)) ratio_task(*t.second, prev, true);
+		}
+
+		// The class whose ratio a resource contributes to.
+		static resource_t ratio_class(resource_t resource)    {return (resource < RESOURCE_CLASSES) ? resource : 0;}
+
+		// Add or remove the ratio contributions of one option, or all of a task's options.
+		void ratio_option(const typename Profile_t::Task &curr, const typename Profile_t::Task &prev, choice_index_t i, bool add)
+		{
+			BurdenRatio_t &specific = _ratios[ratio_class(curr.resource)];
+			if (add) {_ratio.add   (curr.estimates[i].full, prev.estimates[i].full); specific.add   (curr.estimates[i].full, prev.estimates[i].full);}
+			else     {_ratio.remove(curr.estimates[i].full, prev.estimates[i].full); specific.remove(curr.estimates[i].full, prev.estimates[i].full);}
+		}
+		void ratio_task(const typename Profile_t::Task &curr, const typename Profile_t::Task *prev, bool add)
+		{
+			if (!prev) return;
+			choice_index_t count = std::min(curr.count, prev->count);
+			for (choice_index_t i = 0; i < count; ++i) ratio_option(curr, *prev, i, add);
+		}
+
+		// No copying
+		Goblin_(const Goblin_ &o) = delete;
+		void operator=(const Goblin_ &o) = delete;
+	};
+	
+	/*
+		A setting which can be controlled by the goblin.
+	*/
+	template<typename T_Economy>
+	class Setting_
+	{
+	public:
+		using economy_t      = T_Economy;
+		using burden_t       = typename economy_t::burden_t;
+		using value_t        = typename economy_t::value_t;
+
+		using Profile_t      = Profile_<economy_t>;
+		using Measurement    = typename Profile_t::Measurement;
+		using resource_t     = typename Profile_t::resource_t;
+
+		using Goblin_t         = Goblin_<economy_t>;
+		
+		using strategy_index_t = typename Goblin_t::strategy_index_t;
+		using choice_index_t   = typename Goblin_t::choice_index_t;
+
+		static const choice_index_t NO_CHOICE = Goblin_t::NO_CHOICE;
+
+		struct Option
+		{
+			value_t value;
+		};
+		struct Options
+		{
+			const Option  *options;
+			choice_index_t option_count;
+
+			// Iterable.
+			const Option *begin() const    {return options;}
+			const Option *end  () const    {return options+option_count;}
+		};
+
+	public:
+		Setting_() {}
+
+		virtual ~Setting_()
+		{
+			if (_goblin) _goblin->remove(this);
+		}
+
+		/*
+			Get the set of options (defines values).
+		*/
+		virtual const Options &options() const = 0;
+
+		/*
+			Return a reasonable default choice.
+		*/
+		virtual choice_index_t choice_default() const    {return 0;}
+		
+
+		/*
+			Semi-unique ID for performance profile.
+				IDs may be re-used for settings with the same burdens per option.
+				Avoid double quotes and line breaks in this value.
+		*/
+		virtual const std::string &id() const = 0;
+
+		/*
+			Resource class burdened by this setting, such as CPU or GPU time.
+				Past/present burden ratios are estimated separately for each class.
+				Must be less than Profile_::RESOURCE_CLASSES.
+		*/
+		virtual resource_t resource_class() const    {return 0;}
+
+		/*
+			Get the goblin controlling this setting, if any.
+		*/
+		Goblin_t *goblin() const    {return _goblin;}
+
+		/*
+			Whether the goblin wants a measurement of the current choice this frame.
+				Settings may skip timing when this is false, to reduce overhead.
+				Measurements are still accepted either way.
+		*/
+		bool wants_measurement() const    {return _wants_measurement;}
+
+	protected:
+		/*
+			These methods are used by the Goblin.
+		*/
+		friend class Goblin_<economy_t>;
+		friend class GoblinState_<economy_t>;
+
+		// Called when a goblin takes or releases control over this setting.
+		virtual void        goblin_set() {}
+
+		// Get the next measurement in queue (default-construct if N/A)
+		virtual Measurement measurement() = 0;
+
+		// Receive new choices made by the Goblin.
+		//   Strategies are unsupported at the moment and always set to zero.
+		virtual void        choice_set(
+			choice_index_t   choice_index,
+			strategy_index_t strategy_index) = 0;
+
+	private:
+		
+		Goblin_t *_goblin = nullptr;
+
+		// Sampling state, managed by the goblin.
+		bool      _wants_measurement = true;
+		size_t    _sampled_frame     = 0;
+	};
+
+
+	/*
+		Goblin implementation...
+	*/
+	template<typename Econ>
+	Goblin_<Econ>::Goblin_()
+	{
+	}
+
+	template<typename Econ>
+	Goblin_<Econ>::~Goblin_()
+	{
+		while (settings.size()) remove(settings.begin()->first);
+	}
+
+	template<typename Econ>
+	bool Goblin_<Econ>::add   (Setting_t *setting)
+	{
+		if (setting->_goblin) return setting->_goblin == this;
+		setting->_goblin = this;
+		setting->goblin_set();
+		if (settings.find(setting) != settings.end()) return true;
+		size_t index = _decisions.size();
+		if (_free_decisions.empty()) _decisions.emplace_back();
+		else {index = _free_decisions.back(); _free_decisions.pop_back(); _decisions[index] = Decision_t();}
+		settings.emplace(setting, index);
+		_order.push_back(setting);
+		_order_decisions.push_back(&_decisions[index]);
+		return true;
+	}
+	template<typename Econ>
+	void Goblin_<Econ>::remove(Setting_t *setting)
+	{
+		auto entry = settings.find(setting);
+		if (entry != settings.end())
+		{
+			Decision_t *decision = &_decisions[entry->second];
+			auto &decisions = _knapsack.decisions;
+			decisions.erase(std::remove(decisions.begin(), decisions.end(), decision), decisions.end());
+			_free_decisions.push_back(entry->second);
+			settings.erase(entry);
+			size_t k = size_t(std::find(_order.begin(), _order.end(), setting) - _order.begin());
+			_order          .erase(_order          .begin() + k);
+			_order_decisions.erase(_order_decisions.begin() + k);
+		}
+		if (setting->_goblin == this)
+		{
+			setting->_goblin = nullptr;
+			setting->goblin_set();
+		}
+	}
+
+	template<typename Econ>
+	void Goblin_<Econ>::update_harvest()
+	{
+		++_frame;
+
+		// Evict stale tasks if the profile is over its memory limit, along with their part in the ratios.
+		_profile.trim([this](const std::string &id, const typename Profile_t::Task &task)
+			{ratio_task(task, _past.find(id), false);});
+
+		// Decay old measurements
+		//   Each setting decays per interval between its measurements, so sampled settings
+		//   keep as much recent data as settings measured every frame.
+		_profile.decay_recent(config.recent_alpha);
+
+		// Sums for calculating anomaly, including groups collected since the last harvest
+		burden_t
+			sum_typical = _group_typical,
+			sum_current = _group_current;
+		_group_typical = _group_current = economy_t::zero();
+
+		// Harvest any new measurements
+		for (auto *setting : _order)
+		{
+			while (true)
+			{
+				// Measure...
+				auto measure = setting->measurement();
+				if (!measure.valid()) break;
+
+				// Burdens must be >= 0.
+				if (economy_t::lesser(measure.burden, economy_t::zero()))
+					measure.burden = economy_t::zero();
+
+				if (_observer) _observer->harvested(*setting, measure);
+
+				// Compare with existing metrics to calculate anomaly.
+				//   If the setting's resource class changed, its whole ratio contribution moves to the new class.
+				const resource_t resource = setting->resource_class();
+				auto entry = _profile.find(setting->id());
+				auto past  = _past   .find(setting->id());
+				bool moved = (entry && past && ratio_class(entry->resource) != ratio_class(resource));
+				if (past && measure.choice >= past->count && !moved) past = nullptr;
+				if (entry)
+				{
+					sum_typical += entry->estimates[measure.choice].full.mean();
+					sum_current += measure.burden;
+					if      (moved) ratio_task  (*entry, past, false);
+					else if (past)  ratio_option(*entry, *past, measure.choice, false);
+				}
+
+				// Collect into profile.
+				entry = _profile.collect(
+					setting->id(),
+					setting->options().option_count,
+					measure,
+					resource);
+
+				if      (moved) ratio_task  (*entry, past, true);
+				else if (past)  ratio_option(*entry, *past, measure.choice, true);
+			}
+		}
+
+		// Estimate anomaly
+		if (economy_t::lesser(economy_t::zero(), sum_typical))
+		{
+			_anomaly.latest = sum_current / sum_typical;
+			_anomaly.recent += (1 - config.anomaly_alpha) * (_anomaly.latest - _anomaly.recent);
+		}
+	}
+
+	template<typename Econ>
+	bool Goblin_<Econ>::collect_group(Group &group, burden_t burden)
+	{
+		group._choices.resize(group._settings.size());
+		for (size_t i = 0; i < group._settings.size(); ++i)
+		{
+			auto entry = settings.find(group._settings[i]);
+			if (entry == settings.end()) return false;
+			group._choices[i] = _decisions[entry->second].choice;
+		}
+
+		if (economy_t::lesser(burden, economy_t::zero())) burden = economy_t::zero();
+
+		// Group collection adds to every member's estimates.
+		burden_t typical = economy_t::zero();
+		bool     known   = true;
+		auto    &members = group._model.members();
+		for (size_t i = 0; i < members.size(); ++i)
+		{
+			auto *curr = _profile.find(members[i].id);
+			if (curr) ratio_task(*curr, _past.find(members[i].id), false);
+			if (curr && group._choices[i] < curr->count) typical += curr->estimates[group._choices[i]].full.mean();
+			else known = false;
+		}
+
+		_profile.collect_group(group._model, group._choices.data(), burden);
+
+		for (auto &member : members)
+			ratio_task(*_profile.find(member.id), _past.find(member.id), true);
+
+		// The group's burden counts toward the anomaly of the next harvest.
+		if (known)
+		{
+			_group_typical += typical;
+			_group_current += burden;
+		}
+		return true;
+	}
+
+	template<typename Econ>
+	void Goblin_<Econ>::merge(ProfileShard_t &shard)
+	{
+		for (auto &change : shard)
+			if (auto *curr = _profile.find(change.id)) ratio_task(*curr, _past.find(change.id), false);
+
+		_profile.merge(shard);
+
+		for (auto &change : shard)
+			ratio_task(*_profile.find(change.id), _past.find(change.id), true);
+		shard.reset();
+	}
+
+	template<typename Econ>
+	void Goblin_<Econ>::update_decide(capacity_t capacity, size_t precision)
+	{
+		_knapsack.clear();
+		option_store.clear();
+
+		static const burden_stat_t UNKNOWN_BURDEN = {};
+
+		// Calculate estimated burden for all options and generate a knapsack problem
+		//   Settings are visited in the order added, so that ties resolve the same way in every process.
+		for (size_t k = 0; k < _order.size(); ++k)
+		{
+			Setting_t  *setting  = _order[k];
+			Decision_t &decision = *_order_decisions[k];
+			const typename Setting_t::Options &options = setting->options();
+			decision.option_count = options.option_count;
+
+			// Get profile data for this task, which is kept while the setting is present
+			auto *pres = _profile.find(setting->id());
+			auto *past = _past   .find(setting->id());
+			if (pres) _profile.mark_present(*pres);
+
+			// Calculate proportion between past-run costs and this-run costs.
+			const scalar_t ratio = past_present_ratio(setting->resource_class());
+
+			// Estimate burdens for each choice.
+			if (pres || (past && ratio > scalar_t(0)))
+			{
+				// Calculate a blind guess for unprofiled options?
+				burden_norm_t blind_guess = economy_norm_t::zero();
+				scalar_t      unexplored_burden_mod = scalar_t(1);
+				scalar_t      data_total = 0, data_missing = 0;
+				if (!pres || !pres->meets_quota(config.measure_quota))
+				{
+					burden_norm_t lightest = economy_norm_t::infinite();
+
+					for (choice_index_t i = 0; i < decision.option_count; ++i)
+					{
+						const burden_stat_t &
+							curr = (pres ? pres->estimates[i].full : UNKNOWN_BURDEN),
+							prev = (past ? past->estimates[i].full : UNKNOWN_BURDEN);
+
+						data_total   += curr.count() + prev.count();
+						data_missing += std::max<scalar_t>(0,
+							config.measure_quota - curr.count() - prev.count());
+
+						burden_norm_t test;
+						float count = 0;
+						if      (curr) {count = curr.count(); test = curr.burden_norm() * _anomaly.recent;}
+						else if (prev) {count = prev.count(); test = prev.burden_norm() * ratio;}
+						if (count && economy_norm_t::lesser(test, lightest)) lightest = test;
+					}
+
+					blind_guess = lightest;
+					unexplored_burden_mod = data_missing /
+						std::max<scalar_t>(data_missing, data_total);
+				}
+
+				// Estimate burdens for each option, if possible.
+				for (choice_index_t i = 0; i < decision.option_count; ++i)
+				{
+					burden_norm_t option_burden;
+					value_t value_bonus = economy_t::zero();
+
+					const burden_stat_t &
+						recent = (pres ? _profile.recent(*pres, i) : UNKNOWN_BURDEN),
+						curr   = (pres ? pres->estimates[i].full   : UNKNOWN_BURDEN),
+						prev   = (past ? past->estimates[i].full   : UNKNOWN_BURDEN);
+
+					// Prior burden is based on past runs, or failing that a blind guess.
+					burden_norm_t prior_burden = (prev ?
+						(prev.burden_norm() * ratio) :
+						blind_guess);
+
+					if (curr)
+					{
+						if (curr.count() < config.measure_quota)
+						{
+							// Interpolate between data from this run and prior estimate.
+							float mix = curr.count() / config.measure_quota;
+							option_burden = curr.burden_norm() * _anomaly.recent;
+							option_burden =
+								option_burden * mix +
+								prior_burden  * (1.f-mix);
+						}
+						else
+						{
+							// TODO mix with full when recent measures are few
+
+							// Estimate based on recent measurements
+							option_burden = recent.burden_norm();
+						}
+					}
+					else
+					{
+						// No profiling data from this run.  Use past data or blind guess.
+						option_burden = prior_burden;
+					}
+
+					// Incentive to explore options further...
+					if (prev.count() + curr.count() < config.measure_quota)
+					{
+						value_bonus    = config.explore_value;
+						option_burden *= unexplored_burden_mod;
+					}
+
+					// Formulate option for knapsack decision...
+					option_store.push_back(Option_t{
+						option_burden,
+						options.options[i].value + value_bonus});
+				}
+			}
+			else
+			{
+				// Lacking any profiler data from this run, we force to the default choice.
+				decision.choice = setting->choice_default();
+				if (decision.choice >= decision.option_count) decision.choice = 0;
+				for (choice_index_t i = 0; i < options.option_count; ++i)
+				{
+					option_store.push_back(Option_t{
+						{(i == decision.choice) ? burden_t(economy_t::zero()) : burden_t(economy_t::infinite())},
+						options.options[i].value});
+				}
+			}
+
+			// Add this decision to the knapsack.
+			_knapsack.add_decision(&decision);
+		}
+
+		// Associate all decisions with options
+		{
+			size_t i = 0;
+			for (auto *decision : _knapsack.decisions)
+			{
+				decision->options = &option_store[i];
+				i += decision->option_count;
+			}
+		}
+
+		// Finally, run the knapsack solver.
+		_knapsack.decide(capacity, precision);
+
+		// Then apply all choices
+		for (size_t k = 0; k < _order.size(); ++k)
+		{
+			_order[k]->choice_set(_order_decisions[k]->choice, 0);
+		}
+
+		// Decide which settings should measure next frame.
+		update_sampling();
+
+		if (_observer) _observer->decided(capacity, precision);
+	}
+
+	template<typename Econ>
+	void Goblin_<Econ>::update_sampling()
+	{
+		if (!(config.sample_fraction < 1))
+		{
+			for (auto *setting : _order) setting->_wants_measurement = true;
+			return;
+		}
+
+		sample_store.clear();
+		size_t forced = 0;
+		for (size_t k = 0; k < _order.size(); ++k)
+		{
+			Setting_t *setting = _order[k];
+			auto *pres = _profile.find(setting->id());
+			setting->_wants_measurement = false;
+
+			// Always measure options which haven't met the quota.
+			const choice_index_t choice = _order_decisions[k]->choice;
+			if (!pres || choice >= pres->count || pres->estimates[choice].full.count() < config.measure_quota)
+			{
+				setting->_wants_measurement = true;
+				++forced;
+				continue;
+			}
+
+			// Priority grows with staleness and the relative error of the recent estimate.
+			const burden_stat_t recent = _profile.recent(*pres, choice);
+			scalar_t error = scalar_t(1e-3);
+			if (recent && economy_t::lesser(economy_t::zero(), recent.mean()))
+				error = std::max<scalar_t>(error, recent.deviation() /
+					(recent.mean() * std::sqrt(std::max<scalar_t>(recent.count(), 1))));
+			scalar_t staleness = scalar_t(_frame - setting->_sampled_frame);
+			sample_store.push_back(SampleCandidate{staleness * error, setting});
+		}
+
+		// Select the highest-priority settings, up to the sampling fraction.
+		size_t quota = size_t(std::ceil(config.sample_fraction * settings.size()));
+		quota = (quota > forced) ? (quota - forced) : 0;
+		if (quota < sample_store.size())
+			std::nth_element(sample_store.begin(), sample_store.begin() + quota, sample_store.end());
+		else
+			quota = sample_store.size();
+		for (size_t i = 0; i < quota; ++i) sample_store[i].setting->_wants_measurement = true;
+
+		for (auto *setting : _order)
+			if (setting->_wants_measurement) setting->_sampled_frame = _frame;
+	}
+
+	template<typename Econ>
+	void Goblin_<Econ>::update(capacity_t capacity, size_t precision)
+	{
+		// Harvest new measurements
+		update_harvest();
+
+		// Decide
+		update_decide(capacity, precision);
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+/*
+	Hardware-counter clocks for scope timers, based on Linux perf_event.
+		Cycle and instruction counts are far less sensitive to frequency scaling
+		than wall time, which keeps burden ratios stable across machines.
+
+	Counters are opened lazily for each thread which reads them.
+		If a counter can't be opened (unsupported, or not permitted by
+		perf_event_paranoid) the clock falls back to software counters:
+		task-clock falls back to per-thread CPU time; cycles fall back to
+		per-thread CPU time converted to nominal (TSC) cycles.  Instructions
+		can't be estimated from time, so they have no fallback, and timers
+		record nothing.  source() reports which is in use on the calling thread.
+
+	When the kernel multiplexes more counters than the CPU has, each count is
+		scaled by the time it was enabled over the time it was running.
+		If a counter can't be read mid-scope, the reading fails (see ScopeTimer_)
+		and the measurement is dropped, rather than mixing in another clock's units.
+*/
+
+#include "goblin_timer.h"
+
+#if defined(__linux__)
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <cstring>
+	#define PERF_GOBLIN_HAS_PERF_EVENT 1
+#else
+	#define PERF_GOBLIN_HAS_PERF_EVENT 0
+#endif
+
+
+namespace perf_goblin
+{
+	enum class PerfCounter
+	{
+		TaskClock,    // Nanoseconds of CPU time, counted by the kernel.
+		Cycles,       // CPU cycles spent by the thread.
+		Instructions, // Instructions retired by the thread.
+	};
+
+	enum class PerfSource
+	{
+		PerfEvent,    // The requested perf_event counter.
+		TaskClock,    // Software task-clock counter (hardware counter unavailable).
+		ThreadClock,  // Clock_ThreadCPU (perf_event unavailable).
+		None,         // No counter (instructions, perf_event unavailable).
+	};
+
+	/*
+		A clock which reads a perf_event counter for the calling thread.
+			Cycles are reported in units of nominal cycles, and seconds_per_tick()
+			gives the nominal cycle period, measured from the TSC.
+			Instructions are counted as they are; seconds_per_tick() is 1e-9, so a
+			timer's burden_per_second gives the burden of a billion instructions
+			(by default, burdens are in millions of instructions).
+	*/
+	template<PerfCounter T_Counter>
+	struct Clock_PerfEvent_
+	{
+		using tick_t = uint64_t;
+
+		static const PerfCounter counter = T_Counter;
+
+		static tick_t now()
+		{
+			Counter &c = _counter();
+#if PERF_GOBLIN_HAS_PERF_EVENT
+			if (c.fd >= 0)
+			{
+				// The count, then the times the counter was enabled and running.
+				uint64_t data[3] = {};
+				if (::read(c.fd, data, sizeof(data)) != ssize_t(sizeof(data))) return ~tick_t(0);
+				double value = double(data[0]);
+				if (data[2] < data[1])
+				{
+					if (!data[2]) return ~tick_t(0);
+					value *= double(data[1]) / double(data[2]);
+				}
+				return (c.source == PerfSource::TaskClock) ? _ns_to_ticks(value) : tick_t(value);
+			}
+#endif
+			if (c.source == PerfSource::None) return ~tick_t(0);
+			return _ns_to_ticks(Clock_ThreadCPU::now() * _thread_ns_per_tick());
+		}
+
+		static double seconds_per_tick()
+		{
+			return (counter == PerfCounter::Cycles) ? _nominal_cycle_seconds() : 1e-9;
+		}
+
+		// Which counter is used on the calling thread.
+		static PerfSource source()    {return _counter().source;}
+
+		// Whether the requested counter is in use on the calling thread.
+		static bool available()       {return source() == PerfSource::PerfEvent;}
+
+	private:
+		struct Counter
+		{
+			int        fd     = -1;
+			PerfSource source = PerfSource::ThreadClock;
+
+			Counter()
+			{
+#if PERF_GOBLIN_HAS_PERF_EVENT
+				if (counter == PerfCounter::TaskClock)
+				{
+					fd = _open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+					if (fd >= 0) source = PerfSource::PerfEvent;
+				}
+				else
+				{
+					fd = _open(PERF_TYPE_HARDWARE, (counter == PerfCounter::Cycles) ?
+						PERF_COUNT_HW_CPU_CYCLES : PERF_COUNT_HW_INSTRUCTIONS);
+					if (fd >= 0) source = PerfSource::PerfEvent;
+					else if (counter == PerfCounter::Cycles)
+					{
+						fd = _open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+						if (fd >= 0) source = PerfSource::TaskClock;
+					}
+				}
+#endif
+				if (fd < 0 && counter == PerfCounter::Instructions) source = PerfSource::None;
+			}
+			~Counter()
+			{
+#if PERF_GOBLIN_HAS_PERF_EVENT
+				if (fd >= 0) ::close(fd);
+#endif
+			}
+		};
+
+#if PERF_GOBLIN_HAS_PERF_EVENT
+		static int _open(uint32_t type, uint64_t config)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size           = sizeof(attr);
+			attr.type           = type;
+			attr.config         = config;
+			attr.exclude_kernel = 1; // Permitted with perf_event_paranoid <= 2.
+			attr.exclude_hv     = 1;
+			attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			return int(::syscall(__NR_perf_event_open, &attr, 0 /*this thread*/, -1 /*any cpu*/, -1, 0));
+		}
+#endif
+
+		static Counter &_counter()
+		{
+			static thread_local Counter c;
+			return c;
+		}
+
+		static double _nominal_cycle_seconds()
+		{
+			return Clock_TSC::available() ? Clock_TSC::seconds_per_tick() : 1e-9;
+		}
+
+		static double _thread_ns_per_tick()
+		{
+			return Clock_ThreadCPU::seconds_per_tick() * 1e9;
+		}
+
+		// Software fallbacks count nanoseconds; convert to this clock's ticks.
+		static tick_t _ns_to_ticks(double ns)
+		{
+			return (counter == PerfCounter::Cycles) ? tick_t(ns * 1e-9 / _nominal_cycle_seconds()) : tick_t(ns);
+		}
+	};
+
+	using Clock_TaskClock    = Clock_PerfEvent_<PerfCounter::TaskClock>;
+	using Clock_Cycles       = Clock_PerfEvent_<PerfCounter::Cycles>;
+	using Clock_Instructions = Clock_PerfEvent_<PerfCounter::Instructions>;
+
+	using ScopeTimer_TaskClock    = ScopeTimer_<Clock_TaskClock>;
+	using ScopeTimer_Cycles       = ScopeTimer_<Clock_Cycles>;
+	using ScopeTimer_Instructions = ScopeTimer_<Clock_Instructions>;
+}
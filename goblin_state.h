@@ -0,0 +1,418 @@
+#pragma once
+
+/*
+	Snapshots of a goblin's complete state, for warm restarts.
+
+	Profile JSON keeps only the "full" statistics of each estimate.  A snapshot
+		also keeps recent statistics, the anomaly, each setting's choice and
+		sampling state, and the goblin's config, so a goblin restored after a
+		level reload or hot restart resumes at steady state.
+
+	Snapshots are compact binary data holding estimates in their in-memory layout,
+		so (like ProfileView_ data) they are specific to one economy and platform.
+		Restoring refuses data written elsewhere, leaving the goblin unchanged.
+
+	Settings are matched by ID, so restore after adding the goblin's settings.
+*/
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "goblin.h"
+
+
+namespace perf_goblin
+{
+	namespace detail
+	{
+		struct GoblinStateHeader
+		{
+			static const uint32_t VERSION    = 5;
+			static const uint32_t ORDER_MARK = 0x01020304u;
+
+			char     magic[8];
+			uint32_t version;
+			uint32_t order_mark;
+			uint32_t estimate_size;
+			uint32_t scalar_size;
+			uint32_t config_size;
+			uint32_t reserved;
+			uint64_t total_size;
+
+			static const char *expected_magic()    {return "PGSTATE";}
+		};
+
+		// Bounds-checked reading of snapshot data.
+		struct StateReader
+		{
+			const char *p, *end;
+
+			bool read(void *out, size_t n)
+			{
+				if (size_t(end - p) < n) return false;
+				std::memcpy(out, p, n);
+				p += n;
+				return true;
+			}
+			template<typename T> bool get(T &out)    {return read(&out, sizeof(T));}
+
+			bool get_string(std::string &out)
+			{
+				uint32_t length;
+				if (!get(length) || size_t(end - p) < length) return false;
+				out.assign(p, length);
+				p += length;
+				return true;
+			}
+		};
+
+		struct StateWriter
+		{
+			std::string &out;
+
+			void write(const void *data, size_t n)    {out.append(static_cast<const char*>(data), n);}
+			template<typename T> void put(const T &v)    {write(&v, sizeof(T));}
+
+			void put_string(const std::string &s)    {put(uint32_t(s.length())); write(s.data(), s.length());}
+			void put_string(const char *s)           {uint32_t n = uint32_t(std::strlen(s)); put(n); write(s, n);}
+		};
+
+		/*
+			Structs with members of mixed sizes are written field by field,
+				so that their padding bytes (which are uninitialized) never reach the output.
+		*/
+		template<typename T_Config>
+		void put_config(StateWriter &w, const T_Config &config)
+		{
+			w.put(config.recent_alpha);
+			w.put(config.anomaly_alpha);
+			w.put(config.measure_quota);
+			w.put(config.explore_value);
+			w.put(config.sample_fraction);
+			w.put(config.ratio_shrinkage);
+		}
+		template<typename T_Config>
+		bool get_config(StateReader &r, T_Config &config)
+		{
+			return r.get(config.recent_alpha) && r.get(config.anomaly_alpha) && r.get(config.measure_quota) &&
+				r.get(config.explore_value) && r.get(config.sample_fraction) && r.get(config.ratio_shrinkage);
+		}
+
+		// Capacities with a margin in sigmas (see Economy_Normal_) pair a limit with a scalar.
+		template<typename T> auto put_capacity(StateWriter &w, const T &capacity, int) -> decltype(capacity.sigmas, void())
+			{w.put(capacity.limit); w.put(capacity.sigmas);}
+		template<typename T> void put_capacity(StateWriter &w, const T &capacity, long)    {w.put(capacity);}
+		template<typename T> void put_capacity(StateWriter &w, const T &capacity)          {put_capacity(w, capacity, 0);}
+
+		template<typename T> auto get_capacity(StateReader &r, T &capacity, int) -> decltype(capacity.sigmas, bool())
+			{return r.get(capacity.limit) && r.get(capacity.sigmas);}
+		template<typename T> bool get_capacity(StateReader &r, T &capacity, long)    {return r.get(capacity);}
+		template<typename T> bool get_capacity(StateReader &r, T &capacity)          {return get_capacity(r, capacity, 0);}
+	}
+
+
+	template<typename T_Economy>
+	class GoblinState_
+	{
+	public:
+		using Goblin_t       = Goblin_<T_Economy>;
+		using Setting_t      = typename Goblin_t::Setting_t;
+		using Profile_t      = typename Goblin_t::Profile_t;
+		using Config         = typename Goblin_t::Config;
+		using Anomaly        = typename Goblin_t::Anomaly;
+		using Task           = typename Profile_t::Task;
+		using Estimate       = typename Profile_t::Estimate;
+		using burden_stat_t  = typename Profile_t::burden_stat_t;
+		using scalar_t       = typename Goblin_t::scalar_t;
+		using burden_t       = typename Goblin_t::burden_t;
+		using choice_index_t = typename Goblin_t::choice_index_t;
+		using Group          = typename Goblin_t::Group;
+		using Header         = detail::GoblinStateHeader;
+
+		// Groups whose models are saved and restored with the goblin (see Goblin_::Group).
+		using Groups         = std::vector<Group*>;
+
+	public:
+		/*
+			Encode a goblin's state, replacing the contents of out.
+				A past profile backed by external data (such as a mapped file) may be
+				left out of the snapshot and passed to set_past_profile again after restoring.
+				The goblin doesn't own its groups, so pass any whose models should be kept.
+		*/
+		static void save(const Goblin_t &goblin, std::string &out, bool include_past = true, const Groups &groups = Groups())
+		{
+			out.assign(sizeof(Header), '\0');
+			detail::StateWriter w = {out};
+
+			detail::put_config(w, goblin.config);
+			w.put(goblin._anomaly.latest);
+			w.put(goblin._anomaly.recent);
+			w.put(goblin._group_typical);
+			w.put(goblin._group_current);
+			w.put(uint64_t(goblin._frame));
+
+			w.put(uint32_t(goblin._profile._recent_frame));
+			w.put(goblin._profile._recent_alpha);
+			_put_tasks(w, goblin._profile);
+
+			w.put(uint8_t(include_past));
+			if (include_past) _put_tasks(w, goblin._past);
+
+			w.put(uint32_t(goblin.settings.size()));
+			for (size_t k = 0; k < goblin._order.size(); ++k)
+			{
+				const Setting_t  *setting  = goblin._order[k];
+				const auto       &decision = *goblin._order_decisions[k];
+				w.put_string(setting->id());
+				w.put(uint32_t(decision.option_count));
+				w.put(uint32_t(decision.choice));
+				w.put(uint64_t(goblin._frame - setting->_sampled_frame));
+				w.put(uint8_t(setting->_wants_measurement));
+			}
+
+			w.put(uint32_t(groups.size()));
+			for (const Group *group : groups)
+			{
+				auto &model = group->model();
+				w.put(uint32_t(model._members.size()));
+				for (auto &member : model._members)
+				{
+					w.put_string(member.id);
+					w.put(uint32_t(member.option_count));
+				}
+				w.put(uint8_t(!model._theta.empty()));
+				if (!model._theta.empty())
+				{
+					w.write(model._theta.data(), model._theta.size() * sizeof(double));
+					w.write(model._cov  .data(), model._cov  .size() * sizeof(double));
+				}
+			}
+
+			Header head = {};
+			std::memcpy(head.magic, Header::expected_magic(), 8);
+			head.version       = Header::VERSION;
+			head.order_mark    = Header::ORDER_MARK;
+			head.estimate_size = uint32_t(sizeof(Estimate));
+			head.scalar_size   = uint32_t(sizeof(scalar_t));
+			head.config_size   = uint32_t(sizeof(Config));
+			head.total_size    = out.size();
+			std::memcpy(&out[0], &head, sizeof(head));
+		}
+
+		/*
+			Restore a goblin's state from a snapshot.  Returns false if the data is invalid,
+				or from another economy or platform; the goblin is unchanged in that case.
+				Settings present in the snapshot with the same option count resume their choices,
+				and groups with the same members (by ID and option count) resume their models.
+				The past profile is kept if the snapshot doesn't include one.
+		*/
+		static bool restore(Goblin_t &goblin, const void *data, size_t size, const Groups &groups = Groups())
+		{
+			Header head;
+			detail::StateReader r = {static_cast<const char*>(data), static_cast<const char*>(data) + size};
+			if (!r.get(head)) return false;
+			if (std::memcmp(head.magic, Header::expected_magic(), 8) != 0 ||
+				head.version       != Header::VERSION ||
+				head.order_mark    != Header::ORDER_MARK ||
+				head.estimate_size != sizeof(Estimate) ||
+				head.scalar_size   != sizeof(scalar_t) ||
+				head.config_size   != sizeof(Config) ||
+				head.total_size    != size) return false;
+
+			// Decode everything before changing the goblin.
+			Config   config;
+			Anomaly  anomaly;
+			burden_t group_typical, group_current;
+			uint64_t frame;
+			uint32_t recent_frame;
+			scalar_t recent_alpha;
+			uint8_t  has_past;
+			Profile_t present, past;
+			if (!detail::get_config(r, config) || !r.get(anomaly.latest) || !r.get(anomaly.recent) ||
+				!r.get(group_typical) || !r.get(group_current) || !r.get(frame) ||
+				!r.get(recent_frame) || !r.get(recent_alpha)) return false;
+			present._recent_frame = recent_frame; // Decay and eviction stamps are relative to this frame.
+			present._recent_alpha = recent_alpha;
+			if (!_get_tasks(r, present) || !r.get(has_past) || (has_past && !_get_tasks(r, past))) return false;
+
+			struct SettingState
+			{
+				uint32_t option_count, choice;
+				uint64_t sample_age;
+				uint8_t  wants_measurement;
+			};
+			detail::FlatMap<std::string, SettingState> setting_states;
+			uint32_t setting_count;
+			if (!r.get(setting_count)) return false;
+			for (uint32_t i = 0; i < setting_count; ++i)
+			{
+				std::string id;
+				SettingState state;
+				if (!r.get_string(id) || !r.get(state.option_count) || !r.get(state.choice) ||
+					!r.get(state.sample_age) || !r.get(state.wants_measurement)) return false;
+				if (state.choice >= state.option_count) return false;
+				setting_states.emplace(std::move(id), state);
+			}
+
+			struct GroupState
+			{
+				std::vector<std::pair<std::string, uint32_t>> members; // ID and option count.
+				std::vector<double> theta, cov;
+			};
+			std::vector<GroupState> group_states;
+			uint32_t group_count;
+			if (!r.get(group_count)) return false;
+			for (uint32_t g = 0; g < group_count; ++g)
+			{
+				GroupState state;
+				uint32_t member_count;
+				uint8_t  has_model;
+				size_t   dim = 0;
+				if (!r.get(member_count) || size_t(r.end - r.p) / (2*sizeof(uint32_t)) < member_count) return false;
+				state.members.resize(member_count);
+				for (auto &member : state.members)
+				{
+					if (!r.get_string(member.first) || !r.get(member.second) || member.second == 0) return false;
+					dim += member.second;
+				}
+				if (!r.get(has_model)) return false;
+				if (has_model)
+				{
+					size_t doubles = size_t(r.end - r.p) / sizeof(double);
+					if (dim > doubles || dim * dim > doubles - dim) return false;
+					state.theta.resize(dim);
+					state.cov  .resize(dim * dim);
+					r.read(state.theta.data(), dim * sizeof(double));
+					r.read(state.cov  .data(), dim * dim * sizeof(double));
+				}
+				group_states.push_back(std::move(state));
+			}
+			if (r.p != r.end) return false;
+
+			// Commit.
+			goblin.config         = config;
+			goblin._anomaly       = anomaly;
+			goblin._group_typical = group_typical;
+			goblin._group_current = group_current;
+			goblin._frame         = size_t(frame);
+
+			// The memory limit and observer configure the goblin's profile; they aren't part of the snapshot.
+			present.set_memory_limit(goblin._profile.memory_limit());
+			present.set_observer    (goblin._profile.observer());
+			goblin._profile = std::move(present);
+			if (has_past) goblin.set_past_profile(past);
+			else          goblin.ratio_recount();
+
+			for (size_t k = 0; k < goblin._order.size(); ++k)
+			{
+				Setting_t *setting  = goblin._order[k];
+				auto      &decision = *goblin._order_decisions[k];
+				auto i = setting_states.find(setting->id());
+				if (i == setting_states.end() || i->second.option_count != setting->options().option_count) continue;
+				const SettingState &state = i->second;
+				decision.option_count       = choice_index_t(state.option_count);
+				decision.choice             = choice_index_t(state.choice);
+				setting->_sampled_frame     = goblin._frame - size_t(std::min<uint64_t>(state.sample_age, frame));
+				setting->_wants_measurement = (state.wants_measurement != 0);
+				setting->choice_set(decision.choice, 0);
+			}
+
+			for (Group *group : groups)
+			{
+				auto &model = group->model();
+				for (auto &state : group_states)
+				{
+					if (state.members.size() != model._members.size()) continue;
+					bool same = true;
+					for (size_t m = 0; same && m < state.members.size(); ++m)
+						same = (state.members[m].first == model._members[m].id && state.members[m].second == model._members[m].option_count);
+					if (!same) continue;
+					model._theta = state.theta;
+					model._cov   = state.cov;
+					break;
+				}
+			}
+			return true;
+		}
+		static bool restore(Goblin_t &goblin, const std::string &data, const Groups &groups = Groups())
+			{return restore(goblin, data.data(), data.size(), groups);}
+
+	private:
+		template<typename T_Profile>
+		static void _put_tasks(detail::StateWriter &w, const T_Profile &profile)
+		{
+			uint32_t task_count = 0;
+			for (auto &&entry : profile) {(void) entry; ++task_count;}
+			w.put(task_count);
+			for (auto &&entry : profile)
+			{
+				const Task &task = *entry.second;
+				w.put_string(entry.first);
+				w.put(uint32_t(task.count));
+				w.put(uint32_t(task.resource));
+				w.put(task.collected);
+				w.put(task.present);
+				w.put(task.interval);
+				for (auto &estimate : task) _put_estimate(w, estimate);
+			}
+		}
+
+		static bool _get_tasks(detail::StateReader &r, Profile_t &profile)
+		{
+			uint32_t task_count;
+			if (!r.get(task_count)) return false;
+			std::string id;
+			for (uint32_t t = 0; t < task_count; ++t)
+			{
+				uint32_t count, resource;
+				uint32_t collected, present;
+				scalar_t interval;
+				if (!r.get_string(id) || !r.get(count) || !r.get(resource) || !r.get(collected) || !r.get(present) || !r.get(interval)) return false;
+				if (!(interval >= 1)) return false;
+				if (count == 0 || count > uint32_t(typename Profile_t::choice_index_t(~0u))) return false;
+				if (size_t(r.end - r.p) / ESTIMATE_BYTES < count) return false;
+				bool created;
+				Task &task = profile.task_init(id, choice_index_t(count), &created);
+				if (!created) return false;
+				task.resource  = typename Profile_t::resource_t(resource);
+				task.collected = collected;
+				task.present   = present;
+				task.interval  = interval;
+				for (auto &estimate : task) _get_estimate(r, estimate);
+			}
+			return true;
+		}
+
+		// Estimates are written field by field; a statistic's sums share one type, so it has no padding.
+		static const size_t ESTIMATE_BYTES = 2 * sizeof(burden_stat_t) + sizeof(uint32_t)
+#if PERF_GOBLIN_HISTOGRAMS
+			+ (Profile_t::histogram_t::BUCKETS + 1) * sizeof(typename Profile_t::histogram_t::count_t)
+#endif
+			;
+
+		static void _put_estimate(detail::StateWriter &w, const Estimate &estimate)
+		{
+			w.put(estimate.full);
+			w.put(estimate.recent);
+			w.put(estimate.recent_frame);
+#if PERF_GOBLIN_HISTOGRAMS
+			w.put(estimate.histogram.counts);
+			w.put(estimate.histogram.unit);
+#endif
+		}
+		static void _get_estimate(detail::StateReader &r, Estimate &estimate)
+		{
+			r.get(estimate.full);
+			r.get(estimate.recent);
+			r.get(estimate.recent_frame);
+#if PERF_GOBLIN_HISTOGRAMS
+			r.get(estimate.histogram.counts);
+			r.get(estimate.histogram.unit);
+#endif
+		}
+	};
+
+	using GoblinState = GoblinState_<Economy_f>;
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+/*
+	Scope timers which measure burdens for settings.
+		A timer is constructed at the start of some work and destroyed at the end.
+		The elapsed time is recorded as a measurement of the setting's current choice.
+
+	Timers may be nested.  Time spent in an inner timer is excluded from the outer one,
+		so each setting is only burdened with its own work.
+		The cost of reading the clock is estimated once and subtracted from each measurement.
+
+	Clocks are calibrated on first use, which may block (Clock_TSC takes 20ms).  Call
+		ScopeTimer_::calibrate() during setup to keep this out of measured frames.  Otherwise the
+		first timer calibrates before it starts, excluding the time from enclosing timers.
+
+	Timers skip settings which don't want a measurement this frame (see Setting_::wants_measurement).
+		Outside of any other timer, a skipped timer doesn't read the clock at all.
+
+	Several clocks are available:
+		Clock_Steady    -- std::chrono::steady_clock (wall time).
+		Clock_ThreadCPU -- CPU time consumed by the calling thread.
+		Clock_TSC       -- calibrated timestamp counter, where invariant TSC is available.
+*/
+
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#define PERF_GOBLIN_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#include <cpuid.h>
+	#define PERF_GOBLIN_HAS_TSC 1
+#else
+	#define PERF_GOBLIN_HAS_TSC 0
+#endif
+
+
+namespace perf_goblin
+{
+	/*
+		Clocks provide a tick count and the duration of one tick.
+			Ticks are only compared on the thread which read them.
+			A reading of ~tick_t(0) means the clock failed, and timers spanning it record nothing.
+	*/
+	struct Clock_Steady
+	{
+		using tick_t = uint64_t;
+
+		static tick_t now()                 {return tick_t(std::chrono::steady_clock::now().time_since_epoch().count());}
+		static double seconds_per_tick()    {return double(std::chrono::steady_clock::period::num) / std::chrono::steady_clock::period::den;}
+		static bool   available()           {return true;}
+	};
+
+	struct Clock_TSC
+	{
+		using tick_t = uint64_t;
+
+		static tick_t now()
+		{
+#if PERF_GOBLIN_HAS_TSC
+			if (available()) return tick_t(__rdtsc());
+#endif
+			return Clock_Steady::now();
+		}
+
+		static double seconds_per_tick()
+		{
+			static const double period = calibrate();
+			return period;
+		}
+
+		// The TSC is only used if it ticks at a constant rate across cores and power states.
+		static bool available()
+		{
+			static const bool invariant = invariant_tsc();
+			return invariant;
+		}
+
+		// Measure the TSC against steady_clock, blocking for the given span.
+		//   seconds_per_tick calibrates on first use (see ScopeTimer_::calibrate).
+		static double calibrate(std::chrono::microseconds span = std::chrono::microseconds(20000))
+		{
+			if (!available()) return Clock_Steady::seconds_per_tick();
+			auto   t0 = std::chrono::steady_clock::now();
+			tick_t c0 = now();
+			auto   t1 = t0;
+			while (t1 - t0 < span) t1 = std::chrono::steady_clock::now();
+			tick_t c1 = now();
+			return std::chrono::duration<double>(t1 - t0).count() / double(std::max<tick_t>(c1 - c0, 1));
+		}
+
+	private:
+		static bool invariant_tsc()
+		{
+#if PERF_GOBLIN_HAS_TSC && defined(_MSC_VER)
+			int regs[4] = {};
+			__cpuid(regs, 0x80000000);
+			if (unsigned(regs[0]) < 0x80000007u) return false;
+			__cpuid(regs, 0x80000007);
+			return (regs[3] & (1 << 8)) != 0;
+#elif PERF_GOBLIN_HAS_TSC
+			unsigned a, b, c, d;
+			if (__get_cpuid_max(0x80000000u, nullptr) < 0x80000007u) return false;
+			if (!__get_cpuid(0x80000007u, &a, &b, &c, &d)) return false;
+			return (d & (1u << 8)) != 0;
+#else
+			return false;
+#endif
+		}
+	};
+
+	struct Clock_ThreadCPU
+	{
+		using tick_t = uint64_t;
+
+#if defined(_WIN32)
+		// Windows counts thread time in TSC cycles.
+		static tick_t now()
+		{
+			ULONG64 c = 0;
+			if (!QueryThreadCycleTime(GetCurrentThread(), &c)) return ~tick_t(0);
+			return tick_t(c);
+		}
+		static double seconds_per_tick()    {return Clock_TSC::seconds_per_tick();}
+		static bool   available()           {return true;}
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+		static tick_t now()
+		{
+			timespec ts;
+			if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return ~tick_t(0);
+			return tick_t(ts.tv_sec) * 1000000000u + tick_t(ts.tv_nsec);
+		}
+		static double seconds_per_tick()    {return 1e-9;}
+		static bool   available()           {return true;}
+#else
+		// No per-thread clock; fall back to wall time.
+		static tick_t now()                 {return Clock_Steady::now();}
+		static double seconds_per_tick()    {return Clock_Steady::seconds_per_tick();}
+		static bool   available()           {return false;}
+#endif
+	};
+
+
+	/*
+		Times a scope and records the elapsed burden into a setting.
+			The setting must provide choice_current() and measurement_add(burden),
+			as Setting_Array_ does.  Timers must be destroyed in reverse order of
+			construction, on the thread which constructed them.
+
+		burden_per_second sets the unit of recorded burdens (default: milliseconds).
+	*/
+	template<typename T_Clock = Clock_Steady>
+	class ScopeTimer_
+	{
+	public:
+		using clock_t = T_Clock;
+		using tick_t  = typename clock_t::tick_t;
+
+	public:
+		// Time a scope without recording it anywhere (excludes it from enclosing timers).
+		ScopeTimer_()    {_calibrate_outside(); _start();}
+
+		template<typename T_Setting>
+		explicit ScopeTimer_(T_Setting &setting, double burden_per_second = 1000.0) :
+			_target(&setting),
+			_record(&_record_to<T_Setting>)
+		{
+			if (!setting.wants_measurement())
+			{
+				_record = nullptr;
+				if (!_top) {_stopped = true; return;}
+			}
+			_calibrate_outside();
+			_burden_per_tick = burden_per_second * clock_t::seconds_per_tick();
+			_start();
+		}
+
+		~ScopeTimer_()    {stop();}
+
+		/*
+			Stop the timer early and record its burden.  Returns the exclusive ticks measured.
+		*/
+		tick_t stop()
+		{
+			if (_stopped) return _self;
+			tick_t end = clock_t::now();
+			_stopped = true;
+			_top = _parent;
+
+			// If the clock failed, neither this timer nor its parent knows its own time.
+			if (_dropped || _failed(_begin) || _failed(end))
+			{
+				_self = 0;
+				if (_parent) _parent->_dropped = true;
+				return _self;
+			}
+
+			// Clocks which estimate (such as multiplexed counters) may step back slightly.
+			tick_t total = (end > _begin) ? (end - _begin) : 0, cost = _nested + overhead();
+			_self = (total > cost) ? (total - cost) : 0;
+
+			if (_parent) _parent->_nested += total + overhead();
+			if (_record) _record(_target, double(_self) * _burden_per_tick);
+			return _self;
+		}
+
+		/*
+			Calibrate the clock's period and the cost of reading it, if not done already.
+		*/
+		static void calibrate()
+		{
+			if (_calibrated.load(std::memory_order_acquire)) return;
+			clock_t::seconds_per_tick();
+			overhead();
+			_calibrated.store(true, std::memory_order_release);
+		}
+
+		/*
+			Cost of one clock read in ticks, measured on first use.
+				This is subtracted from every measurement.
+		*/
+		static tick_t overhead()
+		{
+			static const tick_t cost = calibrate_overhead();
+			return cost;
+		}
+
+		static tick_t calibrate_overhead(unsigned samples = 1000)
+		{
+			tick_t best = ~tick_t(0);
+			for (unsigned i = 0; i < samples; ++i)
+			{
+				tick_t a = clock_t::now(), b = clock_t::now();
+				if (!_failed(a) && !_failed(b) && b >= a && b - a < best) best = b - a;
+			}
+			return (best == ~tick_t(0)) ? 0 : best;
+		}
+
+	private:
+		// Calibrate if needed, excluding the time from any enclosing timer.
+		void _calibrate_outside()
+		{
+			if (_calibrated.load(std::memory_order_acquire)) return;
+			tick_t begin = clock_t::now();
+			calibrate();
+			tick_t end = clock_t::now();
+			if (_top && !_failed(begin) && !_failed(end) && end > begin) _top->_nested += end - begin;
+		}
+
+		static bool _failed(tick_t reading)    {return reading == ~tick_t(0);}
+
+		void _start()
+		{
+			_parent = _top;
+			_top    = this;
+			_begin  = clock_t::now();
+		}
+
+		template<typename T_Setting>
+		static void _record_to(void *target, double burden)
+		{
+			auto &setting = *static_cast<T_Setting*>(target);
+			setting.measurement_add(typename T_Setting::burden_t(burden));
+		}
+
+		// No copying
+		ScopeTimer_(const ScopeTimer_ &o) = delete;
+		void operator=(const ScopeTimer_ &o) = delete;
+
+	private:
+		void        *_target = nullptr;
+		void       (*_record)(void*, double) = nullptr;
+		double       _burden_per_tick = 0;
+		ScopeTimer_ *_parent  = nullptr;
+		tick_t       _begin   = 0;
+		tick_t       _nested  = 0;
+		tick_t       _self    = 0;
+		bool         _stopped = false;
+		bool         _dropped = false; // A nested timer's clock failed.
+
+		// Innermost running timer on this thread.
+		static thread_local ScopeTimer_ *_top;
+
+		static std::atomic<bool> _calibrated;
+	};
+
+	template<typename T_Clock>
+	thread_local ScopeTimer_<T_Clock> *ScopeTimer_<T_Clock>::_top = nullptr;
+
+	template<typename T_Clock>
+	std::atomic<bool> ScopeTimer_<T_Clock>::_calibrated(false);
+
+	using ScopeTimer           = ScopeTimer_<Clock_Steady>;
+	using ScopeTimer_ThreadCPU = ScopeTimer_<Clock_ThreadCPU>;
+	using ScopeTimer_TSC       = ScopeTimer_<Clock_TSC>;
+}
@@ -0,0 +1,533 @@
+#pragma once
+
+/*
+	Recording and offline replay of a goblin's inputs, for tuning against real load.
+
+	A GoblinTraceRecorder_ observes a goblin (see Goblin_::Observer) and appends
+		each frame's inputs and decisions to a compact binary trace:
+			- settings' IDs, resource classes, default choices and option values,
+			  written when first seen and again whenever they change;
+			- the list of settings controlled by the goblin, when it changes;
+			- each measurement harvested, the capacity and precision, and the choices made.
+
+	A GoblinTraceReplay_ feeds a trace into a fresh goblin.  When the goblin makes the
+		recorded choice, the recorded measurement is replayed.  When it chooses otherwise,
+		a burden is drawn from a normal distribution fitted to all of the trace's
+		measurements of that option, or skipped if the trace never measured it.
+
+	Like goblin snapshots, traces hold burdens and values in their in-memory layout,
+		so they are specific to one economy and platform.
+		Records are self-contained, so a trace may be written out in pieces (see take)
+		and a trace cut short by a crash replays up to its last complete record.
+*/
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "goblin.h"
+#include "goblin_state.h"
+
+
+namespace perf_goblin
+{
+	namespace detail
+	{
+		struct GoblinTraceHeader
+		{
+			static const uint32_t VERSION    = 2;
+			static const uint32_t ORDER_MARK = 0x01020304u;
+
+			char     magic[8];
+			uint32_t version;
+			uint32_t order_mark;
+			uint32_t burden_size;
+			uint32_t value_size;
+			uint32_t capacity_size;
+			uint32_t config_size;
+
+			static const char *expected_magic()    {return "PGTRACE";}
+		};
+
+		// Record tags.
+		enum GoblinTraceRecord : uint8_t
+		{
+			TRACE_SETTING = 'S', // index, id, resource, default choice, option values
+			TRACE_ROSTER  = 'R', // indices of settings controlled by the goblin, in order
+			TRACE_FRAME   = 'F', // capacity, precision, measurements, choices
+		};
+	}
+
+
+	template<typename T_Economy>
+	class GoblinTraceRecorder_ : public Goblin_<T_Economy>::Observer
+	{
+	public:
+		using Goblin_t       = Goblin_<T_Economy>;
+		using Setting_t      = typename Goblin_t::Setting_t;
+		using Config         = typename Goblin_t::Config;
+		using Measurement    = typename Goblin_t::Profile_t::Measurement;
+		using burden_t       = typename Goblin_t::burden_t;
+		using value_t        = typename Goblin_t::value_t;
+		using capacity_t     = typename Goblin_t::capacity_t;
+		using choice_index_t = typename Goblin_t::choice_index_t;
+		using Header         = detail::GoblinTraceHeader;
+
+	public:
+		/*
+			Start recording a goblin, beginning with its current config.
+				The goblin must outlive the recorder, or be given another observer first.
+		*/
+		explicit GoblinTraceRecorder_(Goblin_t &goblin) :
+			_goblin(goblin)
+		{
+			Header head = {};
+			std::memcpy(head.magic, Header::expected_magic(), 8);
+			head.version       = Header::VERSION;
+			head.order_mark    = Header::ORDER_MARK;
+			head.burden_size   = uint32_t(sizeof(burden_t));
+			head.value_size    = uint32_t(sizeof(value_t));
+			head.capacity_size = uint32_t(sizeof(capacity_t));
+			head.config_size   = uint32_t(sizeof(Config));
+			_w.put(head);
+			detail::put_config(_w, goblin.config);
+			goblin.set_observer(this);
+		}
+		~GoblinTraceRecorder_()
+		{
+			if (_goblin.observer() == this) _goblin.set_observer(nullptr);
+		}
+
+		/*
+			Trace data recorded so far.
+				take() moves it out (eg, to append to a file) and continues with an empty buffer.
+		*/
+		const std::string &data() const    {return _data;}
+		void take(std::string &out)        {out.swap(_data); _data.clear();}
+
+		size_t frames() const    {return _frames;}
+
+		void harvested(const Setting_t &setting, const Measurement &measure) override
+		{
+			if (measure.choice >= setting.options().option_count) return;
+			Pending pending = {_index(setting), measure.choice, measure.burden};
+			_pending.push_back(pending);
+		}
+
+		void decided(capacity_t capacity, size_t precision) override
+		{
+			const auto &order = _goblin.settings_in_order();
+
+			_roster.clear();
+			for (Setting_t *setting : order) _roster.push_back(_index(*setting));
+			if (_roster != _last_roster)
+			{
+				_w.put(uint8_t(detail::TRACE_ROSTER));
+				_w.put(uint32_t(_roster.size()));
+				for (uint32_t index : _roster) _w.put(index);
+				_last_roster = _roster;
+			}
+
+			_w.put(uint8_t(detail::TRACE_FRAME));
+			detail::put_capacity(_w, capacity);
+			_w.put(uint32_t(precision));
+			_w.put(uint32_t(_pending.size()));
+			for (const Pending &p : _pending) {_w.put(p.index); _w.put(p.choice); _w.put(p.burden);}
+			for (Setting_t *setting : order) _w.put(choice_index_t(_goblin.get_decision(setting)->choice));
+			_pending.clear();
+			++_frames;
+		}
+
+	private:
+		struct Known
+		{
+			bool                 defined = false;
+			std::string          id;
+			uint32_t             resource;
+			choice_index_t       choice_default;
+			std::vector<value_t> values;
+		};
+		struct Pending
+		{
+			uint32_t       index;
+			choice_index_t choice;
+			burden_t       burden;
+		};
+
+		// Index of a setting in the trace, (re)defining it if it's new or changed.
+		uint32_t _index(const Setting_t &setting)
+		{
+			auto found = _indices.find(&setting);
+			uint32_t index;
+			if (found == _indices.end())
+			{
+				index = uint32_t(_known.size());
+				_indices.emplace(&setting, index);
+				_known.emplace_back();
+			}
+			else index = found->second;
+
+			Known &known = _known[index];
+			const auto &options = setting.options();
+			bool same = (known.id == setting.id() &&
+				known.resource == uint32_t(setting.resource_class()) &&
+				known.choice_default == setting.choice_default() &&
+				known.values.size() == options.option_count);
+			for (size_t i = 0; same && i < known.values.size(); ++i) same = (known.values[i] == options.options[i].value);
+			if (same && known.defined) return index;
+
+			known.defined        = true;
+			known.id             = setting.id();
+			known.resource       = uint32_t(setting.resource_class());
+			known.choice_default = setting.choice_default();
+			known.values.clear();
+			for (auto &option : options) known.values.push_back(option.value);
+
+			_w.put(uint8_t(detail::TRACE_SETTING));
+			_w.put(index);
+			_w.put_string(known.id);
+			_w.put(known.resource);
+			_w.put(known.choice_default);
+			_w.put(choice_index_t(known.values.size()));
+			for (value_t value : known.values) _w.put(value);
+			return index;
+		}
+
+		// No copying
+		GoblinTraceRecorder_(const GoblinTraceRecorder_ &o) = delete;
+		void operator=(const GoblinTraceRecorder_ &o) = delete;
+
+	private:
+		Goblin_t                                       &_goblin;
+		std::string                                     _data;
+		detail::StateWriter                             _w = {_data};
+		detail::FlatMap<const Setting_t*, uint32_t>     _indices;
+		std::vector<Known>                              _known;
+		std::vector<Pending>                            _pending;
+		std::vector<uint32_t>                           _roster, _last_roster;
+		size_t                                          _frames = 0;
+	};
+
+
+	template<typename T_Economy>
+	class GoblinTraceReplay_
+	{
+	public:
+		using economy_t      = T_Economy;
+		using Goblin_t       = Goblin_<economy_t>;
+		using Setting_t      = typename Goblin_t::Setting_t;
+		using Config         = typename Goblin_t::Config;
+		using Profile_t      = typename Goblin_t::Profile_t;
+		using Measurement    = typename Profile_t::Measurement;
+		using burden_t       = typename Goblin_t::burden_t;
+		using burden_stat_t  = typename Goblin_t::burden_stat_t;
+		using value_t        = typename Goblin_t::value_t;
+		using capacity_t     = typename Goblin_t::capacity_t;
+		using choice_index_t = typename Goblin_t::choice_index_t;
+		using resource_t     = typename Goblin_t::resource_t;
+		using Header         = detail::GoblinTraceHeader;
+
+		static const choice_index_t NO_CHOICE = Goblin_t::NO_CHOICE;
+
+		struct Stats
+		{
+			size_t  frames       = 0;
+			size_t  decisions    = 0; // Settings decided, summed over frames.
+			size_t  agreements   = 0; // Decisions matching the recording.
+			size_t  measurements = 0; // Recorded measurements replayed as-is.
+			size_t  simulated    = 0; // Measurements drawn for choices that differ from the recording.
+			size_t  unsimulated  = 0; // Measurements skipped; the trace never measured the choice.
+			size_t  overruns     = 0; // Frames whose replayed burdens exceed the capacity limit.
+			value_t value = 0, recorded_value = 0; // Total value of choices made, and of those recorded.
+		};
+
+	public:
+		/*
+			Read a trace.  Returns false if its header is invalid, or from another economy or platform.
+				Records after one which is cut short or corrupt are ignored.
+		*/
+		bool load(const void *data, size_t size)
+		{
+			_data.assign(static_cast<const char*>(data), size);
+			_begin = _end = 0;
+			_settings.clear();
+			_dists.clear();
+			_frames = 0;
+
+			Header head;
+			detail::StateReader r = {_data.data(), _data.data() + _data.size()};
+			if (!r.get(head) || !detail::get_config(r, _config)) return false;
+			if (std::memcmp(head.magic, Header::expected_magic(), 8) != 0 ||
+				head.version       != Header::VERSION ||
+				head.order_mark    != Header::ORDER_MARK ||
+				head.burden_size   != sizeof(burden_t) ||
+				head.value_size    != sizeof(value_t) ||
+				head.capacity_size != sizeof(capacity_t) ||
+				head.config_size   != sizeof(Config)) return false;
+			_begin = _end = size_t(r.p - _data.data());
+
+			// Check each record and fit per-option distributions to the measurements.
+			//   Replay stops before the first record which is incomplete or invalid.
+			Frame frame;
+			while (r.p != r.end)
+			{
+				uint8_t tag;
+				bool ok = r.get(tag);
+				if (ok) switch (tag)
+				{
+				case detail::TRACE_SETTING:
+					{
+						uint32_t index;
+						ok = _read_setting(r, index);
+						if (!ok) break;
+						_dists.resize(_settings.size());
+						_dists[index].resize(std::max(_dists[index].size(), _settings[index]->values.size()));
+					}
+					break;
+				case detail::TRACE_ROSTER:
+					ok = _read_roster(r, frame.roster);
+					break;
+				case detail::TRACE_FRAME:
+					ok = _read_frame(r, frame);
+					if (!ok) break;
+					for (const Pending &p : frame.pending) _dists[p.index][p.choice].push(p.burden);
+					++_frames;
+					break;
+				default:
+					ok = false;
+					break;
+				}
+				if (!ok) break;
+				_end = size_t(r.p - _data.data());
+			}
+			return true;
+		}
+		bool load(const std::string &data)    {return load(data.data(), data.size());}
+
+		size_t        frames() const    {return _frames;}
+		const Config &config() const    {return _config;}
+
+		/*
+			Replay the trace into a goblin which controls no settings, and report how it fared.
+				The goblin takes the recorded config unless use_config is false.
+				Precision overrides the recorded precision if nonzero.
+				Settings are removed from the goblin when the replay finishes.
+		*/
+		Stats run(Goblin_t &goblin, uint32_t seed = 1, bool use_config = true, size_t precision = 0)
+		{
+			Stats stats;
+			if (!_frames) return stats;
+			if (use_config) goblin.config = _config;
+
+			std::mt19937 rng(seed);
+			std::vector<std::unique_ptr<ReplaySetting>> replay;
+			std::vector<uint32_t> active;
+
+			detail::StateReader r = {_data.data() + _begin, _data.data() + _end};
+			Frame frame;
+			while (r.p != r.end)
+			{
+				uint8_t tag;
+				r.get(tag);
+				switch (tag)
+				{
+				case detail::TRACE_SETTING:
+					{
+						uint32_t index;
+						_read_setting(r, index);
+						while (replay.size() <= index) replay.emplace_back(new ReplaySetting());
+						replay[index]->define(*_settings[index]);
+					}
+					break;
+
+				case detail::TRACE_ROSTER:
+					{
+						_read_roster(r, frame.roster);
+						for (uint32_t index : active)
+							if (std::find(frame.roster.begin(), frame.roster.end(), index) == frame.roster.end())
+								goblin.remove(replay[index].get());
+						for (uint32_t index : frame.roster) goblin.add(replay[index].get());
+						active = frame.roster;
+					}
+					break;
+
+				case detail::TRACE_FRAME:
+					{
+						_read_frame(r, frame);
+
+						// Replay or simulate each measurement for the goblin's current choice.
+						burden_t net_burden = economy_t::zero();
+						for (const Pending &p : frame.pending)
+						{
+							ReplaySetting &setting = *replay[p.index];
+							Measurement m;
+							m.choice = (setting.choice == NO_CHOICE) ? p.choice : setting.choice;
+							if (m.choice == p.choice)
+							{
+								m.burden = p.burden;
+								++stats.measurements;
+							}
+							else if (p.index < _dists.size() && m.choice < _dists[p.index].size() && _dists[p.index][m.choice])
+							{
+								const burden_stat_t &dist = _dists[p.index][m.choice];
+								double burden = std::normal_distribution<double>(double(dist.mean()), double(dist.deviation()))(rng);
+								m.burden = burden_t(std::max(burden, 0.0));
+								++stats.simulated;
+							}
+							else
+							{
+								++stats.unsimulated;
+								continue;
+							}
+							net_burden += m.burden;
+							setting.measurements.push_back(m);
+						}
+						if (!economy_t::acceptable(net_burden, frame.capacity.limit)) ++stats.overruns;
+
+						goblin.update(frame.capacity, precision ? precision : frame.precision);
+
+						for (size_t i = 0; i < frame.roster.size(); ++i)
+						{
+							ReplaySetting &setting = *replay[frame.roster[i]];
+							if (setting.choice < setting.values.size())
+								stats.value += setting.values[setting.choice];
+							if (frame.choices[i] < setting.values.size())
+								stats.recorded_value += setting.values[frame.choices[i]];
+							stats.agreements += (setting.choice == frame.choices[i]);
+						}
+						stats.decisions += frame.roster.size();
+						++stats.frames;
+					}
+					break;
+				}
+			}
+
+			for (uint32_t index : active) goblin.remove(replay[index].get());
+			return stats;
+		}
+
+	private:
+		struct Definition
+		{
+			std::string          id;
+			resource_t           resource;
+			choice_index_t       choice_default;
+			std::vector<value_t> values;
+		};
+		struct Pending
+		{
+			uint32_t       index;
+			choice_index_t choice;
+			burden_t       burden;
+		};
+		struct Frame
+		{
+			capacity_t                  capacity;
+			uint32_t                    precision;
+			std::vector<Pending>        pending;
+			std::vector<uint32_t>       roster;
+			std::vector<choice_index_t> choices;
+		};
+
+		// A setting controlled by the replaying goblin.
+		class ReplaySetting : public Setting_t
+		{
+		public:
+			using typename Setting_t::Option;
+			using typename Setting_t::Options;
+			using typename Setting_t::strategy_index_t;
+
+			std::string              _id;
+			resource_t               resource = 0;
+			choice_index_t           _default = 0;
+			choice_index_t           choice   = NO_CHOICE;
+			std::vector<value_t>     values;
+			std::vector<Option>      option_store;
+			Options                  _options = {nullptr, 0};
+			std::vector<Measurement> measurements;
+
+			void define(const Definition &def)
+			{
+				_id = def.id;
+				resource = def.resource;
+				_default = def.choice_default;
+				values   = def.values;
+				option_store.clear();
+				for (value_t value : values) option_store.push_back(Option{value});
+				_options.options      = option_store.data();
+				_options.option_count = choice_index_t(option_store.size());
+				if (choice != NO_CHOICE && choice >= _options.option_count) choice = NO_CHOICE;
+			}
+
+			const Options     &options()        const override    {return _options;}
+			const std::string &id()             const override    {return _id;}
+			resource_t         resource_class() const override    {return resource;}
+			choice_index_t     choice_default() const override    {return _default;}
+
+			Measurement measurement() override
+			{
+				if (measurements.empty()) return Measurement();
+				Measurement m = measurements.front();
+				measurements.erase(measurements.begin());
+				return m;
+			}
+			void choice_set(choice_index_t c, strategy_index_t) override    {choice = c;}
+		};
+
+		bool _read_setting(detail::StateReader &r, uint32_t &index)
+		{
+			Definition def;
+			uint32_t resource;
+			choice_index_t count;
+			if (!r.get(index) || index > _settings.size() || !r.get_string(def.id) ||
+				!r.get(resource) || !r.get(def.choice_default) || !r.get(count)) return false;
+			if (resource >= Profile_t::RESOURCE_CLASSES || size_t(r.end - r.p) / sizeof(value_t) < count) return false;
+			def.resource = resource_t(resource);
+			def.values.resize(count);
+			for (value_t &value : def.values) r.get(value);
+			if (index == _settings.size()) _settings.emplace_back(new Definition(std::move(def)));
+			else *_settings[index] = std::move(def);
+			return true;
+		}
+
+		bool _read_roster(detail::StateReader &r, std::vector<uint32_t> &roster)
+		{
+			uint32_t count;
+			if (!r.get(count) || size_t(r.end - r.p) / sizeof(uint32_t) < count) return false;
+			roster.resize(count);
+			for (uint32_t &index : roster) if (!r.get(index) || index >= _settings.size()) return false;
+			return true;
+		}
+
+		bool _read_frame(detail::StateReader &r, Frame &frame)
+		{
+			uint32_t count;
+			if (!detail::get_capacity(r, frame.capacity) || !r.get(frame.precision) || !r.get(count)) return false;
+			if (size_t(r.end - r.p) / (sizeof(uint32_t) + sizeof(choice_index_t) + sizeof(burden_t)) < count) return false;
+			frame.pending.resize(count);
+			for (Pending &p : frame.pending)
+			{
+				if (!r.get(p.index) || !r.get(p.choice) || !r.get(p.burden)) return false;
+				if (p.index >= _settings.size() || p.choice >= _settings[p.index]->values.size()) return false;
+			}
+			frame.choices.resize(frame.roster.size());
+			for (choice_index_t &choice : frame.choices) if (!r.get(choice)) return false;
+			return true;
+		}
+
+	private:
+		std::string _data;
+		size_t      _begin = 0, _end = 0, _frames = 0;
+		Config      _config;
+
+		// Settings as last defined while reading, and each option's burden distribution over the trace.
+		std::vector<std::unique_ptr<Definition>>  _settings;
+		std::vector<std::vector<burden_stat_t>>   _dists;
+	};
+
+	using GoblinTraceRecorder = GoblinTraceRecorder_<Economy_f>;
+	using GoblinTraceReplay   = GoblinTraceReplay_<Economy_f>;
+}
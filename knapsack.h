@@ -1,436 +1,633 @@
-#pragma once
-
-
-/*
-	C++ implementation of the multiple-choice knapsack algorithm.
-		Attempts to find the combination of options which optimizes value,
-		while keeping net burden below a defined capacity.
-
-	In typical use-cases, burden is proportional to CPU or GPU time.
-		Maximum burden is chosen to maintain a desirable framerate or
-		meet a deadline of some other kind (eg, for audio rendering).
-
-	The algorithm is most useful when burden values come from live profiling.
-		It's also possible to use estimated proportional burden values,
-		dynamically adjusting the maximum burden based on overall performance.
-		The Goblin class implements the former approach.
-*/
-
-
-#include <limits>    // std::numeric_limits
-#include <algorithm> // std::min, std::max, std::lower_bound
-#include <cassert>
-#include <vector>
-#include <cstdint>
-
-#include "economy.h"
-
-
-namespace perf_goblin
-{
-	/*
-		This class models the multiple-choice knapsack problem.
-			
-	*/
-	template<typename T_Economy>
-	struct Knapsack_
-	{
-	public:
-		static const bool EnableProfiling = true;
-
-		using economy_t      = T_Economy;
-		using burden_t       = typename economy_t::burden_t;
-		using capacity_t     = typename economy_t::capacity_t;
-		using value_t        = typename economy_t::value_t;
-
-		using index_t        = size_t;
-		using choice_index_t = uint16_t;
-		using score_t        = ptrdiff_t;
-
-		static const choice_index_t NO_CHOICE = ~choice_index_t(0);
-
-
-		// A single item that may be chosen.
-		struct Option
-		{
-			// Burden represents a cost applying to some finite resource.
-			//   The algorithm keeps total burden under some maximum.
-			//   This value is typically positive (but not required to be).
-			burden_t burden;
-
-			// Value represents the benefit or detriment from picking this option.
-			//   The algorithm tries to maximize value.
-			//   This value may be positive or negative.
-			value_t  value;
-
-			// -- remaining members are automatically-computed --
-
-			// Quantized value used in the algorithm.
-			mutable score_t score;
-
-
-			// Is this option possible?
-			bool possible() const    {return economy_t::is_possible(burden);}
-		};
-
-		// A choice among some number of items.
-		struct Decision
-		{
-			const Option  *options      = nullptr;
-			choice_index_t option_count = 0;
-
-			// Iterable.
-			const Option *begin() const    {return options;}
-			const Option *end  () const    {return options+option_count;}
-
-			// The current choice among options.
-			//    This is overwritten by the algorithm.
-			choice_index_t
-				choice      = 0, // Algorithm's choice.
-				choice_easy = 0, // Lowest-burden choice.
-				choice_high = 0; // Highest-value choice.
-
-			// Access options after running the solver
-			const Option &chosen()      const    {return options[choice];}
-			const Option &option_easy() const    {return options[choice_easy];}
-			const Option &option_high() const    {return options[choice_high];}
-
-			// Refresh choice_easy and choice_high.
-			void refresh_range()
-			{
-				choice_easy = choice_high = 0;
-				if (option_count == 0) return;
-
-				const Option &first = options[0];
-				burden_t easy_burden = first.burden;
-				value_t high_value = (first.possible() ? first.value : -std::numeric_limits<value_t>::infinity());
-
-				for (choice_index_t i = 1; i < option_count; ++i)
-				{
-					const Option &option = options[i];
-					if (option.value > high_value && option.possible()) {high_value  = option.value;  choice_high = i;}
-					if (economy_t::lesser(option.burden, easy_burden))  {easy_burden = option.burden; choice_easy = i;}
-				}
-			}
-		};
-
-		// Statistics describing a set of decisions.
-		struct Stats
-		{
-			burden_t net_burden = economy_t::zero();
-			value_t  net_value  = economy_t::zero();
-			score_t  net_score  = 0;
-
-			Stats &operator+=(const Option &o)
-			{
-				net_burden += o.burden;
-				net_value  += o.value;
-				net_score += o.score;
-				return *this;
-			}
-		};
-
-		// Internal: used to track lightest solution
-		struct Minimum
-		{
-			score_t        net_score  = score_t(0);
-			burden_t       net_burden = economy_t::infinite();
-			choice_index_t choice     = NO_CHOICE;
-
-			// Ordering
-			bool operator<(const Minimum &o) const    {return net_score < o.net_score;}
-
-			// Validity
-			bool valid() const                        {return choice != NO_CHOICE;}
-
-			// Update with an alternative, if it is lighter
-			void consider(const Minimum &other)       {if (economy_t::lesser(other.net_burden, net_burden)) *this = other;}
-		};
-
-		// Internal: used to track lightest solution for every combination of subset/score
-		struct Minimums
-		{
-			std::vector<Minimum> store;
-			std::vector<size_t>  row_end;
-
-			void clear()
-			{
-				store.clear();
-				row_end.clear();
-			}
-
-			// Query a minimum
-			Minimum operator()(index_t row, score_t score) const
-			{
-				// Determine the row we're searching
-				auto
-					rbeg = store.begin() + (row ? row_end[row-1] : 0u),
-					rend = store.begin() + row_end[row];
-				Minimum search;
-				search.net_score = score;
-
-				// Find an element with the given score.
-				auto pos = std::lower_bound(rbeg, rend, search);
-				if (pos != rend) search = *pos;
-				return search;
-			}
-
-			// Select the high-value strategy for a given burden limit.
-			Minimum decide(const capacity_t capacity, index_t row)
-			{
-				index_t i = row_end[row], e = (i ? row_end[row-1] : 0u);
-				while (i-- > e)
-					if (economy_t::acceptable(store[i].net_burden, capacity)) return store[i];
-				return Minimum();
-			}
-			Minimum decide(const capacity_t capacity)
-			{
-				return decide(capacity, row_end.size()-1);
-			}
-		};
-
-	public:
-		// Set of decisions to fill in
-		std::vector<Decision*> decisions;
-
-		// Metadata generated by the algorithm.
-		Minimums   minimums;
-		
-		struct ProblemStats
-		{
-			Stats   chosen, highest, lightest;
-			size_t  iterations           = 0;
-			value_t value_to_score_scale = 0;
-		}
-			stats;
-
-	public:
-		void clear()
-		{
-			decisions.clear();
-			minimums.clear();
-			stats = ProblemStats();
-		}
-		void add_decision(Decision *decision)
-		{
-			decisions.push_back(decision);
-		}
-
-		/*
-			Evaluate all decisions, selecting exactly one option for each and overwriting
-				the 'option' field to that option's index.
-
-			capacity -- sets a limit on the total burden of selected options.
-				If all solutions exceed this limit, the lowest-burden solution is chosen.
-
-			precision -- governs the algorithm's optimality and efficiency.
-				The solution's net value will be at least (100 - 100/precision)% of optimal.
-				Runtime increases linearly with precision.
-		*/
-		bool decide(capacity_t capacity, size_t precision = 50)
-		{
-			precision = std::max<size_t>(precision, 4);
-
-			stats.iterations = 0;
-
-			// Prepare algorithm (performs value->score scaling)
-			_prepare(precision);
-
-			// Shortcut: if the lightest solution is overburdened, return it (failure)
-			if (!economy_t::acceptable(stats.lightest.net_burden, capacity))
-			{
-				for (Decision *decision : decisions) decision->choice = decision->choice_easy;
-				stats.chosen = stats.lightest;
-				return false;
-			}
-
-			// Shortcut: if the highest-valued solution is not overburdened, return it
-			if (economy_t::acceptable(stats.highest.net_burden, capacity))
-			{
-				// Load the choice as noted in _prepare, and return it.
-				for (Decision *decision : decisions) decision->choice = decision->choice_high;
-				stats.chosen = stats.highest;
-				return true;
-			}
-
-			// Sort all decisions by maximum value
-			std::sort(decisions.begin(), decisions.end(),
-				[](const Decision *l, const Decision *r) {return l->option_high().score < r->option_high().score;});
-
-			// Compute the table of minimums...
-			_compute_minimums(capacity);
-
-			// Identify the highest-scoring solution that is not over-burden
-			{
-				Minimum solution = minimums.decide(capacity);
-
-				index_t i = decisions.size();
-				while (true)
-				{
-					--i;
-					Decision &decision = *decisions[i];
-					assert(solution.choice <= decision.option_count);
-					decision.choice = solution.choice;
-					score_t next_score = solution.net_score - decision.chosen().score;
-					if (i == 0)
-					{
-						assert(next_score == 0);
-						break;
-					}
-					solution = minimums(i-1, next_score);
-				}
-			}
-
-			// Calculate final stats and return.
-			stats.chosen = Stats();
-			for (Decision *decision : decisions) stats.chosen += decision->chosen();
-			assert(economy_t::acceptable(stats.chosen.net_burden, capacity));
-			
-			return true;
-		}
-
-	private:
-
-		/*
-			Main algorithm:
-				* Find lightest solution per score for every subset 0..i
-		*/
-		void _compute_minimums(const capacity_t &capacity)
-		{
-			minimums.clear();
-
-			std::vector<Minimum>
-				previous,
-				current;
-
-			previous.reserve(stats.highest.net_score);
-			current .reserve(stats.highest.net_score);
-
-			auto consider = [&](const Minimum &candidate)
-			{
-				// optimization?: don't even consider over-capacity candidates.
-				if (!economy_t::acceptable(candidate.net_burden, capacity)) return;
-				assert(economy_t::is_possible(candidate.net_burden));
-				
-				// Add to nonsparse list
-				if (candidate.net_score >= score_t(current.size()))
-					current.resize(candidate.net_score + 1);
-				current[candidate.net_score].consider(candidate);
-
-				// Consolidate into current row (which is sorted)
-				/*auto existing = std::lower_bound(current.begin(), current.end(), candidate);
-				if (existing == current.end()) current.push_back(candidate);
-				else if (existing->net_score > candidate.net_score) current.insert(existing, candidate);
-				else existing->consider(candidate.choice, candidate.net_burden);*/
-			};
-
-			for (index_t i = 0; i < decisions.size(); ++i)
-			{
-				Decision &decision = *decisions[i];
-
-				for (choice_index_t choice_index = 0, e = decision.option_count; choice_index < e; ++choice_index)
-				{
-					// Only consider options with non-negative value.
-					const Option &option = decision.options[choice_index];
-					if (option.score < 0 || !option.possible()) continue;
-
-					if (i == 0)
-					{
-						Minimum candidate;
-						candidate.net_burden = option.burden;
-						candidate.net_score  = option.score;
-						candidate.choice     = choice_index;
-						
-						consider(candidate);
-
-						if (EnableProfiling) ++stats.iterations;
-					}
-					else
-						for (const Minimum &base : previous) // TODO fewer iterations?
-					{
-						// Find minimum 
-						Minimum candidate = base;
-						candidate.net_burden += option.burden;
-						candidate.net_score  += option.score;
-						candidate.choice     = choice_index;
-
-						consider(candidate);
-
-						if (EnableProfiling) ++stats.iterations; // maybe inc by log2(current.size())
-					}
-				}
-
-				previous.clear();
-
-				// Copy the row into our sparse table.
-				for (auto &min : current)
-					if (min.valid())
-				{
-					previous.push_back(min);
-					minimums.store.push_back(min);
-				}
-				minimums.row_end.push_back(minimums.store.size());
-
-				// Save the row for use in the next row.
-				//std::swap(previous, current);
-				current.clear();
-			}
-		}
-
-		// Prepare algorithm
-		void _prepare(size_t precision)
-		{
-			value_t max_value_range = 0;
-
-			stats.lightest = Stats();
-			stats.highest = Stats();
-
-			/*
-				First pass:
-					* ascertain lightest item(s) and pick them by default
-					* ascertain maximum range of relevant values
-			*/
-			for (Decision *decision : decisions) if (decision->option_count)
-			{
-				// Detect low-burden and high-value options.
-				decision->refresh_range();
-
-				// Look for the range of values
-				const Option
-					&easy = decision->option_easy(),
-					&high = decision->option_high();
-
-				easy.score = 0;
-				stats.lightest += easy;
-
-				max_value_range = std::max(max_value_range, high.value - easy.value);
-			}
-			if (max_value_range <= 0) max_value_range = 1;
-
-			/*
-				Second pass:
-					* score each option, up to max score <precision>.
-					* calculate the highest-valued solution (and max net score).
-			*/
-			const value_t value_to_score_scale = precision / max_value_range;
-			stats.value_to_score_scale = value_to_score_scale;
-
-			for (Decision *decision : decisions)
-			{
-				// Searching for the highest-value option.
-				value_t value_min = decision->option_easy().value;
-
-				for (const Option &option : *decision)
-				{
-					// Calculate quantized value ("score").
-					option.score = score_t(std::ceil((option.value - value_min) * value_to_score_scale));
-				}
-
-				// Add lightest option to lightest total.
-				stats.highest += decision->option_high();
-			}
-		}
-	};
-
-	using Knapsack = Knapsack_<Economy_f>;
-}
+#pragma once
+
+
+/*
+	C++ implementation of the multiple-choice knapsack algorithm.
+		Attempts to find the combination of options which optimizes value,
+		while keeping net burden below a defined capacity.
+
+	In typical use-cases, burden is proportional to CPU or GPU time.
+		Maximum burden is chosen to maintain a desirable framerate or
+		meet a deadline of some other kind (eg, for audio rendering).
+
+	The algorithm is most useful when burden values come from live profiling.
+		It's also possible to use estimated proportional burden values,
+		dynamically adjusting the maximum burden based on overall performance.
+		The Goblin class implements the former approach.
+*/
+
+
+#include <limits>    // std::numeric_limits
+#include <algorithm> // std::min, std::max, std::lower_bound
+#include <cassert>
+#include <vector>
+#include <cstdint>
+
+#include "economy.h"
+
+
+namespace perf_goblin
+{
+	/*
+		This class models the multiple-choice knapsack problem.
+			
+	*/
+	template<typename T_Economy>
+	struct Knapsack_
+	{
+	public:
+		static const bool EnableProfiling = true;
+
+		using economy_t      = T_Economy;
+		using burden_t       = typename economy_t::burden_t;
+		using capacity_t     = typename economy_t::capacity_t;
+		using value_t        = typename economy_t::value_t;
+
+		using index_t        = size_t;
+		using choice_index_t = uint16_t;
+		using score_t        = ptrdiff_t;
+
+		static const choice_index_t NO_CHOICE = ~choice_index_t(0);
+
+
+		// A single item that may be chosen.
+		struct Option
+		{
+			// Burden represents a cost applying to some finite resource.
+			//   The algorithm keeps total burden under some maximum.
+			//   This value is typically positive (but not required to be).
+			burden_t burden;
+
+			// Value represents the benefit or detriment from picking this option.
+			//   The algorithm tries to maximize value.
+			//   This value may be positive or negative.
+			value_t  value;
+
+			// -- remaining members are automatically-computed --
+
+			// Quantized value used in the algorithm.
+			mutable score_t score;
+
+
+			// Is this option possible?
+			bool possible() const    {return economy_t::is_possible(burden);}
+		};
+
+		// A choice among some number of items.
+		struct Decision
+		{
+			const Option  *options      = nullptr;
+			choice_index_t option_count = 0;
+
+			// Iterable.
+			const Option *begin() const    {return options;}
+			const Option *end  () const    {return options+option_count;}
+
+			// The current choice among options.
+			//    This is overwritten by the algorithm.
+			choice_index_t
+				choice      = 0, // Algorithm's choice.
+				choice_easy = 0, // Lowest-burden choice.
+				choice_high = 0; // Highest-value choice.
+
+			// Access options after running the solver
+			const Option &chosen()      const    {return options[choice];}
+			const Option &option_easy() const    {return options[choice_easy];}
+			const Option &option_high() const    {return options[choice_high];}
+
+			// Refresh choice_easy and choice_high.
+			void refresh_range()
+			{
+				choice_easy = choice_high = 0;
+				if (option_count == 0) return;
+
+				const Option &first = options[0];
+				burden_t easy_burden = first.burden;
+				value_t high_value = (first.possible() ? first.value : -std::numeric_limits<value_t>::infinity());
+
+				for (choice_index_t i = 1; i < option_count; ++i)
+				{
+					const Option &option = options[i];
+					if (option.value > high_value && option.possible()) {high_value  = option.value;  choice_high = i;}
+					if (economy_t::lesser(option.burden, easy_burden))  {easy_burden = option.burden; choice_easy = i;}
+				}
+			}
+		};
+
+		// Statistics describing a set of decisions.
+		struct Stats
+		{
+			burden_t net_burden = economy_t::zero();
+			value_t  net_value  = economy_t::zero();
+			score_t  net_score  = 0;
+
+			Stats &operator+=(const Option &o)
+			{
+				net_burden += o.burden;
+				net_value  += o.value;
+				net_score += o.score;
+				return *this;
+			}
+		};
+
+		// Internal: used to track lightest solution
+		struct Minimum
+		{
+			score_t        net_score  = score_t(0);
+			burden_t       net_burden = economy_t::infinite();
+			choice_index_t choice     = NO_CHOICE;
+
+			// Ordering
+			bool operator<(const Minimum &o) const    {return net_score < o.net_score;}
+
+			// Validity
+			bool valid() const                        {return choice != NO_CHOICE;}
+
+			// Update with an alternative, if it is lighter
+			void consider(const Minimum &other)       {if (economy_t::lesser(other.net_burden, net_burden)) *this = other;}
+		};
+
+		// Internal: used to track lightest solution for every combination of subset/score
+		struct Minimums
+		{
+			std::vector<Minimum> store;
+			std::vector<size_t>  row_end;
+
+			void clear()
+			{
+				store.clear();
+				row_end.clear();
+			}
+
+			// Query a minimum
+			Minimum operator()(index_t row, score_t score) const
+			{
+				// Determine the row we're searching
+				auto
+					rbeg = store.begin() + (row ? row_end[row-1] : 0u),
+					rend = store.begin() + row_end[row];
+				Minimum search;
+				search.net_score = score;
+
+				// Find an element with the given score.
+				auto pos = std::lower_bound(rbeg, rend, search);
+				if (pos != rend) search = *pos;
+				return search;
+			}
+
+			// Select the high-value strategy for a given burden limit.
+			Minimum decide(const capacity_t capacity, index_t row)
+			{
+				index_t i = row_end[row], e = (i ? row_end[row-1] : 0u);
+				while (i-- > e)
+					if (economy_t::acceptable(store[i].net_burden, capacity)) return store[i];
+				return Minimum();
+			}
+			Minimum decide(const capacity_t capacity)
+			{
+				return decide(capacity, row_end.size()-1);
+			}
+		};
+
+		/*
+			The linear relaxation of a problem, which bounds the value of its solutions.
+				Each decision climbs the upper convex hull of its options from the lightest, and the
+				steps of all decisions are taken by value per burden, the last one fractionally.
+		*/
+		struct Relaxation
+		{
+			struct Step
+			{
+				double  burden, value;
+				index_t decision;    // Index in the knapsack's decisions.
+			};
+
+			// Net burden and value of each decision's lightest option (the most valuable of equally light ones).
+			double lightest_burden = 0, lightest_value = 0;
+
+			// Steps up the decisions' hulls, by decreasing value per burden.
+			std::vector<Step> steps;
+
+			// Upper bound on the value gained over the lightest options within some spare burden.
+			double gain(double spare) const
+			{
+				double gain = 0;
+				for (const Step &step : steps)
+				{
+					if (step.burden <= spare) {spare -= step.burden; gain += step.value; continue;}
+					if (spare > 0) gain += step.value * spare / step.burden;
+					break;
+				}
+				return gain;
+			}
+		};
+
+	public:
+		// Set of decisions to fill in
+		std::vector<Decision*> decisions;
+
+		// Metadata generated by the algorithm.
+		Minimums   minimums;
+		
+		struct ProblemStats
+		{
+			Stats   chosen, highest, lightest;
+			size_t  iterations           = 0;
+			value_t value_to_score_scale = 0;
+		}
+			stats;
+
+	public:
+		void clear()
+		{
+			decisions.clear();
+			minimums.clear();
+			stats = ProblemStats();
+		}
+		void add_decision(Decision *decision)
+		{
+			decisions.push_back(decision);
+		}
+
+		/*
+			Evaluate all decisions, selecting exactly one option for each and overwriting
+				the 'option' field to that option's index.
+
+			capacity -- sets a limit on the total burden of selected options.
+				If all solutions exceed this limit, the lowest-burden solution is chosen.
+
+			precision -- governs the algorithm's optimality and efficiency.
+				The solution's net value will be at least (100 - 100/precision)% of optimal,
+				counting value gained over the lightest solution.  (Economies without ordered
+				burdens, like Economy_Normal_, approximate this.)
+				Runtime and memory of a solve increase linearly with precision.
+
+				With ordered burdens, a solution that can't be shown to meet the precision is
+				solved again with options scored 4 times finer, then if need be finely enough
+				to divide the gain into (varied decisions * precision) steps.  In the worst case
+				that multiplies runtime and memory by about the number of decisions; typically
+				it's several times (about 4x for 3000 decisions of 4 options at precision 30).
+		*/
+		bool decide(capacity_t capacity, size_t precision = 50)
+		{
+			precision = std::max<size_t>(precision, 4);
+
+			stats.iterations = 0;
+
+			// Prepare algorithm (performs value->score scaling)
+			_prepare(precision);
+
+			// Shortcut: if the lightest solution is overburdened, return it (failure)
+			if (!economy_t::acceptable(stats.lightest.net_burden, capacity))
+			{
+				for (Decision *decision : decisions) decision->choice = decision->choice_easy;
+				stats.chosen = stats.lightest;
+				return false;
+			}
+
+			// Shortcut: if the highest-valued solution is not overburdened, return it
+			if (economy_t::acceptable(stats.highest.net_burden, capacity))
+			{
+				// Load the choice as noted in _prepare, and return it.
+				for (Decision *decision : decisions) decision->choice = decision->choice_high;
+				stats.chosen = stats.highest;
+				return true;
+			}
+
+			// Find the highest-scoring solution.
+			_solve(capacity);
+
+			// The solution falls short of optimal by no more than the chosen options' rounding error,
+			//   nor than the relaxed bound's margin over it.  If both could exceed 1/precision of the
+			//   value gained over the lightest solution, score options in finer steps and solve again:
+			//   first 4 times finer, then finely enough that rounding can't cost more than that.
+			//   Without ordered burdens, solutions are ranked by an approximation and this can't be proven.
+			double relaxed_gain = NAN;
+			if (economy_t::burden_is_ordered && !_within_precision(capacity, precision, relaxed_gain))
+			{
+				const value_t fine_scale = _exclude(capacity, precision), finer_scale = 4 * stats.value_to_score_scale;
+				if (fine_scale > 0 && finer_scale < fine_scale)
+				{
+					_rescore(finer_scale);
+					_solve(capacity);
+				}
+				if (fine_scale > 0 && !(finer_scale < fine_scale && _within_precision(capacity, precision, relaxed_gain)))
+				{
+					_rescore(fine_scale);
+					_solve(capacity);
+				}
+			}
+
+			return true;
+		}
+
+		/*
+			Relax the current decisions.  Burdens are mapped to doubles by economy_t::relax;
+				decisions without possible options are skipped.
+		*/
+		Relaxation relaxation() const
+		{
+			struct Point {double burden, value;};
+			std::vector<Point> points, hull;
+			Relaxation relaxed;
+
+			for (index_t i = 0; i < decisions.size(); ++i)
+			{
+				points.clear();
+				for (const Option &option : *decisions[i])
+					if (option.possible()) points.push_back(Point{economy_t::relax(option.burden), double(option.value)});
+				if (points.empty()) continue;
+
+				// Lightest first, and the most valuable of equally light options first.
+				std::sort(points.begin(), points.end(), [](const Point &l, const Point &r)
+					{return (l.burden != r.burden) ? (l.burden < r.burden) : (l.value > r.value);});
+				hull.clear();
+				for (const Point &point : points)
+				{
+					if (!hull.empty() && point.value <= hull.back().value) continue;
+					while (hull.size() >= 2)
+					{
+						const Point &a = hull[hull.size()-2], &b = hull.back();
+						if ((b.value - a.value) * (point.burden - a.burden) > (point.value - a.value) * (b.burden - a.burden)) break;
+						hull.pop_back();
+					}
+					hull.push_back(point);
+				}
+
+				relaxed.lightest_burden += hull[0].burden;
+				relaxed.lightest_value  += hull[0].value;
+				for (size_t k = 1; k < hull.size(); ++k)
+					relaxed.steps.push_back(typename Relaxation::Step{hull[k].burden - hull[k-1].burden, hull[k].value - hull[k-1].value, i});
+			}
+
+			// A stable sort resolves ties the same way with any standard library.
+			std::stable_sort(relaxed.steps.begin(), relaxed.steps.end(), [](const typename Relaxation::Step &l, const typename Relaxation::Step &r)
+				{return l.value * r.burden > r.value * l.burden;});
+			return relaxed;
+		}
+
+		/*
+			An upper bound on the net value of any solution within the capacity, by linear relaxation.
+				Returns -infinity if even the lightest options exceed the capacity.
+		*/
+		double relaxed_bound(const capacity_t &capacity) const
+		{
+			const Relaxation relaxed = relaxation();
+			const double spare = economy_t::relax(capacity) - relaxed.lightest_burden;
+			if (spare < 0) return -std::numeric_limits<double>::infinity();
+			return relaxed.lightest_value + relaxed.gain(spare);
+		}
+
+	private:
+
+		/*
+			Find the highest-scoring solution within the capacity, and choose it.
+		*/
+		void _solve(const capacity_t &capacity)
+		{
+			// Sort all decisions by maximum value
+			//   A stable sort resolves ties the same way with any standard library.
+			std::stable_sort(decisions.begin(), decisions.end(),
+				[](const Decision *l, const Decision *r) {return l->option_high().score < r->option_high().score;});
+
+			// Compute the table of minimums...
+			_compute_minimums(capacity);
+
+			// Identify the highest-scoring solution that is not over-burden
+			{
+				Minimum solution = minimums.decide(capacity);
+
+				index_t i = decisions.size();
+				while (true)
+				{
+					--i;
+					Decision &decision = *decisions[i];
+					assert(solution.choice <= decision.option_count);
+					decision.choice = solution.choice;
+					score_t next_score = solution.net_score - decision.chosen().score;
+					if (i == 0)
+					{
+						assert(next_score == 0);
+						break;
+					}
+					solution = minimums(i-1, next_score);
+				}
+			}
+
+			// Calculate final stats.
+			stats.chosen = Stats();
+			for (Decision *decision : decisions) stats.chosen += decision->chosen();
+			assert(economy_t::acceptable(stats.chosen.net_burden, capacity));
+		}
+
+		/*
+			Main algorithm:
+				* Find lightest solution per score for every subset 0..i
+		*/
+		void _compute_minimums(const capacity_t &capacity)
+		{
+			minimums.clear();
+
+			std::vector<Minimum>
+				previous,
+				current;
+
+			previous.reserve(stats.highest.net_score);
+			current .reserve(stats.highest.net_score);
+
+			auto consider = [&](const Minimum &candidate)
+			{
+				// optimization?: don't even consider over-capacity candidates.
+				if (!economy_t::acceptable(candidate.net_burden, capacity)) return;
+				assert(economy_t::is_possible(candidate.net_burden));
+				
+				// Add to nonsparse list
+				if (candidate.net_score >= score_t(current.size()))
+					current.resize(candidate.net_score + 1);
+				current[candidate.net_score].consider(candidate);
+
+				// Consolidate into current row (which is sorted)
+				/*auto existing = std::lower_bound(current.begin(), current.end(), candidate);
+				if (existing == current.end()) current.push_back(candidate);
+				else if (existing->net_score > candidate.net_score) current.insert(existing, candidate);
+				else existing->consider(candidate.choice, candidate.net_burden);*/
+			};
+
+			for (index_t i = 0; i < decisions.size(); ++i)
+			{
+				Decision &decision = *decisions[i];
+
+				for (choice_index_t choice_index = 0, e = decision.option_count; choice_index < e; ++choice_index)
+				{
+					// Only consider options with non-negative value.
+					const Option &option = decision.options[choice_index];
+					if (option.score < 0 || !option.possible()) continue;
+
+					if (i == 0)
+					{
+						Minimum candidate;
+						candidate.net_burden = option.burden;
+						candidate.net_score  = option.score;
+						candidate.choice     = choice_index;
+						
+						consider(candidate);
+
+						if (EnableProfiling) ++stats.iterations;
+					}
+					else
+						for (const Minimum &base : previous) // TODO fewer iterations?
+					{
+						// Find minimum 
+						Minimum candidate = base;
+						candidate.net_burden += option.burden;
+						candidate.net_score  += option.score;
+						candidate.choice     = choice_index;
+
+						consider(candidate);
+
+						if (EnableProfiling) ++stats.iterations; // maybe inc by log2(current.size())
+					}
+				}
+
+				previous.clear();
+
+				// Copy the row into our sparse table.
+				for (auto &min : current)
+					if (min.valid())
+				{
+					previous.push_back(min);
+					minimums.store.push_back(min);
+				}
+				minimums.row_end.push_back(minimums.store.size());
+
+				// Save the row for use in the next row.
+				//std::swap(previous, current);
+				current.clear();
+			}
+		}
+
+		// Prepare algorithm
+		void _prepare(size_t precision)
+		{
+			value_t max_value_range = 0;
+
+			stats.lightest = Stats();
+			stats.highest = Stats();
+
+			/*
+				First pass:
+					* ascertain lightest item(s) and pick them by default
+					* ascertain maximum range of relevant values
+			*/
+			for (Decision *decision : decisions) if (decision->option_count)
+			{
+				// Detect low-burden and high-value options.
+				decision->refresh_range();
+
+				// Look for the range of values
+				const Option
+					&easy = decision->option_easy(),
+					&high = decision->option_high();
+
+				easy.score = 0;
+				stats.lightest += easy;
+
+				max_value_range = std::max(max_value_range, high.value - easy.value);
+			}
+			if (max_value_range <= 0) max_value_range = 1;
+
+			/*
+				Second pass:
+					* score each option, up to max score <precision>.
+					* calculate the highest-valued solution (and max net score).
+			*/
+			const value_t value_to_score_scale = precision / max_value_range;
+			stats.value_to_score_scale = value_to_score_scale;
+
+			for (Decision *decision : decisions)
+			{
+				// Searching for the highest-value option.
+				value_t value_min = decision->option_easy().value;
+
+				for (const Option &option : *decision)
+				{
+					// Calculate quantized value ("score").
+					option.score = score_t(std::ceil((option.value - value_min) * value_to_score_scale));
+				}
+
+				// Add lightest option to lightest total.
+				stats.highest += decision->option_high();
+			}
+		}
+
+		/*
+			Check that the chosen solution is provably within 1/precision of the optimal gain.
+				The relaxed bound is computed once, when the rounding error alone can't tell.
+		*/
+		bool _within_precision(const capacity_t &capacity, size_t precision, double &relaxed_gain) const
+		{
+			const double gain = double(stats.chosen.net_value - stats.lightest.net_value), allowed = gain / double(precision);
+			if (double(stats.chosen.net_score) / double(stats.value_to_score_scale) - gain <= allowed) return true;
+			if (std::isnan(relaxed_gain)) relaxed_gain = relaxed_bound(capacity) - double(stats.lightest.net_value);
+			return relaxed_gain - gain <= allowed;
+		}
+
+		/*
+			Exclude options which exceed the capacity even alongside the lightest options, and
+				return a scale at which rounding costs at most 1/precision of the optimal gain,
+				or zero if no option can add value.  The scale divides a lower bound on the optimal
+				gain (the gain found so far or the best single option's) into decisions * precision steps.
+		*/
+		value_t _exclude(const capacity_t &capacity, size_t precision)
+		{
+			// Lightest burden of the decisions before and after each decision.
+			const index_t count = decisions.size();
+			std::vector<burden_t> before(count + 1, burden_t(economy_t::zero())), after(count + 1, burden_t(economy_t::zero()));
+			for (index_t i = 0; i < count; ++i)
+			{
+				before[i+1] = before[i];
+				if (decisions[i]->option_count) before[i+1] += decisions[i]->option_easy().burden;
+			}
+			for (index_t i = count; i-- > 0;)
+			{
+				after[i] = after[i+1];
+				if (decisions[i]->option_count) after[i] += decisions[i]->option_easy().burden;
+			}
+
+			// Mark options which can't fit with score -1, and find the best gain of the rest.
+			value_t bound = stats.chosen.net_value - stats.lightest.net_value;
+			size_t  varied = 0;
+			for (index_t i = 0; i < count; ++i)
+			{
+				Decision &decision = *decisions[i];
+				if (decision.option_count > 1) ++varied;
+				for (const Option &option : decision)
+				{
+					burden_t burden = before[i];
+					burden += option.burden;
+					burden += after[i+1];
+					option.score = (economy_t::acceptable(burden, capacity) ? 0 : -1);
+					if (option.score == 0) bound = std::max(bound, option.value - decision.option_easy().value);
+				}
+			}
+			return (bound > 0) ? value_t(varied * precision) / bound : value_t(0);
+		}
+
+		// Score the options which aren't excluded again, at a finer scale.
+		void _rescore(value_t value_to_score_scale)
+		{
+			stats.value_to_score_scale = value_to_score_scale;
+			stats.highest.net_score = 0;
+
+			for (Decision *decision : decisions)
+			{
+				value_t value_min = decision->option_easy().value;
+				for (const Option &option : *decision)
+					if (option.score >= 0) option.score = score_t(std::ceil((option.value - value_min) * value_to_score_scale));
+				stats.highest.net_score += std::max<score_t>(decision->option_high().score, 0);
+			}
+		}
+	};
+
+	using Knapsack = Knapsack_<Economy_f>;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+/*
+	An exact solver for the multiple-choice knapsack problem, as a reference for Knapsack_.
+
+	This is a depth-first branch-and-bound search.  Dominated options (no lighter than
+		another option of the same decision, and no more valuable) are discarded,
+		and each branch is bounded by the linear relaxation of the remaining decisions
+		(see Knapsack_::relaxation).
+		Decisions with the widest range of values are branched on first.
+
+	Runtime is exponential in the worst case, so the search gives up after a number
+		of nodes.  It is meant for validating faster solvers on problems of up to
+		a few dozen decisions, and only supports economies with scalar burdens.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "knapsack.h"
+
+
+namespace perf_goblin
+{
+	template<typename T_Economy>
+	class KnapsackExact_
+	{
+	public:
+		using economy_t      = T_Economy;
+		using Knapsack_t     = Knapsack_<economy_t>;
+		using burden_t       = typename Knapsack_t::burden_t;
+		using capacity_t     = typename Knapsack_t::capacity_t;
+		using value_t        = typename Knapsack_t::value_t;
+		using choice_index_t = typename Knapsack_t::choice_index_t;
+		using Decision       = typename Knapsack_t::Decision;
+		using Option         = typename Knapsack_t::Option;
+
+		static_assert(economy_t::burden_is_scalar, "the exact solver needs scalar burdens");
+
+		struct Result
+		{
+			bool   feasible = false; // False if even the lightest options exceed the capacity.
+			bool   exact    = false; // False if the search gave up; the result is the best found.
+			double value    = 0;     // Net value and burden of the choices, summed in double.
+			double burden   = 0;
+			size_t nodes    = 0;
+		};
+
+	public:
+		/*
+			Solve a knapsack's decisions exactly, overwriting each decision's choice.
+				Like Knapsack_::decide, chooses the lightest options if no solution fits.
+		*/
+		Result solve(Knapsack_t &knapsack, capacity_t capacity, size_t max_nodes = 50000000)
+		{
+			Result result;
+			_capacity  = double(capacity);
+			_max_nodes = max_nodes;
+			_nodes     = 0;
+			result.feasible = _prepare(knapsack) && (_rest_burden[0] < _capacity);
+			if (!result.feasible)
+			{
+				result.exact = true;
+				for (Decision *decision : knapsack.decisions) if (decision->option_count)
+				{
+					decision->refresh_range();
+					decision->choice = decision->choice_easy;
+					result.value  += double(decision->chosen().value);
+					result.burden += double(decision->chosen().burden);
+				}
+				return result;
+			}
+
+			// Start from the lightest solution, then search.
+			_best_value = _rest_value[0];
+			_path.assign(_rows.size(), 0);
+			_best = _path;
+			_search(0, 0, 0);
+
+			for (size_t i = 0; i < _rows.size(); ++i)
+			{
+				const Item &item = _rows[i].items[_best[i]];
+				_rows[i].decision->choice = item.choice;
+				result.value  += item.value;
+				result.burden += item.burden;
+			}
+			result.exact = (_nodes < _max_nodes);
+			result.nodes = _nodes;
+			return result;
+		}
+
+	private:
+		struct Item
+		{
+			double         burden, value;
+			choice_index_t choice;
+		};
+		struct Row
+		{
+			Decision         *decision;
+			size_t            index;    // Index in the knapsack's decisions.
+			std::vector<Item> items;    // Undominated options, by increasing burden and value.
+			double            range;    // Value range of the undominated options.
+		};
+		struct Step
+		{
+			double burden, value;
+			size_t row;
+		};
+
+		// Returns false if some decision has no possible options.
+		bool _prepare(Knapsack_t &knapsack)
+		{
+			bool possible = true;
+			_rows.clear();
+			_steps.clear();
+			for (size_t d = 0; d < knapsack.decisions.size(); ++d)
+			{
+				Decision *decision = knapsack.decisions[d];
+				if (!decision->option_count) continue;
+				Row row = {decision, d, {}, 0};
+				for (choice_index_t i = 0; i < decision->option_count; ++i)
+				{
+					const Option &option = decision->options[i];
+					if (option.possible()) row.items.push_back(Item{double(option.burden), double(option.value), i});
+				}
+				if (row.items.empty()) {possible = false; continue;}
+
+				// Discard dominated options.
+				std::stable_sort(row.items.begin(), row.items.end(), [](const Item &l, const Item &r)
+					{return (l.burden != r.burden) ? (l.burden < r.burden) : (l.value > r.value);});
+				size_t kept = 1;
+				for (size_t i = 1; i < row.items.size(); ++i)
+					if (row.items[i].value > row.items[kept-1].value) row.items[kept++] = row.items[i];
+				row.items.resize(kept);
+				row.range = row.items.back().value - row.items.front().value;
+				_rows.push_back(std::move(row));
+			}
+
+			// Branch on the widest decisions first.
+			std::stable_sort(_rows.begin(), _rows.end(), [](const Row &l, const Row &r) {return l.range > r.range;});
+
+			// Lightest burden and value of all rows from each row onward.
+			_rest_burden.assign(_rows.size() + 1, 0);
+			_rest_value .assign(_rows.size() + 1, 0);
+			for (size_t i = _rows.size(); i-- > 0;)
+			{
+				_rest_burden[i] = _rest_burden[i+1] + _rows[i].items[0].burden;
+				_rest_value [i] = _rest_value [i+1] + _rows[i].items[0].value;
+			}
+
+			// Steps along each row's upper convex hull, by decreasing value per burden.
+			std::vector<size_t> row_of(knapsack.decisions.size(), 0);
+			for (size_t r = 0; r < _rows.size(); ++r) row_of[_rows[r].index] = r;
+			for (const auto &step : knapsack.relaxation().steps)
+				_steps.push_back(Step{step.burden, step.value, row_of[step.decision]});
+			return possible;
+		}
+
+		// Upper bound on the value added by rows from 'first' onward, above their lightest options.
+		double _bound(size_t first, double spare) const
+		{
+			double bound = 0;
+			for (const Step &step : _steps)
+			{
+				if (step.row < first) continue;
+				if (step.burden <= spare) {spare -= step.burden; bound += step.value; continue;}
+				return bound + step.value * spare / step.burden;
+			}
+			return bound;
+		}
+
+		void _search(size_t row, double burden, double value)
+		{
+			if (++_nodes >= _max_nodes) return;
+			if (row == _rows.size())
+			{
+				if (value > _best_value) {_best_value = value; _best = _path;}
+				return;
+			}
+
+			// Try the most valuable options first.
+			const auto &items = _rows[row].items;
+			for (size_t i = items.size(); i-- > 0;)
+			{
+				const Item &item = items[i];
+				double next_burden = burden + item.burden, next_value = value + item.value;
+				double spare = _capacity - next_burden - _rest_burden[row+1];
+				if (!(spare > 0)) continue;
+				if (next_value + _rest_value[row+1] + _bound(row+1, spare) <= _best_value) continue;
+
+				_path[row] = i;
+				_search(row+1, next_burden, next_value);
+				if (_nodes >= _max_nodes) return;
+			}
+		}
+
+	private:
+		std::vector<Row>    _rows;
+		std::vector<Step>   _steps;
+		std::vector<double> _rest_burden, _rest_value;
+		std::vector<size_t> _path, _best;
+		double              _capacity = 0, _best_value = 0;
+		size_t              _max_nodes = 0, _nodes = 0;
+	};
+
+	using KnapsackExact = KnapsackExact_<Economy_f>;
+}
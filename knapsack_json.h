@@ -0,0 +1,282 @@
+#pragma once
+
+/*
+	Dumps of knapsack problems, for reproducing a solve offline.
+
+	A KnapsackDump_ copies every decision's options, along with the capacity and
+		precision passed to Knapsack_::decide.  Dumps are read and written as JSON:
+
+			{"capacity":12.5,"precision":30,"decisions":[
+				[[0,0],[1.25,3]],
+				[[0.5,1]],
+				...]}
+
+	Each option is [burden, value].  Under Economy_Normal_, burdens are written as
+		[mean, variance] and the capacity as [limit, sigmas].  Impossible burdens are null.
+		Numbers are written in their shortest round-trip form, so a dump reproduces a solve exactly.
+*/
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include "knapsack.h"
+#include "profile_json.h"
+
+
+namespace perf_goblin
+{
+	template<typename T_Economy> class KnapsackDump_;
+	using KnapsackDump        = KnapsackDump_<Economy_f>;
+	using KnapsackDump_Normal = KnapsackDump_<Economy_Normal_f>;
+
+	namespace detail
+	{
+		inline bool json_null_ws(JsonCursor &in)
+		{
+			in.skip_ws();
+			if (in.end - in.p < 4 || std::memcmp(in.p, "null", 4) != 0) return false;
+			in.p += 4;
+			return true;
+		}
+
+		inline bool json_key_ws(JsonCursor &in, const char *key)
+		{
+			size_t n = std::strlen(key);
+			if (!in.req_char_ws('"') || size_t(in.end - in.p) < n + 1 ||
+				std::memcmp(in.p, key, n) != 0 || in.p[n] != '"') return false;
+			in.p += n + 1;
+			return in.req_char_ws(':');
+		}
+
+		template<typename T>
+		inline bool json_read_scalar(JsonCursor &in, T &value)    {return in.number_ws(value);}
+		template<typename T_Int>
+		inline bool json_read_scalar(JsonCursor &in, Ticks_<T_Int> &value)
+		{
+			T_Int ticks;
+			if (!in.number_ws(ticks)) return false;
+			value = Ticks_<T_Int>::from_ticks(ticks);
+			return true;
+		}
+
+		// Burdens and capacities of scalar economies are plain numbers.
+		template<typename T_Economy>
+		struct KnapsackJson
+		{
+			using economy_t  = T_Economy;
+			using burden_t   = typename economy_t::burden_t;
+			using capacity_t = typename economy_t::capacity_t;
+
+			static void write_burden(std::string &out, const burden_t &burden)
+			{
+				if (economy_t::is_possible(burden)) json_write_number(out, burden);
+				else                                out.append("null");
+			}
+			static bool read_burden(JsonCursor &in, burden_t &burden)
+			{
+				if (json_null_ws(in)) {burden = economy_t::infinite(); return true;}
+				return json_read_scalar(in, burden);
+			}
+
+			static void write_capacity(std::string &out, const capacity_t &capacity)    {json_write_number(out, capacity);}
+			static bool read_capacity (JsonCursor &in, capacity_t &capacity)            {return json_read_scalar(in, capacity);}
+		};
+
+		// Normal burdens are [mean, variance]; capacities are [limit, sigmas].
+		template<typename T_Base>
+		struct KnapsackJson<Economy_Normal_<T_Base>>
+		{
+			using economy_t  = Economy_Normal_<T_Base>;
+			using burden_t   = typename economy_t::burden_t;
+			using capacity_t = typename economy_t::capacity_t;
+
+			static void write_burden(std::string &out, const burden_t &burden)
+			{
+				if (!economy_t::is_possible(burden)) {out.append("null"); return;}
+				out.push_back('[');
+				json_write_number(out, burden.mean);
+				out.push_back(',');
+				json_write_number(out, burden.var);
+				out.push_back(']');
+			}
+			static bool read_burden(JsonCursor &in, burden_t &burden)
+			{
+				if (json_null_ws(in)) {burden = economy_t::infinite(); return true;}
+				return in.req_char_ws('[') && json_read_scalar(in, burden.mean) &&
+					in.req_char_ws(',') && json_read_scalar(in, burden.var) && in.req_char_ws(']');
+			}
+
+			static void write_capacity(std::string &out, const capacity_t &capacity)
+			{
+				out.push_back('[');
+				json_write_number(out, capacity.limit);
+				out.push_back(',');
+				json_write_number(out, capacity.sigmas);
+				out.push_back(']');
+			}
+			static bool read_capacity(JsonCursor &in, capacity_t &capacity)
+			{
+				return in.req_char_ws('[') && json_read_scalar(in, capacity.limit) &&
+					in.req_char_ws(',') && in.number_ws(capacity.sigmas) && in.req_char_ws(']');
+			}
+		};
+	}
+
+
+	/*
+		A copy of a knapsack problem.
+	*/
+	template<typename T_Economy>
+	class KnapsackDump_
+	{
+	public:
+		using economy_t      = T_Economy;
+		using Knapsack_t     = Knapsack_<economy_t>;
+		using capacity_t     = typename Knapsack_t::capacity_t;
+		using choice_index_t = typename Knapsack_t::choice_index_t;
+		using Decision       = typename Knapsack_t::Decision;
+		using Option         = typename Knapsack_t::Option;
+
+	public:
+		capacity_t capacity  = capacity_t();
+		size_t     precision = 50;
+
+		// Options of each decision.
+		std::vector<std::vector<Option>> decisions;
+
+	public:
+		KnapsackDump_() {}
+		KnapsackDump_(const Knapsack_t &knapsack, capacity_t capacity, size_t precision)    {capture(knapsack, capacity, precision);}
+
+		/*
+			Copy a knapsack's decisions, and the capacity and precision it is (or was) solved with.
+				The Goblin's knapsack may be captured after update_decide (see Goblin_::Observer).
+		*/
+		void capture(const Knapsack_t &knapsack, capacity_t _capacity, size_t _precision)
+		{
+			capacity  = _capacity;
+			precision = _precision;
+			decisions.clear();
+			for (const Decision *decision : knapsack.decisions)
+				decisions.emplace_back(decision->begin(), decision->end());
+		}
+
+		/*
+			Replace a knapsack's decisions with this dump's, ready to decide.
+				The knapsack refers to this dump until it is cleared or set up again.
+		*/
+		void setup(Knapsack_t &knapsack)
+		{
+			_decisions.assign(decisions.size(), Decision());
+			knapsack.clear();
+			for (size_t i = 0; i < decisions.size(); ++i)
+			{
+				_decisions[i].options      = decisions[i].data();
+				_decisions[i].option_count = choice_index_t(decisions[i].size());
+				knapsack.add_decision(&_decisions[i]);
+			}
+		}
+
+		size_t option_count() const
+		{
+			size_t count = 0;
+			for (auto &options : decisions) count += options.size();
+			return count;
+		}
+
+	private:
+		std::vector<Decision> _decisions;
+	};
+
+
+	/*
+		Append a knapsack dump's JSON representation to a string.
+	*/
+	template<typename T_Econ>
+	void write_json(std::string &out, const KnapsackDump_<T_Econ> &dump)
+	{
+		using Json = detail::KnapsackJson<T_Econ>;
+
+		out.append("{\"capacity\":");
+		Json::write_capacity(out, dump.capacity);
+		out.append(",\"precision\":");
+		detail::json_write_number(out, (unsigned long long)(dump.precision));
+		out.append(",\"decisions\":[");
+		for (size_t i = 0; i < dump.decisions.size(); ++i)
+		{
+			out.append(i ? ",\n\t[" : "\n\t[");
+			bool first = true;
+			for (auto &option : dump.decisions[i])
+			{
+				out.append(first ? "[" : ",[");
+				first = false;
+				Json::write_burden(out, option.burden);
+				out.push_back(',');
+				detail::json_write_number(out, option.value);
+				out.push_back(']');
+			}
+			out.push_back(']');
+		}
+		out.append("]}\n");
+	}
+
+	template<typename T_Econ>
+	std::string to_json(const KnapsackDump_<T_Econ> &dump)
+	{
+		std::string out;
+		write_json(out, dump);
+		return out;
+	}
+
+	/*
+		Read a knapsack dump from a JSON buffer, replacing its contents.
+			Returns false if the buffer is malformed or holds another economy's burdens.
+	*/
+	template<typename T_Econ>
+	bool read_json(const char *begin, const char *end, KnapsackDump_<T_Econ> &dump)
+	{
+		using Json   = detail::KnapsackJson<T_Econ>;
+		using Option = typename KnapsackDump_<T_Econ>::Option;
+
+		detail::JsonCursor in = {begin, end};
+		dump.decisions.clear();
+		unsigned long long precision;
+		if (!in.req_char_ws('{') ||
+			!detail::json_key_ws(in, "capacity")  || !Json::read_capacity(in, dump.capacity) || !in.req_char_ws(',') ||
+			!detail::json_key_ws(in, "precision") || !in.number_ws(precision) || !in.req_char_ws(',') ||
+			!detail::json_key_ws(in, "decisions") || !in.req_char_ws('[')) return false;
+		dump.precision = size_t(precision);
+
+		if (in.peek_ws(']')) ++in.p;
+		else while (true)
+		{
+			if (!in.req_char_ws('[')) return false;
+			dump.decisions.emplace_back();
+			auto &options = dump.decisions.back();
+			if (in.peek_ws(']')) ++in.p;
+			else while (true)
+			{
+				Option option = {};
+				if (!in.req_char_ws('[') || !Json::read_burden(in, option.burden) ||
+					!in.req_char_ws(',') || !in.number_ws(option.value) || !in.req_char_ws(']')) return false;
+				options.push_back(option);
+				if (options.size() >= size_t(Knapsack_<T_Econ>::NO_CHOICE)) return false;
+
+				if (in.peek_ws(',')) {++in.p; continue;}
+				if (!in.req_char_ws(']')) return false;
+				break;
+			}
+
+			if (in.peek_ws(',')) {++in.p; continue;}
+			if (!in.req_char_ws(']')) return false;
+			break;
+		}
+		return in.req_char_ws('}');
+	}
+
+	template<typename T_Econ>
+	bool read_json(const std::string &text, KnapsackDump_<T_Econ> &dump)
+	{
+		return read_json(text.data(), text.data() + text.size(), dump);
+	}
+}
@@ -1,751 +1,3397 @@
-#include <iostream>
-#include <iomanip>
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <list>
-#include <cmath>
-#include <ctime>
-#include <chrono>
-#include <random>
-
-#include "knapsack.h"
-#include "goblin.h"
-#include "profile_json.h"
-
-
-using namespace perf_goblin;
-
-using std::cout;
-using std::endl;
-
-
-static std::random_device rand_dev;
-static std::mt19937       rand_gen;
-
-
-std::ostream& operator<<(std::ostream &out, const Knapsack::Option &option)
-{
-	return out << "(#" << option.burden << " $" << option.value << ')';
-}
-
-std::ostream& operator<<(std::ostream &out, const Knapsack::Decision &decision)
-{
-	out << '{';
-	for (size_t i = 0; i < decision.option_count; ++i)
-	{
-		out << (i ? ", " : "") << decision.options[i];
-	}
-	out << '}';
-	return out;
-}
-
-std::ostream& operator<<(std::ostream &out, const Knapsack::Stats &stats)
-{
-	return out << "(#" << stats.net_burden << " $" << stats.net_value << " @" << stats.net_score << ")";
-}
-
-static float random_burden()
-{
-	unsigned rv = rand_gen();
-	return .2f + .8f * + ((rv & 255u) / 255.f) * (((rv >> 8u) & 255u) / 2.55f);
-}
-
-static float random_value(float burden)
-{
-	unsigned rv = rand_gen();
-	float uncorrelated_val = ((rv & 255u) / 255.f) * (((rv >> 8u) & 255u) / 2.55f);
-	return std::sqrt(burden * uncorrelated_val);
-}
-
-static float random_capacity(size_t decisions)
-{
-	float capacity = 0.f;
-	size_t N = decisions;
-	for (size_t i = N/2; i < N; ++i) capacity += random_burden();
-	return capacity;
-}
-
-void write_svg(std::ostream &out, Knapsack &problem, float max_burden)
-{
-	out << std::fixed << std::setprecision(3);
-
-	float svg_width = 600.0f, svg_height = 200.0f;
-
-	out << "<svg width=\"" << svg_width << "\" height=\"" << svg_height << "\">\n";
-
-	// Capacity
-	out << "\t<g stroke=\"black\" fill=\"darkgray\" stroke-width=\"0\">\n";
-	out << "\t<rect x=\"30\" y=\"150\" width=\"540\" height=\"20\" fill=\"darkgray\"/>\n";
-	out << "\t<rect x=\"30\" y=\"50\" width=\"20\" height=\"120\" fill=\"darkgray\"/>\n";
-	out << "\t<rect x=\"550\" y=\"50\" width=\"20\" height=\"120\" fill=\"darkgray\"/>\n";
-	out << "\t</g>\n";
-
-	out << "\t<g stroke=\"black\" fill=\"gray\" stroke-width=\".5\">\n";
-
-	float x = 50.f, x_scale = 500.f / max_burden, y_scale = 100.f / 4.f;
-
-	struct box_t
-	{
-		float burden, value_burden_ratio;
-		size_t index;
-	};
-	std::vector<box_t> boxes;
-
-	for (unsigned i = 0; i < problem.decisions.size(); ++i)
-	{
-		auto *d = problem.decisions[i];
-		auto &c = d->chosen();
-		if (c.burden <= 0.f) continue;
-
-		box_t box = {c.burden, c.value / c.burden, i};
-		boxes.push_back(box);
-	}
-	std::sort(boxes.begin(), boxes.end(), [](const box_t &l, const box_t &r) -> bool {return l.value_burden_ratio > r.value_burden_ratio;});
-
-	for (auto &box : boxes)
-	{
-		auto *d = problem.decisions[box.index];
-		auto &c = d->chosen();
-
-		float y = 150.f;
-		float wid = x_scale * box.burden, hei = y_scale * box.value_burden_ratio;
-
-		if (c.value == 0.f) {y += 10.f; hei = 10.f;}
-
-		out << "\t\t<rect x=\"" << x << "\" y=\"" << (y-hei)
-			<< "\" width=\"" << wid << "\" height=\"" << hei;
-		if (c.value == 0.f) out << "\" fill=\"#CC6666";
-		else if (d->option_count == 2) out << "\" fill=\"#55BBBB";
-		out << "\"/>";
-		out << "<!-- " << c << " -->" "\n";
-		x += wid;
-	}
-
-	out << "\t</g>\n";
-
-	out << "</svg>";
-}
-
-void describe_problem(std::ostream &out, Knapsack &problem)
-{
-	out << "problem & solution:" << endl;
-	for (unsigned i = 0; i < problem.decisions.size(); ++i)
-	{
-		auto &decision = problem.decisions[i];
-		out << " " << std::setw(3) << (i+1) << ": ";
-		auto opts = decision->option_count;
-		switch (opts)
-		{
-		case 0: case 1: out << "   ";                       break;
-		case 2:  out << (decision->choice ? " on" : "off");  break;
-		default: out << (decision->choice+1) << "/" << opts; break;
-		}
-		
-		//<< " " << decision.chosen()
-		//<< " @" << std::setw(2) << decision.chosen().score << endl
-		out << " ~ " << *decision << endl;
-	}
-	out << endl;
-
-	/*out << "solution:" << endl;
-	for (auto &decision : problem.decisions)
-	{
-		cout << "  d" << std::setw(3) << (&decision-&problem.decisions[0] + 1)
-			
-	}*/
-}
-
-void generate_decision(Knapsack::Decision &decision, std::vector<Knapsack::Option> &options)
-{
-	switch (rand_gen() & 7)
-	{
-	case 0:
-		// Fixed burden
-		decision.option_count = 1;
-		options.push_back(Knapsack::Option{random_burden()});
-		break;
-
-	case 1:
-		// Fixed incentive
-		decision.option_count = 1;
-		options.push_back(Knapsack::Option{0, random_value(random_burden()) - random_value(random_burden())});
-		break;
-			
-	case 2: case 3: case 4:
-		// Binary choice
-		{
-			float burden = random_burden(), value = random_value(burden);
-
-			decision.option_count = 2;
-			options.push_back(Knapsack::Option{0,0});
-			options.push_back(Knapsack::Option{burden, value});
-		}
-		break;
-
-	case 5: case 6:
-		// Multiple choice, orderly
-		{
-			float burden = 0.f, value = 0.f;
-			unsigned count = 2u + (1u + (rand_gen() & 3u)) * (1u + (rand_gen() & 3u));
-			for (unsigned i = 0; i < count; ++i)
-			{
-				float new_burden = random_burden() * (2.f/count);
-				burden += new_burden;
-				value += random_value(new_burden);
-				Knapsack::Option option = {burden, value};
-				options.push_back(option);
-				++decision.option_count;
-			}
-		}
-		break;
-
-	case 7: default:
-		// Multiple choice, chaotic
-		{
-			unsigned count = 2u + (1u + (rand_gen() & 3u)) * (1u + (rand_gen() & 3u));
-			for (unsigned i = 0; i < count; ++i)
-			{
-				float burden = random_burden() * 2.f;
-				float value = random_value(burden);
-				Knapsack::Option option = {burden, value};
-				options.push_back(option);
-				++decision.option_count;
-			}
-		}
-		break;
-	}
-
-	decision.options = &options[options.size() - decision.option_count];
-}
-
-void generate_problem(Knapsack &knapsack, size_t count = 50)
-{
-	static std::vector<Knapsack::Decision> decisions;
-	static std::vector<Knapsack::Option>   options;
-
-	decisions.clear();
-	options.clear();
-
-	// Generate a list of decisions
-	for (unsigned i = 0; i < count; ++i)
-	{
-		decisions.emplace_back(Knapsack::Decision());
-		generate_decision(decisions.back(), options);
-	}
-
-	// Set the option-list pointers
-	Knapsack::Option *option = options.data();
-	for (auto &d : decisions)
-	{
-		d.options = option;
-		option += d.option_count;
-	}
-
-	// Formulate a knapsack problem
-	knapsack.decisions.clear();
-	for (auto &d : decisions)
-	{
-		knapsack.add_decision(&d);
-	}
-}
-
-void test_knapsack()
-{
-	Knapsack problem;
-
-	srand(unsigned(time(NULL)));
-
-	cout << std::fixed << std::setprecision(1);
-
-	while (true)
-	{
-		cout << "Generating a new multiple-choice knapsack problem." << endl;
-		generate_problem(problem);
-		cout << endl;
-
-		cout << "  problem:" << endl;
-
-		unsigned precision = 30;
-		float max_burden = random_capacity(problem.decisions.size());
-
-		{
-			size_t total_options = 0;
-			for (auto *d : problem.decisions) total_options += d->option_count;
-
-			cout << "    decisions:     " << problem.decisions.size() << endl;
-			cout << "    total options: " << total_options << endl;
-			cout << "    mean opt/dec:  " << (float(total_options)/problem.decisions.size()) << endl;
-
-			cout << "    burden limit:  #" << max_burden << endl;
-			cout << "    precision:     " << precision << endl;
-			cout << "    worst-case:    " << (precision * problem.decisions.size() * total_options) << " iterations" << endl;
-			cout << endl;
-		}
-
-		// Run solver
-		cout << "    (...solving...)" << endl;
-		auto prof_time = std::chrono::high_resolution_clock::now();
-		bool successful = problem.decide(max_burden, precision);
-		float time_taken = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - prof_time).count();
-		cout << endl;
-
-		{
-			size_t table_size = problem.minimums.store.size(),
-				table_size_max = problem.decisions.size() * problem.stats.highest.net_score;
-
-			/*for (auto &item : problem.minimums.store)
-			{
-				if (!(item.net_burden < Knapsack::economy_t::infinite())) ++table_empties;
-			}*/
-
-			cout << "  solver data:" << endl;
-			cout << "    solver time: " << (1000000.f*time_taken) << " us" << endl;
-			cout << "    solution is: ";
-			if      (problem.stats.iterations) cout << "approximate (" << problem.stats.iterations << " iterations)";
-			else if (successful)               cout << "ideal";
-			else                               cout << "impossible (selecting minimum burden)";
-			cout << endl;
-			if (table_size)
-			{
-				cout << "    table size:  " << table_size << endl;
-				cout << "    table fill:  " << (100.f*table_size / table_size_max) << "%" << endl;
-			}
-			cout << endl;
-		}
-
-		{
-			cout << "  solution stats:" << endl;
-			cout << "    min-burden: " << problem.stats.lightest << endl;
-			cout << "    max-score:  " << problem.stats.highest << endl;
-			cout << "    chosen:     " << problem.stats.chosen << endl;
-			cout << "    efficiency: "
-				<< "(#" << (100.f*problem.stats.chosen.net_burden / problem.stats.highest.net_burden) << "%"
-				<< " $" << (100.f*problem.stats.chosen.net_value  / problem.stats.highest.net_value ) << "%"
-				<< " @" << (100.f*problem.stats.chosen.net_score / problem.stats.highest.net_score) << "%) compared to max-score" << endl;
-			cout << endl;
-		}
-
-		
-
-		while (true)
-		{
-			cout << "What now?\n"
-				"  R = go again (default action)\n"
-				"  V = view problem and solution\n"
-				"  S = save SVG diagram\n"
-				"  Q = quit\n"
-				">> ";
-			std::string s;
-			std::getline(std::cin, s);
-
-			if (s.length() == 0 || s[0] == 'r' || s[0] == 'R' || s[0] == '\r' || s[0] == '\n')
-			{
-				break;
-			}
-			else if (s[0] == 'v' || s[0] == 'V')
-			{
-				describe_problem(cout, problem);
-			}
-			else if (s[0] == 'q' || s[0] == 'Q')
-			{
-				return;
-			}
-			else if (s[0] == 's' || s[0] == 'S')
-			{
-				std::ofstream out("solution.svg");
-				write_svg(out, problem, max_burden);
-				if (out.good()) cout << "saved to solution.svg" << endl;
-				else            cout << "couldn't save to solution.svg" << endl;
-			}
-			else
-			{
-				cout << "unknown command." << endl;
-			}
-		}
-	}
-}
-
-class SimSetting : public Setting
-{
-public:
-	choice_index_t choice_index = 0;
-
-	std::vector<Option> optionVec;
-	Options            _options;
-
-	std::vector<std::normal_distribution<float>> costs;
-
-	unsigned random_steps = 1;
-
-	Measurement measure;
-
-	std::string _id;
-
-	SimSetting()
-	{
-		Knapsack_<economy_t>::Decision tmp_decision;
-		std::vector<Knapsack_<economy_t>::Option> tmp_options;
-		generate_decision(tmp_decision, tmp_options);
-
-		// Cost generators
-		std::uniform_real_distribution<float> exp_range
-			//{1e-20f, 1e-20f};
-			{std::log(1.02f), std::log(1.25f)};
-		for (auto &option : tmp_options)
-		{
-			optionVec.push_back({option.value});
-			costs.emplace_back(
-				std::log(std::max(option.burden, 1e-20f)),
-				exp_range(rand_gen));
-		}
-		_options.options = optionVec.data();
-		_options.option_count = Goblin::choice_index_t(optionVec.size());
-
-#if 0
-		std::cout << "some measures:";
-		Goblin::burden_stat_t stat;
-		for (unsigned i = 0; i < 100; ++i)
-		{
-			update();
-			auto m = measurement();
-			if (i < 4) std::cout << " #" << m.burden;
-			stat.push_decay(m.burden, 1.f - 1.f/30.f);
-		}
-		std::cout << " .. mean #" << stat.mean() << " sigma #" << stat.variance() << std::endl;
-#endif
-
-		// Generate ID
-		for (unsigned i = 0; i < 12; ++i)
-		{
-			_id.push_back('a' + (rand_gen()%26));
-		}
-	}
-
-	virtual choice_index_t choice_default() const override
-	{
-		return choice_index;
-	}
-	void choice_set(
-		choice_index_t   _choice_index,
-		strategy_index_t strategy_index) override
-	{
-		choice_index = _choice_index;
-	}
-
-	const Options &options() const override
-	{
-		return _options;
-	}
-	const Option &chosen()
-	{
-		return _options.options[choice_index];
-	}
-
-	Measurement measurement() override
-	{
-		Measurement m = measure;
-		measure.choice = NO_CHOICE;
-		//if (m.valid())
-		//	cout << "Prf[" << _id << "]: " << m.choice << " #" << m.burden << endl;
-		return m;
-	}
-
-	void update()
-	{
-		measure.burden = std::exp(costs[choice_index](rand_gen));
-		measure.choice = choice_index;
-	}
-
-	const std::string &id() const override    {return _id;}
-
-	float expect_mean(unsigned option_index)
-	{
-		auto &o = costs[option_index];
-		return std::exp(o.mean() + .5f*o.stddev()*o.stddev());
-	}
-};
-
-void test_goblin()
-{
-	bool repeat_problem = false;
-
-	std::list<SimSetting> scenario;
-
-	Profile_f saved_profile;
-
-	while (true)
-	{
-		cout << std::fixed << std::setprecision(1);
-
-		Goblin goblin;
-
-		auto &knapsack = goblin.knapsack();
-		auto &chosen = knapsack.stats.chosen;
-
-		if (repeat_problem)
-		{
-			cout << "Running a goblin scenario with past-run knowledge." << endl;
-
-			goblin.set_past_profile(saved_profile);
-			goblin.set_profile(Profile_f());
-
-			for (auto &item : scenario) goblin.add(&item);
-		}
-		else
-		{
-			cout << "Generating a new goblin scenario." << endl;
-
-			scenario.clear();
-
-			for (size_t i = 0; i < 50; ++i)
-			{
-				scenario.emplace_back();
-				goblin.add(&scenario.back());
-			}
-		}
-
-		Goblin::capacity_t capacity =
-			{1.5f * random_capacity(scenario.size()), 4};
-		size_t precision = 30;
-
-		
-		goblin.config.explore_value = (repeat_problem ? 0.f : 50.f);
-		
-
-#if 0
-		// DEBUG: give the goblin complete knowledge of (non-varying) burdens
-		for (auto &setting : scenario)
-		{
-			size_t count = setting.options().option_count;
-			for (size_t i = 0; i < count; ++i)
-			{
-				setting.choice_set(i, 0);
-				setting.update();
-				auto m = setting.measurement();
-				goblin.make_certain(setting.id(), i, count, {m.burden, 0});
-			}
-		}
-#endif
-
-		size_t option_count = 0;
-		for (auto &s : scenario) option_count += s.options().option_count;
-
-		{
-			cout << "  capacity:      #" << capacity.limit << " at mean+sigma*" << capacity.sigmas << endl;
-			cout << "  precision:      " << precision << endl;
-			cout << "  settings:       " << scenario.size()
-				<< ", totaling " << option_count << " options" << endl;
-			cout << "  measure quota:  " << goblin.config.measure_quota << endl;
-			cout << "  explore value: $" << goblin.config.explore_value << endl;
-		}
-
-		float knowledge_max = option_count * goblin.config.measure_quota;
-
-		cout << "Running simulation..." << endl;
-		size_t frames = 0, frames_prev = 0, frames_overload = 0, frames_overload_prev = 0;
-		SimSetting::burden_t load_total = {}, load_pess = {},
-			high_load_total = {}, light_load_total = {},
-			last_net_burden = {};
-		SimSetting::value_t value_total = 0.f;
-		float calc_time_total = 0.f;
-
-		for (size_t s = 4; s <= 16; s += 2)
-		{
-			unsigned explored_count = 0;
-			float knowledge_count = 0;
-
-			size_t frame_quota = size_t(1) << s;
-
-			frames_prev = frames;
-			frames_overload_prev = frames_overload;
-			while (frames < frame_quota)
-			{
-				++frames;
-
-				// Update goblin
-				auto prof_time = std::chrono::high_resolution_clock::now();
-				goblin.update(capacity, precision);
-				calc_time_total += std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - prof_time).count();
-
-				// Update all settings...
-				for (auto &setting : scenario) setting.update();
-
-				// Calculate stats for this frame
-				SimSetting::burden_t net_burden = 0.f;
-				SimSetting::value_t  net_value = 0.f;
-				knowledge_count = 0;
-				explored_count = 0;
-				for (auto &setting : scenario)
-				{
-					net_burden += setting.measure.burden;
-					net_value += setting.chosen().value;
-
-					auto QUOTA = goblin.config.measure_quota;
-
-					if (auto est = goblin.profile().find(setting.id()))
-					{
-						auto pest = goblin.past_profile().find(setting.id());
-
-						if (est->meets_quota(QUOTA) || (pest && pest->meets_quota(QUOTA)))
-							++explored_count;
-
-						for (unsigned i = 0; i < est->count; ++i)
-							knowledge_count += std::min(QUOTA,
-								est->estimates[i].full.count() +
-								(pest ? pest->estimates[i].full.count() : Goblin::scalar_t(0)));
-					}
-				}
-
-				//assert(net_burden == chosen.net_burden.mean);
-
-				// Accumulate stats
-				last_net_burden = net_burden;
-				load_total += net_burden;
-				load_pess += chosen.net_burden.sigma_offset(capacity.sigmas);
-				high_load_total += knapsack.stats.highest.net_burden.sigma_offset(capacity.sigmas);
-				light_load_total += knapsack.stats.lightest.net_burden.sigma_offset(capacity.sigmas);
-				value_total += net_value;
-				if (!Goblin::economy_t::acceptable(net_burden, capacity.limit)) ++frames_overload;
-			}
-
-			Goblin::scalar_t total_data = 0;
-			for (auto &s : scenario)
-			{
-				auto *entry = goblin.profile().find(s.id());
-				if (entry) total_data += entry->data_count();
-			}
-
-			cout << "  after " << frames << " frames:" << endl;
-			cout << "     goblin CPU avg: " << (1000000.f * calc_time_total / frames) << " us" << endl;
-			cout << "     over-budget:    "
-				<< (100.f * (frames_overload-frames_overload_prev) / (frames-frames_prev)) << "%"
-					<< " (" << (frames_overload-frames_overload_prev) << "/" << (frames-frames_prev) << "), overall "
-				<< (100.f * frames_overload / frames) << "%"
-					<< " (" << frames_overload << "/" << frames << ")" << endl;
-			cout << "     profiling data: " << (100.f * knowledge_count / knowledge_max) << "%"
-				<< ", " << explored_count << "/" << scenario.size() << " settings fully explored"
-				/*<< " using " << total_data << " measurements"*/ << endl;
-			cout << "     mean workload:  " << (100.f * load_total / (capacity.limit*frames)) << "%"
-				<< " (#" << (load_total / frames) << " / limit: #" << capacity.limit << ")" << endl;
-			cout << "     pess.workload:  " << (100.f * load_pess / (capacity.limit*frames)) << "%"
-				<< " (#" << (load_pess / frames)
-				<< " / high: #" << (high_load_total / frames)
-				<< " / light: #" << (light_load_total / frames) << ")" << endl;
-			cout << "     mean value:     $" << (value_total / frames)
-				<< " / high: $" << knapsack.stats.highest.net_value
-				<< " / light: $" << knapsack.stats.lightest.net_value << endl;
-			cout << "     last choice:    #(" << chosen.net_burden.mean
-				<< " ~ " << std::sqrt(chosen.net_burden.var) << ") -> #" << last_net_burden
-				<< " $" << chosen.net_value << endl;
-			cout << "     present/past:   " << (100.f*goblin.past_present_ratio()) << "%" << endl;
-		}
-		
-
-		while (true)
-		{
-			cout << endl;
-			cout << "What now?\n"
-				"  N = test with new problem (default action\n"
-				"  R = test with same problem, keeping knowledge\n"
-				"  P = view profile data\n"
-				"  Q = quit (proceed to knapsack test)\n"
-				">> ";
-			std::string s;
-			std::getline(std::cin, s);
-			cout << endl;
-
-			if (s.length() == 0 || s[0] == 'n' || s[0] == 'N' || s[0] == '\r' || s[0] == '\n')
-			{
-				repeat_problem = false;
-				break;
-			}
-			else if (s[0] == 'r' || s[0] == 'R')
-			{
-				saved_profile = goblin.full_profile();
-				repeat_problem = true;
-				break;
-			}
-			else if (s[0] == 'q' || s[0] == 'Q')
-			{
-				return;
-			}
-			else if (s[0] == 'p' || s[0] == 'P')
-			{
-				cout << "Profile data...";
-				cout << "  capacity:     #" << capacity.limit << " at mean+sigma*" << capacity.sigmas << endl;
-				cout << "  measure quota: " << goblin.config.measure_quota << endl;
-
-				std::stringstream ss;
-				ss << std::fixed << std::setprecision(2);
-				ss << goblin.profile();
-
-				cout << ss.str() << endl;
-
-				{
-					cout << "Copying profile data..." << endl;
-					Profile_f copy;
-					ss >> copy;
-					if (!ss.fail() && !ss.bad())
-					{
-						std::stringstream ss2;
-						ss2 << std::fixed << std::setprecision(2);
-						ss2 << copy;
-						if (ss2.str() == ss2.str())
-						{
-							cout << "  copy has the same textual representation (success)" << endl;
-						}
-						else
-						{
-							cout << "  printing the copy..." << endl;
-							cout << ss2.str() << endl;
-						}
-					}
-					else cout << "  failed to re-parse the above text into a profile." << endl;
-				}
-
-				/*size_t n = 0;
-				for (auto &setting : scenario)
-				{
-					if (setting.options().option_count <= 1) continue;
-					auto *decision = goblin.get_decision(&setting);
-					auto *est = goblin.profile().find(setting.id());
-					std::cout << "  D" << (++n) << ": ";
-					if (!est)
-					{
-						cout << "[NO DATA] ";
-					}
-					else for (size_t i = 0; i < setting.options().option_count; ++i)
-					{
-						auto &entry = est->estimates[i];
-						std::cout << int(entry.full.count())
-							<< ":{#" << entry.full.mean() << " ~#" << decision->options[i].burden.mean
-							<< " $" << setting.options().options[i].value << "} ";
-					}
-					std::cout << std::endl;
-					//std::cout << "o1 m #" << first.full.mean() << " sig #" << first.this_run.deviation() << std::endl;
-					//if (++n >= 9) break;
-				}*/
-
-				cout << endl;
-			}
-			/*else if (s[0] == 's' || s[0] == 'S')
-			{
-				std::ofstream out("solution.svg");
-				write_svg(out, problem, max_burden);
-				if (out.good()) cout << "saved to solution.svg" << endl;
-				else            cout << "couldn't save to solution.svg" << endl;
-			}*/
-			else
-			{
-				cout << "unknown command." << endl;
-			}
-		}
-	}
-}
-
-int main(int argc, char **argv)
-{
-	test_goblin();
-	test_knapsack();
-}
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <list>
+#include <deque>
+#include <cmath>
+#include <ctime>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <atomic>
+
+#include "knapsack.h"
+#include "goblin.h"
+#include "goblin_timer.h"
+#include "goblin_perf_event.h"
+#include "profile_json.h"
+#include "profile_view.h"
+#include "profile_journal.h"
+#include "goblin_state.h"
+#include "goblin_trace.h"
+#include "knapsack_json.h"
+#include "knapsack_exact.h"
+
+
+using namespace perf_goblin;
+
+using std::cout;
+using std::endl;
+
+
+static std::random_device rand_dev;
+static std::mt19937       rand_gen;
+
+
+std::ostream& operator<<(std::ostream &out, const Knapsack::Option &option)
+{
+	return out << "(#" << option.burden << " $" << option.value << ')';
+}
+
+std::ostream& operator<<(std::ostream &out, const Knapsack::Decision &decision)
+{
+	out << '{';
+	for (size_t i = 0; i < decision.option_count; ++i)
+	{
+		out << (i ? ", " : "") << decision.options[i];
+	}
+	out << '}';
+	return out;
+}
+
+std::ostream& operator<<(std::ostream &out, const Knapsack::Stats &stats)
+{
+	return out << "(#" << stats.net_burden << " $" << stats.net_value << " @" << stats.net_score << ")";
+}
+
+static float random_burden()
+{
+	unsigned rv = rand_gen();
+	return .2f + .8f * + ((rv & 255u) / 255.f) * (((rv >> 8u) & 255u) / 2.55f);
+}
+
+static float random_value(float burden)
+{
+	unsigned rv = rand_gen();
+	float uncorrelated_val = ((rv & 255u) / 255.f) * (((rv >> 8u) & 255u) / 2.55f);
+	return std::sqrt(burden * uncorrelated_val);
+}
+
+static float random_capacity(size_t decisions)
+{
+	float capacity = 0.f;
+	size_t N = decisions;
+	for (size_t i = N/2; i < N; ++i) capacity += random_burden();
+	return capacity;
+}
+
+void write_svg(std::ostream &out, Knapsack &problem, float max_burden)
+{
+	out << std::fixed << std::setprecision(3);
+
+	float svg_width = 600.0f, svg_height = 200.0f;
+
+	out << "<svg width=\"" << svg_width << "\" height=\"" << svg_height << "\">\n";
+
+	// Capacity
+	out << "\t<g stroke=\"black\" fill=\"darkgray\" stroke-width=\"0\">\n";
+	out << "\t<rect x=\"30\" y=\"150\" width=\"540\" height=\"20\" fill=\"darkgray\"/>\n";
+	out << "\t<rect x=\"30\" y=\"50\" width=\"20\" height=\"120\" fill=\"darkgray\"/>\n";
+	out << "\t<rect x=\"550\" y=\"50\" width=\"20\" height=\"120\" fill=\"darkgray\"/>\n";
+	out << "\t</g>\n";
+
+	out << "\t<g stroke=\"black\" fill=\"gray\" stroke-width=\".5\">\n";
+
+	float x = 50.f, x_scale = 500.f / max_burden, y_scale = 100.f / 4.f;
+
+	struct box_t
+	{
+		float burden, value_burden_ratio;
+		size_t index;
+	};
+	std::vector<box_t> boxes;
+
+	for (unsigned i = 0; i < problem.decisions.size(); ++i)
+	{
+		auto *d = problem.decisions[i];
+		auto &c = d->chosen();
+		if (c.burden <= 0.f) continue;
+
+		box_t box = {c.burden, c.value / c.burden, i};
+		boxes.push_back(box);
+	}
+	std::sort(boxes.begin(), boxes.end(), [](const box_t &l, const box_t &r) -> bool {return l.value_burden_ratio > r.value_burden_ratio;});
+
+	for (auto &box : boxes)
+	{
+		auto *d = problem.decisions[box.index];
+		auto &c = d->chosen();
+
+		float y = 150.f;
+		float wid = x_scale * box.burden, hei = y_scale * box.value_burden_ratio;
+
+		if (c.value == 0.f) {y += 10.f; hei = 10.f;}
+
+		out << "\t\t<rect x=\"" << x << "\" y=\"" << (y-hei)
+			<< "\" width=\"" << wid << "\" height=\"" << hei;
+		if (c.value == 0.f) out << "\" fill=\"#CC6666";
+		else if (d->option_count == 2) out << "\" fill=\"#55BBBB";
+		out << "\"/>";
+		out << "<!-- " << c << " -->" "\n";
+		x += wid;
+	}
+
+	out << "\t</g>\n";
+
+	out << "</svg>";
+}
+
+void describe_problem(std::ostream &out, Knapsack &problem)
+{
+	out << "problem & solution:" << endl;
+	for (unsigned i = 0; i < problem.decisions.size(); ++i)
+	{
+		auto &decision = problem.decisions[i];
+		out << " " << std::setw(3) << (i+1) << ": ";
+		auto opts = decision->option_count;
+		switch (opts)
+		{
+		case 0: case 1: out << "   ";                       break;
+		case 2:  out << (decision->choice ? " on" : "off");  break;
+		default: out << (decision->choice+1) << "/" << opts; break;
+		}
+		
+		//<< " " << decision.chosen()
+		//<< " @" << std::setw(2) << decision.chosen().score << endl
+		out << " ~ " << *decision << endl;
+	}
+	out << endl;
+
+	/*out << "solution:" << endl;
+	for (auto &decision : problem.decisions)
+	{
+		cout << "  d" << std::setw(3) << (&decision-&problem.decisions[0] + 1)
+			
+	}*/
+}
+
+/*
+	kind selects one of the cases below (default: random).
+		option_count fixes the number of options in a multiple choice (default: random).
+*/
+void generate_decision(Knapsack::Decision &decision, std::vector<Knapsack::Option> &options,
+	int kind = -1, unsigned option_count = 0)
+{
+	switch (kind < 0 ? int(rand_gen() & 7) : kind)
+	{
+	case 0:
+		// Fixed burden
+		decision.option_count = 1;
+		options.push_back(Knapsack::Option{random_burden()});
+		break;
+
+	case 1:
+		// Fixed incentive
+		decision.option_count = 1;
+		options.push_back(Knapsack::Option{0, random_value(random_burden()) - random_value(random_burden())});
+		break;
+			
+	case 2: case 3: case 4:
+		// Binary choice
+		{
+			float burden = random_burden(), value = random_value(burden);
+
+			decision.option_count = 2;
+			options.push_back(Knapsack::Option{0,0});
+			options.push_back(Knapsack::Option{burden, value});
+		}
+		break;
+
+	case 5: case 6:
+		// Multiple choice, orderly
+		{
+			float burden = 0.f, value = 0.f;
+			unsigned count = option_count ? option_count : 2u + (1u + (rand_gen() & 3u)) * (1u + (rand_gen() & 3u));
+			for (unsigned i = 0; i < count; ++i)
+			{
+				float new_burden = random_burden() * (2.f/count);
+				burden += new_burden;
+				value += random_value(new_burden);
+				Knapsack::Option option = {burden, value};
+				options.push_back(option);
+				++decision.option_count;
+			}
+		}
+		break;
+
+	case 7: default:
+		// Multiple choice, chaotic
+		{
+			unsigned count = option_count ? option_count : 2u + (1u + (rand_gen() & 3u)) * (1u + (rand_gen() & 3u));
+			for (unsigned i = 0; i < count; ++i)
+			{
+				float burden = random_burden() * 2.f;
+				float value = random_value(burden);
+				Knapsack::Option option = {burden, value};
+				options.push_back(option);
+				++decision.option_count;
+			}
+		}
+		break;
+	}
+
+	decision.options = &options[options.size() - decision.option_count];
+}
+
+void generate_problem(Knapsack &knapsack, size_t count = 50, int kind = -1, unsigned option_count = 0)
+{
+	static std::vector<Knapsack::Decision> decisions;
+	static std::vector<Knapsack::Option>   options;
+
+	decisions.clear();
+	options.clear();
+
+	// Generate a list of decisions
+	for (unsigned i = 0; i < count; ++i)
+	{
+		decisions.emplace_back(Knapsack::Decision());
+		generate_decision(decisions.back(), options, kind, option_count);
+	}
+
+	// Set the option-list pointers
+	Knapsack::Option *option = options.data();
+	for (auto &d : decisions)
+	{
+		d.options = option;
+		option += d.option_count;
+	}
+
+	// Formulate a knapsack problem
+	knapsack.decisions.clear();
+	for (auto &d : decisions)
+	{
+		knapsack.add_decision(&d);
+	}
+}
+
+void test_knapsack()
+{
+	Knapsack problem;
+
+	srand(unsigned(time(NULL)));
+
+	cout << std::fixed << std::setprecision(1);
+
+	while (true)
+	{
+		cout << "Generating a new multiple-choice knapsack problem." << endl;
+		generate_problem(problem);
+		cout << endl;
+
+		cout << "  problem:" << endl;
+
+		unsigned precision = 30;
+		float max_burden = random_capacity(problem.decisions.size());
+
+		{
+			size_t total_options = 0;
+			for (auto *d : problem.decisions) total_options += d->option_count;
+
+			cout << "    decisions:     " << problem.decisions.size() << endl;
+			cout << "    total options: " << total_options << endl;
+			cout << "    mean opt/dec:  " << (float(total_options)/problem.decisions.size()) << endl;
+
+			cout << "    burden limit:  #" << max_burden << endl;
+			cout << "    precision:     " << precision << endl;
+			cout << "    worst-case:    " << (precision * problem.decisions.size() * total_options) << " iterations" << endl;
+			cout << endl;
+		}
+
+		// Run solver
+		cout << "    (...solving...)" << endl;
+		auto prof_time = std::chrono::high_resolution_clock::now();
+		bool successful = problem.decide(max_burden, precision);
+		float time_taken = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - prof_time).count();
+		cout << endl;
+
+		{
+			size_t table_size = problem.minimums.store.size(),
+				table_size_max = problem.decisions.size() * problem.stats.highest.net_score;
+
+			/*for (auto &item : problem.minimums.store)
+			{
+				if (!(item.net_burden < Knapsack::economy_t::infinite())) ++table_empties;
+			}*/
+
+			cout << "  solver data:" << endl;
+			cout << "    solver time: " << (1000000.f*time_taken) << " us" << endl;
+			cout << "    solution is: ";
+			if      (problem.stats.iterations) cout << "approximate (" << problem.stats.iterations << " iterations)";
+			else if (successful)               cout << "ideal";
+			else                               cout << "impossible (selecting minimum burden)";
+			cout << endl;
+			if (table_size)
+			{
+				cout << "    table size:  " << table_size << endl;
+				cout << "    table fill:  " << (100.f*table_size / table_size_max) << "%" << endl;
+			}
+			cout << endl;
+		}
+
+		{
+			cout << "  solution stats:" << endl;
+			cout << "    min-burden: " << problem.stats.lightest << endl;
+			cout << "    max-score:  " << problem.stats.highest << endl;
+			cout << "    chosen:     " << problem.stats.chosen << endl;
+			cout << "    efficiency: "
+				<< "(#" << (100.f*problem.stats.chosen.net_burden / problem.stats.highest.net_burden) << "%"
+				<< " $" << (100.f*problem.stats.chosen.net_value  / problem.stats.highest.net_value ) << "%"
+				<< " @" << (100.f*problem.stats.chosen.net_score / problem.stats.highest.net_score) << "%) compared to max-score" << endl;
+			cout << endl;
+		}
+
+		
+
+		while (true)
+		{
+			cout << "What now?\n"
+				"  R = go again (default action)\n"
+				"  V = view problem and solution\n"
+				"  S = save SVG diagram\n"
+				"  Q = quit\n"
+				">> ";
+			std::string s;
+			std::getline(std::cin, s);
+
+			if (s.length() == 0 || s[0] == 'r' || s[0] == 'R' || s[0] == '\r' || s[0] == '\n')
+			{
+				break;
+			}
+			else if (s[0] == 'v' || s[0] == 'V')
+			{
+				describe_problem(cout, problem);
+			}
+			else if (s[0] == 'q' || s[0] == 'Q')
+			{
+				return;
+			}
+			else if (s[0] == 's' || s[0] == 'S')
+			{
+				std::ofstream out("solution.svg");
+				write_svg(out, problem, max_burden);
+				if (out.good()) cout << "saved to solution.svg" << endl;
+				else            cout << "couldn't save to solution.svg" << endl;
+			}
+			else
+			{
+				cout << "unknown command." << endl;
+			}
+		}
+	}
+}
+
+class SimSetting : public Setting
+{
+public:
+	choice_index_t choice_index = 0;
+
+	std::vector<Option> optionVec;
+	Options            _options;
+
+	std::vector<std::normal_distribution<float>> costs;
+
+	unsigned random_steps = 1;
+
+	// Multiplies all burdens, for simulating changing conditions.
+	float cost_scale = 1.f;
+
+	Measurement measure;
+
+	std::string _id;
+
+	SimSetting()
+	{
+		Knapsack_<economy_t>::Decision tmp_decision;
+		std::vector<Knapsack_<economy_t>::Option> tmp_options;
+		generate_decision(tmp_decision, tmp_options);
+
+		// Cost generators
+		std::uniform_real_distribution<float> exp_range
+			//{1e-20f, 1e-20f};
+			{std::log(1.02f), std::log(1.25f)};
+		for (auto &option : tmp_options)
+		{
+			optionVec.push_back({option.value});
+			costs.emplace_back(
+				std::log(std::max(option.burden, 1e-20f)),
+				exp_range(rand_gen));
+		}
+		_options.options = optionVec.data();
+		_options.option_count = Goblin::choice_index_t(optionVec.size());
+
+#if 0
+		std::cout << "some measures:";
+		Goblin::burden_stat_t stat;
+		for (unsigned i = 0; i < 100; ++i)
+		{
+			update();
+			auto m = measurement();
+			if (i < 4) std::cout << " #" << m.burden;
+			stat.push_decay(m.burden, 1.f - 1.f/30.f);
+		}
+		std::cout << " .. mean #" << stat.mean() << " sigma #" << stat.variance() << std::endl;
+#endif
+
+		// Generate ID
+		for (unsigned i = 0; i < 12; ++i)
+		{
+			_id.push_back('a' + (rand_gen()%26));
+		}
+	}
+
+	virtual choice_index_t choice_default() const override
+	{
+		return choice_index;
+	}
+	void choice_set(
+		choice_index_t   _choice_index,
+		strategy_index_t strategy_index) override
+	{
+		choice_index = _choice_index;
+	}
+
+	const Options &options() const override
+	{
+		return _options;
+	}
+	const Option &chosen()
+	{
+		return _options.options[choice_index];
+	}
+
+	Measurement measurement() override
+	{
+		Measurement m = measure;
+		measure.choice = NO_CHOICE;
+		//if (m.valid())
+		//	cout << "Prf[" << _id << "]: " << m.choice << " #" << m.burden << endl;
+		return m;
+	}
+
+	void update()
+	{
+		measure.burden = cost_scale * std::exp(costs[choice_index](rand_gen));
+		measure.choice = (wants_measurement() ? choice_index : NO_CHOICE);
+	}
+
+	const std::string &id() const override    {return _id;}
+
+	float expect_mean(unsigned option_index)
+	{
+		auto &o = costs[option_index];
+		return cost_scale * std::exp(o.mean() + .5f*o.stddev()*o.stddev());
+	}
+};
+
+void test_goblin()
+{
+	bool repeat_problem = false;
+
+	std::list<SimSetting> scenario;
+
+	Profile_f saved_profile;
+
+	while (true)
+	{
+		cout << std::fixed << std::setprecision(1);
+
+		Goblin goblin;
+
+		auto &knapsack = goblin.knapsack();
+		auto &chosen = knapsack.stats.chosen;
+
+		if (repeat_problem)
+		{
+			cout << "Running a goblin scenario with past-run knowledge." << endl;
+
+			goblin.set_past_profile(saved_profile);
+			goblin.set_profile(Profile_f());
+
+			for (auto &item : scenario) goblin.add(&item);
+		}
+		else
+		{
+			cout << "Generating a new goblin scenario." << endl;
+
+			scenario.clear();
+
+			for (size_t i = 0; i < 50; ++i)
+			{
+				scenario.emplace_back();
+				goblin.add(&scenario.back());
+			}
+		}
+
+		Goblin::capacity_t capacity =
+			{1.5f * random_capacity(scenario.size()), 4};
+		size_t precision = 30;
+
+		
+		goblin.config.explore_value = (repeat_problem ? 0.f : 50.f);
+		
+
+#if 0
+		// DEBUG: give the goblin complete knowledge of (non-varying) burdens
+		for (auto &setting : scenario)
+		{
+			size_t count = setting.options().option_count;
+			for (size_t i = 0; i < count; ++i)
+			{
+				setting.choice_set(i, 0);
+				setting.update();
+				auto m = setting.measurement();
+				goblin.make_certain(setting.id(), i, count, {m.burden, 0});
+			}
+		}
+#endif
+
+		size_t option_count = 0;
+		for (auto &s : scenario) option_count += s.options().option_count;
+
+		{
+			cout << "  capacity:      #" << capacity.limit << " at mean+sigma*" << capacity.sigmas << endl;
+			cout << "  precision:      " << precision << endl;
+			cout << "  settings:       " << scenario.size()
+				<< ", totaling " << option_count << " options" << endl;
+			cout << "  measure quota:  " << goblin.config.measure_quota << endl;
+			cout << "  explore value: $" << goblin.config.explore_value << endl;
+		}
+
+		float knowledge_max = option_count * goblin.config.measure_quota;
+
+		cout << "Running simulation..." << endl;
+		size_t frames = 0, frames_prev = 0, frames_overload = 0, frames_overload_prev = 0;
+		SimSetting::burden_t load_total = {}, load_pess = {},
+			high_load_total = {}, light_load_total = {},
+			last_net_burden = {};
+		SimSetting::value_t value_total = 0.f;
+		float calc_time_total = 0.f;
+
+		for (size_t s = 4; s <= 16; s += 2)
+		{
+			unsigned explored_count = 0;
+			float knowledge_count = 0;
+
+			size_t frame_quota = size_t(1) << s;
+
+			frames_prev = frames;
+			frames_overload_prev = frames_overload;
+			while (frames < frame_quota)
+			{
+				++frames;
+
+				// Update goblin
+				auto prof_time = std::chrono::high_resolution_clock::now();
+				goblin.update(capacity, precision);
+				calc_time_total += std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - prof_time).count();
+
+				// Update all settings...
+				for (auto &setting : scenario) setting.update();
+
+				// Calculate stats for this frame
+				SimSetting::burden_t net_burden = 0.f;
+				SimSetting::value_t  net_value = 0.f;
+				knowledge_count = 0;
+				explored_count = 0;
+				for (auto &setting : scenario)
+				{
+					net_burden += setting.measure.burden;
+					net_value += setting.chosen().value;
+
+					auto QUOTA = goblin.config.measure_quota;
+
+					if (auto est = goblin.profile().find(setting.id()))
+					{
+						auto pest = goblin.past_profile().find(setting.id());
+
+						if (est->meets_quota(QUOTA) || (pest && pest->meets_quota(QUOTA)))
+							++explored_count;
+
+						for (unsigned i = 0; i < est->count; ++i)
+							knowledge_count += std::min(QUOTA,
+								est->estimates[i].full.count() +
+								(pest ? pest->estimates[i].full.count() : Goblin::scalar_t(0)));
+					}
+				}
+
+				//assert(net_burden == chosen.net_burden.mean);
+
+				// Accumulate stats
+				last_net_burden = net_burden;
+				load_total += net_burden;
+				load_pess += chosen.net_burden.sigma_offset(capacity.sigmas);
+				high_load_total += knapsack.stats.highest.net_burden.sigma_offset(capacity.sigmas);
+				light_load_total += knapsack.stats.lightest.net_burden.sigma_offset(capacity.sigmas);
+				value_total += net_value;
+				if (!Goblin::economy_t::acceptable(net_burden, capacity.limit)) ++frames_overload;
+			}
+
+			Goblin::scalar_t total_data = 0;
+			for (auto &s : scenario)
+			{
+				auto *entry = goblin.profile().find(s.id());
+				if (entry) total_data += entry->data_count();
+			}
+
+			cout << "  after " << frames << " frames:" << endl;
+			cout << "     goblin CPU avg: " << (1000000.f * calc_time_total / frames) << " us" << endl;
+			cout << "     over-budget:    "
+				<< (100.f * (frames_overload-frames_overload_prev) / (frames-frames_prev)) << "%"
+					<< " (" << (frames_overload-frames_overload_prev) << "/" << (frames-frames_prev) << "), overall "
+				<< (100.f * frames_overload / frames) << "%"
+					<< " (" << frames_overload << "/" << frames << ")" << endl;
+			cout << "     profiling data: " << (100.f * knowledge_count / knowledge_max) << "%"
+				<< ", " << explored_count << "/" << scenario.size() << " settings fully explored"
+				/*<< " using " << total_data << " measurements"*/ << endl;
+			cout << "     mean workload:  " << (100.f * load_total / (capacity.limit*frames)) << "%"
+				<< " (#" << (load_total / frames) << " / limit: #" << capacity.limit << ")" << endl;
+			cout << "     pess.workload:  " << (100.f * load_pess / (capacity.limit*frames)) << "%"
+				<< " (#" << (load_pess / frames)
+				<< " / high: #" << (high_load_total / frames)
+				<< " / light: #" << (light_load_total / frames) << ")" << endl;
+			cout << "     mean value:     $" << (value_total / frames)
+				<< " / high: $" << knapsack.stats.highest.net_value
+				<< " / light: $" << knapsack.stats.lightest.net_value << endl;
+			cout << "     last choice:    #(" << chosen.net_burden.mean
+				<< " ~ " << std::sqrt(chosen.net_burden.var) << ") -> #" << last_net_burden
+				<< " $" << chosen.net_value << endl;
+			cout << "     present/past:   " << (100.f*goblin.past_present_ratio()) << "%" << endl;
+		}
+		
+
+		while (true)
+		{
+			cout << endl;
+			cout << "What now?\n"
+				"  N = test with new problem (default action\n"
+				"  R = test with same problem, keeping knowledge\n"
+				"  P = view profile data\n"
+				"  Q = quit (proceed to knapsack test)\n"
+				">> ";
+			std::string s;
+			std::getline(std::cin, s);
+			cout << endl;
+
+			if (s.length() == 0 || s[0] == 'n' || s[0] == 'N' || s[0] == '\r' || s[0] == '\n')
+			{
+				repeat_problem = false;
+				break;
+			}
+			else if (s[0] == 'r' || s[0] == 'R')
+			{
+				saved_profile = goblin.full_profile();
+				repeat_problem = true;
+				break;
+			}
+			else if (s[0] == 'q' || s[0] == 'Q')
+			{
+				return;
+			}
+			else if (s[0] == 'p' || s[0] == 'P')
+			{
+				cout << "Profile data...";
+				cout << "  capacity:     #" << capacity.limit << " at mean+sigma*" << capacity.sigmas << endl;
+				cout << "  measure quota: " << goblin.config.measure_quota << endl;
+
+				std::stringstream ss;
+				ss << std::fixed << std::setprecision(2);
+				ss << goblin.profile();
+
+				cout << ss.str() << endl;
+
+				{
+					cout << "Copying profile data..." << endl;
+					Profile_f copy;
+					ss >> copy;
+					if (!ss.fail() && !ss.bad())
+					{
+						std::stringstream ss2;
+						ss2 << std::fixed << std::setprecision(2);
+						ss2 << copy;
+						if (ss2.str() == ss2.str())
+						{
+							cout << "  copy has the same textual representation (success)" << endl;
+						}
+						else
+						{
+							cout << "  printing the copy..." << endl;
+							cout << ss2.str() << endl;
+						}
+					}
+					else cout << "  failed to re-parse the above text into a profile." << endl;
+				}
+
+				/*size_t n = 0;
+				for (auto &setting : scenario)
+				{
+					if (setting.options().option_count <= 1) continue;
+					auto *decision = goblin.get_decision(&setting);
+					auto *est = goblin.profile().find(setting.id());
+					std::cout << "  D" << (++n) << ": ";
+					if (!est)
+					{
+						cout << "[NO DATA] ";
+					}
+					else for (size_t i = 0; i < setting.options().option_count; ++i)
+					{
+						auto &entry = est->estimates[i];
+						std::cout << int(entry.full.count())
+							<< ":{#" << entry.full.mean() << " ~#" << decision->options[i].burden.mean
+							<< " $" << setting.options().options[i].value << "} ";
+					}
+					std::cout << std::endl;
+					//std::cout << "o1 m #" << first.full.mean() << " sig #" << first.this_run.deviation() << std::endl;
+					//if (++n >= 9) break;
+				}*/
+
+				cout << endl;
+			}
+			/*else if (s[0] == 's' || s[0] == 'S')
+			{
+				std::ofstream out("solution.svg");
+				write_svg(out, problem, max_burden);
+				if (out.good()) cout << "saved to solution.svg" << endl;
+				else            cout << "couldn't save to solution.svg" << endl;
+			}*/
+			else
+			{
+				cout << "unknown command." << endl;
+			}
+		}
+	}
+}
+
+/*
+	Value of the best choices for the settings' true mean burdens, solved at high precision.
+*/
+static float sim_oracle_value(std::list<SimSetting> &settings, float limit)
+{
+	size_t total_options = 0;
+	for (auto &setting : settings) total_options += setting.options().option_count;
+
+	std::vector<Knapsack::Option>   options;
+	std::vector<Knapsack::Decision> decisions(settings.size());
+	options.reserve(total_options);
+
+	Knapsack knapsack;
+	auto decision = decisions.begin();
+	for (auto &setting : settings)
+	{
+		decision->options      = options.data() + options.size();
+		decision->option_count = setting.options().option_count;
+		for (unsigned i = 0; i < decision->option_count; ++i)
+			options.push_back(Knapsack::Option{setting.expect_mean(i), setting.options().options[i].value});
+		knapsack.add_decision(&*decision++);
+	}
+	knapsack.decide(limit, 200);
+	return knapsack.stats.chosen.net_value;
+}
+
+enum SimScenario {SIM_STEADY, SIM_BURSTY, SIM_DRIFTING, SIM_CHURN, SIM_TRANSFER, SIM_SCENARIOS};
+static const char *const sim_scenario_names[SIM_SCENARIOS] = {"steady", "bursty", "drifting", "churn", "transfer"};
+
+struct SimResult
+{
+	size_t frames = 0, overruns = 0;
+	double update_seconds = 0, value = 0, oracle_value = 0;
+	long   converged = -1; // Frames until converging, or -1 if the goblin never did.
+};
+
+/*
+	Run a goblin over the settings for some frames under a scenario's conditions.
+		bursty   -- all burdens occasionally rise 2.5x for a few frames.
+		drifting -- each setting's burdens wander by about 2% per frame, within 0.4x to 2.5x.
+		churn    -- every 64 frames, a random setting is replaced with a new one.
+		transfer -- a steady run starting with a past profile (and no exploration incentive).
+	The goblin has converged at the end of the first 32-frame window with at most one overrun
+		which captures 98% of the value it captures (relative to the oracle) in the final quarter.
+*/
+static SimResult simulate_goblin(std::list<SimSetting> &settings, SimScenario scenario, size_t frames,
+	Goblin::capacity_t capacity, const Profile_f *past = nullptr, Profile_f *profile_out = nullptr)
+{
+	const size_t precision = 30, window = 32, period = 64;
+
+	Goblin goblin;
+	if (past) goblin.set_past_profile(*past);
+	goblin.config.explore_value = (past ? 0.f : 50.f);
+	for (auto &setting : settings) goblin.add(&setting);
+
+	SimResult result;
+	float oracle = sim_oracle_value(settings, capacity.limit);
+	std::vector<float> frame_value, frame_oracle;
+	std::vector<char>  frame_over;
+	size_t burst_left = 0;
+	std::normal_distribution<float> drift(0.f, .02f);
+
+	for (size_t f = 0; f < frames; ++f)
+	{
+		switch (scenario)
+		{
+		case SIM_BURSTY:
+			if (burst_left) --burst_left;
+			else if (rand_gen() % 100 == 0) burst_left = 1 + rand_gen() % 8;
+			for (auto &setting : settings) setting.cost_scale = (burst_left ? 2.5f : 1.f);
+			break;
+
+		case SIM_DRIFTING:
+			for (auto &setting : settings)
+				setting.cost_scale = std::min(std::max(setting.cost_scale * std::exp(drift(rand_gen)), .4f), 2.5f);
+			if (f % period == 0) oracle = sim_oracle_value(settings, capacity.limit);
+			break;
+
+		case SIM_CHURN:
+			if (f && f % period == 0)
+			{
+				auto victim = settings.begin();
+				std::advance(victim, rand_gen() % settings.size());
+				goblin.remove(&*victim);
+				settings.erase(victim);
+				settings.emplace_back();
+				goblin.add(&settings.back());
+				oracle = sim_oracle_value(settings, capacity.limit);
+			}
+			break;
+
+		default: break;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		goblin.update(capacity, precision);
+		result.update_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (auto &setting : settings) setting.update();
+
+		float net_burden = 0.f, net_value = 0.f;
+		for (auto &setting : settings)
+		{
+			net_burden += setting.measure.burden;
+			net_value  += setting.chosen().value;
+		}
+		bool over = !Goblin::economy_t::acceptable(net_burden, capacity.limit);
+		result.overruns     += over;
+		result.value        += net_value;
+		result.oracle_value += oracle;
+
+		frame_value .push_back(net_value);
+		frame_oracle.push_back(oracle);
+		frame_over  .push_back(over);
+	}
+
+	// Compare each window of frames to the value captured over the final quarter.
+	auto captured = [&](size_t begin, size_t end)
+	{
+		double value = 0, oracle_value = 0;
+		for (size_t f = begin; f < end; ++f) {value += frame_value[f]; oracle_value += frame_oracle[f];}
+		return value / oracle_value;
+	};
+	double settled = captured(frames - std::max<size_t>(frames/4, 1), frames);
+	for (size_t end = window; end <= frames; ++end)
+	{
+		size_t overruns = std::count(frame_over.begin() + (end - window), frame_over.begin() + end, 1);
+		if (overruns <= 1 && captured(end - window, end) >= .98 * settled) {result.converged = long(end); break;}
+	}
+	result.frames = frames;
+	if (profile_out) *profile_out = goblin.full_profile();
+	return result;
+}
+
+/*
+	Benchmark: goblins over a fixed corpus of simulated scenarios.
+		Every scenario starts from the same seeded settings and capacity.
+		Prints one CSV line (or JSON object) per scenario.
+*/
+int bench_goblin_main(int argc, char **argv)
+{
+	size_t frames = 4096, setting_count = 50;
+	std::string only;
+	bool json = false;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if      (arg == "--json") json = true;
+		else if (arg == "--frames"   && i+1 < argc) frames        = size_t(std::max(1l, std::atol(argv[++i])));
+		else if (arg == "--settings" && i+1 < argc) setting_count = size_t(std::max(1l, std::atol(argv[++i])));
+		else if (arg == "--scenario" && i+1 < argc) only = argv[++i];
+		else
+		{
+			cout << "usage: bench-goblin [--json] [--frames N] [--settings N]"
+				" [--scenario steady|bursty|drifting|churn|transfer]" << endl;
+			return 1;
+		}
+	}
+
+	if (json) cout << "[" << endl;
+	else      cout << "scenario,settings,frames,us_per_update,overrun_rate,value_captured,frames_to_converge" << endl;
+	bool first_row = true;
+
+	for (int s = 0; s < SIM_SCENARIOS; ++s)
+	{
+		SimScenario scenario = SimScenario(s);
+		const char *name = sim_scenario_names[s];
+		if (!only.empty() && only != name) continue;
+
+		rand_gen.seed(1);
+		std::list<SimSetting> settings(setting_count);
+		Goblin::capacity_t capacity = {1.5f * random_capacity(setting_count), 4};
+
+		SimResult result;
+		if (scenario == SIM_TRANSFER)
+		{
+			Profile_f prior;
+			simulate_goblin(settings, SIM_STEADY, frames, capacity, nullptr, &prior);
+			result = simulate_goblin(settings, SIM_TRANSFER, frames, capacity, &prior);
+		}
+		else result = simulate_goblin(settings, scenario, frames, capacity);
+
+		double us_per_update  = 1e6 * result.update_seconds / double(result.frames),
+			overrun_rate   = double(result.overruns) / double(result.frames),
+			value_captured = result.value / result.oracle_value;
+
+		std::ostringstream row;
+		row << std::setprecision(4);
+		if (json)
+		{
+			row << (first_row ? "  " : ", ") << "{\"scenario\":\"" << name << "\",\"settings\":" << setting_count
+				<< ",\"frames\":" << result.frames << ",\"us_per_update\":" << us_per_update
+				<< ",\"overrun_rate\":" << overrun_rate << ",\"value_captured\":" << value_captured
+				<< ",\"frames_to_converge\":" << result.converged << '}';
+		}
+		else
+		{
+			row << name << ',' << setting_count << ',' << result.frames << ',' << us_per_update << ','
+				<< overrun_rate << ',' << value_captured << ',' << result.converged;
+		}
+		cout << row.str() << endl;
+		first_row = false;
+	}
+	if (json) cout << "]" << endl;
+	return 0;
+}
+
+/*
+	Benchmark: profile task and goblin setting lookups, flat map vs std::unordered_map.
+*/
+template<typename T_Map, typename T_Key>
+double bench_lookups(const std::vector<T_Key> &keys, const std::vector<T_Key> &probes, size_t &found)
+{
+	T_Map map;
+	for (size_t i = 0; i < keys.size(); ++i) map.emplace(keys[i], i);
+
+	// Best of several passes, to reduce noise.
+	double best = INFINITY;
+	for (int pass = 0; pass < 5; ++pass)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (auto &key : probes)
+		{
+			auto i = map.find(key);
+			if (i != map.end()) found += i->second;
+		}
+		best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / probes.size());
+	}
+	return best;
+}
+
+template<typename T_Key>
+void bench_map_pair(const char *name, const std::vector<T_Key> &keys, const std::vector<T_Key> &probes)
+{
+	size_t found_flat = 0, found_std = 0;
+	double t_flat = bench_lookups<detail::FlatMap   <T_Key, size_t>>(keys, probes, found_flat);
+	double t_std  = bench_lookups<std::unordered_map<T_Key, size_t>>(keys, probes, found_std);
+	cout << "  " << std::setw(8) << name << std::setw(8) << keys.size()
+		<< "   flat " << std::setw(6) << t_flat << " ns"
+		<< "   unordered " << std::setw(6) << t_std << " ns"
+		<< "   speedup " << (t_std / t_flat) << "x" << endl;
+	if (found_flat != found_std) cout << "    MISMATCH" << endl;
+}
+
+void bench_maps()
+{
+	cout << std::fixed << std::setprecision(2);
+	cout << "Lookup time per probe (half hits, half misses):" << endl;
+
+	rand_gen.seed(1);
+	for (size_t count : {64, 1024, 16384, 262144})
+	{
+		// Task identifiers, as in a profile.
+		std::vector<std::string> ids, id_probes;
+		for (size_t i = 0; i < count; ++i) ids.push_back("render.pass" + std::to_string(i) + ".quality");
+		for (size_t i = 0; i < 1000000; ++i)
+		{
+			size_t k = rand_gen() % count;
+			id_probes.push_back((i & 1) ? ids[k] : "render.pass" + std::to_string(k) + ".missing");
+		}
+		bench_map_pair("task", ids, id_probes);
+
+		// Setting pointers, as in a goblin.
+		std::vector<SimSetting> settings(count);
+		std::vector<Setting*> ptrs, ptr_probes;
+		for (auto &setting : settings) ptrs.push_back(&setting);
+		for (size_t i = 0; i < 1000000; ++i)
+		{
+			size_t k = rand_gen() % count;
+			ptr_probes.push_back((i & 1) ? ptrs[k] : reinterpret_cast<Setting*>(reinterpret_cast<char*>(ptrs[k]) + 1));
+		}
+		bench_map_pair("setting", ptrs, ptr_probes);
+	}
+
+	// The goblin walks its decisions in setting order every frame.
+	cout << "Walking decisions in setting order, per setting:" << endl;
+	for (size_t count : {64, 1024, 16384})
+	{
+		std::vector<SimSetting> settings(count);
+		std::vector<Setting*> order;
+		for (auto &setting : settings) order.push_back(&setting);
+
+		// One allocation per decision, found through the map.
+		detail::FlatMap<Setting*, std::unique_ptr<Goblin::Decision_t>> by_map;
+		for (auto *setting : order) by_map.emplace(setting, std::unique_ptr<Goblin::Decision_t>(new Goblin::Decision_t()));
+
+		// Decisions in a deque, with pointers kept alongside the order.
+		std::deque<Goblin::Decision_t> decisions(count);
+		std::vector<Goblin::Decision_t*> order_decisions;
+		for (auto &decision : decisions) order_decisions.push_back(&decision);
+
+		const size_t passes = std::max<size_t>(1, 4000000 / count);
+		size_t sum_map = 0, sum_order = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t p = 0; p < passes; ++p)
+			for (auto *setting : order) sum_map += ++by_map.find(setting)->second->choice;
+		double t_map = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (passes * count);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t p = 0; p < passes; ++p)
+			for (size_t k = 0; k < order.size(); ++k) sum_order += ++order_decisions[k]->choice;
+		double t_order = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (passes * count);
+
+		cout << "  " << std::setw(8) << count
+			<< "   map " << std::setw(6) << t_map << " ns"
+			<< "   in order " << std::setw(6) << t_order << " ns"
+			<< "   speedup " << (t_map / t_order) << "x" << endl;
+		if (sum_map != sum_order) cout << "    MISMATCH" << endl;
+	}
+}
+
+/*
+	Benchmark: collecting measurements from several threads, with a shared lock vs per-thread shards.
+*/
+void bench_shards()
+{
+	const unsigned threads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+	const size_t tasks_per_thread = 200, per_frame = 20000, frames = 20;
+	const Profile_f::choice_index_t options = 4;
+
+	// Each thread owns its own tasks.
+	std::vector<std::vector<std::string>> ids(threads);
+	for (unsigned t = 0; t < threads; ++t)
+		for (size_t i = 0; i < tasks_per_thread; ++i)
+			ids[t].push_back("thread" + std::to_string(t) + ".task" + std::to_string(i));
+
+	auto measure = [&](unsigned t, size_t i)
+	{
+		Profile_f::Measurement m;
+		m.choice = Profile_f::choice_index_t((i * 7 + t) % options);
+		m.burden = 1.f + float((i * 2654435761u + t) % 1000) * .001f;
+		return m;
+	};
+	auto run_frames = [&](const std::function<void(unsigned)> &work, const std::function<void()> &sync)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t f = 0; f < frames; ++f)
+		{
+			std::vector<std::thread> pool;
+			for (unsigned t = 0; t < threads; ++t) pool.emplace_back(work, t);
+			for (auto &thread : pool) thread.join();
+			sync();
+		}
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+			/ (frames * threads * per_frame);
+	};
+
+	// Shared profile behind a mutex.
+	Profile_f locked;
+	std::mutex lock;
+	double t_locked = run_frames([&](unsigned t)
+	{
+		for (size_t i = 0; i < per_frame; ++i)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			locked.collect(ids[t][i % tasks_per_thread], options, measure(t, i));
+		}
+	}, []{});
+
+	// Per-thread shards merged at each sync point.
+	Profile_f merged;
+	std::vector<ProfileShard_f> shards(threads);
+	double t_merge = 0;
+	double t_sharded = run_frames([&](unsigned t)
+	{
+		for (size_t i = 0; i < per_frame; ++i)
+			shards[t].collect(ids[t][i % tasks_per_thread], options, measure(t, i));
+	}, [&]
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (auto &shard : shards) {merged.merge(shard); shard.reset();}
+		t_merge += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	});
+
+	// Both should hold the same statistics.
+	double max_error = 0;
+	size_t mismatches = 0;
+	for (auto &entry : locked)
+	{
+		auto *other = merged.find(entry.first);
+		if (!other) {++mismatches; continue;}
+		for (Profile_f::choice_index_t i = 0; i < options; ++i)
+		{
+			auto &a = entry.second->estimates[i].full, &b = other->estimates[i].full;
+			if (a.count() != b.count()) ++mismatches;
+			max_error = std::max(max_error, double(std::abs(a.mean() - b.mean()) / std::max(a.mean(), 1e-6f)));
+		}
+	}
+
+	cout << std::fixed << std::setprecision(2);
+	cout << "Collecting from " << threads << " threads, " << (threads * tasks_per_thread) << " tasks:" << endl;
+	cout << "  locked profile:   " << t_locked  << " ns per measurement" << endl;
+	cout << "  sharded profiles: " << t_sharded << " ns per measurement (merges " << (t_merge / frames) << " us per frame)" << endl;
+	cout << "  mismatched counts: " << mismatches << ", max relative mean error: " << std::scientific << max_error << endl;
+}
+
+/*
+	Benchmark: loading a large past profile from JSON vs a mapped binary file.
+*/
+static Profile_f generate_profile(size_t task_count)
+{
+	Profile_f profile;
+	for (size_t i = 0; i < task_count; ++i)
+	{
+		std::string id = "subsystem" + std::to_string(i % 97) + ".setting" + std::to_string(i);
+		auto options = Profile_f::choice_index_t(2 + i % 5);
+		for (Profile_f::choice_index_t c = 0; c < options; ++c)
+			for (int n = 0; n < 3; ++n)
+			{
+				Profile_f::Measurement m;
+				m.choice = c;
+				m.burden = std::exp(std::normal_distribution<float>(float(c), .5f)(rand_gen));
+				profile.collect(id, options, m, Profile_f::resource_t(i % 2));
+			}
+	}
+	return profile;
+}
+
+void bench_profile_load()
+{
+	using clock = std::chrono::steady_clock;
+	auto ms = [](clock::duration d) {return std::chrono::duration<double, std::milli>(d).count();};
+
+	rand_gen.seed(1);
+	Profile_f profile = generate_profile(40000);
+
+	const char *json_path = "bench_profile.json", *binary_path = "bench_profile.pgp";
+	{
+		std::ofstream json(json_path);
+		json << profile;
+		std::ofstream binary(binary_path, std::ios::binary);
+		ProfileImage_f(profile).write(binary);
+	}
+
+	auto start = clock::now();
+	Profile_f parsed;
+	{
+		std::ifstream json(json_path);
+		json >> parsed;
+	}
+	double t_json = ms(clock::now() - start);
+
+	start = clock::now();
+	MappedFile mapped(binary_path);
+	ProfileView_f view;
+	bool ok = view.attach(mapped.data(), mapped.size());
+	double t_map = ms(clock::now() - start);
+
+	// Check the view against the original.
+	size_t mismatches = ok ? 0 : 1;
+	for (auto &entry : profile)
+	{
+		auto *task = view.find(entry.first);
+		if (!task || task->count != entry.second->count || task->resource != entry.second->resource) {++mismatches; continue;}
+		for (Profile_f::choice_index_t i = 0; i < task->count; ++i)
+		{
+			auto &a = entry.second->estimates[i].full, &b = task->estimates[i].full;
+			if (a.count() != b.count() || a.mean() != b.mean() || a._vk != b._vk) ++mismatches;
+		}
+	}
+
+	cout << std::fixed << std::setprecision(2);
+	cout << "Loading a profile of " << profile.tasks().size() << " tasks:" << endl;
+	cout << "  JSON parse:        " << t_json << " ms (" << (parsed.tasks().size() == profile.tasks().size() ? "ok" : "FAILED") << ")" << endl;
+	cout << "  binary map+attach: " << t_map << " ms, " << (mapped.size() / 1024) << " KiB ("
+		<< (mismatches ? "MISMATCH" : "ok") << ")" << endl;
+
+	mapped.close();
+	std::remove(json_path);
+	std::remove(binary_path);
+}
+
+/*
+	Test: views refuse binary profiles whose slots, tasks or identifiers fall outside the data,
+		or whose hash table has no empty slot to end a lookup.
+*/
+int test_profile_view()
+{
+	using Header = detail::ProfileBinaryHeader;
+	using Slot   = detail::ProfileBinarySlot;
+
+	rand_gen.seed(1);
+	ProfileImage_f image(generate_profile(100));
+	const std::vector<uint64_t> original(static_cast<const uint64_t*>(image.data()),
+		static_cast<const uint64_t*>(image.data()) + (image.size() + 7) / 8);
+
+	struct Case {const char *name; std::function<void(std::vector<uint64_t>&, size_t&)> corrupt;};
+	auto header = [](std::vector<uint64_t> &w) {return reinterpret_cast<Header*>(w.data());};
+	auto slots  = [&](std::vector<uint64_t> &w) {return reinterpret_cast<Slot*>(reinterpret_cast<char*>(w.data()) + header(w)->slots_offset);};
+	auto first  = [&](std::vector<uint64_t> &w) -> Slot&
+	{
+		Slot *s = slots(w);
+		while (s->task_offset == Slot::EMPTY) ++s;
+		return *s;
+	};
+	const Case cases[] =
+	{
+		{"unmodified",           [&](std::vector<uint64_t>&, size_t&) {}},
+		{"no empty slot",        [&](std::vector<uint64_t> &w, size_t&)
+			{
+				Slot occupied = first(w);
+				for (uint32_t i = 0; i < header(w)->slot_count; ++i)
+					if (slots(w)[i].task_offset == Slot::EMPTY) slots(w)[i] = occupied;
+				header(w)->task_count = header(w)->slot_count;
+			}},
+		{"task count miscounted", [&](std::vector<uint64_t> &w, size_t&) {header(w)->task_count -= 1;}},
+		{"task out of range",    [&](std::vector<uint64_t> &w, size_t&) {first(w).task_offset = uint32_t(header(w)->total_size);}},
+		{"task misaligned",      [&](std::vector<uint64_t> &w, size_t&) {first(w).task_offset += 4;}},
+		{"options out of range", [&](std::vector<uint64_t> &w, size_t&)
+			{
+				char *tasks = reinterpret_cast<char*>(w.data()) + header(w)->tasks_offset;
+				auto *task = reinterpret_cast<Profile_f::Task*>(tasks + first(w).task_offset);
+				const_cast<Profile_f::choice_index_t&>(task->count) = 60000;
+			}},
+		{"id out of range",      [&](std::vector<uint64_t> &w, size_t&) {first(w).id_offset = uint32_t(header(w)->total_size);}},
+		{"id unterminated",      [&](std::vector<uint64_t> &w, size_t&) {first(w).id_length += 1;}},
+		{"slots overlap header", [&](std::vector<uint64_t> &w, size_t&) {header(w)->slots_offset = 0;}},
+		{"truncated",            [&](std::vector<uint64_t>&, size_t &size) {size -= 8;}},
+	};
+
+	cout << "Binary profile views of " << image.view().size() << " tasks:" << endl;
+	bool ok = true;
+	for (auto &c : cases)
+	{
+		std::vector<uint64_t> words = original;
+		size_t size = image.size();
+		c.corrupt(words, size);
+		ProfileView_f view;
+		bool attached = view.attach(words.data(), size), expect = (&c == cases);
+		ok = ok && attached == expect;
+		cout << "  " << std::left << std::setw(22) << c.name << std::right << (attached ? "attached" : "refused")
+			<< (attached == expect ? "" : " FAILED") << endl;
+	}
+	cout << "  " << (ok ? "views ok" : "VIEWS FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Benchmark: JSON profile throughput, stream operators vs buffer reader/writer.
+*/
+void bench_json()
+{
+	using clock = std::chrono::steady_clock;
+	auto seconds = [](clock::duration d) {return std::chrono::duration<double>(d).count();};
+
+	rand_gen.seed(1);
+	Profile_f profile = generate_profile(40000);
+
+	// Write
+	auto start = clock::now();
+	std::stringstream stream;
+	stream << profile;
+	double t_stream_write = seconds(clock::now() - start);
+	std::string stream_text = stream.str();
+
+	start = clock::now();
+	std::string text = to_json(profile);
+	double t_buffer_write = seconds(clock::now() - start);
+
+	// Read
+	start = clock::now();
+	Profile_f from_stream;
+	std::stringstream in(text);
+	in >> from_stream;
+	double t_stream_read = seconds(clock::now() - start);
+
+	start = clock::now();
+	Profile_f from_buffer;
+	bool ok = read_json(text, from_buffer);
+	double t_buffer_read = seconds(clock::now() - start);
+
+	// The formats must be interchangeable; buffer round trips are exact.
+	Profile_f cross;
+	ok = ok && !in.fail() && read_json(stream_text, cross) && cross.tasks().size() == profile.tasks().size();
+	size_t mismatches = 0;
+	for (auto &entry : profile)
+	{
+		auto *task = from_buffer.find(entry.first), *other = from_stream.find(entry.first);
+		if (!task || !other || task->count != entry.second->count) {++mismatches; continue;}
+		for (Profile_f::choice_index_t i = 0; i < task->count; ++i)
+		{
+			auto &a = entry.second->estimates[i].full, &b = task->estimates[i].full;
+			if (a.count() != b.count() || a.mean() != b.mean() || a.deviation() != b.deviation()) ++mismatches;
+		}
+	}
+
+	double mb = text.size() / 1e6, stream_mb = stream_text.size() / 1e6;
+	cout << std::fixed << std::setprecision(1);
+	cout << "JSON profile of " << profile.tasks().size() << " tasks (" << mb << " MB):" << endl;
+	cout << "  write: stream " << std::setw(7) << (stream_mb / t_stream_write) << " MB/s   buffer " << std::setw(7) << (mb / t_buffer_write) << " MB/s   ("
+		<< (t_stream_write / t_buffer_write) << "x)" << endl;
+	cout << "  read:  stream " << std::setw(7) << (mb / t_stream_read) << " MB/s   buffer " << std::setw(7) << (mb / t_buffer_read) << " MB/s   ("
+		<< (t_stream_read / t_buffer_read) << "x)" << endl;
+	cout << "  " << ((ok && !mismatches) ? "round trip ok" : "ROUND TRIP FAILED") << endl;
+}
+
+/*
+	Test and benchmark: journaling a profile, then restoring it after a clean close or a crash.
+*/
+static size_t compare_full(const Profile_f &a, const Profile_f &b)
+{
+	size_t mismatches = (a.tasks().size() == b.tasks().size()) ? 0 : 1;
+	for (auto &entry : a)
+	{
+		auto *task = b.find(entry.first);
+		if (!task || task->count != entry.second->count) {++mismatches; continue;}
+		for (Profile_f::choice_index_t i = 0; i < task->count; ++i)
+		{
+			auto &x = entry.second->estimates[i].full, &y = task->estimates[i].full;
+			if (x.count() != y.count() || std::abs(x.mean() - y.mean()) > 1e-4f * std::abs(x.mean())) ++mismatches;
+		}
+	}
+	return mismatches;
+}
+
+int test_journal()
+{
+	using clock = std::chrono::steady_clock;
+	const std::string path = "journal_test.json";
+	const size_t measurements = 1000000, task_count = 2000;
+
+	rand_gen.seed(1);
+	std::vector<std::string> ids;
+	for (size_t i = 0; i < task_count; ++i) ids.push_back("task" + std::to_string(i));
+
+	auto run = [&](Profile_f &profile, size_t count)
+	{
+		Profile_f::Measurement m;
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t t = rand_gen() % task_count;
+			m.choice = Profile_f::choice_index_t(t % 3);
+			m.burden = 1.f + float(rand_gen() % 1000) * .01f;
+			profile.collect(ids[t], 3, m);
+		}
+	};
+
+	// Baseline collection cost, without a journal.
+	Profile_f plain;
+	auto start = clock::now();
+	run(plain, measurements);
+	double t_plain = std::chrono::duration<double, std::nano>(clock::now() - start).count() / measurements;
+
+	// Journal a session in two parts, compacting along the way.
+	Profile_f profile, restored;
+	ProfileJournal_f::load(path, profile); // Clears leftovers into an empty profile
+	ProfileJournal_f::Config config;
+	config.flush_interval = std::chrono::milliseconds(20);
+	config.compact_bytes  = 64 * 1024;
+	config.queue_capacity = measurements;
+
+	ProfileJournal_f journal;
+	bool ok = journal.open(path, Profile_f(), config);
+	profile.set_observer(&journal);
+	start = clock::now();
+	run(profile, measurements);
+	double t_journal = std::chrono::duration<double, std::nano>(clock::now() - start).count() / measurements;
+	profile.set_observer(nullptr);
+	journal.close();
+
+	// Measurements observed after closing are ignored, and queue nothing.
+	{
+		Profile_f late;
+		Profile_f::Measurement m;
+		m.choice = 0;
+		m.burden = 1.f;
+		late.set_observer(&journal);
+		late.collect("after_close", 1, m);
+	}
+
+	ok = ok && ProfileJournal_f::load(path, restored);
+	size_t mismatches = compare_full(profile, restored);
+
+	// Continue from the restored profile.
+	{
+		ProfileJournal_f second;
+		ok = ok && second.open(path, restored, config);
+		profile.set_observer(&second);
+		run(profile, measurements / 10);
+		profile.set_observer(nullptr);
+		second.close();
+	}
+	ok = ok && ProfileJournal_f::load(path, restored);
+	mismatches += compare_full(profile, restored);
+
+	// Crash between setting the journal aside and committing a new snapshot:
+	//   the old journal must be replayed, and a torn last line ignored.
+	std::string journal_text;
+	detail::read_file(path + ".journal", journal_text);
+	detail::write_file(path + ".journal.old", journal_text);
+	detail::write_file(path + ".journal", "\"task0\":[[1,");
+	detail::write_file(path + ".tmp", "{\"torn");
+	ok = ok && ProfileJournal_f::load(path, restored);
+	mismatches += compare_full(profile, restored);
+
+	// Reopening settles the leftovers.
+	{
+		ProfileJournal_f third;
+		ok = ok && third.open(path, restored);
+	}
+	ok = ok && !detail::file_exists(path + ".tmp") && !detail::file_exists(path + ".journal.old");
+	ok = ok && ProfileJournal_f::load(path, restored);
+	mismatches += compare_full(profile, restored);
+
+	cout << std::fixed << std::setprecision(1);
+	cout << "Journaling " << measurements << " measurements over " << task_count << " tasks:" << endl;
+	cout << "  collect: " << t_plain << " ns plain, " << t_journal << " ns journaled ("
+		<< journal.dropped() << " dropped)" << endl;
+	cout << "  " << ((ok && !mismatches) ? "restore ok" : "RESTORE FAILED") << " (" << mismatches << " mismatches)" << endl;
+
+	std::remove(path.c_str());
+	std::remove((path + ".journal").c_str());
+	return (ok && !mismatches) ? 0 : 1;
+}
+
+/*
+	Tool: merge many profiles (eg, from a fleet of machines) into one prior per hardware class.
+		Each machine runs faster or slower overall, so its profile is first scaled by
+		its burden ratio to a reference (as Goblin_::past_present_ratio does), then pooled.
+		The reference is the unscaled pool of all inputs of the class.  Files are streamed
+		twice, in parallel.
+
+	A profile's hardware class comes from a mapping given on the command line, or else
+		from its "$hardware_class" metadata (see JsonMetadata).  Options may be weighted
+		differently on different hardware, so classes are merged separately.
+*/
+struct MergeResult
+{
+	Profile_f merged;
+	size_t    merged_files = 0;
+	std::vector<std::string> skipped; // Unreadable, or sharing no data with the reference.
+};
+
+static void for_each_file(const std::vector<std::string> &paths, unsigned threads,
+	const std::function<void(unsigned worker, const std::string &path, const Profile_f &profile)> &visit,
+	std::vector<std::string> &skipped)
+{
+	std::atomic<size_t> next(0);
+	std::mutex skip_lock;
+	auto work = [&](unsigned worker)
+	{
+		std::string text;
+		Profile_f profile;
+		for (size_t i; (i = next++) < paths.size();)
+		{
+			if (detail::read_file(paths[i], text) && read_json(text, profile)) visit(worker, paths[i], profile);
+			else {std::lock_guard<std::mutex> lock(skip_lock); skipped.push_back(paths[i]);}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work, t);
+	work(0);
+	for (auto &thread : pool) thread.join();
+}
+
+MergeResult merge_profiles(const std::vector<std::string> &paths, unsigned threads)
+{
+	threads = std::max(1u, threads);
+	MergeResult result;
+	std::vector<Profile_f> partial(threads);
+	std::vector<std::string> unreadable, unrelated;
+	std::mutex unrelated_lock;
+
+	// Pass 1: pool raw estimates as a reference.
+	for_each_file(paths, threads, [&](unsigned worker, const std::string&, const Profile_f &profile)
+	{
+		for (auto &entry : profile) partial[worker].assimilate(entry.first, *entry.second);
+	}, unreadable);
+	Profile_f reference;
+	for (auto &p : partial) {for (auto &entry : p) reference.assimilate(entry.first, *entry.second); p.clear();}
+
+	// Pass 2: pool estimates scaled to the reference.
+	std::vector<size_t> merged(threads, 0);
+	std::vector<std::string> unused;
+	for_each_file(paths, threads, [&](unsigned worker, const std::string &path, const Profile_f &profile)
+	{
+		BurdenRatio_<Economy_f> ratio;
+		for (auto &entry : profile)
+			if (auto *ref = reference.find(entry.first))
+				for (Profile_f::choice_index_t i = 0; i < std::min(entry.second->count, ref->count); ++i)
+					ratio.add(entry.second->estimates[i].full, ref->estimates[i].full);
+		if (!(ratio.ratio() > 0)) {std::lock_guard<std::mutex> lock(unrelated_lock); unrelated.push_back(path); return;}
+		for (auto &entry : profile) partial[worker].assimilate(entry.first, *entry.second, 1 / ratio.ratio());
+		++merged[worker];
+	}, unused);
+	for (unsigned t = 0; t < threads; ++t)
+	{
+		for (auto &entry : partial[t]) result.merged.assimilate(entry.first, *entry.second);
+		result.merged_files += merged[t];
+	}
+	result.skipped = unreadable;
+	result.skipped.insert(result.skipped.end(), unrelated.begin(), unrelated.end());
+	return result;
+}
+
+// The hardware class recorded in a profile's metadata, or "" (metadata precedes the tasks).
+static std::string profile_hardware_class(const std::string &path)
+{
+	std::string head(4096, '\0');
+	FILE *f = std::fopen(path.c_str(), "rb");
+	if (!f) return std::string();
+	head.resize(std::fread(&head[0], 1, head.size(), f));
+	std::fclose(f);
+	JsonMetadata metadata;
+	read_json_metadata(head, metadata);
+	for (auto &member : metadata) if (member.first == "hardware_class") return member.second;
+	return std::string();
+}
+
+/*
+	Group profiles by hardware class.  The mapping (path to class) takes precedence
+		over metadata.  Profiles with no class are grouped under "".
+*/
+std::map<std::string, std::vector<std::string>> group_by_hardware_class(
+	const std::vector<std::string> &paths, const std::map<std::string, std::string> &mapping)
+{
+	std::map<std::string, std::vector<std::string>> classes;
+	for (auto &path : paths)
+	{
+		auto mapped = mapping.find(path);
+		classes[(mapped != mapping.end()) ? mapped->second : profile_hardware_class(path)].push_back(path);
+	}
+	return classes;
+}
+
+// Output path for a class: "{class}" in the pattern is replaced, else the class precedes the extension.
+static std::string class_output_path(const std::string &pattern, const std::string &hardware_class)
+{
+	std::string path = pattern;
+	size_t slot = path.find("{class}");
+	if (slot != std::string::npos) return path.replace(slot, 7, hardware_class);
+	size_t dot = path.rfind('.'), slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path.size();
+	return path.insert(dot, "." + hardware_class);
+}
+
+int merge_profiles_main(int argc, char **argv)
+{
+	std::vector<std::string> inputs;
+	std::map<std::string, std::string> mapping;
+	std::string output = "merged_profile.json";
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if      (arg == "-o" && i+1 < argc) output  = argv[++i];
+		else if (arg == "-j" && i+1 < argc) threads = unsigned(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "-c" && i+1 < argc)
+		{
+			// Lines of "class path"; mapped paths are merged even if not listed as inputs.
+			std::ifstream in(argv[++i]);
+			std::string hardware_class, path;
+			if (!in) {cout << "failed to read " << argv[i] << endl; return 1;}
+			while (in >> hardware_class && std::getline(in >> std::ws, path))
+			{
+				inputs.push_back(path);
+				mapping[path] = hardware_class;
+			}
+		}
+		else inputs.push_back(arg);
+	}
+	std::sort(inputs.begin(), inputs.end());
+	inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
+	if (inputs.empty())
+	{
+		cout << "usage: merge-profiles [-o merged.json] [-j threads] [-c classes.txt] profile.json..." << endl;
+		cout << "  Writes one prior per hardware class (from the -c mapping of \"class path\" lines," << endl;
+		cout << "  or each profile's \"$hardware_class\" metadata), named merged.<class>.json" << endl;
+		cout << "  or by replacing {class} in the output name.  Unclassified profiles go to merged.json." << endl;
+		return 1;
+	}
+
+	auto classes = group_by_hardware_class(inputs, mapping);
+	for (auto &hardware_class : classes)
+	{
+		const std::string &name = hardware_class.first;
+		MergeResult result = merge_profiles(hardware_class.second, threads);
+		for (auto &path : result.skipped) cout << "skipped " << path << endl;
+
+		std::string path = name.empty() ? output : class_output_path(output, name);
+		JsonMetadata metadata;
+		if (!name.empty()) metadata.emplace_back("hardware_class", name);
+		if (!detail::write_file(path, to_json(result.merged, metadata)))
+		{
+			cout << "failed to write " << path << endl;
+			return 1;
+		}
+		cout << "merged " << result.merged_files << " of " << hardware_class.second.size() << " profiles";
+		if (!name.empty()) cout << " of class " << name;
+		cout << " (" << result.merged.tasks().size() << " tasks) into " << path << endl;
+	}
+	return 0;
+}
+
+/*
+	Benchmark: merging a synthetic fleet of machines with known speed factors.
+*/
+void bench_merge()
+{
+	using clock = std::chrono::steady_clock;
+	const size_t machines = 400, task_count = 2000;
+
+	// Every machine measures a random subset of tasks, at its own speed.
+	rand_gen.seed(1);
+	std::vector<float> base(task_count);
+	for (auto &b : base) b = std::exp(std::normal_distribution<float>(0.f, 1.f)(rand_gen));
+	std::vector<std::string> paths;
+	for (size_t k = 0; k < machines; ++k)
+	{
+		float speed = std::exp(std::uniform_real_distribution<float>(-1.f, 1.f)(rand_gen));
+		Profile_f profile;
+		Profile_f::Measurement m;
+		for (size_t t = 0; t < task_count; ++t)
+		{
+			if (rand_gen() % 4) continue;
+			std::string id = "task" + std::to_string(t);
+			for (m.choice = 0; m.choice < 2; ++m.choice)
+				for (int n = 0; n < 5; ++n)
+				{
+					m.burden = base[t] * (1 + m.choice) * speed * std::exp(std::normal_distribution<float>(0.f, .1f)(rand_gen));
+					profile.collect(id, 2, m);
+				}
+		}
+		paths.push_back("fleet_profile" + std::to_string(k) + ".json");
+		detail::write_file(paths.back(), to_json(profile));
+	}
+
+	cout << "Merging " << machines << " profiles of ~" << (task_count / 4) << " tasks:" << endl;
+	unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned threads = 1; ; threads = std::min(threads * 2, max_threads))
+	{
+		auto start = clock::now();
+		MergeResult result = merge_profiles(paths, threads);
+		double t = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		// Normalized means should be proportional to the base burdens, with one common factor.
+		double sum_log = 0, sum_log2 = 0;
+		size_t n = 0;
+		for (size_t i = 0; i < task_count; ++i)
+			if (auto *task = result.merged.find("task" + std::to_string(i)))
+			{
+				double r = std::log(double(task->estimates[1].full.mean()) / (2 * base[i]));
+				sum_log += r; sum_log2 += r*r; ++n;
+			}
+		double spread = n ? std::sqrt(std::max(0.0, sum_log2/n - (sum_log/n)*(sum_log/n))) : 0;
+
+		cout << std::fixed << std::setprecision(1) << "  " << threads << " threads: " << t << " ms, "
+			<< result.merged_files << " merged, " << std::setprecision(3) << "relative spread of normalized means " << spread
+			<< ((spread < .05 && result.merged_files == machines) ? " (ok)" : " (FAILED)") << endl;
+		if (threads == max_threads) break;
+	}
+	for (auto &path : paths) std::remove(path.c_str());
+}
+
+/*
+	Test: merge-profiles writes one prior per hardware class.
+		The second option costs twice the first on one class and half on the other;
+		pooled together, the ratio would be lost.  Half the profiles name their class
+		in metadata, the other half are classified by a mapping file.
+*/
+int test_merge_classes()
+{
+	rand_gen.seed(5);
+	const size_t machines = 20, task_count = 50;
+	const char *classes[2] = {"desktop", "handheld"};
+	const float option_ratio[2] = {2.f, .5f};
+	std::vector<std::string> paths;
+	std::ofstream mapping("merge_classes.txt");
+	for (size_t k = 0; k < machines; ++k)
+	{
+		size_t c = k % 2;
+		float speed = std::exp(std::uniform_real_distribution<float>(-.5f, .5f)(rand_gen));
+		Profile_f profile;
+		Profile_f::Measurement m;
+		for (size_t t = 0; t < task_count; ++t)
+			for (m.choice = 0; m.choice < 2; ++m.choice)
+				for (int n = 0; n < 4; ++n)
+				{
+					m.burden = (1 + t) * (m.choice ? option_ratio[c] : 1.f) * speed;
+					profile.collect("task" + std::to_string(t), 2, m);
+				}
+		paths.push_back("class_profile" + std::to_string(k) + ".json");
+		JsonMetadata metadata;
+		if (k < machines / 2) metadata.emplace_back("hardware_class", classes[c]);
+		else                  mapping << classes[c] << ' ' << paths.back() << '\n';
+		detail::write_file(paths.back(), to_json(profile, metadata));
+	}
+	mapping.close();
+
+	std::vector<std::string> args = {"perf-goblin", "merge-profiles", "-o", "class_prior_{class}.json", "-c", "merge_classes.txt"};
+	args.insert(args.end(), paths.begin(), paths.begin() + machines / 2);
+	std::vector<char*> argv;
+	for (auto &arg : args) argv.push_back(&arg[0]);
+	bool ok = (merge_profiles_main(int(argv.size()), argv.data()) == 0);
+
+	for (size_t c = 0; c < 2; ++c)
+	{
+		std::string path = std::string("class_prior_") + classes[c] + ".json", text;
+		Profile_f prior;
+		JsonMetadata metadata;
+		bool read = detail::read_file(path, text) && read_json(text, prior) && read_json_metadata(text, metadata);
+		bool tagged = read && metadata.size() == 1 && metadata[0].second == classes[c];
+		double worst = 0;
+		for (size_t t = 0; read && t < task_count; ++t)
+		{
+			auto *task = prior.find("task" + std::to_string(t));
+			if (!task) {read = false; break;}
+			double ratio = task->estimates[1].full.mean() / task->estimates[0].full.mean();
+			worst = std::max(worst, std::abs(ratio / option_ratio[c] - 1));
+		}
+		bool class_ok = read && tagged && worst < .01 && prior.tasks().size() == task_count;
+		cout << "  " << classes[c] << ": option ratio error " << worst
+			<< (class_ok ? "  ok" : "  FAILED") << endl;
+		ok = ok && class_ok;
+		std::remove(path.c_str());
+	}
+	cout << (ok ? "  merge classes ok" : "MERGE CLASSES FAILED") << endl;
+	for (auto &path : paths) std::remove(path.c_str());
+	std::remove("merge_classes.txt");
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: a goblin restored from a snapshot continues exactly as the original would.
+*/
+int test_goblin_state()
+{
+	rand_gen.seed(3);
+	std::list<SimSetting> settings_a;
+	for (size_t i = 0; i < 40; ++i) settings_a.emplace_back();
+	std::list<SimSetting> settings_b = settings_a, settings_cold = settings_a; // Copied before any goblin controls them
+
+	Goblin goblin_a, goblin_b, goblin_cold;
+	for (auto &s : settings_a)    goblin_a.add(&s);
+	for (auto &s : settings_b)    goblin_b.add(&s);
+	for (auto &s : settings_cold) goblin_cold.add(&s);
+	goblin_a.config.sample_fraction = .5f;
+	goblin_cold.config.sample_fraction = .5f;
+
+	Goblin::capacity_t capacity = {1.5f * random_capacity(settings_a.size()), 4};
+	auto run = [&](Goblin &goblin, std::list<SimSetting> &settings, std::vector<Goblin::choice_index_t> *choices)
+	{
+		for (auto &s : settings) s.update();
+		goblin.update(capacity, 30);
+		if (choices) for (auto &s : settings) choices->push_back(s.choice_index);
+	};
+
+	// Warm up, then snapshot.
+	for (size_t f = 0; f < 500; ++f) run(goblin_a, settings_a, nullptr);
+	std::string snapshot;
+	GoblinState::save(goblin_a, snapshot);
+
+	bool ok = GoblinState::restore(goblin_b, snapshot);
+	ok = ok && !GoblinState::restore(goblin_cold, snapshot.data(), snapshot.size() - 1);
+	ok = ok && goblin_b.config.sample_fraction == goblin_a.config.sample_fraction;
+
+	// Continue with identical measurement streams.
+	//   Restoring the original must replay it exactly.  Another goblin's settings were
+	//   added in the same order, so it should follow closely (float sums may still differ).
+	const size_t frames = 200;
+	std::vector<Goblin::choice_index_t> choices_a, choices_replay, choices_b, choices_cold;
+	const std::mt19937 stream_state = rand_gen;
+	auto rewind = [&](std::list<SimSetting> &settings)
+	{
+		rand_gen = stream_state;
+		for (auto &s : settings) for (auto &cost : s.costs) cost.reset(); // Distributions cache values
+	};
+	rewind(settings_a);
+	for (size_t f = 0; f < frames; ++f) run(goblin_a, settings_a, &choices_a);
+	auto anomaly_a = goblin_a.anomaly().recent;
+	ok = ok && GoblinState::restore(goblin_a, snapshot);
+	rewind(settings_a);
+	for (size_t f = 0; f < frames; ++f) run(goblin_a, settings_a, &choices_replay);
+	rewind(settings_b);
+	for (size_t f = 0; f < frames; ++f) run(goblin_b, settings_b, &choices_b);
+	rewind(settings_cold);
+	for (size_t f = 0; f < frames; ++f) run(goblin_cold, settings_cold, &choices_cold);
+
+	size_t same_b = 0, same_cold = 0;
+	for (size_t i = 0; i < choices_a.size(); ++i)
+	{
+		same_b    += (choices_a[i] == choices_b[i]);
+		same_cold += (choices_a[i] == choices_cold[i]);
+	}
+	ok = ok && choices_replay == choices_a && goblin_a.anomaly().recent == anomaly_a && same_b > same_cold;
+
+	cout << std::fixed << std::setprecision(1);
+	cout << "Goblin snapshot of " << settings_a.size() << " settings: " << snapshot.size() << " bytes" << endl;
+	cout << "  choices matching the original over " << frames << " frames: replay "
+		<< (choices_replay == choices_a ? "100%" : "MISMATCH") << ", restored elsewhere "
+		<< (100.0 * same_b / choices_a.size()) << "%, cold start " << (100.0 * same_cold / choices_a.size()) << "%" << endl;
+	cout << "  " << (ok ? "restore ok" : "RESTORE FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: decisions returned by get_decision, and held by the solver, survive adding settings.
+*/
+int test_decision_pointers()
+{
+	rand_gen.seed(13);
+	std::list<SimSetting> settings(4);
+	Goblin goblin;
+	for (auto &s : settings) goblin.add(&s);
+	Goblin::capacity_t capacity = {1.5f * random_capacity(settings.size()), 4};
+	for (auto &s : settings) s.update();
+	goblin.update(capacity, 30);
+
+	std::vector<const Goblin::Decision_t*> held;
+	std::vector<Goblin::choice_index_t>    choices;
+	for (auto &s : settings) {held.push_back(goblin.get_decision(&s)); choices.push_back(held.back()->choice);}
+	auto solver = goblin.knapsack().decisions;
+
+	// Enough settings to grow the table several times.
+	std::list<SimSetting> more(200);
+	for (auto &s : more) goblin.add(&s);
+
+	bool ok = (goblin.knapsack().decisions == solver);
+	size_t index = 0;
+	for (auto &s : settings)
+	{
+		ok = ok && goblin.get_decision(&s) == held[index] && held[index]->choice == choices[index];
+		++index;
+	}
+
+	// Removing a setting removes its decision from the solver.
+	goblin.remove(&settings.front());
+	auto &remaining = goblin.knapsack().decisions;
+	ok = ok && remaining.size() + 1 == solver.size() &&
+		std::find(remaining.begin(), remaining.end(), held[0]) == remaining.end();
+
+	for (auto &s : settings) s.update();
+	for (auto &s : more) s.update();
+	goblin.update(capacity, 30);
+	ok = ok && goblin.knapsack().decisions.size() == settings.size() - 1 + more.size();
+
+	cout << "Decisions after adding " << more.size() << " settings to " << settings.size() << ": "
+		<< (ok ? "stable ok" : "STABLE FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: per-class past/present ratios stay consistent when settings change resource class.
+*/
+int test_resource_classes()
+{
+	struct ClassedSetting : SimSetting
+	{
+		resource_t resource = 0;
+		resource_t resource_class() const override    {return resource;}
+	};
+
+	rand_gen.seed(11);
+	const Goblin::resource_t cycle[] = {0, 1, 2, Goblin::RESOURCE_CLASSES + 1};
+	std::list<ClassedSetting> settings(30);
+	Goblin::capacity_t capacity = {1.5f * random_capacity(settings.size()), 4};
+	auto run = [&](Goblin &goblin, size_t frames, size_t flip_every)
+	{
+		for (size_t f = 0; f < frames; ++f)
+		{
+			size_t index = 0;
+			for (auto &s : settings)
+			{
+				// Settings start in classes 0-2; some cycle through them and one out of range as they run.
+				if (!flip_every) s.resource = cycle[index % 3];
+				else if ((f + index) % flip_every == 0 && index % 3 == 0) s.resource = cycle[(f / flip_every + index) % 4];
+				s.cost_scale = (s.resource == 1) ? 1.5f : (s.resource == 2) ? .75f : 1.f;
+				s.update();
+				++index;
+			}
+			goblin.update(capacity, 30);
+		}
+	};
+
+	Goblin past;
+	for (auto &s : settings) past.add(&s);
+	run(past, 200, 0);
+	for (auto &s : settings) past.remove(&s);
+
+	Goblin goblin;
+	for (auto &s : settings) goblin.add(&s);
+	goblin.set_past_profile(past.profile());
+	run(goblin, 400, 25);
+
+	// Incremental ratios must match a recount, and out-of-range classes share class 0's ratio.
+	std::vector<float> ratios;
+	for (Goblin::resource_t r = 0; r < Goblin::RESOURCE_CLASSES; ++r) ratios.push_back(goblin.past_present_ratio(r));
+	float overall = goblin.past_present_ratio(), out_of_range = goblin.past_present_ratio(Goblin::RESOURCE_CLASSES + 1);
+	goblin.set_profile(Profile_f(goblin.profile()));
+	bool ok = std::abs(overall - goblin.past_present_ratio()) < 1e-3f && out_of_range == ratios[0];
+	cout << std::fixed << std::setprecision(4) << "Resource class ratios after class changes (recount):" << endl;
+	for (Goblin::resource_t r = 0; r < 3; ++r)
+	{
+		float recount = goblin.past_present_ratio(r);
+		ok = ok && std::abs(ratios[r] - recount) < 1e-3f;
+		cout << "  class " << int(r) << ": " << ratios[r] << " (" << recount << ")" << endl;
+	}
+	cout << "  overall " << overall << ", out of range " << out_of_range << endl;
+	cout << "  " << (ok ? "classes ok" : "CLASSES FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: least-squares attribution of group measurements converges to known per-option costs.
+		Only differences between a member's options, and the group total, are observable.
+*/
+int test_groups()
+{
+	struct ShareSum : Profile_f::Observer
+	{
+		double sum = 0;
+		void pooled(const std::string&, const Profile_f::Task&, Profile_f::choice_index_t, const BurdenStat_f &delta) override
+			{sum += double(delta.sum());}
+	};
+
+	rand_gen.seed(9);
+	const std::vector<std::vector<float>> costs = {{1.f, 3.f}, {.5f, 2.f, 4.5f}, {2.f, 2.5f}};
+	const size_t frames = 3000;
+
+	Profile_f profile;
+	Profile_f::Group group;
+	ShareSum shares;
+	profile.set_observer(&shares);
+	for (size_t m = 0; m < costs.size(); ++m)
+		group.add("member" + std::to_string(m), Profile_f::choice_index_t(costs[m].size()));
+
+	std::vector<Profile_f::choice_index_t> choices(costs.size());
+	std::normal_distribution<float> noise(0.f, .05f);
+	for (size_t f = 0; f < frames; ++f)
+	{
+		float total = 0;
+		for (size_t m = 0; m < costs.size(); ++m)
+		{
+			choices[m] = Profile_f::choice_index_t(rand_gen() % costs[m].size());
+			total += costs[m][choices[m]];
+		}
+		profile.decay_recent(1.f - 1.f/30.f);
+		profile.collect_group(group, choices.data(), total * std::exp(noise(rand_gen)));
+	}
+
+	// Compare each option's cost relative to the member's first option, from the model and from recent estimates.
+	cout << std::fixed << std::setprecision(3);
+	cout << "Group of " << costs.size() << " members over " << frames << " frames:" << endl;
+	double model_error = 0, recent_error = 0, full_sum = 0, stat_count = 0;
+	bool varied = true;
+	for (size_t m = 0; m < costs.size(); ++m)
+	{
+		const Profile_f::Task *task = profile.find("member" + std::to_string(m));
+		cout << "  member" << m << ":";
+		for (Profile_f::choice_index_t i = 0; i < costs[m].size(); ++i)
+		{
+			double expect = costs[m][i] - costs[m][0];
+			double model  = group.predict(m, i) - group.predict(m, 0);
+			double recent = double(profile.recent(*task, i).mean()) - double(profile.recent(*task, 0).mean());
+			model_error  = std::max(model_error,  std::abs(model  - expect));
+			recent_error = std::max(recent_error, std::abs(recent - expect));
+			full_sum   += double(task->estimates[i].full.sum());
+			stat_count += double(task->estimates[i].full.count());
+			varied = varied && task->estimates[i].full.variance() > 0;
+			cout << " " << expect << " (model " << model << ", recent " << recent << ")";
+		}
+		cout << endl;
+	}
+
+	// Shares are collected as ordinary measurements: one per member per frame, observed as stored.
+	bool ok = model_error < .05 && recent_error < .15 && varied
+		&& stat_count == double(frames * costs.size()) && std::abs(shares.sum - full_sum) < 1e-3 * full_sum;
+	cout << "  largest error: model " << model_error << ", recent " << recent_error
+		<< "; observed shares " << shares.sum << " of stored " << full_sum << endl;
+
+	// Group burdens feed the goblin's anomaly.
+	//   Halfway, a second goblin is restored from a snapshot with the group's model, and follows in lockstep.
+	rand_gen.seed(9);
+	std::list<SimSetting> settings(3);
+	std::list<SimSetting> settings_b = settings;
+	Goblin goblin, goblin_b;
+	Goblin::Group goblin_group, group_b;
+	for (auto &s : settings)   {goblin  .add(&s); goblin_group.add(&s);}
+	for (auto &s : settings_b) {goblin_b.add(&s); group_b     .add(&s);}
+	goblin_b.set_profile_memory_limit(1 << 20);
+	Goblin::capacity_t capacity = {1e6f, 4};
+	float anomaly_before = 0, anomaly_after = 0, anomaly_b = 0;
+	bool restored = false;
+	for (size_t f = 0; f <= 300; ++f)
+	{
+		float scale = (f < 300) ? 1.f : 2.f, total = 0, total_b = 0;
+		for (auto &s : settings)   total   += scale * s.expect_mean(s.choice_index);
+		for (auto &s : settings_b) total_b += scale * s.expect_mean(s.choice_index);
+		ok = goblin.collect_group(goblin_group, total) && ok;
+		if (restored) goblin_b.collect_group(group_b, total_b);
+		if (f == 150)
+		{
+			std::string snapshot;
+			GoblinState::save(goblin, snapshot, true, {&goblin_group});
+			restored = GoblinState::restore(goblin_b, snapshot, {&group_b});
+		}
+		goblin.update(capacity, 30);
+		if (restored) {goblin_b.update(capacity, 30); anomaly_b = goblin_b.anomaly().latest;}
+		(f < 300 ? anomaly_before : anomaly_after) = goblin.anomaly().latest;
+	}
+	ok = ok && std::abs(anomaly_before - 1.f) < .05f && std::abs(anomaly_after - 2.f) < .1f;
+	cout << "  goblin anomaly " << anomaly_before << ", then " << anomaly_after << " when group burdens double" << endl;
+
+	bool same_model = restored && anomaly_b == anomaly_after && goblin_b.profile().memory_limit() == (1 << 20);
+	for (size_t m = 0; m < goblin_group.model().members().size(); ++m)
+		for (Goblin::choice_index_t i = 0; i < goblin_group.model().members()[m].option_count; ++i)
+			same_model = same_model && goblin_group.model().predict(m, i) == group_b.model().predict(m, i);
+	ok = ok && same_model;
+	cout << "  restored from a snapshot: " << (same_model ? "same model and anomaly" : "DIFFERENT") << endl;
+	cout << "  " << (ok ? "groups ok" : "GROUPS FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: sampling trades estimate accuracy for measurement overhead.
+		Recent statistics decay per measurement, so every measured estimate keeps
+		about 1/(1-alpha) recent samples whatever the sampling fraction.
+*/
+int test_sampling()
+{
+	const size_t setting_count = 40, frames = 3000;
+	const float  fractions[] = {1.f, .5f, .25f, .1f};
+
+	cout << std::fixed << std::setprecision(3);
+	cout << "Sampling " << setting_count << " settings over " << frames << " frames (costs double halfway):" << endl;
+	bool ok = true;
+	double last_overhead = 2, first_error = 0, last_error = 0;
+	for (float fraction : fractions)
+	{
+		rand_gen.seed(5);
+		std::list<SimSetting> settings;
+		for (size_t i = 0; i < setting_count; ++i) settings.emplace_back();
+		Goblin goblin;
+		for (auto &s : settings) goblin.add(&s);
+		goblin.config.sample_fraction = fraction;
+		Goblin::capacity_t capacity = {1.5f * random_capacity(settings.size()), 4};
+
+		size_t measured = 0, error_count = 0;
+		double error = 0;
+		std::vector<double> counts;
+		for (size_t f = 0; f < frames; ++f)
+		{
+			if (f == frames / 2) for (auto &s : settings) s.cost_scale = 2.f;
+			std::vector<bool> was_measured;
+			for (auto &s : settings) {s.update(); was_measured.push_back(s.measure.valid()); measured += was_measured.back();}
+			goblin.update(capacity, 30);
+			if (f < frames / 2) continue;
+
+			// Relative error of the recent estimate of each chosen option.
+			size_t index = 0;
+			for (auto &s : settings)
+			{
+				bool just_measured = was_measured[index++];
+				auto *task = goblin.profile().find(s.id());
+				if (!task) continue;
+				auto recent = goblin.profile().recent(*task, s.choice_index);
+				if (!recent) continue;
+				double expect = s.expect_mean(s.choice_index);
+				error += std::abs(double(recent.mean()) - expect) / expect;
+				++error_count;
+				if (f + 1 == frames && just_measured)
+					counts.push_back(double(recent.count()));
+			}
+		}
+		double overhead = double(measured) / double(setting_count * frames);
+		error /= std::max<size_t>(error_count, 1);
+		if (fraction == fractions[0]) first_error = error;
+		last_error = error;
+
+		// Settings measured in the last frame typically hold about 30 recent samples (alpha = 29/30).
+		std::sort(counts.begin(), counts.end());
+		double median_count = counts.empty() ? 0 : counts[counts.size() / 2];
+		bool row_ok = overhead < last_overhead && median_count > 20 && median_count < 40;
+		ok = ok && row_ok;
+		last_overhead = overhead;
+		cout << "  fraction " << std::setprecision(2) << fraction << ": measured " << std::setprecision(3) << overhead
+			<< " of settings per frame, mean relative error " << error << ", median recent samples "
+			<< std::setprecision(1) << median_count << (row_ok ? "" : " FAILED") << endl;
+	}
+	ok = ok && first_error < last_error;
+	cout << "  " << (ok ? "sampling ok" : "SAMPLING FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Generate a C++ header holding a profile as a table which ProfileView_ uses in place.
+		The table holds the binary profile format, so the header asserts that it is
+		compiled for the same layout as the generator.
+*/
+std::string embed_profile_header(const ProfileImage_f &image, const std::string &name, const std::string &source)
+{
+	using Header = detail::ProfileBinaryHeader;
+	const uint8_t order_bytes[4] = {4, 3, 2, 1};
+	uint32_t order_probe;
+	std::memcpy(&order_probe, order_bytes, sizeof(order_probe));
+	const bool little_endian = (order_probe == Header::ORDER_MARK);
+
+	// The image's words, copied out to avoid aliasing its bytes.
+	size_t word_count = (image.size() + 7) / 8;
+	std::vector<uint64_t> words(word_count, 0);
+	std::memcpy(words.data(), image.data(), image.size());
+
+	std::string header;
+	header += "#pragma once\n\n";
+	header += "// Generated by perf-goblin \"embed-profile\" from " + source + " (" + std::to_string(image.view().size()) + " tasks).\n";
+	header += "//   Binary profile data for " + std::to_string(sizeof(void*) * 8) + "-bit "
+		+ (little_endian ? "little" : "big") + "-endian platforms; view it with ProfileView_f::attach.\n";
+	header += "//   Include this file from one source file only.\n\n";
+	header += "#include <cstdint>\n";
+	header += "#include \"profile_view.h\"\n\n";
+	header += "// The table is only valid where the profile types have the generator's layout.\n";
+	header += "static_assert(perf_goblin::detail::ProfileBinaryHeader::VERSION == " + std::to_string(Header::VERSION)
+		+ ", \"" + name + ": binary profile format changed; regenerate with embed-profile\");\n";
+	header += "static_assert(sizeof(perf_goblin::ProfileView_f::Task) == " + std::to_string(sizeof(ProfileView_f::Task))
+		+ ", \"" + name + ": Task layout differs from the generator's; regenerate for this platform\");\n";
+	header += "static_assert(sizeof(perf_goblin::ProfileView_f::Estimate) == " + std::to_string(sizeof(ProfileView_f::Estimate))
+		+ ", \"" + name + ": Estimate layout differs from the generator's; regenerate for this platform\");\n";
+	header += "static_assert(sizeof(perf_goblin::ProfileView_f::burden_t) == " + std::to_string(sizeof(ProfileView_f::burden_t))
+		+ ", \"" + name + ": burden type differs from the generator's; regenerate for this platform\");\n\n";
+	header += "alignas(8) static constexpr uint64_t " + name + "[" + std::to_string(word_count) + "] =\n{";
+	char word[24];
+	for (size_t i = 0; i < word_count; ++i)
+	{
+		std::snprintf(word, sizeof(word), "0x%016llxull", static_cast<unsigned long long>(words[i]));
+		header += ((i % 4) ? " " : "\n\t");
+		header += word;
+		if (i+1 < word_count) header += ',';
+	}
+	header += "\n};\n";
+	return header;
+}
+
+/*
+	Tool: embed a profile in a C++ header (see embed_profile_header).
+*/
+int embed_profile_main(int argc, char **argv)
+{
+	if (argc < 5)
+	{
+		cout << "usage: embed-profile profile.json output.h table_name" << endl;
+		return 1;
+	}
+	const std::string input = argv[2], output = argv[3], name = argv[4];
+
+	std::string text;
+	Profile_f profile;
+	if (!detail::read_file(input, text) || !read_json(text, profile))
+	{
+		cout << "failed to read " << input << endl;
+		return 1;
+	}
+	ProfileImage_f image(profile);
+
+	if (!detail::write_file(output, embed_profile_header(image, name, input)))
+	{
+		cout << "failed to write " << output << endl;
+		return 1;
+	}
+	cout << "embedded " << profile.tasks().size() << " tasks (" << image.size() << " bytes) as " << name << " in " << output << endl;
+	return 0;
+}
+
+/*
+	Test: a profile embedded by the tool reads back through the table overload of ProfileView_::attach.
+		The table is parsed from the generated header as the compiler would read it,
+		and the header's layout assertions must name this build's sizes.
+*/
+int test_embed_profile()
+{
+	rand_gen.seed(2);
+	Profile_f profile = generate_profile(200);
+	const std::string input = "embed_test.json", output = "embed_test.h";
+	std::vector<std::string> args = {"perf-goblin", "embed-profile", input, output, "embed_test"};
+	std::vector<char*> argv;
+	for (auto &arg : args) argv.push_back(&arg[0]);
+	std::string header;
+	bool ok = detail::write_file(input, to_json(profile))
+		&& embed_profile_main(int(argv.size()), argv.data()) == 0
+		&& detail::read_file(output, header);
+	std::remove(input.c_str());
+	std::remove(output.c_str());
+
+	auto asserts = [&](const std::string &expression, size_t value)
+		{return header.find("static_assert(" + expression + " == " + std::to_string(value) + ",") != std::string::npos;};
+	bool layout = asserts("perf_goblin::detail::ProfileBinaryHeader::VERSION",    detail::ProfileBinaryHeader::VERSION)
+		&& asserts("sizeof(perf_goblin::ProfileView_f::Task)",     sizeof(ProfileView_f::Task))
+		&& asserts("sizeof(perf_goblin::ProfileView_f::Estimate)", sizeof(ProfileView_f::Estimate))
+		&& asserts("sizeof(perf_goblin::ProfileView_f::burden_t)", sizeof(ProfileView_f::burden_t));
+
+	// Parse the table's initializer.
+	alignas(8) static uint64_t table[1 << 16];
+	size_t word_count = 0, declared = 0;
+	size_t at = header.find("embed_test[");
+	if (at != std::string::npos) declared = std::strtoull(header.c_str() + at + 11, nullptr, 10);
+	for (at = header.find("0x", at); at != std::string::npos && word_count < (1 << 16); at = header.find("0x", at + 2))
+		table[word_count++] = std::strtoull(header.c_str() + at, nullptr, 16);
+
+	ProfileView_f view;
+	bool attached = ok && word_count == declared && view.attach(table) && view.size() == profile.tasks().size();
+	size_t mismatches = 0;
+	for (auto &entry : profile)
+	{
+		auto *task = attached ? view.find(entry.first) : nullptr;
+		if (!task || task->count != entry.second->count) {++mismatches; continue;}
+		for (Profile_f::choice_index_t i = 0; i < task->count; ++i)
+		{
+			auto &a = entry.second->estimates[i].full, &b = task->estimates[i].full;
+			if (a.count() != b.count() || a.mean() != b.mean() || a.deviation() != b.deviation()) ++mismatches;
+		}
+	}
+	cout << "  layout assertions " << (layout ? "match" : "MISMATCH") << ", " << word_count << " words "
+		<< (attached ? "attached" : "refused") << ", " << mismatches << " mismatched tasks" << endl;
+	ok = ok && layout && attached && !mismatches;
+	cout << "  " << (ok ? "embed ok" : "EMBED FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Benchmark: a long session where new task IDs keep appearing, with and without a memory limit.
+		Measurements reach the goblin through a shard, as from a streaming thread.
+*/
+void bench_eviction()
+{
+	using clock = std::chrono::steady_clock;
+	const size_t frames = 100000, active = 200, limit = 1 << 20;
+
+	// A past profile covering some tasks, so the goblin tracks a ratio.
+	rand_gen.seed(7);
+	auto id_of = [](size_t k) {return "asset" + std::to_string(k) + ".lod";};
+	Profile_f past;
+	Profile_f::Measurement m;
+	for (size_t k = 0; k < frames + active; k += 10)
+		for (m.choice = 0; m.choice < 3; ++m.choice) {m.burden = 1.f + m.choice + k % 7; past.collect(id_of(k), 3, m);}
+
+	cout << "Session of " << frames << " frames; " << active << " tasks active at a time, one new task per frame:" << endl;
+	for (size_t run_limit : {size_t(0), limit})
+	{
+		Goblin goblin;
+		goblin.set_past_profile(past);
+		goblin.set_profile_memory_limit(run_limit);
+		ProfileShard_f shard;
+
+		size_t max_bytes = 0;
+		double t_first = 0, t_last = 0;
+		auto start = clock::now();
+		for (size_t f = 0; f < frames; ++f)
+		{
+			for (size_t a = 0; a < 20; ++a)
+			{
+				size_t k = f + rand_gen() % active;
+				m.choice = Profile_f::choice_index_t(rand_gen() % 3);
+				m.burden = (1.f + .5f * (k % 3)) * (1.f + m.choice + k % 7);
+				shard.collect(id_of(k), 3, m);
+			}
+			goblin.merge(shard);
+			goblin.update_harvest();
+			max_bytes = std::max(max_bytes, goblin.profile().bytes_used());
+
+			if ((f+1) % (frames / 10) == 0)
+			{
+				double t = std::chrono::duration<double, std::micro>(clock::now() - start).count() / (frames / 10);
+				if (!t_first) t_first = t;
+				t_last = t;
+				start = clock::now();
+			}
+		}
+
+		// The incrementally maintained ratio must match a recount over the remaining tasks.
+		float ratio = goblin.past_present_ratio();
+		goblin.set_profile(Profile_f(goblin.profile()));
+		float recount = goblin.past_present_ratio();
+
+		cout << std::fixed << std::setprecision(2);
+		cout << "  " << (run_limit ? "limit 1 MiB: " : "no limit:    ") << goblin.profile().tasks().size() << " tasks, peak "
+			<< (max_bytes / 1024) << " KiB, " << t_first << " -> " << t_last << " us per frame, ratio "
+			<< std::setprecision(4) << ratio << " (recount " << recount << ")"
+			<< ((std::abs(ratio - recount) < 1e-3f && (!run_limit || max_bytes <= limit + limit / 4)) ? "" : " FAILED") << endl;
+	}
+}
+
+/*
+	Test: a profile's memory limit holds with tasks of mixed option counts,
+		and settings present in a sampling goblin survive eviction while unmeasured.
+*/
+int test_eviction()
+{
+	rand_gen.seed(11);
+	const size_t limit = 256 << 10;
+	Profile_f::Measurement m;
+
+	// New tasks of 1 to 16 options every frame; memory held must stay near the limit.
+	Profile_f profile;
+	profile.set_memory_limit(limit);
+	size_t peak = 0, next_id = 0;
+	for (size_t f = 0; f < 20000; ++f)
+	{
+		for (size_t a = 0; a < 10; ++a)
+		{
+			auto count = Profile_f::choice_index_t(1 + rand_gen() % 16);
+			m.choice = Profile_f::choice_index_t(rand_gen() % count);
+			m.burden = 1.f;
+			profile.collect("mixed" + std::to_string(next_id++), count, m);
+		}
+		profile.decay_recent(.9f);
+		peak = std::max(peak, profile.bytes_used());
+	}
+	Profile_f moved;
+	moved = std::move(profile);
+	bool mixed_ok = (peak <= limit + limit / 8) && moved.memory_limit() == limit;
+	cout << "  mixed option counts: " << moved.tasks().size() << " tasks, peak " << (peak / 1024) << " KiB of "
+		<< (limit / 1024) << (mixed_ok ? "  ok" : "  FAILED") << endl;
+
+	// A sampling goblin whose settings are measured rarely, beside a stream of one-off tasks.
+	std::list<SimSetting> settings(40);
+	Goblin goblin;
+	for (auto &s : settings) goblin.add(&s);
+	goblin.config.sample_fraction = .05f;
+	goblin.set_profile_memory_limit(limit);
+	ProfileShard_f shard;
+	Goblin::capacity_t capacity = {1.5f * random_capacity(settings.size()), 4};
+	size_t lost = 0;
+	for (size_t f = 0; f < 2000; ++f)
+	{
+		for (size_t a = 0; a < 200; ++a)
+		{
+			m.choice = Profile_f::choice_index_t(rand_gen() % 3);
+			m.burden = 1.f;
+			shard.collect("stream" + std::to_string(next_id++), 3, m);
+		}
+		goblin.merge(shard);
+		for (auto &s : settings) s.update();
+		goblin.update(capacity, 30);
+		if (f >= 100) for (auto &s : settings) if (!goblin.profile().find(s.id())) ++lost;
+	}
+	bool present_ok = (lost == 0);
+	cout << "  sampled settings: " << lost << " evicted while present, "
+		<< goblin.profile().tasks().size() << " tasks kept" << (present_ok ? "  ok" : "  FAILED") << endl;
+	bool ok = mixed_ok && present_ok;
+	cout << "  " << (ok ? "eviction ok" : "EVICTION FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: scope timers record the burden of their own work, excluding nested timers,
+		and record nothing for settings which don't want a measurement.
+*/
+struct TimedSetting
+{
+	using burden_t = float;
+
+	bool   wants  = true;
+	float  burden = 0.f;
+	size_t count  = 0;
+
+	bool wants_measurement() const         {return wants;}
+	void measurement_add(burden_t add)     {burden += add; ++count;}
+};
+
+static void spin_for_ms(double ms)
+{
+	auto end = std::chrono::steady_clock::now() + std::chrono::duration<double, std::milli>(ms);
+	while (std::chrono::steady_clock::now() < end) {}
+}
+
+template<typename T_Timer>
+static bool test_timer(const char *name)
+{
+	using clock = std::chrono::steady_clock;
+
+	// Calibration happens here, once, rather than in the first measured scope.
+	auto t0 = clock::now();
+	T_Timer::calibrate();
+	auto t1 = clock::now();
+	T_Timer::calibrate();
+	auto t2 = clock::now();
+
+	// An outer timer of 2+1ms around an inner of 3ms, around a skipped 1ms.
+	//   Preemption can stretch a run, so the best of a few runs is checked.
+	bool ok = false;
+	TimedSetting outer, inner, skipped, top_skipped, stopped;
+	for (int attempt = 0; attempt < 5 && !ok; ++attempt)
+	{
+		outer = inner = skipped = top_skipped = stopped = TimedSetting();
+		skipped.wants = top_skipped.wants = false;
+		{
+			T_Timer a(outer);
+			spin_for_ms(2);
+			{
+				T_Timer b(inner);
+				spin_for_ms(3);
+				T_Timer c(skipped);
+				spin_for_ms(1);
+			}
+			spin_for_ms(1);
+		}
+		{
+			T_Timer d(top_skipped);
+			T_Timer e(stopped);
+			spin_for_ms(1);
+			e.stop();
+			spin_for_ms(1);
+		}
+		ok = outer.count == 1 && inner.count == 1 && skipped.count == 0 && top_skipped.count == 0 && stopped.count == 1
+			&& std::abs(outer.burden - 3.f) < .3f && std::abs(inner.burden - 3.f) < .3f && std::abs(stopped.burden - 1.f) < .2f;
+	}
+
+	cout << "  " << std::left << std::setw(10) << name << std::right
+		<< " calibrate " << std::chrono::duration<double, std::milli>(t1 - t0).count() << "ms then "
+		<< std::chrono::duration<double, std::milli>(t2 - t1).count() << "ms, outer "
+		<< outer.burden << "ms, inner " << inner.burden << "ms, stopped " << stopped.burden << "ms"
+		<< (ok ? "" : " FAILED") << endl;
+	return ok;
+}
+
+int test_timers()
+{
+	cout << std::fixed << std::setprecision(3);
+	cout << "Scope timers (expecting outer 3ms, inner 3ms, stopped 1ms):" << endl;
+	bool ok = test_timer<ScopeTimer>("steady");
+	ok = test_timer<ScopeTimer_ThreadCPU>("threadcpu") && ok;
+	ok = test_timer<ScopeTimer_TSC>("tsc") && ok;
+	cout << "  " << (ok ? "timers ok" : "TIMERS FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: perf_event clocks time a scope in their own units, or record nothing without a counter.
+*/
+template<typename T_Clock>
+static bool test_perf_clock(const char *name, float expected, float tolerance)
+{
+	static const char *const sources[] = {"perf_event", "task-clock", "thread clock", "none"};
+	using Timer = ScopeTimer_<T_Clock>;
+	Timer::calibrate();
+
+	TimedSetting setting;
+	{
+		Timer timer(setting);
+		spin_for_ms(2);
+	}
+	bool counted = (T_Clock::source() != PerfSource::None);
+	bool ok = counted ?
+		(setting.count == 1 && setting.burden > expected / tolerance && setting.burden < expected * tolerance) :
+		(setting.count == 0);
+
+	cout << "  " << std::left << std::setw(13) << name << std::right << " via " << sources[int(T_Clock::source())]
+		<< ": " << setting.burden << (ok ? "" : " FAILED") << endl;
+	return ok;
+}
+
+// A clock which fails on demand, like a counter which can't be read.
+struct Clock_Flaky
+{
+	using tick_t = uint64_t;
+	static bool failing;
+	static tick_t now()                 {return failing ? ~tick_t(0) : Clock_Steady::now();}
+	static double seconds_per_tick()    {return Clock_Steady::seconds_per_tick();}
+};
+bool Clock_Flaky::failing = false;
+
+void test_perf_event()
+{
+	cout << std::fixed << std::setprecision(3);
+	cout << "perf_event timers over 2ms of work (task-clock in ms, cycles in nominal ms, instructions in millions):" << endl;
+	bool ok = test_perf_clock<Clock_TaskClock>("task-clock", 2.f, 1.3f);
+	ok = test_perf_clock<Clock_Cycles>("cycles", 2.f, 4.f) && ok;
+	ok = test_perf_clock<Clock_Instructions>("instructions", 2.f, 1000.f) && ok;
+
+	// A failed reading drops the inner measurement and the enclosing one.
+	using FlakyTimer = ScopeTimer_<Clock_Flaky>;
+	FlakyTimer::calibrate();
+	TimedSetting outer, inner, after;
+	{
+		FlakyTimer a(outer);
+		{
+			FlakyTimer b(inner);
+			spin_for_ms(1);
+			Clock_Flaky::failing = true;
+		}
+		Clock_Flaky::failing = false;
+		spin_for_ms(1);
+	}
+	{
+		FlakyTimer c(after);
+		spin_for_ms(1);
+	}
+	bool dropped = (outer.count == 0 && inner.count == 0 && after.count == 1);
+	cout << "  failed reading: " << (dropped ? "dropped" : "RECORDED") << endl;
+	ok = ok && dropped;
+	cout << "  " << (ok ? "perf_event ok" : "PERF_EVENT FAILED") << endl;
+}
+
+/*
+	Test: histograms of a bimodal burden, such as a cache hit or miss.
+		A normal approximation misjudges the chance of exceeding a budget; the histogram shouldn't.
+*/
+int test_histograms()
+{
+	rand_gen.seed(11);
+	std::normal_distribution<float> hit(1.f, .1f), miss(8.f, .5f);
+	std::bernoulli_distribution is_miss(.1);
+
+	BurdenStat_f stat;
+	BurdenHistogram_f histogram;
+	std::vector<float> samples;
+	for (size_t i = 0; i < 20000; ++i)
+	{
+		float burden = is_miss(rand_gen) ? miss(rand_gen) : hit(rand_gen);
+		samples.push_back(burden);
+		stat.push(burden);
+		histogram.push(burden);
+	}
+
+	bool ok = true;
+	cout << std::fixed << std::setprecision(3);
+	cout << "Bimodal burden (90% ~1ms, 10% ~8ms), mean " << stat.mean() << " deviation " << stat.deviation() << ":" << endl;
+	for (float budget : {1.5f, 3.f, 6.f, 10.f})
+	{
+		size_t over = 0;
+		for (float b : samples) over += (b > budget);
+		double actual = double(over) / samples.size();
+		double normal = .5 * std::erfc((budget - stat.mean()) / (stat.deviation() * std::sqrt(2.0)));
+		double hist   = histogram.probability_above(budget);
+		ok = ok && std::abs(hist - actual) < .02;
+		cout << "  P(burden > " << budget << "): actual " << actual << ", histogram " << hist << ", normal " << normal << endl;
+	}
+	cout << "  median " << histogram.quantile(.5f) << ", 95th percentile " << histogram.quantile(.95f) << endl;
+
+	// Pooling adds, decay diminishes, scaling moves the distribution.
+	auto pooled = histogram.pool(histogram);
+	ok = ok && std::abs(pooled.count() - 2 * histogram.count()) < 1.f;
+	auto decayed = histogram;
+	decayed.decay(.5f);
+	ok = ok && std::abs(decayed.count() - .5f * histogram.count()) < 1.f;
+	auto scaled = histogram;
+	scaled.scale(2.f);
+	ok = ok && std::abs(scaled.count() - histogram.count()) < 1.f
+		&& std::abs(scaled.quantile(.5f) / histogram.quantile(.5f) - 2.f) < .1f;
+
+#if PERF_GOBLIN_HISTOGRAMS
+	// Profiles keep a histogram per estimate, which survives JSON.
+	Profile_f profile, loaded;
+	Profile_f::Measurement m;
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		m.choice = Profile_f::choice_index_t(i % 2);
+		m.burden = samples[i] * (1 + m.choice);
+		profile.collect("bimodal", 2, m);
+	}
+	std::string json;
+	write_json(json, profile);
+	ok = ok && read_json(json, loaded) && loaded.find("bimodal");
+	if (ok) for (Profile_f::choice_index_t i = 0; i < 2; ++i)
+	{
+		auto &a = profile.find("bimodal")->estimates[i].histogram, &b = loaded.find("bimodal")->estimates[i].histogram;
+		ok = ok && std::equal(std::begin(a.counts), std::end(a.counts), std::begin(b.counts));
+	}
+	cout << "  profile histograms round-trip through " << json.size() << " bytes of JSON" << endl;
+
+	// Profile histograms decay with recent statistics, to 1/(1-alpha) samples.
+	Profile_f decaying;
+	m.choice = 0;
+	m.burden = 1.f;
+	for (size_t f = 0; f < 200; ++f) {decaying.decay_recent(.9f); decaying.collect("decaying", 1, m);}
+	auto &estimate = decaying.find("decaying")->estimates[0];
+	ok = ok && std::abs(estimate.histogram.count() - 10.f) < .1f;
+	cout << "  decaying histogram holds " << estimate.histogram.count() << " samples (expected 10)" << endl;
+#endif
+
+	cout << "  " << (ok ? "histograms ok" : "HISTOGRAMS FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: a long session's statistics, in each accumulator precision.
+		The burden doubles after 2^24 samples; the full mean should approach the average.
+		Single-precision counts are expected to freeze; returns false if any other does.
+*/
+template<typename T_Econ>
+static bool test_accumulator(const char *name, bool may_freeze)
+{
+	using clock = std::chrono::steady_clock;
+	const size_t half = size_t(1) << 25;
+
+	BurdenStat_<T_Econ> stat;
+	auto start = clock::now();
+	for (size_t i = 0; i < 2*half; ++i) stat.push(i < half ? 1.f : 2.f);
+	double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / (2*half);
+
+	// Profiles in any precision save and restore.
+	Profile_<T_Econ> profile, loaded;
+	typename Profile_<T_Econ>::Measurement m;
+	for (m.choice = 0; m.choice < 2; ++m.choice) {m.burden = 1.f + m.choice; profile.collect("task", 2, m);}
+	std::string json;
+	write_json(json, profile);
+	bool ok = read_json(json, loaded) && loaded.find("task") && loaded.find("task")->estimates[1].full.mean() == 2.f;
+
+	bool frozen = !(std::abs(stat.mean() - 1.5f) < 1e-3f);
+	cout << std::fixed << std::setprecision(1) << "  " << name << ": " << sizeof(stat) << " bytes, " << ns << " ns per push, count "
+		<< std::setprecision(0) << stat.count() << ", mean " << std::setprecision(4) << stat.mean()
+		<< (frozen ? " (FROZEN)" : "") << (ok ? "" : " (ROUND TRIP FAILED)") << endl;
+	return ok && (may_freeze || !frozen);
+}
+
+int test_accumulators()
+{
+	cout << "Pushing 2^25 burdens of 1 then 2^25 of 2:" << endl;
+	bool ok = test_accumulator<Economy_f> ("float ", true);
+	ok = test_accumulator<Economy_fd>("double", false) && ok;
+	ok = test_accumulator<Economy_fk>("kahan ", false) && ok;
+	cout << "  " << (ok ? "accumulators ok" : "ACCUMULATORS FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	A setting with burdens in integer nanoseconds, drawn from its own integer random stream.
+*/
+class TickSetting : public Setting_<Economy_Ticks>
+{
+public:
+	using Ticks = Economy_Ticks::burden_t;
+
+	choice_index_t     choice_index = 0;
+	std::vector<Option> optionVec;
+	Options            _options;
+	std::vector<uint32_t> base_ns;
+	uint32_t           state;
+	Measurement        measure;
+	std::string        _id;
+
+	explicit TickSetting(uint32_t seed) : state(seed * 2654435761u + 1)
+	{
+		choice_index_t count = choice_index_t(2 + seed % 4);
+		for (choice_index_t i = 0; i < count; ++i)
+		{
+			optionVec.push_back({float(i * (1 + seed % 3))});
+			base_ns.push_back(20000u * (i + 1) * (1 + seed % 5));
+		}
+		_options.options = optionVec.data();
+		_options.option_count = count;
+		_id = "tick" + std::to_string(seed % 40); // Some settings share profiles.
+	}
+
+	uint32_t next()    {state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state;}
+
+	void update()
+	{
+		uint32_t base = base_ns[choice_index], r = next();
+		uint32_t ns = base + r % (base / 4 + 1);
+		if (r % 64 == 0) ns *= 4; // Occasional spikes
+		measure.burden = Ticks::from_ticks(ns);
+		measure.choice = (wants_measurement() ? choice_index : NO_CHOICE);
+	}
+
+	const Options     &options() const override    {return _options;}
+	const std::string &id()      const override    {return _id;}
+	Measurement measurement() override    {Measurement m = measure; measure.choice = NO_CHOICE; return m;}
+	void choice_set(choice_index_t c, strategy_index_t) override    {choice_index = c;}
+};
+
+/*
+	Test: goblins on integer ticks make bit-identical choices from the same inputs.
+		The two goblins' settings live at different addresses, so their hash tables differ.
+		The checksum of all choices should match on every compiler and CPU.
+*/
+int test_determinism()
+{
+	const uint64_t expected = 0x79186874ecbb5747ull;
+	const size_t settings_n = 60, frames = 400;
+	std::list<TickSetting> settings_a, settings_b;
+	std::vector<std::unique_ptr<char[]>> spacers;
+	for (uint32_t i = 0; i < settings_n; ++i)
+	{
+		settings_a.emplace_back(i);
+		spacers.emplace_back(new char[1 + i * 24]);
+		settings_b.emplace_back(i);
+	}
+
+	Goblin_<Economy_Ticks> goblin_a, goblin_b;
+	for (auto &s : settings_a) goblin_a.add(&s);
+	for (auto &s : settings_b) goblin_b.add(&s);
+
+	Goblin_<Economy_Ticks>::capacity_t capacity = {TickSetting::Ticks::from_ticks(5000000), 3};
+	uint64_t checksum = 14695981039346656037ull; // FNV-1a
+	size_t mismatches = 0;
+	for (size_t f = 0; f < frames; ++f)
+	{
+		for (auto &s : settings_a) s.update();
+		for (auto &s : settings_b) s.update();
+		goblin_a.update(capacity, 50);
+		goblin_b.update(capacity, 50);
+		for (auto a = settings_a.begin(), b = settings_b.begin(); a != settings_a.end(); ++a, ++b)
+		{
+			mismatches += (a->choice_index != b->choice_index);
+			checksum = (checksum ^ a->choice_index) * 1099511628211ull;
+		}
+	}
+
+	cout << "Integer-tick goblins over " << frames << " frames of " << settings_n << " settings:" << endl;
+	cout << "  " << mismatches << " differing choices, checksum 0x" << std::hex << checksum
+		<< " (expected 0x" << expected << ")" << std::dec << endl;
+	bool ok = (mismatches == 0 && checksum == expected);
+	cout << "  " << (ok ? "deterministic" : "NOT DETERMINISTIC") << endl;
+	return ok ? 0 : 1;
+}
+
+/*
+	Benchmark: knapsack solves over a sweep of problem sizes, option mixes and precisions.
+		Prints one CSV line (or JSON object) per point.  Each problem is generated from a seed
+		fixed by its size and mix, so every precision solves the same problem on every run.
+		Points whose worst-case iterations (precision × decisions × options) exceed the budget
+		are listed as skipped, except that a problem no precision fits is still solved once,
+		at the finest precision that fits (but at least 4).  value_ratio compares the solution to the LP bound, so it
+		understates the true ratio to the optimum.
+*/
+int bench_knapsack_main(int argc, char **argv)
+{
+	struct Mix {const char *name; int kind;};
+	static const Mix mixes[] = {{"mixed", -1}, {"binary", 2}, {"orderly", 5}, {"chaotic", 7}};
+
+	std::vector<size_t>   decision_counts = {10, 30, 100, 300, 1000, 3000, 10000};
+	std::vector<unsigned> option_counts   = {0, 4, 16}; // 0: random count, as in generate_decision
+	std::vector<unsigned> precisions      = {10, 30, 100};
+	std::string only_mix;
+	double budget = 2e8;
+	bool json = false;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if      (arg == "--json") json = true;
+		else if (arg == "--budget"    && i+1 < argc) budget = std::atof(argv[++i]);
+		else if (arg == "--decisions" && i+1 < argc) decision_counts = {size_t(std::atol(argv[++i]))};
+		else if (arg == "--options"   && i+1 < argc) option_counts = {unsigned(std::atoi(argv[++i]))};
+		else if (arg == "--precision" && i+1 < argc) precisions = {unsigned(std::atoi(argv[++i]))};
+		else if (arg == "--mix"       && i+1 < argc) only_mix = argv[++i];
+		else
+		{
+			cout << "usage: bench-knapsack [--json] [--budget iterations] [--decisions N] [--options N] [--precision N]"
+				" [--mix mixed|binary|orderly|chaotic]" << endl;
+			cout << "  --budget skips precisions whose worst-case iterations exceed it (default 2e8);" << endl;
+			cout << "    a problem no precision fits is solved at the finest precision that does, but at least 4." << endl;
+			return 1;
+		}
+	}
+
+	if (json) cout << "[" << endl;
+	else      cout << "decisions,mix,options,precision,status,ns_per_solve,iterations,table_bytes,value,bound,value_ratio" << endl;
+	bool first_row = true;
+
+	Knapsack problem;
+	for (size_t decision_count : decision_counts)
+		for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m)
+	{
+		const Mix &mix = mixes[m];
+		if (!only_mix.empty() && only_mix != mix.name) continue;
+
+		for (unsigned option_count : option_counts)
+		{
+			if (mix.kind == 2 && option_count) continue; // Binary choices always have 2 options.
+
+			rand_gen.seed(uint32_t(decision_count * 131u + m * 17u + option_count));
+			generate_problem(problem, decision_count, mix.kind, option_count);
+			float capacity = random_capacity(decision_count);
+
+			size_t total_options = 0;
+			for (auto *d : problem.decisions) total_options += d->option_count;
+			const double relaxed  = problem.relaxed_bound(capacity);
+			const bool   feasible = (relaxed > -std::numeric_limits<double>::infinity());
+			const float  bound    = float(relaxed);
+
+			// If even the coarsest precision exceeds the budget, solve at a coarser one instead.
+			const double   work     = double(decision_count) * double(total_options);
+			const unsigned coarsest = *std::min_element(precisions.begin(), precisions.end());
+			const unsigned capped   = unsigned(std::min(double(coarsest), std::max(4.0, std::floor(budget / work))));
+			bool capping = (double(coarsest) * work > budget);
+
+			for (unsigned precision : precisions)
+			{
+				const char *status = "skipped";
+				double ns = 0;
+				size_t table_bytes = 0;
+				bool solve = (double(precision) * work <= budget);
+				if (capping && precision == coarsest) {precision = capped; solve = true; capping = false;}
+				if (solve)
+				{
+					// One untimed solve warms the table's memory, then repeat for at least 50ms.
+					bool successful = problem.decide(capacity, precision);
+					size_t reps = 0;
+					auto start = std::chrono::steady_clock::now();
+					std::chrono::duration<double> elapsed(0);
+					do
+					{
+						problem.decide(capacity, precision);
+						++reps;
+						elapsed = std::chrono::steady_clock::now() - start;
+					}
+					while (elapsed.count() < .05 && reps < 10000);
+					ns = 1e9 * elapsed.count() / double(reps);
+
+					if (problem.stats.iterations) // Shortcuts leave the table from an earlier solve.
+						table_bytes = problem.minimums.store.size() * sizeof(Knapsack::Minimum)
+							+ problem.minimums.row_end.size() * sizeof(problem.minimums.row_end[0]);
+					if      (!successful)              status = "impossible";
+					else if (problem.stats.iterations) status = "approximate";
+					else                               status = "ideal";
+				}
+				bool ran = (status != std::string("skipped")), rated = ran && feasible && bound > 0;
+				float value = problem.stats.chosen.net_value;
+
+				std::ostringstream row;
+				row << std::setprecision(6);
+				if (json)
+				{
+					row << (first_row ? "  " : ", ") << "{\"decisions\":" << decision_count << ",\"mix\":\"" << mix.name
+						<< "\",\"options\":" << option_count << ",\"precision\":" << precision << ",\"status\":\"" << status << '"';
+					if (ran) row << ",\"ns_per_solve\":" << std::llround(ns) << ",\"iterations\":" << problem.stats.iterations
+						<< ",\"table_bytes\":" << table_bytes << ",\"value\":" << value;
+					if (feasible) row << ",\"bound\":" << bound;
+					if (rated) row << ",\"value_ratio\":" << (value / bound);
+					row << '}';
+				}
+				else
+				{
+					row << decision_count << ',' << mix.name << ',' << option_count << ',' << precision << ',' << status << ',';
+					if (ran) row << std::llround(ns) << ',' << problem.stats.iterations << ',' << table_bytes << ',' << value;
+					else     row << ",,,";
+					row << ',';
+					if (feasible) row << bound;
+					row << ',';
+					if (rated) row << (value / bound);
+				}
+				cout << row.str() << endl;
+				first_row = false;
+			}
+		}
+	}
+	if (json) cout << "]" << endl;
+	return 0;
+}
+
+static void print_replay(const char *label, const GoblinTraceReplay::Stats &stats)
+{
+	cout << "  " << label << ":" << endl;
+	cout << "    " << stats.frames << " frames, " << (100.0 * stats.agreements / std::max<size_t>(stats.decisions, 1))
+		<< "% of decisions as recorded" << endl;
+	cout << "    measurements: " << stats.measurements << " replayed, " << stats.simulated << " simulated, "
+		<< stats.unsimulated << " skipped" << endl;
+	cout << "    overruns: " << stats.overruns << ", mean value $" << (stats.value / std::max<size_t>(stats.frames, 1))
+		<< " (recorded $" << (stats.recorded_value / std::max<size_t>(stats.frames, 1)) << ")" << endl;
+}
+
+/*
+	Test: record a simulated goblin and replay the trace.
+		Replaying with the recorded config should reproduce every decision from recorded measurements.
+		Replaying with a different config simulates measurements for the choices which differ.
+*/
+int test_trace_main(int argc, char **argv)
+{
+	std::string output;
+	for (int i = 2; i+1 < argc; ++i) if (std::string(argv[i]) == "-o") output = argv[++i];
+
+	const size_t frames = 1000;
+	rand_gen.seed(5);
+	std::list<SimSetting> settings(50);
+	Goblin::capacity_t capacity = {1.5f * random_capacity(settings.size()), 4};
+
+	std::string trace;
+	{
+		Goblin goblin;
+		goblin.config.explore_value = 50.f;
+		for (auto &setting : settings) goblin.add(&setting);
+
+		GoblinTraceRecorder recorder(goblin);
+		for (size_t f = 0; f < frames; ++f)
+		{
+			goblin.update(capacity, 30);
+			for (auto &setting : settings) setting.update();
+		}
+		trace = recorder.data();
+	}
+	cout << std::fixed << std::setprecision(1);
+	cout << "Recorded " << frames << " frames of " << settings.size() << " settings: "
+		<< trace.size() << " bytes (" << (float(trace.size()) / frames) << " per frame)" << endl;
+
+	GoblinTraceReplay replay;
+	if (!replay.load(trace))
+	{
+		cout << "  failed to load the trace." << endl;
+		return 1;
+	}
+
+	Goblin same;
+	GoblinTraceReplay::Stats stats = replay.run(same);
+	print_replay("replayed with the recorded config", stats);
+	bool reproduced = (stats.agreements == stats.decisions && stats.simulated == 0 && stats.frames == frames);
+
+	Goblin changed;
+	changed.config = replay.config();
+	changed.config.explore_value = 0.f;
+	changed.config.sample_fraction = .25f;
+	print_replay("replayed without exploring, sampling 25%", replay.run(changed, 1, false));
+
+	GoblinTraceReplay cut;
+	bool truncated = cut.load(trace.substr(0, trace.size() - 3)) && cut.frames() == frames - 1;
+	cout << "  a trace cut short replays " << cut.frames() << " frames" << endl;
+
+	if (output.length())
+	{
+		if (detail::write_file(output, trace)) cout << "  saved to " << output << endl;
+		else                                   cout << "  couldn't save to " << output << endl;
+	}
+
+	bool pass = reproduced && truncated;
+	cout << "  " << (pass ? "success" : "FAILED") << endl;
+	return pass ? 0 : 1;
+}
+
+/*
+	Replay a recorded trace into a fresh goblin and report how it fared.
+*/
+int replay_trace_main(int argc, char **argv)
+{
+	std::string path;
+	size_t   precision = 0;
+	uint32_t seed = 1;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if      (arg == "-p" && i+1 < argc) precision = size_t(std::max(0, std::atoi(argv[++i])));
+		else if (arg == "-s" && i+1 < argc) seed      = uint32_t(std::atol(argv[++i]));
+		else path = arg;
+	}
+	if (path.empty())
+	{
+		cout << "usage: replay-trace [-p precision] [-s seed] trace.bin" << endl;
+		return 1;
+	}
+
+	std::string data;
+	GoblinTraceReplay replay;
+	if (!detail::read_file(path, data) || !replay.load(data))
+	{
+		cout << "couldn't read a trace from " << path << endl;
+		return 1;
+	}
+	Goblin goblin;
+	cout << std::fixed << std::setprecision(1);
+	print_replay(path.c_str(), replay.run(goblin, seed, true, precision));
+	return 0;
+}
+
+static float burden_mean(float burden)                              {return burden;}
+static float burden_mean(const Economy_Normal_f::burden_t &burden)    {return burden.mean;}
+
+static float knapsack_bound(const KnapsackDump &dump)
+{
+	Knapsack problem;
+	KnapsackDump copy = dump;
+	copy.setup(problem);
+	const double bound = problem.relaxed_bound(dump.capacity);
+	return (bound > -std::numeric_limits<double>::infinity()) ? float(bound) : NAN;
+}
+static float knapsack_bound(const KnapsackDump_Normal &)    {return NAN;}
+
+// Print the exact optimum of a scalar dump, or the best found if the search gives up.
+static void solve_exact(const std::string &name, const char *economy, KnapsackDump &dump)
+{
+	Knapsack problem;
+	dump.setup(problem);
+	auto start = std::chrono::steady_clock::now();
+	auto result = KnapsackExact().solve(problem, dump.capacity, 5000000);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	cout << name << ',' << economy << ',' << dump.decisions.size() << ',' << dump.option_count() << ','
+		<< (result.exact ? "exact" : "exact-partial") << ",," << (1e6 * elapsed.count()) << ','
+		<< result.value << ',' << result.burden << ',' << (result.feasible ? "yes" : "no") << endl;
+}
+static void solve_exact(const std::string &, const char *, KnapsackDump_Normal &)    {}
+
+/*
+	Solve a dumped knapsack problem with each available solver, printing a CSV line for each.
+		Solvers are repeated for at least 20ms.  The exact solver and LP bound apply only to scalar burdens.
+*/
+template<typename T_Economy>
+static void solve_dump(const std::string &name, const char *economy, KnapsackDump_<T_Economy> &dump)
+{
+	using Knapsack_t = Knapsack_<T_Economy>;
+
+	struct Solver {const char *name; size_t precision;};
+	const Solver solvers[] = {{"dp", dump.precision}, {"dp-x4", 4 * dump.precision}};
+
+	Knapsack_t problem;
+	for (const Solver &solver : solvers)
+	{
+		dump.setup(problem);
+		bool successful = problem.decide(dump.capacity, solver.precision);
+		size_t reps = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed(0);
+		do
+		{
+			problem.decide(dump.capacity, solver.precision);
+			++reps;
+			elapsed = std::chrono::steady_clock::now() - start;
+		}
+		while (elapsed.count() < .02 && reps < 10000);
+
+		cout << name << ',' << economy << ',' << dump.decisions.size() << ',' << dump.option_count() << ','
+			<< solver.name << ',' << solver.precision << ',' << (1e6 * elapsed.count() / double(reps)) << ','
+			<< problem.stats.chosen.net_value << ',' << burden_mean(problem.stats.chosen.net_burden) << ','
+			<< (successful ? "yes" : "no") << endl;
+	}
+
+	solve_exact(name, economy, dump);
+	float bound = knapsack_bound(dump);
+	if (!std::isnan(bound))
+		cout << name << ',' << economy << ',' << dump.decisions.size() << ',' << dump.option_count() << ",lp-bound,,," << bound << ",," << endl;
+}
+
+/*
+	Load knapsack dumps and compare solvers on them.
+*/
+int solve_knapsack_main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		cout << "usage: solve-knapsack dump.json..." << endl;
+		return 1;
+	}
+
+	cout << std::setprecision(6);
+	cout << "dump,economy,decisions,options,solver,precision,us_per_solve,value,burden,feasible" << endl;
+	int failures = 0;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string path = argv[i], text;
+		if (!detail::read_file(path, text)) {cout << path << ",unreadable" << endl; ++failures; continue;}
+
+		// Normal dumps have a capacity of [limit, sigmas].
+		size_t key = text.find("\"capacity\"");
+		size_t value = (key == std::string::npos) ? key : text.find_first_not_of(" \t\r\n:", key + 10);
+		bool normal = (value != std::string::npos && text[value] == '[');
+
+		KnapsackDump        dump;
+		KnapsackDump_Normal dump_normal;
+		if      ( normal && read_json(text, dump_normal)) solve_dump(path, "normal", dump_normal);
+		else if (!normal && read_json(text, dump))        solve_dump(path, "scalar", dump);
+		else {cout << path << ",malformed" << endl; ++failures;}
+	}
+	return failures ? 1 : 0;
+}
+
+/*
+	Goblin observer which captures the first knapsack, one during exploration,
+		the one needing the most iterations, and the last.
+*/
+class KnapsackCapture : public Goblin::Observer
+{
+public:
+	const Goblin       &goblin;
+	size_t              frame = 0, most_iterations = 0;
+	KnapsackDump_Normal first, exploring, hardest, last;
+
+	explicit KnapsackCapture(const Goblin &g) : goblin(g) {}
+
+	void harvested(const Setting &, const Profile_f::Measurement &) override {}
+	void decided(Goblin::capacity_t capacity, size_t precision) override
+	{
+		auto &knapsack = goblin.knapsack();
+		++frame;
+		if (frame == 1)  first    .capture(knapsack, capacity, precision);
+		if (frame == 40) exploring.capture(knapsack, capacity, precision);
+		if (knapsack.stats.iterations > most_iterations)
+		{
+			most_iterations = knapsack.stats.iterations;
+			hardest.capture(knapsack, capacity, precision);
+		}
+		last.capture(knapsack, capacity, precision);
+	}
+};
+
+/*
+	Write the knapsack corpus: seeded goblin simulations and generated problems.
+*/
+int make_knapsack_corpus_main(int argc, char **argv)
+{
+	std::string dir = (argc > 2) ? argv[2] : "corpus/knapsack";
+	bool ok = true;
+	auto save = [&](const std::string &name, const std::string &json)
+	{
+		std::string path = dir + "/" + name + ".json";
+		bool saved = detail::write_file(path, json);
+		cout << (saved ? "wrote " : "couldn't write ") << path << endl;
+		ok &= saved;
+	};
+
+	// Goblin knapsacks over a steady simulation.
+	{
+		rand_gen.seed(9);
+		std::list<SimSetting> settings(50);
+		Goblin::capacity_t capacity = {1.5f * random_capacity(settings.size()), 4};
+		Goblin goblin;
+		goblin.config.explore_value = 50.f;
+		for (auto &setting : settings) goblin.add(&setting);
+
+		KnapsackCapture capture(goblin);
+		goblin.set_observer(&capture);
+		for (size_t f = 0; f < 1000; ++f)
+		{
+			goblin.update(capacity, 30);
+			for (auto &setting : settings) setting.update();
+		}
+		goblin.set_observer(nullptr);
+
+		save("goblin_first",     to_json(capture.first));
+		save("goblin_exploring", to_json(capture.exploring));
+		save("goblin_hardest",   to_json(capture.hardest));
+		save("goblin_settled",   to_json(capture.last));
+	}
+
+	// Generated problems with the benchmark's capacities.
+	struct Generated {const char *name; size_t decisions; int kind; unsigned options; size_t precision;};
+	const Generated generated[] = {
+		{"mixed_200",        200, -1,  0, 30},
+		{"binary_500",       500,  2,  0, 20},
+		{"orderly_100x16",   100,  5, 16, 30},
+		{"chaotic_100x16",   100,  7, 16, 50},
+	};
+	for (const Generated &g : generated)
+	{
+		Knapsack problem;
+		rand_gen.seed(uint32_t(g.decisions + g.options));
+		generate_problem(problem, g.decisions, g.kind, g.options);
+		save(g.name, to_json(KnapsackDump(problem, random_capacity(g.decisions), g.precision)));
+	}
+	return ok ? 0 : 1;
+}
+
+/*
+	Test: compare knapsack solver modes against the exact solver on random problems.
+		Each mode must agree on feasibility, fit its solution within the capacity, never beat
+		the exact optimum, and gain at least (100 - 100/precision)% of the optimal gain over
+		the lightest solution, as documented in Knapsack_::decide.
+		Returns nonzero if any check fails, listing the seeds to reproduce.
+*/
+struct ExactCheck
+{
+	const char *name;
+	size_t precision;
+	bool   approximate; // Economies without ordered burdens only approximate the precision; report it.
+	size_t trials = 0, failures = 0;
+	double ratio_total = 0, worst_ratio = 1; // Value relative to the optimum; least share of the optimal gain.
+	std::vector<uint32_t> failed_seeds;
+
+	ExactCheck(const char *_name, size_t _precision, bool _approximate = false) :
+		name(_name), precision(_precision), approximate(_approximate) {}
+
+	template<typename T_Knapsack, typename T_Result>
+	void check(uint32_t seed, T_Knapsack &problem, typename T_Knapsack::capacity_t capacity, const T_Result &exact)
+	{
+		bool successful = problem.decide(capacity, precision);
+		double value = 0, burden = 0, lightest = double(problem.stats.lightest.net_value);
+		for (auto *d : problem.decisions) if (d->option_count)
+		{
+			value  += double(d->chosen().value);
+			burden += mean(d->chosen().burden);
+		}
+
+		bool ok = (successful == exact.feasible);
+		if (ok && successful)
+		{
+			double optimal_gain = exact.value - lightest, slack = 1e-4 * (std::abs(exact.value) + 1);
+			double required = optimal_gain * (1 - 1.0 / double(std::max<size_t>(precision, 4)));
+			ok = (burden < mean(capacity) + slack) && (value <= exact.value + slack) && (approximate || value - lightest >= required - slack);
+			if (optimal_gain > slack) worst_ratio = std::min(worst_ratio, (value - lightest) / optimal_gain);
+		}
+		ratio_total += (ok && successful && exact.value > 0) ? value / exact.value : 1;
+
+		++trials;
+		if (!ok) {++failures; if (failed_seeds.size() < 8) failed_seeds.push_back(seed);}
+	}
+
+	// Normal burdens and capacities are compared by their means.
+	template<typename T> static double mean(const T &burden)               {return double(burden);}
+	static double mean(const Economy_Normal_f::burden_t   &burden)      {return double(burden.mean);}
+	static double mean(const Economy_Normal_f::capacity_t &capacity)    {return double(capacity.limit);}
+};
+
+int test_knapsack_exact_main(int argc, char **argv)
+{
+	size_t trials = 2000;
+	uint32_t first_seed = 1000;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if      (arg == "--trials" && i+1 < argc) trials     = size_t(std::max(1l, std::atol(argv[++i])));
+		else if (arg == "--seed"   && i+1 < argc) first_seed = uint32_t(std::atol(argv[++i]));
+		else
+		{
+			cout << "usage: test-knapsack-exact [--trials N] [--seed S]" << endl;
+			return 1;
+		}
+	}
+
+	using Knapsack_Ticks  = Knapsack_<Economy_Ticks>;
+	using Ticks           = Economy_Ticks::burden_t;
+	using Knapsack_Normal = Knapsack_<Economy_Normal_f>;
+	const float ticks_per_burden = 1000.f;
+
+	// The goblin's economy, with no margin for variance, should find the optimum on the means.
+	std::vector<ExactCheck> checks = {{"dp p=4", 4}, {"dp p=10", 10}, {"dp p=30", 30}, {"dp p=100", 100}, {"dp ticks p=30", 30}, {"dp normal p=30", 30, true}};
+	KnapsackExact                 exact;
+	KnapsackExact_<Economy_Ticks> exact_ticks;
+	size_t gave_up = 0, exact_failures = 0;
+	std::vector<Knapsack_Ticks::Decision> tick_decisions;
+	std::vector<Knapsack_Ticks::Option>   tick_options;
+	std::vector<Knapsack_Normal::Decision> normal_decisions;
+	std::vector<Knapsack_Normal::Option>   normal_options;
+
+	for (size_t t = 0; t < trials; ++t)
+	{
+		// A random problem of 5-40 decisions with a random mix and a capacity from half to 1.5x the usual.
+		const uint32_t seed = first_seed + uint32_t(t);
+		const int kinds[] = {-1, 2, 5, 7};
+		rand_gen.seed(seed);
+		size_t decision_count = 5 + rand_gen() % 36;
+		int kind = kinds[rand_gen() % 4];
+		Knapsack problem;
+		generate_problem(problem, decision_count, kind);
+		float capacity = random_capacity(decision_count) * (.5f + float(rand_gen() % 1000) / 1000.f);
+
+		// The same problem in integer ticks.
+		Knapsack_Ticks problem_ticks;
+		tick_options.clear();
+		tick_decisions.assign(problem.decisions.size(), Knapsack_Ticks::Decision());
+		for (auto *d : problem.decisions)
+			for (auto &option : *d) tick_options.push_back({Ticks(std::round(option.burden * ticks_per_burden)), option.value, 0});
+		for (size_t i = 0, o = 0; i < problem.decisions.size(); ++i)
+		{
+			tick_decisions[i].options      = tick_options.data() + o;
+			tick_decisions[i].option_count = problem.decisions[i]->option_count;
+			o += tick_decisions[i].option_count;
+			problem_ticks.add_decision(&tick_decisions[i]);
+		}
+		Ticks capacity_ticks = Ticks(std::round(capacity * ticks_per_burden));
+
+		// The same problem with normal burdens, whose variance a capacity of 0 sigmas ignores.
+		Knapsack_Normal problem_normal;
+		normal_options.clear();
+		normal_decisions.assign(problem.decisions.size(), Knapsack_Normal::Decision());
+		for (auto *d : problem.decisions)
+			for (auto &option : *d) normal_options.push_back({{option.burden, option.burden * option.burden * .1f}, option.value, 0});
+		for (size_t i = 0, o = 0; i < problem.decisions.size(); ++i)
+		{
+			normal_decisions[i].options      = normal_options.data() + o;
+			normal_decisions[i].option_count = problem.decisions[i]->option_count;
+			o += normal_decisions[i].option_count;
+			problem_normal.add_decision(&normal_decisions[i]);
+		}
+		Economy_Normal_f::capacity_t capacity_normal = {capacity, 0.f};
+
+		auto optimum       = exact.solve(problem, capacity);
+		auto optimum_ticks = exact_ticks.solve(problem_ticks, capacity_ticks);
+		if (!optimum.exact || !optimum_ticks.exact) {++gave_up; continue;}
+		if (optimum.feasible && !(optimum.burden < double(capacity))) ++exact_failures;
+
+		for (size_t c = 0; c < 4; ++c) checks[c].check(seed, problem, capacity, optimum);
+		checks[4].check(seed, problem_ticks, capacity_ticks, optimum_ticks);
+		checks[5].check(seed, problem_normal, capacity_normal, optimum);
+	}
+
+	size_t failures = exact_failures;
+	cout << "Knapsack solvers vs. exact optimum over " << trials << " random problems (" << gave_up << " too hard):" << endl;
+	cout << std::fixed;
+	for (auto &c : checks)
+	{
+		cout << "  " << std::left << std::setw(14) << c.name << std::right
+			<< std::setprecision(3) << " mean value " << (100.0 * c.ratio_total / std::max<size_t>(c.trials, 1)) << "%"
+			<< ", least gain " << (100.0 * c.worst_ratio) << "% of optimal (" << (c.approximate ? "aiming for " : "at least ")
+			<< std::setprecision(1) << (100.0 - 100.0 / double(std::max<size_t>(c.precision, 4))) << "%), "
+			<< c.failures << " failed";
+		for (size_t i = 0; i < c.failed_seeds.size(); ++i) cout << (i ? " " : " (seeds ") << c.failed_seeds[i];
+		cout << (c.failed_seeds.empty() ? "" : ")") << endl;
+		failures += c.failures;
+	}
+	if (exact_failures) cout << "  exact solver exceeded the capacity " << exact_failures << " times" << endl;
+	cout << "  " << (failures ? "FAILED" : "success") << endl;
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::string command = (argc > 1) ? argv[1] : "";
+
+	if (command == "bench-map")    {bench_maps();   return 0;}
+	if (command == "bench-shards") {bench_shards(); return 0;}
+	if (command == "bench-load")   {bench_profile_load(); return 0;}
+	if (command == "bench-json")   {bench_json(); return 0;}
+	if (command == "test-journal") return test_journal();
+	if (command == "bench-merge")  {bench_merge(); return 0;}
+	if (command == "test-merge-classes") return test_merge_classes();
+	if (command == "test-state")   return test_goblin_state();
+	if (command == "test-sampling") return test_sampling();
+	if (command == "test-group")   return test_groups();
+	if (command == "test-resource") return test_resource_classes();
+	if (command == "test-decisions") return test_decision_pointers();
+	if (command == "test-view")    return test_profile_view();
+	if (command == "bench-evict")  {bench_eviction(); return 0;}
+	if (command == "test-evict")   return test_eviction();
+	if (command == "test-histogram") return test_histograms();
+	if (command == "test-accum")   return test_accumulators();
+	if (command == "test-determinism") return test_determinism();
+	if (command == "test-timers")  return test_timers();
+	if (command == "test-perf-event") {test_perf_event(); return 0;}
+	if (command == "merge-profiles") return merge_profiles_main(argc, argv);
+	if (command == "embed-profile")  return embed_profile_main(argc, argv);
+	if (command == "test-embed")     return test_embed_profile();
+	if (command == "bench-knapsack") return bench_knapsack_main(argc, argv);
+	if (command == "bench-goblin")   return bench_goblin_main(argc, argv);
+	if (command == "test-trace")     return test_trace_main(argc, argv);
+	if (command == "replay-trace")   return replay_trace_main(argc, argv);
+	if (command == "solve-knapsack") return solve_knapsack_main(argc, argv);
+	if (command == "make-knapsack-corpus") return make_knapsack_corpus_main(argc, argv);
+	if (command == "test-knapsack-exact")  return test_knapsack_exact_main(argc, argv);
+
+	test_goblin();
+	test_knapsack();
+}
@@ -1,302 +1,1178 @@
-#pragma once
-
-#include <unordered_map> // Goblin's estimate and setting maps
-#include <string>        // Used to classify profiled items.
-#include <cstdint>
-
-#include "economy.h"
-
-/*
-	A Profile aggregates performance data for various tasks,
-		which are categorized by string identifiers.
-		Each task has a fixed number of optional alternatives.
-*/
-
-namespace perf_goblin
-{
-	template<typename T_Economy> class Profile_;
-	using Profile_f = Profile_<Economy_f>;
-
-	template<typename T_Economy> struct BurdenStat_;
-	using BurdenStat_f = BurdenStat_<Economy_f>;
-
-	/*
-		A class for estimating burdens based on many samples.
-	*/
-	template<typename T_Economy>
-	struct BurdenStat_
-	{
-	public:
-		using economy_t = T_Economy;
-		using burden_t  = typename economy_t::burden_t;
-		using scalar_t  = typename economy_t::scalar_t;
-
-		using economy_norm_t = Economy_Normal_<economy_t>;
-		using burden_norm_t  = typename economy_norm_t::burden_t;
-
-	public:
-		scalar_t _k  = 0;
-		burden_t _mk = 0;
-		burden_t _vk = 0;
-
-	public:
-		void reset()    {_k = 0; _mk = 0; _vk = 0;}
-
-		explicit operator bool() const    {return _k > 0;}
-
-		scalar_t count    () const    {return _k;}
-		burden_t sum      () const    {return _k*_mk;}
-		burden_t mean     () const    {return _mk;}
-		burden_t variance () const    {return _vk / std::max<burden_t>(_k - 1, 1);}
-		burden_t deviation() const    {return std::sqrt(variance());}
-
-		burden_norm_t burden_norm() const    {return {mean(), variance()};}
-		void make_certain(const burden_norm_t burden)    {_k = 1e10f; _mk = burden.mean; _vk = burden.var*_k;}
-
-		burden_t mean_plus_sigmas(scalar_t sigmas)    {return mean() + deviation() * sigmas;}
-
-		void push(const burden_t burden)
-		{
-			burden_t dm = (burden - _mk), dv = (_k++ ? dm : 0);
-			_mk += dm / _k;             // First frame, add burden
-			_vk += dv * (burden - _mk); // First frame, add 0
-		}
-
-		// Decay methods for calculating *recent* variance.  0 < alpha < 1.
-		void decay     (scalar_t alpha)
-		{
-			_k = 1 + (_k - 1) * alpha;
-			_vk *= alpha;
-		}
-		void push_decay(const burden_t burden, scalar_t alpha)
-		{
-			_k *= alpha;
-			burden_t dm = (burden - _mk), dv = (_k++ ? dm : 0);
-			_mk += dm / _k;
-			_vk  = _vk * alpha + dv * (burden - _mk);
-		}
-
-		// Scale this stat's mean and deviation by a factor
-		void scale(const scalar_t scale_factor)
-		{
-			_mk *= scale_factor;
-			_vk *= scale_factor*scale_factor;
-		}
-
-		// Pool the statistics describing two sets.
-		BurdenStat_ pool(const BurdenStat_ &o) const
-		{
-			scalar_t net_count = count() + o.count();
-			burden_t net_mean = (o.sum() + sum()) / net_count;
-			burden_t diff = o.mean() - mean();
-			// Unbiased variance combination formula (O'Neill 2014)
-			burden_t net_vk = o._vk + _vk +
-				diff*diff * (count()*o.count()) / net_count;
-
-			return BurdenStat_{net_count, net_mean, net_vk};
-		}
-	};
-
-	template<typename T_Economy>
-	class Profile_
-	{
-	public:
-		using economy_t      = T_Economy;
-		using burden_t       = typename economy_t::burden_t;
-		using scalar_t       = typename economy_t::scalar_t;
-		using value_t        = typename economy_t::value_t;
-
-		using economy_norm_t = Economy_Normal_<economy_t>;
-		using burden_norm_t  = typename economy_norm_t::burden_t;
-		using capacity_t     = typename economy_norm_t::capacity_t;
-
-		using burden_stat_t  = BurdenStat_<economy_t>;
-
-		using choice_index_t = uint16_t;
-		static const choice_index_t NO_CHOICE = ~choice_index_t(0);
-
-		/*
-			A measurement...
-				Measured burden should ALWAYS be >= 0.
-		*/
-		struct Measurement
-		{
-			burden_t         burden   = economy_t::infinite();
-			choice_index_t   choice   = NO_CHOICE;
-			//strategy_index_t strategy = Knapsack_t::CHOICE_NONE;
-
-			bool valid() const    {return choice != NO_CHOICE;}
-		};
-
-		/*
-			An estimate for a task option.
-		*/
-		struct Estimate
-		{
-			burden_stat_t full;
-			burden_stat_t recent;
-
-			explicit operator bool() const    {return bool(full);}
-		};
-
-		struct Task
-		{
-		public:
-			// The list of estimates.
-			const choice_index_t count;
-			Estimate             estimates[1];
-
-		public:
-			Task(choice_index_t option_count)    : count(option_count) {}
-			Task(const Task &o)                  : count(o.count) {*this = o;}
-
-			// Copyable.
-			Task& operator=(const Task &o)
-			{
-				assert(count == o.count);
-				for (choice_index_t i = 0; i < count; ++i) estimates[i] = o.estimates[i];
-				return *this;
-			}
-
-			// Iterable.
-			const Estimate *begin() const    {return estimates;}
-			const Estimate *end  () const    {return estimates+count;}
-			Estimate       *begin()          {return estimates;}
-			Estimate       *end  ()          {return estimates+count;}
-
-			// Query statistics
-			scalar_t data_count() const
-			{
-				scalar_t n = 0;
-				for (choice_index_t i = 0; i < count; ++i) n += estimates[i].full.count();
-				return n;
-			}
-			bool meets_quota(scalar_t samples_per_option) const
-			{
-				for (choice_index_t i = 0; i < count; ++i)
-					if (estimates[i].full.count() < samples_per_option) return false;
-				return true;
-			}
-
-			// Allocate / deallocate.
-			static Task *alloc(choice_index_t count)
-			{
-				assert(count > 0);
-				auto *e = new (new size_t[(sizeof(Task) + (count-1) * sizeof(Estimate) + sizeof(size_t)-1) / sizeof(size_t)]) Task(count);
-				for (choice_index_t i = 0; i < count; ++i) new (e->estimates+i) Estimate();
-				return e;
-			}
-			static void free(const Task *e)    {delete[] reinterpret_cast<const size_t*>(e);}
-		};
-
-		using Tasks = std::unordered_map<std::string, const Task*>;
-
-	protected:
-		Tasks _tasks;
-
-		Task &task_init(const std::string &id, choice_index_t option_count)
-		{
-			const Task *task = find(id);
-			if (!task) _tasks[id] = task = Task::alloc(option_count);
-			assert(task->count == option_count);
-			return *const_cast<Task*>(task);
-		}
-
-	public:
-		Profile_ ()                     {}
-		Profile_ (const Profile_ &o)    {*this = o;}
-		~Profile_()                     {clear();}
-
-		/*
-			Iterate over all tasks.
-		*/
-		typename Tasks::const_iterator begin() const    {return _tasks.begin();}
-		typename Tasks::const_iterator end  () const    {return _tasks.end  ();}
-
-		/*
-			Get profile data for a task, if available.
-		*/
-		const Task *find(std::string id) const
-		{
-			auto i = _tasks.find(id);
-			return (i == _tasks.end()) ? 0 : i->second;
-		}
-
-		/*
-			Add a measurement for a task.
-		*/
-		const Task *collect(const std::string &id, choice_index_t option_count, const Measurement &measurement)
-		{
-			if (!measurement.valid()) return nullptr;
-			Task     &task     = task_init(id, option_count);
-			Estimate &estimate = task.estimates[measurement.choice];
-			estimate.recent.push(measurement.burden);
-			estimate.full  .push(measurement.burden);
-			return &task;
-		}
-
-#if 0
-		// Provide perfect knowledge of a burden's distribution (debug)
-		void make_certain(std::string id, choice_index_t option_index, choice_index_t option_count, burden_norm_t burden)
-		{
-			task_init(id, option_count).estimates[option_index].this_run.make_certain(burden);
-		}
-#endif
-
-		/*
-			Subject recent measurements to an exponential decay.
-				Decay does not immediately affect mean or variance, only count.
-				Diminishes the influence of previous measurements.
-		*/
-		void decay_recent(scalar_t alpha)
-		{
-			for (auto &task : _tasks)
-				for (auto &estimate : *const_cast<Task*>(task.second))
-					estimate.recent.decay(alpha);
-		}
-
-		/*
-			Access the set of known tasks.
-		*/
-		const Tasks &tasks() const    {return _tasks;}
-
-		/*
-			Clear/copy
-		*/
-		Profile_ &operator=(const Profile_ &o)
-		{
-			clear();
-			for (auto &i : o._tasks) task_init(i.first, i.second->count) = *i.second;
-			return *this;
-		}
-		void clear()    {for (auto &i : _tasks) Task::free(i.second); _tasks.clear();}
-
-
-		/*
-			Assimilate "full" profile data from some other task, with a scaling factor.
-		*/
-		const Task *assimilate(const std::string &id, const Task &data, const scalar_t scale_factor = 1)
-		{
-			Task &task = task_init(id, data.count);
-			if (scale_factor == 1)
-			{
-				for (choice_index_t i = 0; i < task.count; ++i)
-				{
-					auto &est = task.estimates[i];
-					est.full = est.full.pool(data.estimates[i].full);
-				}
-			}
-			else 
-			{
-				for (choice_index_t i = 0; i < task.count; ++i)
-				{
-					auto &est = task.estimates[i];
-					burden_stat_t scaled = data.estimates[i].full;
-					scaled.scale(scale_factor);
-					est.full = est.full.pool(scaled);
-				}
-			}
-			return &task;
-		}
-	};
+#pragma once
+
+#include <string>        // Used to classify profiled items.
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cassert>
+#include <cstring>   // std::memcpy
+#include <memory>    // std::unique_ptr
+#include <algorithm>
+
+#include "economy.h"
+#include "flat_map.h"
+
+// Define as 1 to keep a histogram of burdens in each profile estimate (see BurdenHistogram_).
+#ifndef PERF_GOBLIN_HISTOGRAMS
+	#define PERF_GOBLIN_HISTOGRAMS 0
+#endif
+
+/*
+	A Profile aggregates performance data for various tasks,
+		which are categorized by string identifiers.
+		Each task has a fixed number of optional alternatives.
+*/
+
+namespace perf_goblin
+{
+	template<typename T_Economy> class Profile_;
+	using Profile_f = Profile_<Economy_f>;
+
+	template<typename T_Economy> class ProfileShard_;
+	using ProfileShard_f = ProfileShard_<Economy_f>;
+	template<typename T_Economy> class GoblinState_;
+
+	template<typename T_Economy> struct BurdenStat_;
+	using BurdenStat_f = BurdenStat_<Economy_f>;
+
+	template<typename T_Economy> struct BurdenHistogram_;
+	using BurdenHistogram_f = BurdenHistogram_<Economy_f>;
+
+	/*
+		A class for estimating burdens based on many samples.
+			Sums are kept in the economy's accum_t, which may be wider than burden_t.
+	*/
+	template<typename T_Economy>
+	struct BurdenStat_
+	{
+	public:
+		using economy_t  = T_Economy;
+		using burden_t   = typename economy_t::burden_t;
+		using variance_t = typename economy_t::variance_t;
+		using scalar_t   = typename economy_t::scalar_t;
+		using accum_t    = typename economy_t::accum_t;
+		using calc_t     = typename detail::AccumValue<accum_t>::type;
+
+		using economy_norm_t = Economy_Normal_<economy_t>;
+		using burden_norm_t  = typename economy_norm_t::burden_t;
+
+	public:
+		accum_t _k  = 0;
+		accum_t _mk = 0;
+		accum_t _vk = 0;
+
+	public:
+		void reset()    {_k = 0; _mk = 0; _vk = 0;}
+
+		explicit operator bool() const    {return calc_t(_k) > 0;}
+
+		scalar_t count    () const    {return scalar_t(calc_t(_k));}
+		burden_t sum      () const    {return burden_t(calc_t(_k)*calc_t(_mk));}
+		burden_t mean     () const    {return burden_t(calc_t(_mk));}
+		variance_t variance () const    {return variance_t(calc_t(_vk) / std::max<calc_t>(calc_t(_k) - 1, 1));}
+		burden_t   deviation() const    {return economy_t::deviation(variance());}
+
+		burden_norm_t burden_norm() const    {return {mean(), variance()};}
+		void make_certain(const burden_norm_t burden)    {_k = 1e10f; _mk = burden.mean; _vk = calc_t(burden.var)*calc_t(_k);}
+
+		burden_t mean_plus_sigmas(scalar_t sigmas)    {return mean() + deviation() * sigmas;}
+
+		void push(const burden_t burden)
+		{
+			calc_t b = calc_t(burden), dm = (b - calc_t(_mk)), dv = (calc_t(_k) > 0 ? dm : 0);
+			_k  += calc_t(1);
+			_mk += dm / calc_t(_k);         // First frame, add burden
+			_vk += dv * (b - calc_t(_mk));  // First frame, add 0
+		}
+
+		// Decay methods for calculating *recent* variance.  0 < alpha < 1.
+		void decay     (scalar_t alpha)
+		{
+			_k = 1 + (calc_t(_k) - 1) * calc_t(alpha);
+			_vk *= calc_t(alpha);
+		}
+		void push_decay(const burden_t burden, scalar_t alpha)
+		{
+			_k *= calc_t(alpha);
+			_vk *= calc_t(alpha);
+			push(burden);
+		}
+
+		// Scale this stat's mean and deviation by a factor
+		void scale(const scalar_t scale_factor)
+		{
+			_mk *= calc_t(scale_factor);
+			_vk *= calc_t(scale_factor)*calc_t(scale_factor);
+		}
+
+		// Pool the statistics describing two sets.
+		BurdenStat_ pool(const BurdenStat_ &o) const
+		{
+			// Pooling with an empty set is exact.
+			if (!(calc_t(_k) > 0)) return o;
+			if (!(calc_t(o._k) > 0)) return *this;
+			calc_t k = calc_t(_k), ok = calc_t(o._k), net_count = k + ok;
+			calc_t net_mean = (ok*calc_t(o._mk) + k*calc_t(_mk)) / net_count;
+			calc_t diff = calc_t(o._mk) - calc_t(_mk);
+			// Unbiased variance combination formula (O'Neill 2014)
+			calc_t net_vk = calc_t(o._vk) + calc_t(_vk) +
+				diff*diff * (k*ok) / net_count;
+
+			return BurdenStat_{net_count, net_mean, net_vk};
+		}
+	};
+
+	/*
+		A histogram of burdens in logarithmic buckets, for distributions which
+			mean and variance describe poorly (such as cache hits and misses).
+
+		Buckets are half an octave wide, from 2^MIN_LOG2 to 2^MAX_LOG2 in burden units
+			(1/256 to 4096 milliseconds, when burdens are milliseconds).
+			Burdens outside that range are counted in the first or last bucket.
+
+		Counts are 16-bit fixed point, in 1/unit of a sample, so histograms can decay like
+			recent statistics in half the space of float counts.  The unit starts at COUNT_ONE
+			and halves whenever a bucket would overflow, so proportions stay exact until a
+			bucket holds 65535 samples; beyond that, every count is halved and older samples
+			weigh less.  Decay restores the unit as counts shrink.
+	*/
+	template<typename T_Economy>
+	struct BurdenHistogram_
+	{
+	public:
+		using economy_t = T_Economy;
+		using burden_t  = typename economy_t::burden_t;
+		using scalar_t  = typename economy_t::scalar_t;
+		using count_t   = uint16_t;
+
+		static const int      MIN_LOG2 = -8, MAX_LOG2 = 12;
+		static const unsigned BUCKETS  = 2 * (MAX_LOG2 - MIN_LOG2);
+		static const count_t  COUNT_ONE = 256, COUNT_MAX = 65535;
+
+	public:
+		count_t counts[BUCKETS] = {};
+		count_t unit = COUNT_ONE; // Counts per sample; a power of two.
+
+	public:
+		void reset()    {for (auto &c : counts) c = 0; unit = COUNT_ONE;}
+
+		explicit operator bool() const
+		{
+			for (auto c : counts) if (c) return true;
+			return false;
+		}
+
+		// Samples in all buckets, or in bucket i.
+		scalar_t count() const
+		{
+			uint32_t n = 0;
+			for (auto c : counts) n += c;
+			return scalar_t(double(n) / unit);
+		}
+		scalar_t count(unsigned i) const    {return scalar_t(double(counts[i]) / unit);}
+
+		// Set every bucket's count in samples, with the finest unit that fits.
+		void assign(const double *samples)
+		{
+			double most = 0;
+			for (unsigned i = 0; i < BUCKETS; ++i) most = std::max(most, samples[i]);
+			double scale = COUNT_ONE;
+			while (most * scale > COUNT_MAX && scale > 1) scale *= .5;
+			unit = count_t(scale);
+			if (most * scale > COUNT_MAX) scale = COUNT_MAX / most;
+			for (unsigned i = 0; i < BUCKETS; ++i)
+				counts[i] = (samples[i] > 0) ? count_t(std::min(samples[i] * scale + .5, double(COUNT_MAX))) : count_t(0);
+		}
+
+		// Bucket for a burden, and the lower edge of each bucket.
+		static unsigned bucket(const burden_t burden)
+		{
+			if (!(double(burden) > 0)) return 0;
+			int e;
+			double m = std::frexp(double(burden), &e); // burden = m * 2^e, .5 <= m < 1
+			int i = 2 * (e - 1 - MIN_LOG2) + (m >= 0.70710678118654752 ? 1 : 0);
+			return unsigned(std::min(std::max(i, 0), int(BUCKETS) - 1));
+		}
+		static burden_t edge(unsigned i)    {return burden_t(std::exp2(MIN_LOG2 + .5 * double(i)));}
+
+		void push(const burden_t burden, scalar_t weight = 1)
+		{
+			count_t &c = counts[bucket(burden)];
+			uint32_t add = uint32_t(double(weight) * unit + .5);
+			while (c + add > COUNT_MAX)
+			{
+				for (auto &other : counts) other = count_t(other >> 1);
+				if (unit > 1) {unit >>= 1; add = uint32_t(double(weight) * unit + .5);}
+				else          add = std::min<uint32_t>(add, COUNT_MAX - c);
+			}
+			c = count_t(c + add);
+		}
+
+		// Diminish the weight of previous samples.  0 < alpha < 1.
+		void decay(scalar_t alpha)
+		{
+			count_t most = 0;
+			for (auto &c : counts) most = std::max(most, c = count_t(double(c) * alpha));
+			while (unit < COUNT_ONE && most <= COUNT_MAX / 2)
+			{
+				for (auto &c : counts) c = count_t(c << 1);
+				unit <<= 1;
+				most = count_t(most << 1);
+			}
+		}
+
+		// Pool two histograms.
+		BurdenHistogram_ pool(const BurdenHistogram_ &o) const
+		{
+			double samples[BUCKETS];
+			for (unsigned i = 0; i < BUCKETS; ++i) samples[i] = double(count(i)) + double(o.count(i));
+			BurdenHistogram_ r;
+			r.assign(samples);
+			return r;
+		}
+
+		// Scale burdens by a factor, shifting counts between buckets.
+		void scale(const scalar_t scale_factor)
+		{
+			if (!(scale_factor > 0) || scale_factor == 1) return;
+			double shift = 2 * std::log2(double(scale_factor)), whole = std::floor(shift), frac = shift - whole;
+			double scaled[BUCKETS] = {};
+			for (int i = 0; i < int(BUCKETS); ++i)
+			{
+				if (!counts[i]) continue;
+				int lo = std::min(std::max(i + int(whole), 0), int(BUCKETS) - 1), hi = std::min(lo + 1, int(BUCKETS) - 1);
+				scaled[lo] += count(i) * (1 - frac);
+				scaled[hi] += count(i) * frac;
+			}
+			assign(scaled);
+		}
+
+		/*
+			Fraction of samples heavier than a burden.
+				Samples are assumed to be spread log-uniformly within each bucket.
+		*/
+		scalar_t probability_above(const burden_t burden) const
+		{
+			double total = 0;
+			for (auto c : counts) total += c;
+			if (!(total > 0)) return 0;
+			unsigned b = bucket(burden);
+			double above = 0;
+			for (unsigned i = b + 1; i < BUCKETS; ++i) above += counts[i];
+			if (double(burden) > 0)
+			{
+				double within = 2 * std::log2(double(burden)) - 2 * MIN_LOG2 - double(b);
+				above += counts[b] * (1 - std::min(std::max(within, 0.0), 1.0));
+			}
+			else above += counts[b];
+			return scalar_t(above / total);
+		}
+
+		/*
+			Burden below which the given fraction of samples lie (0 <= p <= 1).
+		*/
+		burden_t quantile(scalar_t p) const
+		{
+			double total = 0, below = 0;
+			for (auto c : counts) total += c;
+			double target = double(p) * total;
+			if (!(target > 0)) return burden_t(0);
+			for (unsigned i = 0; i < BUCKETS; ++i)
+			{
+				if (below + counts[i] >= target && counts[i] > 0)
+					return burden_t(std::exp2(MIN_LOG2 + .5 * (double(i) + (target - below) / counts[i])));
+				below += counts[i];
+			}
+			return burden_t(std::exp2(double(MAX_LOG2)));
+		}
+	};
+
+	/*
+		Accumulates the weighted mean ratio of burdens between two profiles.
+			Each option measured in both contributes its ratio of means, weighted
+			by the geometric mean of the sample counts and burdens involved.
+			Contributions may be added and removed as estimates change.
+	*/
+	template<typename T_Economy>
+	struct BurdenRatio_
+	{
+	public:
+		using economy_t     = T_Economy;
+		using scalar_t      = typename economy_t::scalar_t;
+		using burden_stat_t = BurdenStat_<economy_t>;
+
+	public:
+		double sum_ratio  = 0;
+		double sum_weight = 0;
+		double sum_count  = 0; // Geometric mean sample counts; how much data backs the ratio.
+		size_t terms      = 0;
+
+	public:
+		void reset()    {sum_ratio = 0; sum_weight = 0; sum_count = 0; terms = 0;}
+
+		void add   (const burden_stat_t &curr, const burden_stat_t &prev)    {_apply(curr, prev, +1);}
+		void remove(const burden_stat_t &curr, const burden_stat_t &prev)    {_apply(curr, prev, -1);}
+
+		// The weighted ratio curr/prev, or -1 if there is no common data.
+		scalar_t ratio() const
+		{
+			if (terms && sum_weight > 0) return scalar_t(sum_ratio / sum_weight);
+			else                         return scalar_t(-1);
+		}
+
+	private:
+		void _apply(const burden_stat_t &curr, const burden_stat_t &prev, int sign)
+		{
+			double cm = double(curr.mean()), pm = double(prev.mean());
+			double w = std::sqrt(double(curr.count()) * double(prev.count()) * cm * pm);
+			if (!(w > 0)) return; // Also skips zero burdens, which have no meaningful ratio.
+			sum_ratio  += sign * w * (cm / pm);
+			sum_weight += sign * w;
+			sum_count  += sign * std::sqrt(double(curr.count()) * double(prev.count()));
+			if (sign > 0) ++terms;
+			else if (--terms == 0) reset();
+		}
+	};
+
+	namespace detail
+	{
+		/*
+			Bump allocator backing the tasks of a profile.
+				Tasks are freed all at once, and a profile copies its arena block-by-block.
+				To free some tasks (see Profile_::trim), a profile copies the rest into a new arena.
+		*/
+		class TaskArena
+		{
+		public:
+			using word_t = size_t;
+
+			struct Block
+			{
+				std::unique_ptr<word_t[]> data;
+				size_t                    size = 0, used = 0; // In words.
+
+				const char *begin() const    {return reinterpret_cast<const char*>(data.get());}
+				const char *end  () const    {return begin() + used*sizeof(word_t);}
+			};
+
+		public:
+			TaskArena()                          {}
+			TaskArena(TaskArena &&o)             = default;
+			TaskArena &operator=(TaskArena &&o)  = default;
+
+			static size_t words(size_t bytes)    {return (bytes + sizeof(word_t)-1) / sizeof(word_t);}
+
+			void *alloc(size_t bytes)
+			{
+				size_t n = words(bytes);
+				if (_blocks.empty() || _blocks.back().size - _blocks.back().used < n)
+				{
+					size_t grow = _blocks.empty() ? 1024 : 2*_blocks.back().size;
+					if (_max_block) grow = std::min(grow, _max_block);
+					_grow(std::max(n, grow));
+				}
+				Block &block = _blocks.back();
+				void *p = block.data.get() + block.used;
+				block.used += n;
+				_used += n;
+				return p;
+			}
+
+			// Limit the size of new blocks (0 for no limit), so growth overshoots by at most this much.
+			void   set_block_limit(size_t bytes)    {_max_block = words(bytes);}
+			size_t block_limit() const              {return _max_block * sizeof(word_t);}
+
+			// Ensure the next `bytes` of allocations fit in one block.
+			void reserve(size_t bytes)
+			{
+				size_t n = words(bytes);
+				if (_blocks.empty() || _blocks.back().size - _blocks.back().used < n) _grow(n);
+			}
+
+			// Free everything, keeping the largest block for reuse.
+			void clear()
+			{
+				if (_blocks.empty()) return;
+				auto largest = std::max_element(_blocks.begin(), _blocks.end(),
+					[](const Block &l, const Block &r) {return l.size < r.size;});
+				Block keep = std::move(*largest);
+				keep.used = 0;
+				_blocks.clear();
+				_blocks.push_back(std::move(keep));
+				_used = 0;
+			}
+
+			const std::vector<Block> &blocks()  const    {return _blocks;}
+			size_t bytes_used()                 const    {return _used * sizeof(word_t);}
+			size_t bytes_reserved()             const
+			{
+				size_t n = 0;
+				for (auto &b : _blocks) n += b.size;
+				return n * sizeof(word_t);
+			}
+
+		private:
+			void _grow(size_t n)
+			{
+				// Start a new block, unless the last one is unused and we can replace it.
+				if (!_blocks.empty() && _blocks.back().used == 0) _blocks.pop_back();
+				Block block;
+				block.data.reset(new word_t[n]);
+				block.size = n;
+				_blocks.push_back(std::move(block));
+			}
+
+			TaskArena(const TaskArena &o) = delete;
+			void operator=(const TaskArena &o) = delete;
+
+		private:
+			std::vector<Block> _blocks;
+			size_t             _used = 0;
+			size_t             _max_block = 0; // In words.
+		};
+	}
+
+	template<typename T_Economy>
+	class Profile_
+	{
+	public:
+		using economy_t      = T_Economy;
+		using burden_t       = typename economy_t::burden_t;
+		using scalar_t       = typename economy_t::scalar_t;
+		using value_t        = typename economy_t::value_t;
+
+		using economy_norm_t = Economy_Normal_<economy_t>;
+		using burden_norm_t  = typename economy_norm_t::burden_t;
+		using capacity_t     = typename economy_norm_t::capacity_t;
+
+		using burden_stat_t  = BurdenStat_<economy_t>;
+		using histogram_t    = BurdenHistogram_<economy_t>;
+
+		using choice_index_t = uint16_t;
+		static const choice_index_t NO_CHOICE = ~choice_index_t(0);
+
+		// Tasks may be classified by the resource they burden (eg, CPU or GPU).
+		//   Burdens of different classes may scale differently between machines.
+		using resource_t = uint8_t;
+		static const resource_t RESOURCE_CLASSES = 8;
+
+		/*
+			A measurement...
+				Measured burden should ALWAYS be >= 0.
+		*/
+		struct Measurement
+		{
+			burden_t         burden   = economy_t::infinite();
+			choice_index_t   choice   = NO_CHOICE;
+			//strategy_index_t strategy = Knapsack_t::CHOICE_NONE;
+
+			bool valid() const    {return choice != NO_CHOICE;}
+		};
+
+		/*
+			An estimate for a task option.
+		*/
+		struct Estimate
+		{
+			burden_stat_t full;
+			burden_stat_t recent;
+
+			// Frame at which recent (and histogram) was last decayed (see Profile_::recent).
+			uint32_t      recent_frame = 0;
+
+#if PERF_GOBLIN_HISTOGRAMS
+			// Distribution of recent burdens, decaying with recent.
+			histogram_t   histogram;
+#endif
+
+			explicit operator bool() const    {return bool(full);}
+		};
+
+		struct Task
+		{
+		public:
+			// The list of estimates.
+			const choice_index_t count;
+			resource_t           resource = 0;
+			uint32_t             collected = 0; // Frame of the latest measurement (see Profile_::recent).
+			uint32_t             present   = 0; // Frame the task was last measured or present (see Profile_::trim).
+			scalar_t             interval  = 1; // Frames between the latest measurements (see Profile_::recent).
+			mutable uint32_t     handle    = ~uint32_t(0); // Cached by the profile's observer (see ProfileJournal_), not task data.
+			Estimate             estimates[1];
+
+		public:
+			Task(choice_index_t option_count)    : count(option_count) {}
+			Task(const Task &o)                  : count(o.count) {*this = o;}
+
+			// Copyable.
+			Task& operator=(const Task &o)
+			{
+				assert(count == o.count);
+				resource  = o.resource;
+				collected = o.collected;
+				present   = o.present;
+				interval  = o.interval;
+				for (choice_index_t i = 0; i < count; ++i) estimates[i] = o.estimates[i];
+				return *this;
+			}
+
+			// Iterable.
+			const Estimate *begin() const    {return estimates;}
+			const Estimate *end  () const    {return estimates+count;}
+			Estimate       *begin()          {return estimates;}
+			Estimate       *end  ()          {return estimates+count;}
+
+			// Query statistics
+			scalar_t data_count() const
+			{
+				scalar_t n = 0;
+				for (choice_index_t i = 0; i < count; ++i) n += estimates[i].full.count();
+				return n;
+			}
+			bool meets_quota(scalar_t samples_per_option) const
+			{
+				for (choice_index_t i = 0; i < count; ++i)
+					if (estimates[i].full.count() < samples_per_option) return false;
+				return true;
+			}
+
+			// Storage size of a task with the given number of options.
+			static size_t bytes(choice_index_t count)    {return sizeof(Task) + (count-1) * sizeof(Estimate);}
+
+			// Construct a task in the given storage.
+			static Task *init(void *storage, choice_index_t count)
+			{
+				assert(count > 0);
+				auto *e = new (storage) Task(count);
+				for (choice_index_t i = 0; i < count; ++i) new (e->estimates+i) Estimate();
+				return e;
+			}
+
+			// Allocate / deallocate individually (profiles use an arena instead).
+			static Task *alloc(choice_index_t count)
+			{
+				return init(new size_t[detail::TaskArena::words(bytes(count))], count);
+			}
+			static void free(const Task *e)    {delete[] reinterpret_cast<const size_t*>(e);}
+		};
+		static_assert(alignof(Task) <= alignof(detail::TaskArena::word_t), "Task alignment exceeds arena alignment");
+
+		using Tasks = detail::FlatMap<std::string, const Task*>;
+
+		/*
+			Receives every addition to the "full" statistics of a profile (see ProfileJournal_).
+				Called on the thread which modifies the profile.
+				Observers may cache a handle in Task::handle to avoid looking up the ID,
+				but must verify it, as tasks may be copied from another observed profile.
+		*/
+		class Observer
+		{
+		public:
+			virtual ~Observer() {}
+			virtual void pooled(const std::string &id, const Task &task, choice_index_t choice, const burden_stat_t &delta) = 0;
+		};
+
+		/*
+			A group of tasks whose combined burden is measured with one timer.
+				Per-option burdens are learned by recursive least squares over frames
+				with varied choices, in a model kept beside the members' statistics.
+				Each measurement is attributed to the members in proportion to the
+				model's predicted burdens, and the shares are collected like any other
+				measurement, so attributed estimates carry the noise of the whole group.
+				As the model converges, the means of the shares approach its predictions.
+
+				Only differences between options of a member, and the group's total,
+				are observable; the split of a constant between members is not.
+				This doesn't affect decisions, which depend on those quantities.
+		*/
+		class Group
+		{
+		public:
+			struct Member
+			{
+				std::string    id;
+				choice_index_t option_count;
+				resource_t     resource;
+				size_t         offset; // Index of first option in the model.
+			};
+
+			// Forgetting factor for the model; below 1 tracks changing burdens.
+			double forget = 1;
+
+		public:
+			void add(const std::string &id, choice_index_t option_count, resource_t resource = 0)
+			{
+				assert(option_count > 0);
+				_members.push_back(Member{id, option_count, resource, _dim});
+				_dim += option_count;
+				reset();
+			}
+			void clear()    {_members.clear(); _dim = 0; reset();}
+			void reset()    {_theta.clear(); _cov.clear();}
+
+			const std::vector<Member> &members() const    {return _members;}
+
+			// Predicted burden of one member's option (negative if unknown).
+			double predict(size_t member, choice_index_t choice) const
+			{
+				return _theta.empty() ? -1.0 : _theta[_members[member].offset + choice];
+			}
+
+			/*
+				Update the model with a total burden for the given choices (one per member).
+					Writes each member's share of the burden into `shares`.
+			*/
+			void update(const choice_index_t *choices, double burden, double *shares)
+			{
+				const size_t M = _members.size(), D = _dim;
+				if (!M) return;
+
+				if (_theta.empty())
+				{
+					// Prior: an even split, with variance on the order of the burden itself.
+					double prior = burden / double(M), var = std::max(burden*burden, 1e-30);
+					_theta.assign(D, prior);
+					_cov.assign(D*D, 0.0);
+					for (size_t i = 0; i < D; ++i) _cov[i*D+i] = var;
+				}
+
+				// Active columns for this measurement (one-hot per member).
+				_active.resize(M);
+				for (size_t m = 0; m < M; ++m)
+				{
+					assert(choices[m] < _members[m].option_count);
+					_active[m] = _members[m].offset + choices[m];
+				}
+
+				// k = P x / (forget + x' P x)
+				_gain.assign(D, 0.0);
+				for (size_t i = 0; i < D; ++i)
+					for (size_t a : _active) _gain[i] += _cov[i*D+a];
+				double denom = forget, predicted = 0;
+				for (size_t a : _active) {denom += _gain[a]; predicted += _theta[a];}
+				for (double &k : _gain) k /= denom;
+
+				// theta += k * error; P = (P - k x'P) / forget
+				double error = burden - predicted;
+				for (size_t i = 0; i < D; ++i) _theta[i] += _gain[i] * error;
+				_row.assign(D, 0.0);
+				for (size_t a : _active) for (size_t j = 0; j < D; ++j) _row[j] += _cov[a*D+j];
+				for (size_t i = 0; i < D; ++i)
+					for (size_t j = 0; j < D; ++j)
+						_cov[i*D+j] = (_cov[i*D+j] - _gain[i] * _row[j]) / forget;
+
+				// Attribute the burden in proportion to predicted member burdens.
+				double total = 0;
+				for (size_t m = 0; m < M; ++m) total += std::max(_theta[_active[m]], 0.0);
+				for (size_t m = 0; m < M; ++m)
+					shares[m] = (total > 0) ? burden * (std::max(_theta[_active[m]], 0.0) / total) : burden / double(M);
+			}
+
+		private:
+			friend class GoblinState_<T_Economy>;
+			std::vector<Member> _members;
+			size_t              _dim = 0;
+			std::vector<double> _theta, _cov, _gain, _row;
+			std::vector<size_t> _active;
+		};
+
+	protected:
+		friend class ProfileShard_<T_Economy>;
+		friend class GoblinState_<T_Economy>;
+
+		Tasks _tasks;
+
+		// Recent statistics decay lazily, by alpha^(frames elapsed) when accessed.
+		uint32_t _recent_frame = 0;
+		scalar_t _recent_alpha = 1;
+
+		std::vector<double> _group_shares;
+
+		detail::TaskArena _arena;
+		size_t            _id_bytes     = 0; // Approximate storage for identifiers.
+		size_t            _memory_limit = 0;
+
+		// Scratch for choosing tasks to evict.
+		struct EvictCandidate
+		{
+			uint32_t           age;
+			scalar_t           data;
+			const std::string *id;
+
+			bool operator<(const EvictCandidate &o) const    {return (age != o.age) ? (age > o.age) : (data < o.data);}
+		};
+		std::vector<EvictCandidate> _evict_store;
+
+		Observer *_observer = nullptr;
+
+		// Copy the tasks into a new arena of exactly their size, releasing the old one.
+		void _compact()
+		{
+			size_t words = 0;
+			for (auto &entry : _tasks) words += detail::TaskArena::words(Task::bytes(entry.second->count));
+			detail::TaskArena arena;
+			arena.set_block_limit(_arena.block_limit());
+			if (words) arena.reserve(words * sizeof(detail::TaskArena::word_t));
+			for (auto &entry : _tasks)
+			{
+				size_t bytes = Task::bytes(entry.second->count);
+				void *copy = arena.alloc(bytes);
+				std::memcpy(copy, entry.second, bytes);
+				entry.second = static_cast<const Task*>(copy);
+			}
+			_arena = std::move(arena);
+		}
+
+		Task &task_init(const std::string &id, choice_index_t option_count, bool *created = nullptr)
+		{
+			auto entry = _tasks.emplace(id, nullptr);
+			if (created) *created = entry.second;
+			if (entry.second)
+			{
+				Task *task = Task::init(_arena.alloc(Task::bytes(option_count)), option_count);
+				task->collected = task->present = _recent_frame;
+				entry.first->second = task;
+				_id_bytes += id.size() + 1;
+			}
+			const Task *task = entry.first->second;
+			assert(task->count == option_count);
+			return *const_cast<Task*>(task);
+		}
+
+	public:
+		Profile_ ()                     {}
+		Profile_ (const Profile_ &o)    {*this = o;}
+		Profile_ (Profile_ &&o)         {*this = std::move(o);}
+		~Profile_()                     {clear();}
+
+		/*
+			Iterate over all tasks.
+		*/
+		typename Tasks::const_iterator begin() const    {return _tasks.begin();}
+		typename Tasks::const_iterator end  () const    {return _tasks.end  ();}
+
+		/*
+			Get profile data for a task, if available.
+		*/
+		const Task *find(const std::string &id) const
+		{
+			auto i = _tasks.find(id);
+			return (i == _tasks.end()) ? 0 : i->second;
+		}
+
+		/*
+			Add a measurement for a task, which burdens the given resource class.
+		*/
+		const Task *collect(const std::string &id, choice_index_t option_count, const Measurement &measurement,
+			resource_t resource = 0)
+		{
+			if (!measurement.valid()) return nullptr;
+			Task     &task     = task_init(id, option_count);
+			task.resource = resource;
+			mark_collected(task);
+			Estimate &estimate = task.estimates[measurement.choice];
+			settle_recent(task, estimate);
+			estimate.recent.push(measurement.burden);
+			estimate.full  .push(measurement.burden);
+#if PERF_GOBLIN_HISTOGRAMS
+			estimate.histogram.push(measurement.burden);
+#endif
+			if (_observer)
+			{
+				burden_stat_t delta;
+				delta.push(measurement.burden);
+				_observer->pooled(id, task, measurement.choice, delta);
+			}
+			return &task;
+		}
+
+		/*
+			Add a measurement covering all tasks in a group, given each member's choice.
+				Each member's share is collected (and observed) as a measurement.
+		*/
+		void collect_group(Group &group, const choice_index_t *choices, const burden_t burden)
+		{
+			const size_t M = group.members().size();
+			_group_shares.resize(M);
+			group.update(choices, double(burden), _group_shares.data());
+			for (size_t m = 0; m < M; ++m)
+			{
+				auto &member = group.members()[m];
+				Measurement measurement;
+				measurement.burden = burden_t(_group_shares[m]);
+				measurement.choice = choices[m];
+				collect(member.id, member.option_count, measurement, member.resource);
+			}
+		}
+
+		/*
+			Merge the measurements collected by a shard since its last reset.
+				Visits only the tasks the shard has measured.  Recent statistics
+				treat the shard's measurements as happening now.
+		*/
+		void merge(const ProfileShard_<T_Economy> &shard)
+		{
+			for (auto &change : shard)
+			{
+				Task &task = task_init(change.id, change.task->count);
+				task.resource  = change.task->resource;
+				mark_collected(task);
+				for (choice_index_t i = 0; i < task.count; ++i)
+				{
+					const burden_stat_t &delta = change.task->estimates[i].full;
+					if (!delta) continue;
+					Estimate &estimate = task.estimates[i];
+					settle_recent(task, estimate);
+					estimate.full   = estimate.full  .pool(delta);
+					estimate.recent = estimate.recent.pool(delta);
+#if PERF_GOBLIN_HISTOGRAMS
+					estimate.histogram = estimate.histogram.pool(change.task->estimates[i].histogram);
+#endif
+					if (_observer) _observer->pooled(change.id, task, i, delta);
+				}
+			}
+		}
+
+#if 0
+		// Provide perfect knowledge of a burden's distribution (debug)
+		void make_certain(std::string id, choice_index_t option_index, choice_index_t option_count, burden_norm_t burden)
+		{
+			task_init(id, option_count).estimates[option_index].this_run.make_certain(burden);
+		}
+#endif
+
+		/*
+			Subject recent measurements to an exponential decay.
+				Decay does not immediately affect mean or variance, only count.
+				Diminishes the influence of previous measurements.
+
+			Each task decays by alpha per interval between its measurements, rather than per frame,
+				so tasks measured every few frames (see Goblin_::Config::sample_fraction) keep
+				as many recent samples as tasks measured every frame.
+
+			Decay is applied lazily, so this is O(1) unless alpha changes.
+				Read recent statistics through recent(), which applies pending decay.
+				Also enforces the memory limit, if any (see trim).
+		*/
+		void decay_recent(scalar_t alpha)
+		{
+			trim();
+			if (alpha != _recent_alpha)
+			{
+				for (auto &task : _tasks)
+					for (auto &estimate : *const_cast<Task*>(task.second))
+						settle_recent(*task.second, estimate);
+				_recent_alpha = alpha;
+			}
+			++_recent_frame;
+		}
+
+		/*
+			Get the recent statistics for one of a task's estimates, as of the current frame.
+		*/
+		burden_stat_t recent(const Task &task, const Estimate &estimate) const
+		{
+			burden_stat_t stat = estimate.recent;
+			if (stat) stat.decay(pending_decay(task, estimate));
+			return stat;
+		}
+		burden_stat_t recent(const Task &task, choice_index_t choice) const    {return recent(task, task.estimates[choice]);}
+
+		// Decay factor not yet applied to an estimate's recent statistics (and histogram).
+		scalar_t pending_decay(const Task &task, const Estimate &estimate) const
+		{
+			uint32_t elapsed = _recent_frame - estimate.recent_frame;
+			return elapsed ? scalar_t(std::pow(_recent_alpha, scalar_t(elapsed) / task.interval)) : scalar_t(1);
+		}
+
+		// Apply any pending decay to an estimate's recent statistics and histogram.
+		void settle_recent(const Task &task, Estimate &estimate) const
+		{
+			scalar_t decay = pending_decay(task, estimate);
+			if (decay != 1)
+			{
+				if (estimate.recent) estimate.recent.decay(decay);
+#if PERF_GOBLIN_HISTOGRAMS
+				estimate.histogram.decay(decay);
+#endif
+			}
+			estimate.recent_frame = _recent_frame;
+		}
+
+		/*
+			Note that a task is measured in the current frame.
+				Pending decay is settled at the old interval before the interval changes.
+		*/
+		void mark_collected(Task &task) const
+		{
+			uint32_t elapsed = _recent_frame - task.collected;
+			if (!elapsed) return;
+			if (scalar_t(elapsed) != task.interval)
+			{
+				for (auto &estimate : task) settle_recent(task, estimate);
+				task.interval = scalar_t(elapsed);
+			}
+			task.collected = task.present = _recent_frame;
+		}
+
+		/*
+			Note that a task is in use in the current frame, though not measured
+				(such as a setting the goblin decides but doesn't sample), so trim() keeps it.
+		*/
+		void mark_present(const Task &task)    {const_cast<Task&>(task).present = _recent_frame;}
+
+		/*
+			Set an observer of new measurements, or null.  Not copied with the profile.
+				Measurements pooled by assimilate() aren't observed.
+		*/
+		void      set_observer(Observer *observer)    {_observer = observer;}
+		Observer *observer() const                    {return _observer;}
+
+		/*
+			Access the set of known tasks.
+		*/
+		const Tasks &tasks() const    {return _tasks;}
+
+		/*
+			Clear/copy
+		*/
+		Profile_ &operator=(const Profile_ &o)
+		{
+			if (&o == this) return *this;
+			clear();
+
+			_recent_frame = o._recent_frame;
+			_recent_alpha = o._recent_alpha;
+			_id_bytes     = o._id_bytes;
+			_arena.reserve(o._arena.bytes_used());
+			_tasks.reserve(o._tasks.size());
+
+			// Copy the other arena into one block, then relocate task pointers.
+			auto &blocks = o._arena.blocks();
+			std::vector<char*> copies(blocks.size());
+			for (size_t b = 0; b < blocks.size(); ++b)
+			{
+				size_t size = blocks[b].end() - blocks[b].begin();
+				copies[b] = static_cast<char*>(_arena.alloc(size));
+				std::memcpy(copies[b], blocks[b].begin(), size);
+			}
+			for (auto &i : o._tasks)
+			{
+				const char *p = reinterpret_cast<const char*>(i.second);
+				size_t b = 0;
+				while (!(p >= blocks[b].begin() && p < blocks[b].end())) ++b;
+				_tasks.emplace(i.first, reinterpret_cast<const Task*>(copies[b] + (p - blocks[b].begin())));
+			}
+			return *this;
+		}
+		Profile_ &operator=(Profile_ &&o)
+		{
+			std::swap(_tasks, o._tasks);
+			std::swap(_arena, o._arena);
+			std::swap(_id_bytes, o._id_bytes);
+			std::swap(_memory_limit, o._memory_limit);
+			std::swap(_observer, o._observer);
+			_recent_frame = o._recent_frame;
+			_recent_alpha = o._recent_alpha;
+			return *this;
+		}
+		void clear()    {_tasks.clear(); _arena.clear(); _id_bytes = 0;}
+
+		/*
+			Memory used by task data (excluding the map of identifiers).
+		*/
+		size_t task_bytes() const    {return _arena.bytes_used();}
+
+		/*
+			Approximate memory held by the profile: the task arena (including space
+				not yet used), identifiers and the map between them.
+		*/
+		size_t bytes_used() const    {return _arena.bytes_reserved() + _id_bytes + _tasks.bytes();}
+
+		/*
+			Limit the profile's memory use (0 for no limit).  Not copied with the profile.
+				The limit is enforced by trim(), which decay_recent() calls once per frame.
+				The task arena grows by at most 1/16 of the limit at a time.
+		*/
+		void   set_memory_limit(size_t bytes)    {_memory_limit = bytes; _arena.set_block_limit(bytes / 16);}
+		size_t memory_limit() const              {return _memory_limit;}
+
+		/*
+			If the profile exceeds its memory limit, evict the tasks used least recently
+				(and among those, the ones with the least data) until it is within 7/8 of the limit.
+				A task is used when measured or marked present (see mark_present); tasks used
+				during the current frame are kept, so the limit may be exceeded.
+				evicting(id, task) is called before each task is removed.  Returns the number evicted.
+
+			The remaining tasks are then copied into a new arena, releasing the old one,
+				so pointers to all tasks become invalid.  Eviction is proportional to the number
+				of tasks, but happens rarely, as each eviction makes room for many new tasks.
+		*/
+		template<typename T_Evicting>
+		size_t trim(T_Evicting &&evicting)
+		{
+			if (!_memory_limit || bytes_used() <= _memory_limit) return 0;
+			size_t live   = _arena.bytes_used() + _id_bytes + _tasks.bytes(), target = _memory_limit - _memory_limit/8;
+			size_t excess = (live > target) ? (live - target) : 0;
+
+			_evict_store.clear();
+			if (excess)
+				for (auto &entry : _tasks)
+					if (entry.second->present != _recent_frame)
+						_evict_store.push_back(EvictCandidate{_recent_frame - entry.second->present, entry.second->data_count(), &entry.first});
+			std::sort(_evict_store.begin(), _evict_store.end());
+
+			size_t evicted = 0, freed = 0;
+			for (auto &candidate : _evict_store)
+			{
+				if (freed >= excess) break;
+				const std::string &id = *candidate.id;
+				const Task *task = _tasks.find(id)->second;
+				evicting(id, *task);
+				freed += Task::bytes(task->count) + id.size() + 1;
+				_id_bytes -= id.size() + 1;
+				_tasks.erase(id);
+				++evicted;
+			}
+
+			// Release evicted tasks and unused space, unless there is too little to be worth it.
+			if (evicted || _arena.bytes_reserved() - _arena.bytes_used() > _memory_limit/8) _compact();
+			return evicted;
+		}
+		size_t trim()    {return trim([](const std::string&, const Task&) {});}
+
+
+		/*
+			Assimilate "full" profile data from some other task, with a scaling factor.
+		*/
+		const Task *assimilate(const std::string &id, const Task &data, const scalar_t scale_factor = 1)
+		{
+			bool created;
+			Task &task = task_init(id, data.count, &created);
+			if (created) task.resource = data.resource;
+			if (scale_factor == 1)
+			{
+				for (choice_index_t i = 0; i < task.count; ++i)
+				{
+					auto &est = task.estimates[i];
+					est.full = est.full.pool(data.estimates[i].full);
+#if PERF_GOBLIN_HISTOGRAMS
+					est.histogram = est.histogram.pool(data.estimates[i].histogram);
+#endif
+				}
+			}
+			else 
+			{
+				for (choice_index_t i = 0; i < task.count; ++i)
+				{
+					auto &est = task.estimates[i];
+					burden_stat_t scaled = data.estimates[i].full;
+					scaled.scale(scale_factor);
+					est.full = est.full.pool(scaled);
+#if PERF_GOBLIN_HISTOGRAMS
+					histogram_t scaled_histogram = data.estimates[i].histogram;
+					scaled_histogram.scale(scale_factor);
+					est.histogram = est.histogram.pool(scaled_histogram);
+#endif
+				}
+			}
+			return &task;
+		}
+
+		/*
+			Assimilate "full" statistics (and optionally histograms) for each of a task's options.
+		*/
+		const Task *assimilate(const std::string &id, const burden_stat_t *full, choice_index_t count,
+			const histogram_t *histograms = nullptr)
+		{
+			Task &task = task_init(id, count);
+			for (choice_index_t i = 0; i < count; ++i)
+				task.estimates[i].full = task.estimates[i].full.pool(full[i]);
+#if PERF_GOBLIN_HISTOGRAMS
+			if (histograms) for (choice_index_t i = 0; i < count; ++i)
+				task.estimates[i].histogram = task.estimates[i].histogram.pool(histograms[i]);
+#else
+			(void) histograms;
+#endif
+			return &task;
+		}
+	};
+
+	/*
+		Collects measurements on one thread, for merging into a profile at a sync point.
+			Each thread owns its shards, so collection takes no locks or atomics.
+			Call Profile_::merge and then reset() while no thread is collecting.
+
+		The shard remembers which tasks it has measured since the last reset,
+			so merging and resetting take time proportional to those tasks.
+	*/
+	template<typename T_Economy>
+	class ProfileShard_
+	{
+	public:
+		using Profile_t      = Profile_<T_Economy>;
+		using Task           = typename Profile_t::Task;
+		using Measurement    = typename Profile_t::Measurement;
+		using choice_index_t = typename Profile_t::choice_index_t;
+		using resource_t     = typename Profile_t::resource_t;
+
+		// A task measured since the last reset.  Only its "full" statistics are used.
+		struct Change
+		{
+			std::string  id;
+			const Task  *task;
+		};
+
+	public:
+		/*
+			Add a measurement for a task, as Profile_::collect.
+		*/
+		void collect(const std::string &id, choice_index_t option_count, const Measurement &measurement,
+			resource_t resource = 0)
+		{
+			if (!measurement.valid()) return;
+			Task &task = _local.task_init(id, option_count);
+			if (task.data_count() == 0)
+			{
+				// Change entries are reused, so their strings rarely allocate.
+				if (_change_count == _changes.size()) _changes.emplace_back();
+				_changes[_change_count].id   = id;
+				_changes[_change_count].task = &task;
+				++_change_count;
+			}
+			task.resource = resource;
+			task.estimates[measurement.choice].full.push(measurement.burden);
+#if PERF_GOBLIN_HISTOGRAMS
+			task.estimates[measurement.choice].histogram.push(measurement.burden);
+#endif
+		}
+
+		/*
+			Forget measurements (typically after merging).
+		*/
+		void reset()
+		{
+			for (size_t i = 0; i < _change_count; ++i)
+				for (auto &estimate : *const_cast<Task*>(_changes[i].task))
+				{
+					estimate.full.reset();
+#if PERF_GOBLIN_HISTOGRAMS
+					estimate.histogram.reset();
+#endif
+				}
+			_change_count = 0;
+		}
+
+		/*
+			Iterate over tasks measured since the last reset.
+		*/
+		const Change *begin() const    {return _changes.data();}
+		const Change *end  () const    {return _changes.data() + _change_count;}
+		size_t        size () const    {return _change_count;}
+
+	private:
+		Profile_t           _local;
+		std::vector<Change> _changes;
+		size_t              _change_count = 0;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,432 @@
+#pragma once
+
+/*
+	Crash-safe persistence for a profile, as a snapshot plus an append-only journal.
+
+	The journal observes a profile (see Profile_::Observer).  Each new measurement is
+		passed to a background thread through a lock-free queue, so collection only pays
+		for a queue push.  Each task caches its journal index (Task::handle), so
+		identifiers are hashed only when a task is first journaled.  The background thread accumulates per-task deltas and appends
+		them to the journal periodically, one task per line, in the profile JSON format:
+
+			"identifier":[[3,1.25,0.5],[0,0,0],...]
+
+	When the journal grows large it is compacted into a new snapshot (an ordinary JSON
+		profile), using renames so that a crash at any point leaves loadable files.
+		ProfileJournal_::load restores a profile from the snapshot and journal.
+
+	Files, for a path P:
+		P               -- snapshot
+		P.journal       -- deltas since the snapshot
+		P.tmp           -- snapshot being written
+		P.journal.old   -- journal being compacted
+
+	The journal protects against the process crashing; it doesn't sync files to disk.
+*/
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include "profile.h"
+#include "profile_json.h"
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#endif
+
+
+namespace perf_goblin
+{
+	template<typename T_Economy> class ProfileJournal_;
+	using ProfileJournal_f = ProfileJournal_<Economy_f>;
+
+	namespace detail
+	{
+		/*
+			Bounded single-producer, single-consumer queue.
+		*/
+		template<typename T>
+		class SpscQueue
+		{
+		public:
+			explicit SpscQueue(size_t capacity = 1024)
+			{
+				size_t n = 2;
+				while (n < capacity) n *= 2;
+				_items.reset(new T[n]);
+				_mask = n - 1;
+			}
+
+			// Producer: returns false if the queue is full.
+			bool push(const T &item)
+			{
+				size_t tail = _tail.load(std::memory_order_relaxed);
+				if (tail - _head.load(std::memory_order_acquire) > _mask) return false;
+				_items[tail & _mask] = item;
+				_tail.store(tail + 1, std::memory_order_release);
+				return true;
+			}
+
+			// Consumer: returns false if the queue is empty.
+			bool pop(T &item)
+			{
+				size_t head = _head.load(std::memory_order_relaxed);
+				if (head == _tail.load(std::memory_order_acquire)) return false;
+				item = _items[head & _mask];
+				_head.store(head + 1, std::memory_order_release);
+				return true;
+			}
+
+		private:
+			// Producer and consumer indices are kept on separate cache lines.
+			std::unique_ptr<T[]> _items;
+			size_t               _mask;
+			char                 _pad0[64];
+			std::atomic<size_t>  _head{0};
+			char                 _pad1[64];
+			std::atomic<size_t>  _tail{0};
+			char                 _pad2[64];
+		};
+
+		inline bool file_exists(const std::string &path)
+		{
+			if (FILE *f = std::fopen(path.c_str(), "rb")) {std::fclose(f); return true;}
+			return false;
+		}
+
+		// Atomically replace `to` with `from`.
+		inline bool replace_file(const std::string &from, const std::string &to)
+		{
+#if defined(_WIN32)
+			return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+		}
+
+		inline bool read_file(const std::string &path, std::string &out)
+		{
+			out.clear();
+			FILE *f = std::fopen(path.c_str(), "rb");
+			if (!f) return false;
+			char buf[1 << 16];
+			size_t n;
+			while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+			std::fclose(f);
+			return true;
+		}
+
+		inline bool write_file(const std::string &path, const std::string &data)
+		{
+			FILE *f = std::fopen(path.c_str(), "wb");
+			if (!f) return false;
+			bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+			return (std::fclose(f) == 0) && ok;
+		}
+	}
+
+
+	template<typename T_Economy>
+	class ProfileJournal_ : public Profile_<T_Economy>::Observer
+	{
+	public:
+		using Profile_t      = Profile_<T_Economy>;
+		using Task           = typename Profile_t::Task;
+		using choice_index_t = typename Profile_t::choice_index_t;
+		using burden_stat_t  = typename Profile_t::burden_stat_t;
+
+		struct Config
+		{
+			// How often deltas are appended to the journal.
+			std::chrono::milliseconds flush_interval = std::chrono::milliseconds(500);
+
+			// Compact once the journal exceeds this size.
+			size_t compact_bytes = size_t(1) << 20;
+
+			// Measurements the queue can hold; more are dropped until the thread catches up.
+			size_t queue_capacity = size_t(1) << 14;
+		};
+
+	public:
+		ProfileJournal_()     {}
+		~ProfileJournal_()    {close();}
+
+		/*
+			Restore a profile from a snapshot and journal.
+				Returns false if there is no snapshot or journal at the path.
+				Incomplete lines at the end of the journal (from a crash) are ignored.
+		*/
+		static bool load(const std::string &path, Profile_t &profile)
+		{
+			profile.clear();
+			std::string text;
+			bool found = false;
+
+			// A leftover compacting journal is redundant if its snapshot was committed.
+			const std::string old_journal = path + ".journal.old", temp = path + ".tmp";
+			bool replay_old = detail::file_exists(old_journal) && detail::file_exists(temp);
+
+			if (detail::read_file(path, text))
+			{
+				found = true;
+				if (!read_json(text, profile)) profile.clear();
+			}
+			if (replay_old && detail::read_file(old_journal, text)) {found = true; _replay(text, profile);}
+			if (detail::read_file(path + ".journal", text))         {found = true; _replay(text, profile);}
+			return found;
+		}
+
+		/*
+			Start a journal whose first snapshot is the given profile's contents.
+				Typically the profile was just restored with load().
+				Then make the journal the profile's observer (or the goblin's; see
+				Goblin_::set_profile_observer), and detach it before closing.
+		*/
+		bool open(const std::string &path, const Profile_t &profile, const Config &config = Config())
+		{
+			close();
+			_path    = path;
+			_config  = config;
+			_state   = profile;
+			_ids.clear();
+			_names.clear();
+			_pending.clear();
+			_dirty.clear();
+			_dropped = 0;
+
+			// Begin from a fresh snapshot, settling any files left by a crash.
+			if (!_compact()) return false;
+
+			_queue.reset(new detail::SpscQueue<Record>(config.queue_capacity));
+			_running = true;
+			_thread = std::thread(&ProfileJournal_::_run, this);
+			return true;
+		}
+
+		/*
+			Write any pending deltas and stop journaling.
+				Measurements observed after closing are ignored.
+		*/
+		void close()
+		{
+			if (_thread.joinable())
+			{
+				_running = false;
+				_thread.join();
+			}
+			if (_journal) {std::fclose(_journal); _journal = nullptr;}
+
+			// Free anything queued after the thread's last drain.
+			if (_queue)
+			{
+				Record record;
+				while (_queue->pop(record)) delete record.new_id;
+				_queue.reset();
+			}
+		}
+
+		bool is_open() const    {return _thread.joinable();}
+
+		// Measurements dropped because the queue was full.
+		size_t dropped() const    {return _dropped;}
+
+		// Profile_::Observer
+		void pooled(const std::string &id, const Task &task, choice_index_t choice, const burden_stat_t &delta) override
+		{
+			if (!_queue) return;
+			Record record = {task.handle, choice, task.count, nullptr, delta};
+
+			// The cached handle may come from another journal, or from a copied task.
+			if (!(record.task < _names.size() && _names[record.task] == id))
+			{
+				auto entry = _ids.try_emplace(id, uint32_t(_names.size()));
+				record.task = entry.first->second;
+				if (entry.second)
+				{
+					_names.push_back(id);
+					record.new_id = new std::string(id);
+				}
+			}
+			if (!_queue->push(record))
+			{
+				// Forget a new identifier, so it will be sent with a later measurement.
+				if (record.new_id) {delete record.new_id; _ids.erase(id); _names.pop_back();}
+				++_dropped;
+				return;
+			}
+			task.handle = record.task;
+		}
+
+	private:
+		struct Record
+		{
+			uint32_t       task;
+			choice_index_t choice;
+			choice_index_t count;
+			std::string   *new_id;  // Set with the first record for each task.
+			burden_stat_t  delta;
+		};
+
+		struct Pending
+		{
+			std::string                id;
+			std::vector<burden_stat_t> deltas;
+			bool                       dirty = false;
+		};
+
+		void _run()
+		{
+			auto last_flush = std::chrono::steady_clock::now();
+			while (true)
+			{
+				bool stopping = !_running;
+				_drain();
+				auto now = std::chrono::steady_clock::now();
+				if (stopping || now - last_flush >= _config.flush_interval)
+				{
+					_flush();
+					if (_journal_bytes >= _config.compact_bytes) _compact();
+					last_flush = now;
+				}
+				if (stopping) break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+
+		void _drain()
+		{
+			Record record;
+			while (_queue->pop(record))
+			{
+				if (record.task >= _pending.size()) _pending.resize(record.task + 1);
+				Pending &pending = _pending[record.task];
+				if (record.new_id) {pending.id = std::move(*record.new_id); delete record.new_id;}
+				if (pending.deltas.size() < record.count) pending.deltas.resize(record.count);
+				pending.deltas[record.choice] = pending.deltas[record.choice].pool(record.delta);
+				if (!pending.dirty) {pending.dirty = true; _dirty.push_back(record.task);}
+			}
+		}
+
+		// Append dirty deltas to the journal and the snapshot state.
+		void _flush()
+		{
+			if (_dirty.empty() || !_journal) return;
+			_line.clear();
+			for (uint32_t index : _dirty)
+			{
+				Pending &pending = _pending[index];
+				_line.append("\"").append(pending.id).append("\":[");
+				for (size_t i = 0; i < pending.deltas.size(); ++i)
+				{
+					write_json(_line, pending.deltas[i]);
+					_line.push_back(i+1 < pending.deltas.size() ? ',' : ']');
+				}
+				_line.push_back('\n');
+
+				_state.assimilate(pending.id, pending.deltas.data(), choice_index_t(pending.deltas.size()));
+				for (auto &delta : pending.deltas) delta.reset();
+				pending.dirty = false;
+			}
+			_dirty.clear();
+			std::fwrite(_line.data(), 1, _line.size(), _journal);
+			std::fflush(_journal);
+			_journal_bytes += _line.size();
+		}
+
+		/*
+			Replace the snapshot with the current state and start an empty journal.
+				Crash at any step leaves files which load() restores correctly.
+		*/
+		bool _compact()
+		{
+			const std::string journal = _path + ".journal", old_journal = journal + ".old", temp = _path + ".tmp";
+			if (_journal) {std::fclose(_journal); _journal = nullptr;}
+
+			// A set-aside journal left by a crash is live until its snapshot is committed.
+			if (detail::file_exists(old_journal))
+			{
+				std::string text;
+				if (!detail::file_exists(temp)) std::remove(old_journal.c_str());
+				else if (detail::read_file(journal, text))
+				{
+					// Keep it, folding in the current journal so step 2 doesn't overwrite it.
+					FILE *f = std::fopen(old_journal.c_str(), "ab");
+					bool ok = f && std::fwrite(text.data(), 1, text.size(), f) == text.size();
+					if (f) ok = (std::fclose(f) == 0) && ok;
+					if (!ok) {_reopen(journal); return false;}
+					std::remove(journal.c_str());
+				}
+			}
+
+			// 1. Write the new snapshot beside the old one.
+			if (!detail::write_file(temp, to_json(_state))) {_reopen(journal); return false;}
+
+			// 2. Set the journal aside; while the temporary exists, load() replays it.
+			if (detail::file_exists(journal) && !detail::replace_file(journal, old_journal)) {_reopen(journal); return false;}
+
+			// 3. Commit the snapshot, then discard the old journal.
+			if (!detail::replace_file(temp, _path)) {_reopen(journal); return false;}
+			std::remove(old_journal.c_str());
+
+			_journal_bytes = 0;
+			return _reopen(journal);
+		}
+
+		bool _reopen(const std::string &journal)
+		{
+			_journal = std::fopen(journal.c_str(), "ab");
+			return _journal != nullptr;
+		}
+
+		static void _replay(const std::string &text, Profile_t &profile)
+		{
+			Profile_t line_profile;
+			std::string wrapped;
+			size_t begin = 0;
+			while (true)
+			{
+				size_t end = text.find('\n', begin);
+				if (end == std::string::npos) break; // Incomplete line
+				wrapped.assign("{").append(text, begin, end - begin).append("}");
+				if (read_json(wrapped, line_profile))
+					for (auto &entry : line_profile) profile.assimilate(entry.first, *entry.second);
+				begin = end + 1;
+			}
+		}
+
+		// No copying
+		ProfileJournal_(const ProfileJournal_ &o) = delete;
+		void operator=(const ProfileJournal_ &o) = delete;
+
+	private:
+		// Producer side
+		detail::FlatMap<std::string, uint32_t>    _ids;
+		std::vector<std::string>                  _names; // By index, to verify cached handles.
+		size_t                                    _dropped = 0;
+
+		// Shared
+		std::unique_ptr<detail::SpscQueue<Record>> _queue;
+		std::atomic<bool>                          _running{false};
+		std::thread                                _thread;
+		std::string                                _path;
+		Config                                     _config;
+
+		// Background thread
+		Profile_t             _state;
+		std::vector<Pending>  _pending;
+		std::vector<uint32_t> _dirty;
+		std::string           _line;
+		FILE                 *_journal = nullptr;
+		size_t                _journal_bytes = 0;
+	};
+}
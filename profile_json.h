@@ -1,235 +1,665 @@
-#pragma once
-
-/*
-	Read & write profile data in JSON format.
-*/
-
-#include <iostream>
-#include <cmath>
-#include "profile.h"
-
-
-#define PERF_GOBLIN_IO_DEBUG 1
-
-
-namespace perf_goblin
-{
-	namespace detail
-	{
-		bool req_char(std::istream &i, const char required_char)
-		{
-			if (i.peek() == required_char) {i.get(); return true;}
-#if PERF_GOBLIN_IO_DEBUG
-			std::cerr << "req_char: expected `" << required_char << "', got `" << i.peek() << "'" << std::endl;
-#endif
-			i.setstate(std::ios_base::failbit);
-			return false;
-		}
-		bool req_str(std::istream &i, const char *required_str)
-		{
-			while (*required_str)
-				if (!req_char(i, *(required_str++))) return false;
-			return true;
-		}
-		void skip_ws(std::istream &i)
-		{
-			while (true)
-			{
-				switch (i.peek())
-				{
-					case int(' ' ): case int('\n'): case int('\r'):
-					case int('\t'): case int('\f'): case int('\v'):
-						i.get();
-						continue;
-				}
-				break;
-			}
-		}
-		bool req_char_ws(std::istream &i, const char required_char)
-		{
-			skip_ws(i);
-			return req_char(i, required_char);
-		}
-		bool req_chars_ws(std::istream &i, const char *required_chars)
-		{
-			while (*required_chars)
-				{skip_ws(i); if (!req_char(i, *(required_chars++))) return false;}
-			return true;
-		}
-	}
-
-	/*
-		Write/read normal burdens as JSON.
-			We store standard deviation rather than variance, for precision reasons.
-	*/
-	/*template<typename T_Base>
-	std::ostream &operator<<(std::ostream &o, const typename Economy_Normal_<T_Base>::burden_t &burden)
-	{
-		return o << '[' << burden.mean << ',' << std::sqrt(burden.var) << ']';
-	}
-	template<typename T_Base>
-	std::istream &operator>>(std::istream &i, typename Economy_Normal_<T_Base>::burden_t &burden)
-	{
-		if (i.good()) do
-		{
-			typename Economy_Normal_<T_Base>::base_burden_t in_m, in_d;
-			if (!detail::req_char(i,'[') || (i >> in_m).fail()) continue;
-			if (!detail::req_char(i,',') || (i >> in_d).fail()) continue;
-			if (!detail::req_char(i,']'))                       continue;
-			burden.mean = in_m;
-			burden.var = in_d*in_d;
-		}
-		while (0);
-		return i;
-	}*/
-
-	/*
-		Read/write burden statistics as JSON.
-	*/
-	template<typename T_Econ>
-	std::ostream &operator<<(std::ostream &o, const typename BurdenStat_<T_Econ> &stat)
-	{
-		int n = int(stat.count());
-		o << '[';
-		if (stat.count() == n) o << n;
-		else                   o << stat.count();
-		return o << ',' << stat.mean() << ',' << stat.deviation() << ']';
-	}
-	template<typename T_Econ>
-	std::istream &operator>>(std::istream &i, typename BurdenStat_<T_Econ> &stat)
-	{
-		if (i.good()) do
-		{
-			typename Profile_<T_Econ>::scalar_t in_n;
-			typename Profile_<T_Econ>::burden_t in_m, in_d;
-			if (!detail::req_char_ws(i,'[') || (i >> in_n).fail()) continue;
-			if (!detail::req_char_ws(i,',') || (i >> in_m).fail()) continue;
-			if (!detail::req_char_ws(i,',') || (i >> in_d).fail()) continue;
-			if (!detail::req_char_ws(i,']'))                       continue;
-			stat._k = in_n;
-			stat._mk = in_m;
-			stat._vk = (in_d*in_d) * (in_n-1);
-		}
-		while (0);
-		return i;
-	}
-
-	/*
-		Read/write profile as JSON.
-	*/
-	template<typename T_Econ>
-	std::ostream &operator<<(std::ostream &o, const Profile_<T_Econ> &profile)
-	{
-		o << "{";
-		bool first = true;
-		for (auto entry : profile)
-		{
-			if (first) first = false;
-			else       o << ',';
-			auto &task = *entry.second;
-			o << "\n\t\"" << entry.first << "\":[";
-			for (size_t i = 0, last = task.count-1; i <= last; ++i)
-				perf_goblin::operator<<(o, task.estimates[i].full) << (",]"[i == last]);
-		}
-		return o << "\n}";
-	}
-	template<typename T_Econ>
-	std::istream &operator>>(std::istream &i, Profile_<T_Econ> &profile)
-	{
-		typename Profile_<T_Econ>::Task *task_data = nullptr;
-
-		static const typename Profile_<T_Econ>::choice_index_t MAX_OPTIONS = 1024;
-
-		if (i.good()) do
-		{
-			if (!detail::req_char_ws(i,'{')) continue;
-			profile.clear();
-
-			task_data = typename Profile_<T_Econ>::Task::alloc(MAX_OPTIONS);
-
-			while (true)
-			{
-				detail::skip_ws(i);
-
-				if (!detail::req_char_ws(i,'"')) break;
-				std::string id;
-				while (true)
-				{
-					char c = i.get();
-					if (c == '"') break;
-					if (!i.good())
-					{
-#if PERF_GOBLIN_IO_DEBUG
-						std::cerr << "profile load: stream failure while reading id" << std::endl;
-#endif
-						goto parse_failure;
-					}
-					if (c == '\r' || c == '\n' || c == '\v' || c == '\f' || c == '\0')
-					{
-#if PERF_GOBLIN_IO_DEBUG
-						std::cerr << "profile load: id cannot contain char #" << int(c) << std::endl;
-#endif
-						goto parse_failure;
-					}
-					id.push_back(c);
-				}
-
-				// Read estimate array
-				if (!detail::req_chars_ws(i,":[")) break;
-				typename Profile_<T_Econ>::choice_index_t estimate_count = 0;
-				while (estimate_count < MAX_OPTIONS)
-				{
-					// Read an estimate
-					BurdenStat_<T_Econ> &stat = task_data->estimates[estimate_count].full;
-					if (!(i >> stat).good())
-					{
-#if PERF_GOBLIN_IO_DEBUG
-						std::cerr << "profile load: failed to read burden stats" << std::endl;
-#endif
-						goto parse_failure;
-					}
-					++estimate_count;
-
-					// Comma or closing bracket
-					detail::skip_ws(i);
-					char c = i.get();
-					if (c == ',') continue;
-					if (c == ']') break;
-#if PERF_GOBLIN_IO_DEBUG
-					std::cerr << "profile load: expected `,' or `]', got `" << c << "'" << std::endl;
-#endif
-					goto parse_failure;
-				}
-
-				// Assimilate the loaded profile data for the task.
-				const_cast<typename Profile_<T_Econ>::choice_index_t&>(task_data->count) = estimate_count;
-				profile.assimilate(id, *task_data);
-				
-				// Comma or closing brace
-				detail::skip_ws(i);
-				char c = i.get();
-				if (c == ',') continue;
-				if (c == '}') break;
-#if PERF_GOBLIN_IO_DEBUG
-				std::cerr << "profile load: expected `,' or `}', got `" << c << "'" << std::endl;
-#endif
-				goto parse_failure;
-			}
-
-			break;
-		}
-		while (0);
-	
-		goto finish;
-
-	parse_failure:
-		i.setstate(std::ios_base::failbit);
-	finish:
-		if (task_data)
-		{
-			const_cast<typename Profile_<T_Econ>::choice_index_t&>(task_data->count) = MAX_OPTIONS;
-			typename Profile_<T_Econ>::Task::free(task_data);
-		}
-		return i;
-	}
-}
+#pragma once
+
+/*
+	Read & write profile data in JSON format.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "profile.h"
+
+// std::from_chars / std::to_chars for floating point, where the library has them.
+#if (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) && defined(__has_include)
+#if __has_include(<charconv>)
+		#include <charconv>
+#endif
+#endif
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+	#define PERF_GOBLIN_HAS_CHARCONV 1
+#else
+	#define PERF_GOBLIN_HAS_CHARCONV 0
+#endif
+
+
+#define PERF_GOBLIN_IO_DEBUG 1
+
+
+namespace perf_goblin
+{
+	namespace detail
+	{
+		inline bool req_char(std::istream &i, const char required_char)
+		{
+			if (i.peek() == required_char) {i.get(); return true;}
+#if PERF_GOBLIN_IO_DEBUG
+			std::cerr << "req_char: expected `" << required_char << "', got `" << i.peek() << "'" << std::endl;
+#endif
+			i.setstate(std::ios_base::failbit);
+			return false;
+		}
+		inline bool req_str(std::istream &i, const char *required_str)
+		{
+			while (*required_str)
+				if (!req_char(i, *(required_str++))) return false;
+			return true;
+		}
+		inline void skip_ws(std::istream &i)
+		{
+			while (true)
+			{
+				switch (i.peek())
+				{
+					case int(' ' ): case int('\n'): case int('\r'):
+					case int('\t'): case int('\f'): case int('\v'):
+						i.get();
+						continue;
+				}
+				break;
+			}
+		}
+		inline bool req_char_ws(std::istream &i, const char required_char)
+		{
+			skip_ws(i);
+			return req_char(i, required_char);
+		}
+		inline bool req_chars_ws(std::istream &i, const char *required_chars)
+		{
+			while (*required_chars)
+				{skip_ws(i); if (!req_char(i, *(required_chars++))) return false;}
+			return true;
+		}
+	}
+
+	/*
+		Write/read normal burdens as JSON.
+			We store standard deviation rather than variance, for precision reasons.
+	*/
+	/*template<typename T_Base>
+	std::ostream &operator<<(std::ostream &o, const typename Economy_Normal_<T_Base>::burden_t &burden)
+	{
+		return o << '[' << burden.mean << ',' << std::sqrt(burden.var) << ']';
+	}
+	template<typename T_Base>
+	std::istream &operator>>(std::istream &i, typename Economy_Normal_<T_Base>::burden_t &burden)
+	{
+		if (i.good()) do
+		{
+			typename Economy_Normal_<T_Base>::base_burden_t in_m, in_d;
+			if (!detail::req_char(i,'[') || (i >> in_m).fail()) continue;
+			if (!detail::req_char(i,',') || (i >> in_d).fail()) continue;
+			if (!detail::req_char(i,']'))                       continue;
+			burden.mean = in_m;
+			burden.var = in_d*in_d;
+		}
+		while (0);
+		return i;
+	}*/
+
+	// Integer burdens are written as plain numbers.
+	template<typename T_Int>
+	std::ostream &operator<<(std::ostream &o, const Ticks_<T_Int> &ticks)    {return o << ticks.ticks;}
+
+	/*
+		Read/write burden statistics as JSON.
+	*/
+	template<typename T_Econ>
+	std::ostream &operator<<(std::ostream &o, const BurdenStat_<T_Econ> &stat)
+	{
+		int n = int(stat.count());
+		o << '[';
+		if (stat.count() == n) o << n;
+		else                   o << stat.count();
+		return o << ',' << stat.mean() << ',' << stat.deviation() << ']';
+	}
+	/*
+		Histograms are written as the index of the first nonempty bucket, followed by counts:
+			[5,2,0,17,1]
+		When histograms are enabled, an estimate with a histogram is written as [n,m,d,[...]].
+	*/
+	template<typename T_Econ>
+	std::ostream &operator<<(std::ostream &o, const BurdenHistogram_<T_Econ> &histogram)
+	{
+		unsigned first = 0, last = BurdenHistogram_<T_Econ>::BUCKETS;
+		while (first < last && !histogram.counts[first])  ++first;
+		while (last > first && !histogram.counts[last-1]) --last;
+		o << '[' << first;
+		for (unsigned b = first; b < last; ++b) o << ',' << histogram.count(b);
+		return o << ']';
+	}
+
+	namespace detail
+	{
+		template<typename T_Econ>
+		bool read_histogram(std::istream &i, BurdenHistogram_<T_Econ> &histogram)
+		{
+			histogram.reset();
+			unsigned first;
+			double   samples[BurdenHistogram_<T_Econ>::BUCKETS] = {};
+			if (!req_char_ws(i,'[') || (i >> first).fail()) return false;
+			for (unsigned b = first; ; ++b)
+			{
+				skip_ws(i);
+				if (i.peek() == ']') {i.get(); histogram.assign(samples); return true;}
+				if (b >= BurdenHistogram_<T_Econ>::BUCKETS) {i.setstate(std::ios_base::failbit); return false;}
+				if (!req_char(i,',') || (i >> samples[b]).fail()) return false;
+			}
+		}
+
+		// Read [n,m,d] or [n,m,d,[histogram]].
+		template<typename T_Econ>
+		bool read_estimate(std::istream &i, BurdenStat_<T_Econ> &stat, BurdenHistogram_<T_Econ> &histogram)
+		{
+			if (!i.good()) return false;
+			typename BurdenStat_<T_Econ>::scalar_t in_n;
+			typename BurdenStat_<T_Econ>::calc_t   in_m, in_d;
+			if (!req_char_ws(i,'[') || (i >> in_n).fail()) return false;
+			if (!req_char_ws(i,',') || (i >> in_m).fail()) return false;
+			if (!req_char_ws(i,',') || (i >> in_d).fail()) return false;
+			skip_ws(i);
+			histogram.reset();
+			if (i.peek() == ',') {i.get(); if (!read_histogram(i, histogram)) return false;}
+			if (!req_char_ws(i,']')) return false;
+			stat._k = in_n;
+			stat._mk = in_m;
+			stat._vk = (in_d*in_d) * (in_n-1);
+			return true;
+		}
+
+		template<typename T_Estimate>
+		void write_estimate(std::ostream &o, const T_Estimate &estimate)
+		{
+#if PERF_GOBLIN_HISTOGRAMS
+			if (estimate.histogram)
+			{
+				const auto &stat = estimate.full;
+				int n = int(stat.count());
+				o << '[';
+				if (stat.count() == n) o << n;
+				else                   o << stat.count();
+				o << ',' << stat.mean() << ',' << stat.deviation() << ',';
+				perf_goblin::operator<<(o, estimate.histogram);
+				o << ']';
+				return;
+			}
+#endif
+			perf_goblin::operator<<(o, estimate.full);
+		}
+	}
+
+	template<typename T_Econ>
+	std::istream &operator>>(std::istream &i, BurdenStat_<T_Econ> &stat)
+	{
+		BurdenHistogram_<T_Econ> histogram;
+		detail::read_estimate(i, stat, histogram);
+		return i;
+	}
+
+	/*
+		Read/write profile as JSON.
+	*/
+	template<typename T_Econ>
+	std::ostream &operator<<(std::ostream &o, const Profile_<T_Econ> &profile)
+	{
+		o << "{";
+		bool first = true;
+		for (auto &entry : profile)
+		{
+			if (first) first = false;
+			else       o << ',';
+			auto &task = *entry.second;
+			o << "\n\t\"" << entry.first << "\":[";
+			for (size_t i = 0, last = task.count-1; i <= last; ++i)
+			{
+				detail::write_estimate(o, task.estimates[i]);
+				o << (",]"[i == last]);
+			}
+		}
+		return o << "\n}";
+	}
+	template<typename T_Econ>
+	std::istream &operator>>(std::istream &i, Profile_<T_Econ> &profile)
+	{
+		typename Profile_<T_Econ>::Task *task_data = nullptr;
+
+		static const typename Profile_<T_Econ>::choice_index_t MAX_OPTIONS = 1024;
+
+		if (i.good()) do
+		{
+			if (!detail::req_char_ws(i,'{')) continue;
+			profile.clear();
+
+			task_data = Profile_<T_Econ>::Task::alloc(MAX_OPTIONS);
+
+			while (true)
+			{
+				detail::skip_ws(i);
+
+				if (!detail::req_char_ws(i,'"')) break;
+				std::string id;
+				while (true)
+				{
+					char c = i.get();
+					if (c == '"') break;
+					if (!i.good())
+					{
+#if PERF_GOBLIN_IO_DEBUG
+						std::cerr << "profile load: stream failure while reading id" << std::endl;
+#endif
+						goto parse_failure;
+					}
+					if (c == '\r' || c == '\n' || c == '\v' || c == '\f' || c == '\0')
+					{
+#if PERF_GOBLIN_IO_DEBUG
+						std::cerr << "profile load: id cannot contain char #" << int(c) << std::endl;
+#endif
+						goto parse_failure;
+					}
+					id.push_back(c);
+				}
+
+				// Metadata members hold strings, not tasks (see JsonMetadata).
+				if (!id.empty() && id[0] == '$')
+				{
+					if (!detail::req_chars_ws(i,":\"")) break;
+					while (i.good() && i.get() != '"') {}
+					if (!i.good()) goto parse_failure;
+				}
+				else
+				{
+					// Read estimate array
+					if (!detail::req_chars_ws(i,":[")) break;
+					typename Profile_<T_Econ>::choice_index_t estimate_count = 0;
+					while (estimate_count < MAX_OPTIONS)
+					{
+						// Read an estimate
+						auto &estimate = task_data->estimates[estimate_count];
+#if PERF_GOBLIN_HISTOGRAMS
+						auto &histogram = estimate.histogram;
+#else
+						BurdenHistogram_<T_Econ> histogram;
+#endif
+						if (!detail::read_estimate(i, estimate.full, histogram) || !i.good())
+						{
+#if PERF_GOBLIN_IO_DEBUG
+							std::cerr << "profile load: failed to read burden stats" << std::endl;
+#endif
+							goto parse_failure;
+						}
+						++estimate_count;
+
+						// Comma or closing bracket
+						detail::skip_ws(i);
+						char c = i.get();
+						if (c == ',') continue;
+						if (c == ']') break;
+#if PERF_GOBLIN_IO_DEBUG
+						std::cerr << "profile load: expected `,' or `]', got `" << c << "'" << std::endl;
+#endif
+						goto parse_failure;
+					}
+
+					// Assimilate the loaded profile data for the task.
+					const_cast<typename Profile_<T_Econ>::choice_index_t&>(task_data->count) = estimate_count;
+					profile.assimilate(id, *task_data);
+				}
+
+				// Comma or closing brace
+				detail::skip_ws(i);
+				char c = i.get();
+				if (c == ',') continue;
+				if (c == '}') break;
+#if PERF_GOBLIN_IO_DEBUG
+				std::cerr << "profile load: expected `,' or `}', got `" << c << "'" << std::endl;
+#endif
+				goto parse_failure;
+			}
+
+			break;
+		}
+		while (0);
+	
+		goto finish;
+
+	parse_failure:
+		i.setstate(std::ios_base::failbit);
+	finish:
+		if (task_data)
+		{
+			const_cast<typename Profile_<T_Econ>::choice_index_t&>(task_data->count) = MAX_OPTIONS;
+			Profile_<T_Econ>::Task::free(task_data);
+		}
+		return i;
+	}
+
+
+	/*
+		Fast JSON reading/writing on contiguous buffers, in the same format as the stream operators.
+			Numbers are converted with std::from_chars and std::to_chars where available,
+			and written in their shortest round-trip form.
+	*/
+	namespace detail
+	{
+		template<typename T>
+		inline bool json_parse_number(const char *&p, const char *end, T &value)
+		{
+#if PERF_GOBLIN_HAS_CHARCONV
+			auto result = std::from_chars(p, end, value);
+			if (result.ec != std::errc()) return false;
+			p = result.ptr;
+			return true;
+#else
+			// strtod needs a terminated string; numbers in profiles are short.
+			char buf[64];
+			size_t n = 0;
+			while (p + n < end && n < sizeof(buf)-1 && std::strchr("+-.0123456789eEinfatyINFATY", p[n])) ++n;
+			std::memcpy(buf, p, n);
+			buf[n] = '\0';
+			char *parsed = buf;
+			double d = std::strtod(buf, &parsed);
+			if (parsed == buf) return false;
+			p += (parsed - buf);
+			value = T(d);
+			return true;
+#endif
+		}
+
+		template<typename T>
+		inline void json_write_number(std::string &out, T value)
+		{
+			char buf[64];
+#if PERF_GOBLIN_HAS_CHARCONV
+			auto result = std::to_chars(buf, buf + sizeof(buf), value);
+			out.append(buf, result.ptr);
+#else
+			int n = std::numeric_limits<T>::is_integer ?
+				std::snprintf(buf, sizeof(buf), "%lld", (long long)(value)) :
+				std::snprintf(buf, sizeof(buf), "%.*g", int(std::numeric_limits<T>::max_digits10), double(value));
+			out.append(buf, size_t(n));
+#endif
+		}
+		template<typename T_Int>
+		inline void json_write_number(std::string &out, Ticks_<T_Int> value)    {json_write_number(out, value.ticks);}
+
+		struct JsonCursor
+		{
+			const char *p, *end;
+
+			void skip_ws()
+			{
+				while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' || *p == '\f' || *p == '\v')) ++p;
+			}
+			bool req_char_ws(char c)
+			{
+				skip_ws();
+				if (p < end && *p == c) {++p; return true;}
+#if PERF_GOBLIN_IO_DEBUG
+				std::cerr << "json: expected `" << c << "' at " << (p < end ? "`" + std::string(1, *p) + "'" : "end") << std::endl;
+#endif
+				return false;
+			}
+			bool peek_ws(char c)    {skip_ws(); return p < end && *p == c;}
+
+			template<typename T>
+			bool number_ws(T &value)
+			{
+				skip_ws();
+				if (json_parse_number(p, end, value)) return true;
+#if PERF_GOBLIN_IO_DEBUG
+				std::cerr << "json: expected a number" << std::endl;
+#endif
+				return false;
+			}
+		};
+	}
+
+	namespace detail
+	{
+		// Write a count, as an integer when whole (as counts usually are).
+		template<typename T>
+		void json_write_count(std::string &out, T count)
+		{
+			long long n = (std::abs(count) < T(1e15f)) ? (long long)(count) : 0;
+			if (count == n) json_write_number(out, n);
+			else            json_write_number(out, count);
+		}
+
+		// Write n,m,d (without brackets).
+		template<typename T_Econ>
+		void json_write_stat_fields(std::string &out, const BurdenStat_<T_Econ> &stat)
+		{
+			json_write_count(out, stat.count());
+			out.push_back(',');
+			json_write_number(out, stat.mean());
+			out.push_back(',');
+			json_write_number(out, stat.deviation());
+		}
+	}
+
+	template<typename T_Econ>
+	void write_json(std::string &out, const BurdenStat_<T_Econ> &stat)
+	{
+		out.push_back('[');
+		detail::json_write_stat_fields(out, stat);
+		out.push_back(']');
+	}
+
+	template<typename T_Econ>
+	void write_json(std::string &out, const BurdenHistogram_<T_Econ> &histogram)
+	{
+		unsigned first = 0, last = BurdenHistogram_<T_Econ>::BUCKETS;
+		while (first < last && !histogram.counts[first])  ++first;
+		while (last > first && !histogram.counts[last-1]) --last;
+		out.push_back('[');
+		detail::json_write_number(out, first);
+		for (unsigned b = first; b < last; ++b)
+		{
+			out.push_back(',');
+			detail::json_write_count(out, histogram.count(b));
+		}
+		out.push_back(']');
+	}
+
+	namespace detail
+	{
+		// Write an estimate as [n,m,d], or [n,m,d,[histogram]] when it has one.
+		template<typename T_Estimate>
+		void json_write_estimate(std::string &out, const T_Estimate &estimate)
+		{
+			out.push_back('[');
+			json_write_stat_fields(out, estimate.full);
+#if PERF_GOBLIN_HISTOGRAMS
+			if (estimate.histogram)
+			{
+				out.push_back(',');
+				write_json(out, estimate.histogram);
+			}
+#endif
+			out.push_back(']');
+		}
+	}
+
+	/*
+		Metadata stored with a JSON profile, such as the hardware class of the machine
+			which measured it.  Metadata members are named with a leading '$', hold strings
+			(without quotes or line breaks), and precede the tasks.  Profile readers skip them.
+	*/
+	using JsonMetadata = std::vector<std::pair<std::string, std::string>>;
+
+	/*
+		Append a profile's JSON representation to a string, with optional metadata
+			(names are given without the leading '$').
+	*/
+	template<typename T_Econ>
+	void write_json(std::string &out, const Profile_<T_Econ> &profile, const JsonMetadata &metadata = JsonMetadata())
+	{
+		out.push_back('{');
+		bool first = true;
+		for (auto &member : metadata)
+		{
+			if (first) first = false;
+			else       out.push_back(',');
+			out.append("\n\t\"$").append(member.first).append("\":\"").append(member.second).append("\"");
+		}
+		for (auto &entry : profile)
+		{
+			if (first) first = false;
+			else       out.push_back(',');
+			auto &task = *entry.second;
+			out.append("\n\t\"");
+			out.append(entry.first);
+			out.append("\":[");
+			for (size_t i = 0; i < task.count; ++i)
+			{
+				if (i) out.push_back(',');
+				detail::json_write_estimate(out, task.estimates[i]);
+			}
+			out.push_back(']');
+		}
+		out.append("\n}");
+	}
+
+	template<typename T_Econ>
+	std::string to_json(const Profile_<T_Econ> &profile, const JsonMetadata &metadata = JsonMetadata())
+	{
+		std::string out;
+		write_json(out, profile, metadata);
+		return out;
+	}
+
+	/*
+		Read the metadata at the start of a JSON profile, without reading its tasks.
+			Names are returned without the leading '$'.  Returns false if the buffer is malformed.
+	*/
+	inline bool read_json_metadata(const char *begin, const char *end, JsonMetadata &metadata)
+	{
+		metadata.clear();
+		detail::JsonCursor in = {begin, end};
+		if (!in.req_char_ws('{')) return false;
+		while (true)
+		{
+			in.skip_ws();
+			if (end - in.p < 2 || in.p[0] != '"' || in.p[1] != '$') return true;
+			in.p += 2;
+			const char *name = in.p;
+			while (in.p < end && *in.p != '"') ++in.p;
+			if (in.p == end) return false;
+			std::string key(name, in.p++);
+			if (!in.req_char_ws(':') || !in.req_char_ws('"')) return false;
+			const char *value = in.p;
+			while (in.p < end && *in.p != '"') ++in.p;
+			if (in.p == end) return false;
+			metadata.emplace_back(std::move(key), std::string(value, in.p++));
+			if (!in.peek_ws(',')) return true;
+			++in.p;
+		}
+	}
+	inline bool read_json_metadata(const std::string &text, JsonMetadata &metadata)
+	{
+		return read_json_metadata(text.data(), text.data() + text.size(), metadata);
+	}
+
+	/*
+		Read a profile from a JSON buffer, replacing its contents.
+			Returns false if the buffer is malformed (the profile may hold partial data).
+	*/
+	template<typename T_Econ>
+	bool read_json(const char *begin, const char *end, Profile_<T_Econ> &profile)
+	{
+		using Profile_t      = Profile_<T_Econ>;
+		using choice_index_t = typename Profile_t::choice_index_t;
+		using scalar_t       = typename Profile_t::scalar_t;
+		using calc_t         = typename BurdenStat_<T_Econ>::calc_t;
+
+		detail::JsonCursor in = {begin, end};
+		if (!in.req_char_ws('{')) return false;
+		profile.clear();
+		if (in.peek_ws('}')) {++in.p; return true;}
+
+		std::string id;
+		std::vector<BurdenStat_<T_Econ>> stats;
+		std::vector<BurdenHistogram_<T_Econ>> histograms;
+		while (true)
+		{
+			// Identifier
+			if (!in.req_char_ws('"')) return false;
+			const char *id_begin = in.p;
+			while (in.p < end && *in.p != '"')
+			{
+				char c = *in.p;
+				if (c == '\r' || c == '\n' || c == '\v' || c == '\f' || c == '\0')
+				{
+#if PERF_GOBLIN_IO_DEBUG
+					std::cerr << "profile load: id cannot contain char #" << int(c) << std::endl;
+#endif
+					return false;
+				}
+				++in.p;
+			}
+			if (in.p == end) return false;
+			id.assign(id_begin, in.p++);
+
+			// Metadata members hold strings, not tasks (see JsonMetadata).
+			if (!id.empty() && id[0] == '$')
+			{
+				if (!in.req_char_ws(':') || !in.req_char_ws('"')) return false;
+				while (in.p < end && *in.p != '"') ++in.p;
+				if (in.p++ == end) return false;
+				if (in.peek_ws(',')) {++in.p; continue;}
+				return in.req_char_ws('}');
+			}
+
+			// Estimates
+			if (!in.req_char_ws(':') || !in.req_char_ws('[')) return false;
+			stats.clear();
+			histograms.clear();
+			bool has_histograms = false;
+			while (true)
+			{
+				scalar_t n;
+				calc_t   m, d;
+				if (!in.req_char_ws('[') || !in.number_ws(n)) return false;
+				if (!in.req_char_ws(',') || !in.number_ws(m)) return false;
+				if (!in.req_char_ws(',') || !in.number_ws(d)) return false;
+				stats.push_back(BurdenStat_<T_Econ>{n, m, (d*d) * (n-1)});
+				histograms.emplace_back();
+				if (stats.size() > size_t(Profile_t::NO_CHOICE)) return false;
+
+				// Optional histogram: [first, counts...]
+				if (in.peek_ws(','))
+				{
+					++in.p;
+					unsigned first;
+					double   samples[BurdenHistogram_<T_Econ>::BUCKETS] = {};
+					if (!in.req_char_ws('[') || !in.number_ws(first)) return false;
+					for (unsigned b = first; !in.peek_ws(']'); ++b)
+						if (b >= BurdenHistogram_<T_Econ>::BUCKETS || !in.req_char_ws(',') || !in.number_ws(samples[b])) return false;
+					histograms.back().assign(samples);
+					++in.p;
+					has_histograms = true;
+				}
+				if (!in.req_char_ws(']')) return false;
+
+				if (in.peek_ws(',')) {++in.p; continue;}
+				if (!in.req_char_ws(']')) return false;
+				break;
+			}
+			profile.assimilate(id, stats.data(), choice_index_t(stats.size()), has_histograms ? histograms.data() : nullptr);
+
+			if (in.peek_ws(',')) {++in.p; continue;}
+			return in.req_char_ws('}');
+		}
+	}
+
+	template<typename T_Econ>
+	bool read_json(const std::string &text, Profile_<T_Econ> &profile)
+	{
+		return read_json(text.data(), text.data() + text.size(), profile);
+	}
+}
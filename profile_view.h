@@ -0,0 +1,440 @@
+#pragma once
+
+/*
+	A binary profile format which can be used in place, without parsing.
+		Files are typically mapped into memory and viewed as read-only past profiles.
+
+	The format stores tasks in the same layout as Profile_::Task, so it is specific
+		to an economy and platform.  The header records the sizes and byte order involved,
+		and views refuse data that doesn't match.
+
+	Layout (all offsets from the start of the data, which must be 8-byte aligned):
+		Header
+		Slot[slot_count]  -- open-addressed hash table of task identifiers
+		Tasks             -- Profile_::Task images, each 8-byte aligned
+		Strings           -- identifiers, each followed by a null character
+*/
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include "profile.h"
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+namespace perf_goblin
+{
+	template<typename T_Economy> class ProfileView_;
+	template<typename T_Economy> class ProfileImage_;
+	using ProfileView_f  = ProfileView_ <Economy_f>;
+	using ProfileImage_f = ProfileImage_<Economy_f>;
+
+	namespace detail
+	{
+		// Identifier hash used by the binary format (FNV-1a), stable across platforms.
+		inline uint32_t profile_id_hash(const char *id, size_t length)
+		{
+			uint32_t hash = 2166136261u;
+			for (size_t i = 0; i < length; ++i) hash = (hash ^ uint8_t(id[i])) * 16777619u;
+			return hash;
+		}
+
+		struct ProfileBinaryHeader
+		{
+			static const uint32_t VERSION    = 3;
+			static const uint32_t ORDER_MARK = 0x01020304u;
+
+			char     magic[8];       // "PGOBLIN"
+			uint32_t version;
+			uint32_t order_mark;     // ORDER_MARK, in the writer's byte order
+			uint32_t task_size;      // sizeof(Profile_::Task), with one estimate
+			uint32_t estimate_size;  // sizeof(Profile_::Estimate)
+			uint32_t burden_size;    // sizeof(burden_t)
+			uint32_t task_count;
+			uint32_t slot_count;     // A power of two, or zero
+			uint32_t reserved;
+			uint64_t slots_offset;
+			uint64_t tasks_offset;
+			uint64_t strings_offset;
+			uint64_t total_size;
+
+			static const char *expected_magic()    {return "PGOBLIN";}
+		};
+
+		struct ProfileBinarySlot
+		{
+			static const uint32_t EMPTY = ~uint32_t(0);
+
+			uint32_t hash;
+			uint32_t id_offset;    // From strings_offset
+			uint32_t id_length;
+			uint32_t task_offset;  // From tasks_offset, or EMPTY
+		};
+
+		inline size_t align8(size_t n)    {return (n + 7) & ~size_t(7);}
+	}
+
+
+	/*
+		A read-only profile backed by binary data (see ProfileImage_ and MappedFile).
+			Lookups work like Profile_::find, returning tasks stored in the data itself.
+			The data must outlive the view.  Attaching checks every slot, task and
+			identifier against the data's size, in time proportional to the slot count.
+	*/
+	template<typename T_Economy>
+	class ProfileView_
+	{
+	public:
+		using Profile_t = Profile_<T_Economy>;
+		using Task      = typename Profile_t::Task;
+		using Estimate  = typename Profile_t::Estimate;
+		using burden_t  = typename Profile_t::burden_t;
+
+		using Header    = detail::ProfileBinaryHeader;
+		using Slot      = detail::ProfileBinarySlot;
+
+		// Iterates (id, task) pairs, in no particular order.
+		class iterator
+		{
+		public:
+			using value_type = std::pair<const char*, const Task*>;
+
+			iterator(const ProfileView_ *view, uint32_t slot) : _view(view), _slot(slot)    {_skip();}
+
+			value_type operator*() const    {return {_view->_id(_view->_slots[_slot]), _view->_task(_view->_slots[_slot])};}
+			iterator  &operator++()         {++_slot; _skip(); return *this;}
+
+			bool operator==(const iterator &o) const    {return _slot == o._slot;}
+			bool operator!=(const iterator &o) const    {return _slot != o._slot;}
+
+		private:
+			void _skip()    {while (_slot < _view->_slot_count && _view->_slots[_slot].task_offset == Slot::EMPTY) ++_slot;}
+
+			const ProfileView_ *_view;
+			uint32_t            _slot;
+		};
+
+	public:
+		ProfileView_()    {}
+
+		/*
+			View binary profile data.  Returns false (leaving the view empty)
+				if the data is malformed or was written for a different economy or platform.
+		*/
+		bool attach(const void *data, size_t size)
+		{
+			detach();
+			if (!valid(data, size)) return false;
+			_data       = static_cast<const char*>(data);
+			auto &head  = *reinterpret_cast<const Header*>(_data);
+			_slots      = reinterpret_cast<const Slot*>(_data + head.slots_offset);
+			_tasks      = _data + head.tasks_offset;
+			_strings    = _data + head.strings_offset;
+			_slot_count = head.slot_count;
+			_task_count = head.task_count;
+			return true;
+		}
+		void detach()    {*this = ProfileView_();}
+
+		// View a table embedded in the program (see "main embed-profile").
+		template<size_t N>
+		bool attach(const uint64_t (&words)[N])    {return attach(words, sizeof(words));}
+
+		/*
+			Check that data is a well-formed profile for this economy and platform.
+				Lookups stop at an empty slot, so there must be fewer tasks than slots.
+		*/
+		static bool valid(const void *data, size_t size)
+		{
+			if (!data || (reinterpret_cast<uintptr_t>(data) & 7) || size < sizeof(Header)) return false;
+			auto &head = *static_cast<const Header*>(data);
+			bool header_ok = std::memcmp(head.magic, Header::expected_magic(), 8) == 0
+				&& head.version       == Header::VERSION
+				&& head.order_mark    == Header::ORDER_MARK
+				&& head.task_size     == sizeof(Task)
+				&& head.estimate_size == sizeof(Estimate)
+				&& head.burden_size   == sizeof(burden_t)
+				&& (head.slot_count & (head.slot_count - 1)) == 0
+				&& (head.task_count < head.slot_count || head.task_count == 0)
+				&& head.total_size    <= size
+				&& head.slots_offset  >= sizeof(Header)
+				&& head.slots_offset  <= head.tasks_offset
+				&& uint64_t(head.slot_count) * sizeof(Slot) <= head.tasks_offset - head.slots_offset
+				&& head.tasks_offset  <= head.strings_offset
+				&& head.strings_offset <= head.total_size
+				&& (head.slots_offset & 7) == 0
+				&& (head.tasks_offset & 7) == 0;
+			if (!header_ok) return false;
+
+			// Every occupied slot must refer to a task and an identifier within their sections.
+			const char *base      = static_cast<const char*>(data);
+			const Slot *slots     = reinterpret_cast<const Slot*>(base + head.slots_offset);
+			const uint64_t
+				task_bytes   = head.strings_offset - head.tasks_offset,
+				string_bytes = head.total_size     - head.strings_offset;
+			uint32_t occupied = 0;
+			for (uint32_t i = 0; i < head.slot_count; ++i)
+			{
+				const Slot &slot = slots[i];
+				if (slot.task_offset == Slot::EMPTY) continue;
+				++occupied;
+				if ((slot.task_offset & 7) || uint64_t(slot.task_offset) + sizeof(Task) > task_bytes) return false;
+				const Task &task = *reinterpret_cast<const Task*>(base + head.tasks_offset + slot.task_offset);
+				if (task.count == 0 || uint64_t(slot.task_offset) + Task::bytes(task.count) > task_bytes) return false;
+				if (uint64_t(slot.id_offset) + slot.id_length >= string_bytes) return false;
+				if (base[head.strings_offset + slot.id_offset + slot.id_length] != '\0') return false;
+			}
+			return occupied == head.task_count;
+		}
+
+		/*
+			Get profile data for a task, if available.
+		*/
+		const Task *find(const std::string &id) const    {return find(id.data(), id.length());}
+		const Task *find(const char *id, size_t length) const
+		{
+			if (!_task_count) return nullptr;
+			uint32_t hash = detail::profile_id_hash(id, length), mask = _slot_count - 1;
+			for (uint32_t i = hash & mask; ; i = (i+1) & mask)
+			{
+				const Slot &slot = _slots[i];
+				if (slot.task_offset == Slot::EMPTY) return nullptr;
+				if (slot.hash == hash && slot.id_length == length && std::memcmp(_id(slot), id, length) == 0)
+					return _task(slot);
+			}
+		}
+
+		iterator begin() const    {return iterator(this, 0);}
+		iterator end  () const    {return iterator(this, _slot_count);}
+		size_t   size () const    {return _task_count;}
+		bool     empty() const    {return _task_count == 0;}
+
+		// The viewed data, or null.
+		const void *data() const    {return _data;}
+
+	private:
+		const char *_id  (const Slot &slot) const    {return _strings + slot.id_offset;}
+		const Task *_task(const Slot &slot) const    {return reinterpret_cast<const Task*>(_tasks + slot.task_offset);}
+
+	private:
+		const char *_data = nullptr, *_tasks = nullptr, *_strings = nullptr;
+		const Slot *_slots = nullptr;
+		uint32_t    _slot_count = 0, _task_count = 0;
+	};
+
+
+	/*
+		Binary profile data held in memory.
+			Build one from a profile to save it, or read one from a stream.
+			Only "full" statistics are stored.
+	*/
+	template<typename T_Economy>
+	class ProfileImage_
+	{
+	public:
+		using Profile_t = Profile_<T_Economy>;
+		using View_t    = ProfileView_<T_Economy>;
+		using Task      = typename Profile_t::Task;
+		using burden_t  = typename Profile_t::burden_t;
+
+		using Header    = detail::ProfileBinaryHeader;
+		using Slot      = detail::ProfileBinarySlot;
+
+	public:
+		ProfileImage_()                                {}
+		explicit ProfileImage_(const Profile_t &p)     {assign(p);}
+
+		// Encode a profile, or anything iterable as (id, task) pairs with size().
+		template<typename T_Profile>
+		void assign(const T_Profile &profile)
+		{
+			size_t task_count = 0, task_bytes = 0, string_bytes = 0;
+			for (auto &&entry : profile)
+			{
+				++task_count;
+				task_bytes   += detail::align8(Task::bytes(entry.second->count));
+				string_bytes += _length(entry.first) + 1;
+			}
+			uint32_t slot_count = 0;
+			if (task_count) {slot_count = 2; while (slot_count < 2*task_count) slot_count *= 2;}
+
+			Header head = {};
+			std::memcpy(head.magic, Header::expected_magic(), 8);
+			head.version        = Header::VERSION;
+			head.order_mark     = Header::ORDER_MARK;
+			head.task_size      = uint32_t(sizeof(Task));
+			head.estimate_size  = uint32_t(sizeof(typename Profile_t::Estimate));
+			head.burden_size    = uint32_t(sizeof(burden_t));
+			head.task_count     = uint32_t(task_count);
+			head.slot_count     = slot_count;
+			head.slots_offset   = detail::align8(sizeof(Header));
+			head.tasks_offset   = detail::align8(head.slots_offset + slot_count * sizeof(Slot));
+			head.strings_offset = head.tasks_offset + task_bytes;
+			head.total_size     = head.strings_offset + string_bytes;
+
+			_words.assign(detail::align8(size_t(head.total_size)) / 8, 0);
+			char *base    = reinterpret_cast<char*>(_words.data());
+			Slot *slots   = reinterpret_cast<Slot*>(base + head.slots_offset);
+			char *tasks   = base + head.tasks_offset;
+			char *strings = base + head.strings_offset;
+			std::memcpy(base, &head, sizeof(head));
+			for (uint32_t i = 0; i < slot_count; ++i) slots[i].task_offset = Slot::EMPTY;
+
+			size_t task_pos = 0, string_pos = 0;
+			for (auto &&entry : profile)
+			{
+				const Task &src = *entry.second;
+				size_t length = _length(entry.first);
+
+				// Tasks are built member-wise, so padding bytes stay zero.
+				Task *task = Task::init(tasks + task_pos, src.count);
+				task->resource = src.resource;
+				for (typename Profile_t::choice_index_t i = 0; i < src.count; ++i)
+				{
+					task->estimates[i].full = src.estimates[i].full;
+#if PERF_GOBLIN_HISTOGRAMS
+					task->estimates[i].histogram = src.estimates[i].histogram;
+#endif
+				}
+				std::memcpy(strings + string_pos, _chars(entry.first), length);
+
+				uint32_t hash = detail::profile_id_hash(_chars(entry.first), length), mask = slot_count - 1, i = hash & mask;
+				while (slots[i].task_offset != Slot::EMPTY) i = (i+1) & mask;
+				slots[i] = Slot{hash, uint32_t(string_pos), uint32_t(length), uint32_t(task_pos)};
+
+				task_pos   += detail::align8(Task::bytes(src.count));
+				string_pos += length + 1;
+			}
+			_view.attach(base, size_t(head.total_size));
+		}
+
+		/*
+			Read/write binary data.  Reading fails on data the view wouldn't accept.
+		*/
+		bool read(std::istream &in)
+		{
+			clear();
+			Header head;
+			if (!in.read(reinterpret_cast<char*>(&head), sizeof(head))) return false;
+			if (head.total_size < sizeof(head) || head.total_size > (uint64_t(1) << 40)) return _fail(in);
+			_words.assign(detail::align8(size_t(head.total_size)) / 8, 0);
+			char *base = reinterpret_cast<char*>(_words.data());
+			std::memcpy(base, &head, sizeof(head));
+			if (!in.read(base + sizeof(head), std::streamsize(head.total_size - sizeof(head)))) return _fail(in);
+			if (!_view.attach(base, size_t(head.total_size))) return _fail(in);
+			return true;
+		}
+		bool write(std::ostream &out) const
+		{
+			return bool(out.write(static_cast<const char*>(data()), std::streamsize(size())));
+		}
+
+		void clear()    {_words.clear(); _view.detach();}
+
+		const View_t &view() const    {return _view;}
+		const void   *data() const    {return _words.data();}
+		size_t        size() const    {return _view.data() ? size_t(reinterpret_cast<const Header*>(data())->total_size) : 0;}
+
+	private:
+		static size_t      _length(const std::string &s)    {return s.length();}
+		static size_t      _length(const char *s)           {return std::strlen(s);}
+		static const char *_chars (const std::string &s)    {return s.data();}
+		static const char *_chars (const char *s)           {return s;}
+
+		bool _fail(std::istream &in)    {clear(); in.setstate(std::ios_base::failbit); return false;}
+
+		// No copying (the view points into our storage)
+		ProfileImage_(const ProfileImage_ &o) = delete;
+		void operator=(const ProfileImage_ &o) = delete;
+
+	private:
+		std::vector<uint64_t> _words;
+		View_t                _view;
+	};
+
+
+	/*
+		A read-only memory mapping of a file, for viewing binary profiles in place.
+	*/
+	class MappedFile
+	{
+	public:
+		MappedFile()                                {}
+		explicit MappedFile(const char *path)       {open(path);}
+		~MappedFile()                               {close();}
+
+		bool open(const char *path)
+		{
+			close();
+#if defined(_WIN32)
+			_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (_file == INVALID_HANDLE_VALUE) {_file = nullptr; return false;}
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0) {close(); return false;}
+			_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!_mapping) {close(); return false;}
+			_data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!_data) {close(); return false;}
+			_size = size_t(size.QuadPart);
+#else
+			int fd = ::open(path, O_RDONLY);
+			if (fd < 0) return false;
+			struct stat info;
+			if (::fstat(fd, &info) != 0 || info.st_size <= 0) {::close(fd); return false;}
+			void *data = ::mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (data == MAP_FAILED) return false;
+			_data = data;
+			_size = size_t(info.st_size);
+#endif
+			return true;
+		}
+
+		void close()
+		{
+#if defined(_WIN32)
+			if (_data)    UnmapViewOfFile(_data);
+			if (_mapping) CloseHandle(_mapping);
+			if (_file)    CloseHandle(_file);
+			_mapping = _file = nullptr;
+#else
+			if (_data) ::munmap(_data, _size);
+#endif
+			_data = nullptr;
+			_size = 0;
+		}
+
+		const void *data() const    {return _data;}
+		size_t      size() const    {return _size;}
+
+	private:
+		// No copying
+		MappedFile(const MappedFile &o) = delete;
+		void operator=(const MappedFile &o) = delete;
+
+	private:
+		void  *_data = nullptr;
+		size_t _size = 0;
+#if defined(_WIN32)
+		HANDLE _file = nullptr, _mapping = nullptr;
+#endif
+	};
+}